@@ -0,0 +1,353 @@
+#define DMOD_ENABLE_REGISTRATION ON
+#include "dmod.h"
+#include "dmffs.h"
+#include <string.h>
+
+// Default erase sector size
+#define DEFAULT_SECTOR_SIZE     4096u
+
+// Largest supported erase sector size
+#define MAX_SECTOR_SIZE         (16u * 1024u * 1024u)
+
+// FNV-1a 64-bit parameters used for image hashes
+#define HASH_INIT               0xCBF29CE484222325ull
+#define HASH_PRIME              0x00000100000001B3ull
+
+#ifndef SEEK_SET
+#define SEEK_SET 0
+#endif
+
+/**
+ * @brief Update a FNV-1a 64-bit hash with a block of data
+ * 
+ * @param hash Current hash value (HASH_INIT for a new hash)
+ * @param data Data to hash
+ * @param size Size of the data
+ * @return Updated hash value
+ */
+static uint64_t hash_update(uint64_t hash, const void* data, size_t size)
+{
+    const uint8_t* ptr = data;
+    
+    while (size-- > 0) {
+        hash ^= *ptr++;
+        hash *= HASH_PRIME;
+    }
+    
+    return hash;
+}
+
+/**
+ * @brief Parse a decimal number
+ * 
+ * @param str String to parse
+ * @param value Pointer to store the value
+ * @return true if the whole string is a valid number, false otherwise
+ */
+static bool parse_number(const char* str, uint64_t* value)
+{
+    uint64_t result = 0;
+    
+    if (!str || *str == '\0') return false;
+    
+    for (; *str; str++) {
+        if (*str < '0' || *str > '9') {
+            return false;
+        }
+        result = result * 10 + (uint64_t)(*str - '0');
+    }
+    
+    *value = result;
+    return true;
+}
+
+/**
+ * @brief Read the next sector of an image
+ * 
+ * Bytes past the end of the image are zeros, so images of different sizes
+ * are compared sector by sector.
+ * 
+ * @param file Image file
+ * @param remaining Pointer to the number of unread image bytes, updated
+ * @param buffer Sector buffer
+ * @param sector_size Sector size
+ * @param hash Pointer to the image hash, updated with the bytes read
+ * @return true on success, false on a read error
+ */
+static bool read_sector(void* file, uint64_t* remaining, uint8_t* buffer, size_t sector_size, uint64_t* hash)
+{
+    size_t size = (*remaining < sector_size) ? (size_t)*remaining : sector_size;
+    
+    if (size > 0 && Dmod_FileRead(buffer, 1, size, file) != size) {
+        return false;
+    }
+    memset(buffer + size, 0, sector_size - size);
+    
+    *remaining -= size;
+    *hash = hash_update(*hash, buffer, size);
+    return true;
+}
+
+/**
+ * @brief Hash a whole image file
+ * 
+ * @param file Image file
+ * @param size Image size
+ * @param buffer Sector buffer
+ * @param sector_size Size of the buffer
+ * @param hash Pointer to store the hash
+ * @return true on success, false on a read error
+ */
+static bool hash_image(void* file, uint64_t size, uint8_t* buffer, size_t sector_size, uint64_t* hash)
+{
+    *hash = HASH_INIT;
+    
+    if (Dmod_FileSeek(file, 0, SEEK_SET) != 0) {
+        return false;
+    }
+    while (size > 0) {
+        if (!read_sector(file, &size, buffer, sector_size, hash)) {
+            return false;
+        }
+    }
+    
+    return Dmod_FileSeek(file, 0, SEEK_SET) == 0;
+}
+
+/**
+ * @brief Write a delta with the sectors that differ between two images
+ * 
+ * @param old_path Path of the installed image
+ * @param new_path Path of the new image
+ * @param delta_path Path of the delta to write
+ * @param sector_size Erase sector size
+ * @return true on success, false on error
+ */
+static bool create_delta(const char* old_path, const char* new_path, const char* delta_path, size_t sector_size)
+{
+    void* old_file = Dmod_FileOpen(old_path, "rb");
+    void* new_file = Dmod_FileOpen(new_path, "rb");
+    void* delta_file = (old_file && new_file) ? Dmod_FileOpen(delta_path, "wb") : NULL;
+    uint8_t* old_sector = Dmod_Malloc(sector_size);
+    uint8_t* new_sector = Dmod_Malloc(sector_size);
+    bool success = old_file && new_file && delta_file && old_sector && new_sector;
+    
+    if (!success) {
+        DMOD_LOG_ERROR("Failed to open %s\n", !old_file ? old_path : !new_file ? new_path : !delta_file ? delta_path : "the sector buffers");
+    }
+    
+    dmffs_delta_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = DMFFS_DELTA_MAGIC;
+    header.version = DMFFS_DELTA_VERSION;
+    header.sector_size = (uint32_t)sector_size;
+    header.old_hash = HASH_INIT;
+    header.new_hash = HASH_INIT;
+    
+    // The header is written again once the counts and hashes are known
+    if (success) {
+        header.old_size = Dmod_FileSize(old_file);
+        header.new_size = Dmod_FileSize(new_file);
+        success = Dmod_FileWrite(&header, 1, sizeof(header), delta_file) == sizeof(header);
+    }
+    
+    uint64_t old_remaining = header.old_size;
+    uint64_t new_remaining = header.new_size;
+    uint64_t sectors = (header.new_size + sector_size - 1) / sector_size;
+    for (uint64_t i = 0; success && i < sectors; i++) {
+        success = read_sector(old_file, &old_remaining, old_sector, sector_size, &header.old_hash) &&
+                  read_sector(new_file, &new_remaining, new_sector, sector_size, &header.new_hash);
+        if (!success) {
+            DMOD_LOG_ERROR("Failed to read sector %u\n", (unsigned int)i);
+            break;
+        }
+        
+        if (memcmp(old_sector, new_sector, sector_size) != 0) {
+            uint32_t index = (uint32_t)i;
+            success = Dmod_FileWrite(&index, 1, sizeof(index), delta_file) == sizeof(index) &&
+                      Dmod_FileWrite(new_sector, 1, sector_size, delta_file) == sector_size;
+            header.sector_count++;
+        }
+    }
+    
+    // The rest of a larger old image is only hashed
+    while (success && old_remaining > 0) {
+        success = read_sector(old_file, &old_remaining, old_sector, sector_size, &header.old_hash);
+    }
+    
+    if (success) {
+        success = Dmod_FileSeek(delta_file, 0, SEEK_SET) == 0 &&
+                  Dmod_FileWrite(&header, 1, sizeof(header), delta_file) == sizeof(header);
+        if (!success) {
+            DMOD_LOG_ERROR("Failed to write delta: %s\n", delta_path);
+        }
+    }
+    
+    if (success) {
+        Dmod_Printf("Changed sectors: %u of %u (%u bytes per sector)\n",
+                    (unsigned int)header.sector_count, (unsigned int)sectors, (unsigned int)sector_size);
+        Dmod_Printf("Delta size:      %lu bytes\n",
+                    (unsigned long)(sizeof(header) + (uint64_t)header.sector_count * (sizeof(uint32_t) + sector_size)));
+    }
+    
+    if (old_sector) Dmod_Free(old_sector);
+    if (new_sector) Dmod_Free(new_sector);
+    if (old_file) Dmod_FileClose(old_file);
+    if (new_file) Dmod_FileClose(new_file);
+    if (delta_file) Dmod_FileClose(delta_file);
+    return success;
+}
+
+/**
+ * @brief Apply a delta to an image
+ * 
+ * The old image is checked against the hash of the delta before anything is
+ * written, and the result against the hash of the new image.
+ * 
+ * @param old_path Path of the installed image
+ * @param delta_path Path of the delta
+ * @param out_path Path of the new image to write
+ * @return true on success, false on error
+ */
+static bool apply_delta(const char* old_path, const char* delta_path, const char* out_path)
+{
+    dmffs_delta_header_t header;
+    void* delta_file = Dmod_FileOpen(delta_path, "rb");
+    if (!delta_file) {
+        DMOD_LOG_ERROR("Failed to open delta: %s\n", delta_path);
+        return false;
+    }
+    
+    if (Dmod_FileRead(&header, 1, sizeof(header), delta_file) != sizeof(header) ||
+        header.magic != DMFFS_DELTA_MAGIC || header.version != DMFFS_DELTA_VERSION ||
+        header.sector_size == 0 || header.sector_size > MAX_SECTOR_SIZE) {
+        DMOD_LOG_ERROR("Invalid delta: %s\n", delta_path);
+        Dmod_FileClose(delta_file);
+        return false;
+    }
+    
+    size_t sector_size = header.sector_size;
+    void* old_file = Dmod_FileOpen(old_path, "rb");
+    uint8_t* sector = Dmod_Malloc(sector_size);
+    bool success = old_file && sector;
+    uint64_t hash = HASH_INIT;
+    
+    if (!success) {
+        DMOD_LOG_ERROR("Failed to open %s\n", !old_file ? old_path : "the sector buffer");
+    } else if (Dmod_FileSize(old_file) != header.old_size ||
+               !hash_image(old_file, header.old_size, sector, sector_size, &hash) || hash != header.old_hash) {
+        DMOD_LOG_ERROR("The delta does not apply to image: %s\n", old_path);
+        success = false;
+    }
+    
+    void* out_file = success ? Dmod_FileOpen(out_path, "wb") : NULL;
+    if (success && !out_file) {
+        DMOD_LOG_ERROR("Failed to create image: %s\n", out_path);
+        success = false;
+    }
+    
+    uint64_t old_remaining = header.old_size;
+    uint64_t new_remaining = header.new_size;
+    uint64_t sectors = (header.new_size + sector_size - 1) / sector_size;
+    uint32_t records_left = header.sector_count;
+    uint32_t next_record = UINT32_MAX;
+    uint64_t old_hash = HASH_INIT;
+    hash = HASH_INIT;
+    
+    if (success && records_left > 0) {
+        success = Dmod_FileRead(&next_record, 1, sizeof(next_record), delta_file) == sizeof(next_record);
+    }
+    
+    for (uint64_t i = 0; success && i < sectors; i++) {
+        success = read_sector(old_file, &old_remaining, sector, sector_size, &old_hash);
+        if (success && records_left > 0 && next_record == i) {
+            success = Dmod_FileRead(sector, 1, sector_size, delta_file) == sector_size;
+            if (success && --records_left > 0) {
+                success = Dmod_FileRead(&next_record, 1, sizeof(next_record), delta_file) == sizeof(next_record) &&
+                          next_record > i;
+            }
+        }
+        
+        size_t size = (new_remaining < sector_size) ? (size_t)new_remaining : sector_size;
+        success = success && Dmod_FileWrite(sector, 1, size, out_file) == size;
+        hash = hash_update(hash, sector, size);
+        new_remaining -= size;
+    }
+    
+    if (success && (records_left > 0 || hash != header.new_hash)) {
+        DMOD_LOG_ERROR("The result does not match the new image\n");
+        success = false;
+    } else if (!success && out_file) {
+        DMOD_LOG_ERROR("Failed to apply delta: %s\n", delta_path);
+    }
+    
+    if (success) {
+        Dmod_Printf("Applied %u sectors, image size %lu bytes\n",
+                    (unsigned int)header.sector_count, (unsigned long)header.new_size);
+    }
+    
+    if (sector) Dmod_Free(sector);
+    if (old_file) Dmod_FileClose(old_file);
+    if (out_file) Dmod_FileClose(out_file);
+    Dmod_FileClose(delta_file);
+    return success;
+}
+
+/**
+ * @brief Print usage information
+ */
+static void print_usage(void)
+{
+    DMOD_LOG_ERROR("Usage: dmffs_delta [options] <old_image> <new_image> <delta_file>\n");
+    DMOD_LOG_ERROR("       dmffs_delta -a <old_image> <delta_file> <new_image>\n");
+    DMOD_LOG_ERROR("Options:\n");
+    DMOD_LOG_ERROR("  -s <sector> Erase sector size in bytes (default %u)\n", DEFAULT_SECTOR_SIZE);
+    DMOD_LOG_ERROR("  -a          Apply <delta_file> to <old_image> and write <new_image>\n");
+    DMOD_LOG_ERROR("Example: dmffs_delta -s 4096 ./out/old.bin ./out/flash-fs.bin ./out/update.delta\n");
+}
+
+/**
+ * @brief Main application entry point
+ * 
+ * @param argc Argument count
+ * @param argv Argument values
+ * @return 0 on success, non-zero on error
+ */
+int main(int argc, const char* argv[])
+{
+    const char* paths[3] = { NULL, NULL, NULL };
+    int path_count = 0;
+    uint64_t sector_size = DEFAULT_SECTOR_SIZE;
+    bool apply = false;
+    
+    // Parse arguments (argv[0] is the program name)
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            if (!parse_number(argv[++i], &sector_size) || sector_size < 1 || sector_size > MAX_SECTOR_SIZE) {
+                DMOD_LOG_ERROR("Invalid erase sector size: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-a") == 0) {
+            apply = true;
+        } else if (argv[i][0] == '-') {
+            DMOD_LOG_ERROR("Unknown option: %s\n", argv[i]);
+            print_usage();
+            return 1;
+        } else if (path_count < 3) {
+            paths[path_count++] = argv[i];
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+    
+    if (path_count != 3) {
+        print_usage();
+        return 1;
+    }
+    
+    bool success = apply ? apply_delta(paths[0], paths[1], paths[2])
+                         : create_delta(paths[0], paths[1], paths[2], (size_t)sector_size);
+    
+    return success ? 0 : 1;
+}
@@ -0,0 +1,890 @@
+#define DMOD_ENABLE_REGISTRATION ON
+#include "dmod.h"
+#include "dmffs.h"
+#include <string.h>
+
+// Maximum path length
+#define MAX_PATH_LEN 512
+
+// Size of the image read cache
+#define CACHE_SIZE              (64u * 1024u)
+
+// Number of entries in the "top" lists of the report
+#define TOP_COUNT               10
+
+// Number of DATA alignment classes (1, 2, 4, ... 4096 bytes)
+#define ALIGN_CLASSES           13
+
+// Number of buckets of the content hash table
+#define CONTENT_BUCKETS         4096
+
+// FNV-1a 64-bit parameters used for content hashes
+#define HASH_INIT               0xCBF29CE484222325ull
+#define HASH_PRIME              0x00000100000001B3ull
+
+#ifndef SEEK_SET
+#define SEEK_SET 0
+#endif
+
+/**
+ * @brief Decoded TLV header (same rules as in src/dmffs.c)
+ */
+typedef struct {
+    uint64_t offset;            //!< offset of the TLV in the image
+    uint32_t type;              //!< TLV type
+    uint64_t length;            //!< length of the value
+    uint64_t value_offset;      //!< offset of the value in the image
+    uint64_t next_offset;       //!< offset of the TLV following this one
+    uint64_t header_size;       //!< size of the header (compact or large)
+} tlv_header_t;
+
+/**
+ * @brief Path with a value, used for the "top" lists of the report
+ */
+typedef struct {
+    uint64_t value;             //!< ranking value
+    char path[MAX_PATH_LEN];    //!< path of the entry
+} ranked_path_t;
+
+/**
+ * @brief Distinct file content, used to find duplicates
+ */
+typedef struct content_entry {
+    uint64_t hash;                  //!< content hash
+    uint64_t size;                  //!< content size
+    uint32_t count;                 //!< number of files with this content
+    char* path;                     //!< path of the first file
+    struct content_entry* next;     //!< next entry in the same bucket
+} content_entry_t;
+
+// Image file and its size
+static void* image_file = NULL;
+static uint64_t image_size = 0;
+
+// Read cache
+static uint8_t* cache = NULL;
+static uint64_t cache_offset = 0;
+static size_t cache_length = 0;
+
+// Image layout
+static uint64_t root_offset = 0;
+static uint64_t metadata_end = 0;
+static uint64_t data_region_offset = 0;
+static uint64_t data_region_size = 0;
+static bool split_layout = false;
+static char version[32] = "";
+static dmffs_bloom_t bloom = {0, 0};
+static dmffs_index_t lookup_index = {0, 0};
+static dmffs_strings_t strings = {0, 0};
+static uint64_t strings_offset = 0;
+
+// Print every directory and every lookup
+static bool print_all = false;
+
+// Entry statistics
+static uint64_t file_count = 0;
+static uint64_t dir_count = 0;
+static uint64_t header_count = 0;
+static uint64_t large_header_count = 0;
+static uint32_t max_depth = 0;
+static uint64_t metadata_bytes = 0;
+static uint64_t data_bytes = 0;
+static uint64_t end_offset = 0;
+static uint64_t align_classes[ALIGN_CLASSES];
+
+// Directory statistics
+static uint64_t max_fanout = 0;
+static uint64_t total_fanout = 0;
+static ranked_path_t largest_dirs[TOP_COUNT];
+
+// Lookup statistics (number of TLV headers read by a lookup)
+static uint64_t total_lookup_cost = 0;
+static ranked_path_t worst_lookups[TOP_COUNT];
+static ranked_path_t worst_misses[TOP_COUNT];
+
+// Duplicate contents
+static content_entry_t* content_buckets[CONTENT_BUCKETS];
+static uint64_t duplicate_files = 0;
+static uint64_t duplicate_bytes = 0;
+
+// Sparse files and the zero bytes they do not store
+static uint64_t sparse_file_count = 0;
+static uint64_t hole_bytes = 0;
+
+// Pre-compressed files and the size of their decoded contents
+static uint64_t encoded_file_count = 0;
+static uint64_t encoded_bytes = 0;
+static uint64_t decoded_bytes = 0;
+
+// Deleted entries of an overlay image
+static uint64_t whiteout_count = 0;
+
+/**
+ * @brief Read bytes from the image
+ * 
+ * Small reads are served from a read cache, large ones go to the file.
+ * 
+ * @param offset Offset in the image
+ * @param buffer Buffer to store the data
+ * @param size Number of bytes to read
+ * @return true on success, false if the range is outside the image or on read error
+ */
+static bool read_image(uint64_t offset, void* buffer, size_t size)
+{
+    if (offset > image_size || size > image_size - offset) {
+        return false;
+    }
+    
+    // The DMOD file API seeks to long offsets
+    if (offset > (uint64_t)(~0UL >> 1)) {
+        return false;
+    }
+    
+    if (size > CACHE_SIZE / 2) {
+        return Dmod_FileSeek(image_file, (long)offset, SEEK_SET) == 0
+            && Dmod_FileRead(buffer, 1, size, image_file) == size;
+    }
+    
+    // Refill the cache if the range is not in it
+    if (offset < cache_offset || offset + size > cache_offset + cache_length) {
+        uint64_t available = image_size - offset;
+        cache_offset = offset;
+        cache_length = (available < CACHE_SIZE) ? (size_t)available : CACHE_SIZE;
+        
+        if (Dmod_FileSeek(image_file, (long)cache_offset, SEEK_SET) != 0 ||
+            Dmod_FileRead(cache, 1, cache_length, image_file) != cache_length) {
+            cache_length = 0;
+            return false;
+        }
+    }
+    
+    memcpy(buffer, cache + (offset - cache_offset), size);
+    return true;
+}
+
+/**
+ * @brief Read a TLV header from the image
+ * 
+ * Both the compact and the large header encodings are accepted. Headers
+ * whose value does not fit into the image are rejected.
+ * 
+ * @param offset Offset in the image
+ * @param header Pointer to store the decoded header
+ * @return true if successful, false otherwise
+ */
+static bool read_tlv_header(uint64_t offset, tlv_header_t* header)
+{
+    uint32_t raw[2];
+    if (!read_image(offset, raw, sizeof(raw))) {
+        return false;
+    }
+    
+    header->offset = offset;
+    header->type = raw[0];
+    header->length = raw[1];
+    header->header_size = DMFFS_TLV_HEADER_SIZE;
+    
+    if (raw[1] == DMFFS_TLV_LENGTH_LARGE) {
+        uint64_t large_length;
+        if (!read_image(offset + DMFFS_TLV_HEADER_SIZE, &large_length, sizeof(large_length))) {
+            return false;
+        }
+        header->length = large_length;
+        header->header_size = DMFFS_TLV_LARGE_HEADER_SIZE;
+    }
+    
+    header->value_offset = offset + header->header_size;
+    if (header->value_offset > image_size || header->length > image_size - header->value_offset) {
+        return false;
+    }
+    
+    header->next_offset = header->value_offset + header->length;
+    return true;
+}
+
+/**
+ * @brief Decode a name of the string table
+ * 
+ * @param ref NAME_REF value
+ * @param name Buffer to store the name
+ * @param name_size Size of the buffer (the name is truncated to fit)
+ * @return true if the reference is valid, false otherwise
+ */
+static bool read_table_name(uint32_t ref, char* name, size_t name_size)
+{
+    uint64_t offset = strings_offset + DMFFS_NAME_REF_BLOCK(ref);
+    uint64_t end = strings_offset + strings.data_size;
+    size_t current = 0;
+    
+    for (uint32_t i = 0; i <= DMFFS_NAME_REF_INDEX(ref); i++) {
+        uint8_t lengths[2];
+        if (offset + sizeof(lengths) > end || !read_image(offset, lengths, sizeof(lengths)) ||
+            lengths[0] > current || offset + sizeof(lengths) + lengths[1] > end) {
+            return false;
+        }
+        
+        // The shared prefix is already in the buffer
+        size_t copied = (lengths[0] + lengths[1] < name_size - 1) ? lengths[1]
+                      : (lengths[0] < name_size - 1) ? name_size - 1 - lengths[0] : 0;
+        if (copied > 0 && !read_image(offset + sizeof(lengths), name + lengths[0], copied)) {
+            return false;
+        }
+        
+        current = (size_t)lengths[0] + lengths[1];
+        offset += sizeof(lengths) + lengths[1];
+    }
+    
+    name[(current < name_size - 1) ? current : name_size - 1] = '\0';
+    return current == DMFFS_NAME_REF_LENGTH(ref);
+}
+
+/**
+ * @brief Read the name of a FILE or DIR entry
+ * 
+ * @param entry FILE or DIR TLV header
+ * @param name Buffer to store the name
+ * @param name_size Size of the buffer (the name is truncated to fit)
+ * @param headers_read Pointer to store the number of nested headers read until the NAME TLV
+ * @return true if the NAME TLV was found, false otherwise
+ */
+static bool read_entry_name(const tlv_header_t* entry, char* name, size_t name_size, uint64_t* headers_read)
+{
+    uint64_t offset = entry->value_offset;
+    
+    name[0] = '\0';
+    *headers_read = 0;
+    while (offset < entry->next_offset) {
+        tlv_header_t nested;
+        if (!read_tlv_header(offset, &nested)) {
+            break;
+        }
+        (*headers_read)++;
+        
+        if (nested.type == DMFFS_TLV_TYPE_NAME && nested.length > 0) {
+            size_t length = (nested.length < name_size - 1) ? (size_t)nested.length : name_size - 1;
+            if (!read_image(nested.value_offset, name, length)) {
+                return false;
+            }
+            name[length] = '\0';
+            return true;
+        }
+        
+        if (nested.type == DMFFS_TLV_TYPE_NAME_REF) {
+            uint32_t ref;
+            return nested.length == sizeof(ref) && read_image(nested.value_offset, &ref, sizeof(ref)) &&
+                   read_table_name(ref, name, name_size);
+        }
+        
+        offset = nested.next_offset;
+    }
+    
+    return false;
+}
+
+/**
+ * @brief Insert a path into a "top" list sorted by descending value
+ * 
+ * @param list List of TOP_COUNT entries
+ * @param value Ranking value
+ * @param path Path of the entry
+ */
+static void add_ranked(ranked_path_t* list, uint64_t value, const char* path)
+{
+    if (value <= list[TOP_COUNT - 1].value) {
+        return;
+    }
+    
+    size_t i = TOP_COUNT - 1;
+    while (i > 0 && list[i - 1].value < value) {
+        list[i] = list[i - 1];
+        i--;
+    }
+    
+    list[i].value = value;
+    strncpy(list[i].path, path, sizeof(list[i].path) - 1);
+    list[i].path[sizeof(list[i].path) - 1] = '\0';
+}
+
+/**
+ * @brief Update a FNV-1a 64-bit hash with a block of data
+ * 
+ * @param hash Current hash value (HASH_INIT for a new hash)
+ * @param data Data to hash
+ * @param size Size of the data
+ * @return Updated hash value
+ */
+static uint64_t hash_update(uint64_t hash, const void* data, size_t size)
+{
+    const uint8_t* ptr = data;
+    
+    while (size-- > 0) {
+        hash ^= *ptr++;
+        hash *= HASH_PRIME;
+    }
+    
+    return hash;
+}
+
+/**
+ * @brief Record the content of a file for the duplicate detection
+ * 
+ * @param path Path of the file
+ * @param offset Offset of the content in the image
+ * @param size Size of the content
+ * @return true on success, false on read or allocation error
+ */
+static bool add_content(const char* path, uint64_t offset, uint64_t size)
+{
+    static uint8_t buffer[4096];
+    uint64_t hash = HASH_INIT;
+    
+    for (uint64_t done = 0; done < size; ) {
+        size_t chunk = (size - done < sizeof(buffer)) ? (size_t)(size - done) : sizeof(buffer);
+        if (!read_image(offset + done, buffer, chunk)) {
+            DMOD_LOG_ERROR("Failed to read content of: %s\n", path);
+            return false;
+        }
+        hash = hash_update(hash, buffer, chunk);
+        done += chunk;
+    }
+    
+    size_t bucket = (size_t)(hash % CONTENT_BUCKETS);
+    for (content_entry_t* entry = content_buckets[bucket]; entry; entry = entry->next) {
+        if (entry->hash == hash && entry->size == size) {
+            entry->count++;
+            duplicate_files++;
+            duplicate_bytes += size;
+            return true;
+        }
+    }
+    
+    content_entry_t* entry = Dmod_Malloc(sizeof(content_entry_t));
+    char* path_copy = Dmod_Malloc(strlen(path) + 1);
+    if (!entry || !path_copy) {
+        DMOD_LOG_ERROR("Failed to allocate content table\n");
+        Dmod_Free(entry);
+        Dmod_Free(path_copy);
+        return false;
+    }
+    
+    strcpy(path_copy, path);
+    entry->hash = hash;
+    entry->size = size;
+    entry->count = 1;
+    entry->path = path_copy;
+    entry->next = content_buckets[bucket];
+    content_buckets[bucket] = entry;
+    return true;
+}
+
+/**
+ * @brief Get the alignment class of an offset
+ * 
+ * @param offset Offset in the image
+ * @return Index of the largest power of two (up to 4096) that divides the offset
+ */
+static size_t alignment_class(uint64_t offset)
+{
+    size_t align = 0;
+    
+    while (align < ALIGN_CLASSES - 1 && (offset & ((uint64_t)1 << align)) == 0) {
+        align++;
+    }
+    
+    return align;
+}
+
+/**
+ * @brief Resolve a DATA_REF TLV to the location of the file content
+ * 
+ * @param header DATA_REF TLV header
+ * @param offset Pointer to store the offset of the content in the image
+ * @param size Pointer to store the size of the content
+ * @return true if the reference points into the data region, false otherwise
+ */
+static bool read_data_ref(const tlv_header_t* header, uint64_t* offset, uint64_t* size)
+{
+    dmffs_data_ref64_t ref;
+    
+    if (header->length == sizeof(dmffs_data_ref_t)) {
+        dmffs_data_ref_t compact;
+        if (!read_image(header->value_offset, &compact, sizeof(compact))) {
+            return false;
+        }
+        ref.offset = compact.offset;
+        ref.size = compact.size;
+    } else if (header->length != sizeof(dmffs_data_ref64_t) || !read_image(header->value_offset, &ref, sizeof(ref))) {
+        return false;
+    }
+    
+    if (ref.offset > data_region_size || ref.size > data_region_size - ref.offset) {
+        return false;
+    }
+    
+    *offset = data_region_offset + ref.offset;
+    *size = ref.size;
+    return true;
+}
+
+/**
+ * @brief Inspect a FILE entry
+ * 
+ * @param entry FILE TLV header
+ * @param path Path of the file
+ * @param lookup_cost Number of headers read by a lookup of the file
+ * @return true on success, false on error
+ */
+static bool inspect_file(const tlv_header_t* entry, const char* path, uint64_t lookup_cost)
+{
+    uint64_t offset = entry->value_offset;
+    uint64_t content_offset = 0;
+    uint64_t content_size = 0;
+    uint64_t logical_size = 0;
+    uint64_t decoded_size = 0;
+    bool has_content = false;
+    bool sparse = false;
+    bool encoded = false;
+    
+    // Opening the file reads the FILE header and all nested headers again
+    lookup_cost++;
+    
+    while (offset < entry->next_offset) {
+        tlv_header_t nested;
+        if (!read_tlv_header(offset, &nested)) {
+            DMOD_LOG_ERROR("Invalid nested TLV at offset %lu in: %s\n", (unsigned long)offset, path);
+            return false;
+        }
+        
+        header_count++;
+        lookup_cost++;
+        metadata_bytes += nested.header_size;
+        if (nested.header_size == DMFFS_TLV_LARGE_HEADER_SIZE) {
+            large_header_count++;
+        }
+        
+        if (nested.type == DMFFS_TLV_TYPE_DATA) {
+            content_offset = nested.value_offset;
+            content_size = nested.length;
+            has_content = true;
+        } else {
+            metadata_bytes += nested.length;
+            if (nested.type == DMFFS_TLV_TYPE_DATA_REF) {
+                has_content = read_data_ref(&nested, &content_offset, &content_size);
+                if (!has_content) {
+                    DMOD_LOG_ERROR("Invalid DATA_REF in: %s\n", path);
+                }
+            } else if (nested.type == DMFFS_TLV_TYPE_HOLES) {
+                dmffs_holes_t holes;
+                sparse = nested.length >= sizeof(holes) && read_image(nested.value_offset, &holes, sizeof(holes));
+                logical_size = sparse ? holes.size : 0;
+            } else if (nested.type == DMFFS_TLV_TYPE_ENCODING) {
+                dmffs_encoding_t encoding;
+                encoded = nested.length >= sizeof(encoding) && read_image(nested.value_offset, &encoding, sizeof(encoding))
+                       && encoding.type != DMFFS_ENCODING_IDENTITY;
+                decoded_size = encoded ? encoding.size : 0;
+            }
+        }
+        
+        offset = nested.next_offset;
+    }
+    
+    file_count++;
+    data_bytes += content_size;
+    if (sparse && logical_size > content_size) {
+        sparse_file_count++;
+        hole_bytes += logical_size - content_size;
+    }
+    if (encoded) {
+        encoded_file_count++;
+        encoded_bytes += content_size;
+        decoded_bytes += decoded_size;
+    }
+    total_lookup_cost += lookup_cost;
+    add_ranked(worst_lookups, lookup_cost, path);
+    
+    if (has_content && content_size > 0) {
+        align_classes[alignment_class(content_offset)]++;
+        if (!add_content(path, content_offset, content_size)) {
+            return false;
+        }
+    }
+    
+    if (print_all) {
+        Dmod_Printf("file %s size=%lu offset=%lu lookup=%lu\n", path, (unsigned long)content_size,
+                    (unsigned long)content_offset, (unsigned long)lookup_cost);
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Inspect the entries of a directory recursively
+ * 
+ * Lookup costs follow the search in src/dmffs.c: every entry of a directory
+ * before the match costs its header plus the nested headers read until its
+ * NAME TLV.
+ * 
+ * @param offset Offset of the first entry
+ * @param end End of the directory (end of the DIR TLV or of the metadata)
+ * @param path Path of the directory (buffer of MAX_PATH_LEN bytes, extended for children)
+ * @param depth Depth of the directory entries (1 for the root)
+ * @param lookup_base Number of headers read to find the directory
+ * @return true on success, false on error
+ */
+static bool inspect_directory(uint64_t offset, uint64_t end, char* path, uint32_t depth, uint64_t lookup_base)
+{
+    size_t path_len = strlen(path);
+    uint64_t scan_cost = 0;
+    uint64_t fanout = 0;
+    
+    while (offset < end) {
+        tlv_header_t header;
+        if (!read_tlv_header(offset, &header)) {
+            DMOD_LOG_ERROR("Invalid TLV at offset %lu in directory: %s/\n", (unsigned long)offset, path);
+            return false;
+        }
+        
+        header_count++;
+        scan_cost++;
+        metadata_bytes += header.header_size;
+        if (header.header_size == DMFFS_TLV_LARGE_HEADER_SIZE) {
+            large_header_count++;
+        }
+        
+        if (header.type == DMFFS_TLV_TYPE_END || header.type == DMFFS_TLV_TYPE_INVALID) {
+            end_offset = header.next_offset;
+            break;
+        }
+        
+        if (header.type != DMFFS_TLV_TYPE_FILE && header.type != DMFFS_TLV_TYPE_DIR) {
+            whiteout_count += (header.type == DMFFS_TLV_TYPE_WHITEOUT) ? 1 : 0;
+            metadata_bytes += header.length;
+            offset = header.next_offset;
+            continue;
+        }
+        
+        char name[256];
+        uint64_t name_cost = 0;
+        if (!read_entry_name(&header, name, sizeof(name), &name_cost)) {
+            strcpy(name, "<unnamed>");
+        }
+        scan_cost += name_cost;
+        fanout++;
+        
+        if (path_len + 1 + strlen(name) + 1 > MAX_PATH_LEN) {
+            DMOD_LOG_ERROR("Path too long: %s/%s\n", path, name);
+            return false;
+        }
+        path[path_len] = '/';
+        strcpy(path + path_len + 1, name);
+        
+        if (depth > max_depth) {
+            max_depth = depth;
+        }
+        
+        bool success;
+        if (header.type == DMFFS_TLV_TYPE_FILE) {
+            success = inspect_file(&header, path, lookup_base + scan_cost);
+        } else {
+            dir_count++;
+            success = inspect_directory(header.value_offset, header.next_offset, path, depth + 1, lookup_base + scan_cost);
+        }
+        
+        path[path_len] = '\0';
+        if (!success) {
+            return false;
+        }
+        
+        offset = header.next_offset;
+    }
+    
+    // A lookup of a missing name reads every entry of the directory
+    const char* dir_path = path_len ? path : "/";
+    add_ranked(worst_misses, lookup_base + scan_cost, dir_path);
+    add_ranked(largest_dirs, fanout, dir_path);
+    total_fanout += fanout;
+    if (fanout > max_fanout) {
+        max_fanout = fanout;
+    }
+    
+    if (print_all) {
+        Dmod_Printf("dir %s entries=%lu miss=%lu\n", dir_path, (unsigned long)fanout, (unsigned long)(lookup_base + scan_cost));
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Read the image header (VERSION, LAYOUT, BLOOM, INDEX and STRINGS TLVs)
+ * 
+ * @return true on success, false if the image has no valid TLV structure
+ */
+static bool read_image_layout(void)
+{
+    tlv_header_t header;
+    
+    root_offset = 0;
+    metadata_end = image_size;
+    
+    while (read_tlv_header(root_offset, &header)) {
+        if (header.type == DMFFS_TLV_TYPE_VERSION) {
+            size_t length = (header.length < sizeof(version) - 1) ? (size_t)header.length : sizeof(version) - 1;
+            if (read_image(header.value_offset, version, length)) {
+                version[length] = '\0';
+            }
+        } else if (header.type == DMFFS_TLV_TYPE_LAYOUT) {
+            dmffs_layout_t layout;
+            if (header.length < sizeof(layout) || !read_image(header.value_offset, &layout, sizeof(layout)) ||
+                layout.data_offset < header.next_offset || layout.data_offset > image_size ||
+                layout.data_size > image_size - layout.data_offset) {
+                DMOD_LOG_ERROR("Invalid LAYOUT TLV\n");
+                return false;
+            }
+            split_layout = true;
+            metadata_end = layout.data_offset;
+            data_region_offset = layout.data_offset;
+            data_region_size = layout.data_size;
+        } else if (header.type == DMFFS_TLV_TYPE_BLOOM) {
+            if (header.length < sizeof(bloom) || !read_image(header.value_offset, &bloom, sizeof(bloom))) {
+                DMOD_LOG_ERROR("Invalid BLOOM TLV\n");
+                return false;
+            }
+        } else if (header.type == DMFFS_TLV_TYPE_INDEX) {
+            if (header.length < sizeof(lookup_index) || !read_image(header.value_offset, &lookup_index, sizeof(lookup_index))) {
+                DMOD_LOG_ERROR("Invalid INDEX TLV\n");
+                return false;
+            }
+        } else if (header.type == DMFFS_TLV_TYPE_STRINGS) {
+            if (header.length < sizeof(strings) || !read_image(header.value_offset, &strings, sizeof(strings)) ||
+                strings.data_size > header.length - sizeof(strings)) {
+                DMOD_LOG_ERROR("Invalid STRINGS TLV\n");
+                return false;
+            }
+            strings_offset = header.value_offset + sizeof(strings);
+        } else {
+            break;
+        }
+        
+        header_count++;
+        metadata_bytes += header.header_size + header.length;
+        root_offset = header.next_offset;
+    }
+    
+    return read_tlv_header(root_offset, &header) &&
+           (header.type == DMFFS_TLV_TYPE_FILE || header.type == DMFFS_TLV_TYPE_DIR ||
+            header.type == DMFFS_TLV_TYPE_WHITEOUT || header.type == DMFFS_TLV_TYPE_END);
+}
+
+/**
+ * @brief Print a "top" list
+ * 
+ * @param title Title of the list
+ * @param list List of TOP_COUNT entries
+ */
+static void print_ranked(const char* title, const ranked_path_t* list)
+{
+    Dmod_Printf("\n%s:\n", title);
+    for (size_t i = 0; i < TOP_COUNT && list[i].value > 0; i++) {
+        Dmod_Printf("  %8lu  %s\n", (unsigned long)list[i].value, list[i].path);
+    }
+}
+
+/**
+ * @brief Print the report
+ * 
+ * @param image_path Path of the image
+ */
+static void print_report(const char* image_path)
+{
+    Dmod_Printf("Image:              %s (%lu bytes)\n", image_path, (unsigned long)image_size);
+    Dmod_Printf("Version:            %s\n", version[0] ? version : "-");
+    Dmod_Printf("Layout:             %s\n", split_layout ? "split (metadata first)" : "inline");
+    if (bloom.bit_count > 0) {
+        Dmod_Printf("Path filter:        %lu bits, %lu hashes\n", (unsigned long)bloom.bit_count, (unsigned long)bloom.hash_count);
+    } else {
+        Dmod_Printf("Path filter:        -\n");
+    }
+    if (lookup_index.entry_count > 0) {
+        Dmod_Printf("Path index:         %lu entries, at most %lu probes\n", (unsigned long)lookup_index.entry_count,
+                    (unsigned long)lookup_index.max_probes);
+    } else {
+        Dmod_Printf("Path index:         -\n");
+    }
+    if (strings_offset > 0) {
+        Dmod_Printf("String table:       %lu names, %lu bytes\n", (unsigned long)strings.name_count, (unsigned long)strings.data_size);
+    } else {
+        Dmod_Printf("String table:       -\n");
+    }
+    Dmod_Printf("Files:              %lu\n", (unsigned long)file_count);
+    Dmod_Printf("Directories:        %lu\n", (unsigned long)dir_count);
+    Dmod_Printf("Max depth:          %lu\n", (unsigned long)max_depth);
+    Dmod_Printf("TLV headers:        %lu (%lu large)\n", (unsigned long)header_count, (unsigned long)large_header_count);
+    Dmod_Printf("Metadata bytes:     %lu\n", (unsigned long)metadata_bytes);
+    Dmod_Printf("Data bytes:         %lu\n", (unsigned long)data_bytes);
+    if (split_layout) {
+        Dmod_Printf("Metadata block:     0..%lu\n", (unsigned long)metadata_end);
+        Dmod_Printf("Data region:        %lu..%lu\n", (unsigned long)data_region_offset,
+                    (unsigned long)(data_region_offset + data_region_size));
+    } else {
+        Dmod_Printf("Metadata span:      0..%lu (interleaved with data)\n", (unsigned long)end_offset);
+    }
+    Dmod_Printf("Unused bytes:       %lu\n", (unsigned long)(image_size - metadata_bytes - data_bytes));
+    
+    Dmod_Printf("Max fanout:         %lu\n", (unsigned long)max_fanout);
+    Dmod_Printf("Average fanout:     %lu\n", (unsigned long)(total_fanout / (dir_count + 1)));
+    Dmod_Printf("Lookup cost:        max %lu, average %lu headers%s\n", (unsigned long)worst_lookups[0].value,
+                (unsigned long)(file_count > 0 ? total_lookup_cost / file_count : 0),
+                lookup_index.entry_count > 0 ? " (without the path index)" : "");
+    Dmod_Printf("Miss cost:          max %lu headers%s\n", (unsigned long)worst_misses[0].value,
+                bloom.bit_count > 0 ? " (most misses are rejected by the path filter)" : "");
+    Dmod_Printf("Duplicate files:    %lu (%lu bytes)\n", (unsigned long)duplicate_files, (unsigned long)duplicate_bytes);
+    Dmod_Printf("Sparse files:       %lu (%lu hole bytes)\n", (unsigned long)sparse_file_count, (unsigned long)hole_bytes);
+    Dmod_Printf("Encoded files:      %lu (%lu bytes, %lu decoded)\n", (unsigned long)encoded_file_count,
+                (unsigned long)encoded_bytes, (unsigned long)decoded_bytes);
+    if (whiteout_count > 0) {
+        Dmod_Printf("Whiteouts:          %lu (overlay image)\n", (unsigned long)whiteout_count);
+    }
+    
+    Dmod_Printf("DATA alignment:    ");
+    for (size_t i = 0; i < ALIGN_CLASSES; i++) {
+        if (align_classes[i] > 0) {
+            Dmod_Printf(" %lu%s:%lu", (unsigned long)1 << i, (i == ALIGN_CLASSES - 1) ? "+" : "", (unsigned long)align_classes[i]);
+        }
+    }
+    Dmod_Printf("\n");
+    
+    print_ranked("Largest directories (entries)", largest_dirs);
+    print_ranked("Most expensive lookups (headers read)", worst_lookups);
+    print_ranked("Most expensive misses (headers read)", worst_misses);
+    
+    Dmod_Printf("\nDuplicate contents:\n");
+    if (duplicate_files == 0) {
+        Dmod_Printf("  none\n");
+    }
+    for (size_t i = 0; i < CONTENT_BUCKETS; i++) {
+        for (content_entry_t* entry = content_buckets[i]; entry; entry = entry->next) {
+            if (entry->count > 1) {
+                Dmod_Printf("  %8lu  %lu copies of %s\n", (unsigned long)entry->size, (unsigned long)entry->count, entry->path);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Release the content table
+ */
+static void free_contents(void)
+{
+    for (size_t i = 0; i < CONTENT_BUCKETS; i++) {
+        while (content_buckets[i]) {
+            content_entry_t* next = content_buckets[i]->next;
+            Dmod_Free(content_buckets[i]->path);
+            Dmod_Free(content_buckets[i]);
+            content_buckets[i] = next;
+        }
+    }
+}
+
+/**
+ * @brief Print usage information
+ */
+static void print_usage(void)
+{
+    DMOD_LOG_ERROR("Usage: dmffs_inspect [options] <image_file>\n");
+    DMOD_LOG_ERROR("Options:\n");
+    DMOD_LOG_ERROR("  -a          Print every directory and file with its lookup cost\n");
+    DMOD_LOG_ERROR("Example: dmffs_inspect ./out/flash-fs.bin\n");
+}
+
+/**
+ * @brief Main application entry point
+ * 
+ * @param argc Argument count
+ * @param argv Argument values
+ * @return 0 on success, non-zero on error
+ */
+int main(int argc, const char* argv[])
+{
+    const char* image_path = NULL;
+    
+    // Parse arguments (argv[0] is the program name)
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-a") == 0) {
+            print_all = true;
+        } else if (argv[i][0] == '-') {
+            DMOD_LOG_ERROR("Unknown option: %s\n", argv[i]);
+            print_usage();
+            return 1;
+        } else if (!image_path) {
+            image_path = argv[i];
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+    
+    if (!image_path) {
+        print_usage();
+        return 1;
+    }
+    
+    image_file = Dmod_FileOpen(image_path, "rb");
+    if (!image_file) {
+        DMOD_LOG_ERROR("Failed to open image: %s\n", image_path);
+        return 1;
+    }
+    image_size = Dmod_FileSize(image_file);
+    
+    cache = Dmod_Malloc(CACHE_SIZE);
+    if (!cache) {
+        DMOD_LOG_ERROR("Failed to allocate the read cache\n");
+        Dmod_FileClose(image_file);
+        return 1;
+    }
+    
+    bool success = read_image_layout();
+    if (!success) {
+        DMOD_LOG_ERROR("No valid DMFFS structure in image: %s\n", image_path);
+    }
+    
+    char path[MAX_PATH_LEN] = "";
+    if (success) {
+        success = inspect_directory(root_offset, metadata_end, path, 1, 0);
+    }
+    
+    if (success) {
+        print_report(image_path);
+    }
+    
+    free_contents();
+    Dmod_Free(cache);
+    Dmod_FileClose(image_file);
+    
+    return success ? 0 : 1;
+}
+
+/**
+ * @brief Module initialization (optional)
+ */
+void dmod_preinit(void)
+{
+    // Nothing to do
+}
+
+/**
+ * @brief Module initialization
+ */
+int dmod_init(const Dmod_Config_t *Config)
+{
+    // Nothing to do
+    return 0;
+}
+
+/**
+ * @brief Module deinitialization
+ */
+int dmod_deinit(void)
+{
+    // Nothing to do
+    return 0;
+}
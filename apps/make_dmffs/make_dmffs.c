@@ -2,13 +2,314 @@
 #include "dmod.h"
 #include "dmffs.h"
 #include <string.h>
+#ifdef MAKE_DMFFS_HOST_CLOCK
+#include <time.h>
+#endif
 
 // Maximum path length
 #define MAX_PATH_LEN 512
 
+// Size of the output buffer
+#define OUTPUT_BUFFER_SIZE      (4u * 1024u * 1024u)
+
+// Files up to this size are ingested into memory, larger ones are streamed
+#define INGEST_MAX_FILE_SIZE    (16u * 1024u * 1024u)
+
+// Default number of files read ahead of the writer
+#define DEFAULT_READ_AHEAD      4
+
+// Maximum number of files read ahead of the writer
+#define MAX_READ_AHEAD          64
+
+// Number of buckets of the path hash tables (manifest, changed inputs, trace)
+#define PATH_BUCKETS            4096
+
+// Version of the manifest format
+#define MANIFEST_VERSION        1
+
+// Manifest option flags (images built with other options are not reused)
+#define MANIFEST_OPTION_SPLIT   0x1
+
+// Largest number of path filter bits per entry (-b)
+#define MAX_BLOOM_BITS          64
+
+// Smallest zero run stored as a hole of a sparse file (-z)
+#define MIN_HOLE_SIZE           16
+
+// Largest erase sector size of the stable layout (-s)
+#define MAX_SECTOR_SIZE         (16u * 1024u * 1024u)
+
+// Default growth slack of the stable layout in percent (-g)
+#define DEFAULT_SLACK_PERCENT   25
+
+// Manifest option flag of pre-compressed files (-e)
+#define MANIFEST_OPTION_ENCODE  0x2
+
+// Manifest option flag of images with a string table (-n)
+#define MANIFEST_OPTION_STRINGS 0x4
+
+// Longest name that can be stored in the string table (-n)
+#define MAX_TABLE_NAME_LEN      255
+
+// Deflate window and match parameters (gzip encoding, -e)
+#define DEFLATE_WINDOW          32768
+#define DEFLATE_HASH_BITS       15
+#define DEFLATE_MIN_MATCH       3
+#define DEFLATE_MAX_MATCH       258
+#define DEFLATE_MAX_CHAIN       64
+#define DEFLATE_NO_POSITION     0xFFFFFFFFu
+
+// Size of the gzip header and trailer
+#define GZIP_HEADER_SIZE        10
+#define GZIP_TRAILER_SIZE       8
+
+// Size of a tar header and of the blocks its content is padded to
+#define TAR_BLOCK_SIZE          512
+
+// Size of the fixed header of the cpio formats (newc and odc)
+#define CPIO_NEWC_HEADER_SIZE   110
+#define CPIO_ODC_HEADER_SIZE    76
+
+// Largest pax extended header that is parsed (tar)
+#define MAX_PAX_HEADER_SIZE     (64u * 1024u)
+
+// Input name that reads the archive from the standard input
+#define ARCHIVE_STDIN           "-"
+#define ARCHIVE_STDIN_PATH      "/dev/stdin"
+
+// FNV-1a 64-bit parameters used for content and path hashes
+#define HASH_INIT               0xCBF29CE484222325ull
+#define HASH_PRIME              0x00000100000001B3ull
+
+#ifndef SEEK_SET
+#define SEEK_SET 0
+#endif
+
+/**
+ * @brief Node of the in-memory input tree
+ */
+typedef struct node {
+    char* name;                 //!< entry name
+    char* path;                 //!< full path of the input
+    bool is_dir;                //!< true for directories
+    bool is_whiteout;           //!< true for deleted entries of an overlay image (-w)
+    bool in_archive;            //!< true for files read from an input archive
+    uint8_t* content;           //!< content of a file read from an input archive
+    struct node* children;      //!< first child (directories only)
+    struct node* next;          //!< next sibling
+    const char* rel_path;       //!< path relative to the input directory (points into path)
+    uint64_t size;              //!< file size
+    uint64_t hash;              //!< content hash
+    uint32_t mtime;             //!< modification time (0 if unknown)
+    uint64_t entry_offset;      //!< offset of the file in the output image (see manifest_entry_t)
+    uint64_t entry_size;        //!< size of the file in the output image
+    uint64_t data_offset;       //!< offset of the content in the data region (split layout)
+    uint64_t tlv_offset;        //!< offset of the FILE or DIR TLV in the output image (path index)
+    uint32_t name_ref;          //!< reference to the name in the string table (-n)
+    size_t rank;                //!< position in the access trace (SIZE_MAX if not traced)
+} node_t;
+
+/**
+ * @brief Entry of the manifest of a previously built image
+ */
+typedef struct manifest_entry {
+    const char* path;               //!< path relative to the input directory
+    uint64_t size;                  //!< file size
+    uint32_t mtime;                 //!< modification time (0 if unknown)
+    uint64_t hash;                  //!< content hash
+    uint64_t entry_offset;          //!< offset of the FILE TLV (inline) or of the content (split layout)
+    uint64_t entry_size;            //!< size of the FILE TLV including its header, or of the content
+    uint64_t slot_size;             //!< space up to the next content (stable layout, 0 if unknown)
+    struct manifest_entry* next;    //!< next entry in the same bucket
+} manifest_entry_t;
+
+/**
+ * @brief Set of paths (used for the list of changed inputs)
+ */
+typedef struct path_set_entry {
+    const char* path;               //!< path
+    struct path_set_entry* next;    //!< next entry in the same bucket
+} path_set_entry_t;
+
+/**
+ * @brief Entry of the access trace used for placement
+ */
+typedef struct trace_entry {
+    const char* path;               //!< path relative to the input directory
+    size_t rank;                    //!< position of the first access
+    struct trace_entry* next;       //!< next entry in the same bucket
+} trace_entry_t;
+
+/**
+ * @brief Item sorted by a 64-bit key (path index, stable layout)
+ */
+typedef struct {
+    uint64_t key;               //!< sort key
+    const void* item;           //!< sorted item
+} sort_slot_t;
+
+/**
+ * @brief Entry of an input archive (tar or cpio)
+ */
+typedef struct {
+    char path[MAX_PATH_LEN];    //!< path of the entry in the archive
+    uint64_t size;              //!< size of the content
+    uint32_t mtime;             //!< modification time
+    bool is_file;               //!< true for regular files
+    bool is_dir;                //!< true for directories
+} archive_entry_t;
+
+/**
+ * @brief LSB-first bit writer of the deflate encoder
+ */
+typedef struct {
+    uint8_t* data;              //!< output buffer
+    size_t capacity;            //!< size of the output buffer
+    size_t length;              //!< number of bytes written
+    uint32_t bits;              //!< bits not written yet
+    uint32_t bit_count;         //!< number of bits not written yet
+    bool overflow;              //!< set when the output did not fit into the buffer
+} bit_writer_t;
+
+/**
+ * @brief Build phase timed with -T
+ */
+typedef enum {
+    PHASE_WALK,                 //!< input walk or archive load, manifest, whiteouts and trace
+    PHASE_SIZE,                 //!< size calculation (path filter, index, string table, metadata layout)
+    PHASE_COPY,                 //!< reading the input files and encoding the image
+    PHASE_WRITE,                //!< writing the image and the manifest
+    PHASE_COUNT
+} phase_t;
+
+/**
+ * @brief Input file ingested ahead of the writer
+ */
+typedef struct {
+    node_t* node;               //!< file node
+    void* file;                 //!< open input (streamed files only)
+    uint8_t* data;              //!< file content (ingested files only)
+    uint64_t size;              //!< file size
+    const manifest_entry_t* reuse;  //!< entry of the previous image to copy instead
+} ingest_job_t;
+
 // Output file handle
 static void* output_file = NULL;
 
+// Phase timing (-T) and the time spent in each phase in microseconds
+static bool phase_timing = false;
+static uint64_t phase_time[PHASE_COUNT];
+
+// Current write offset in the output file
+static uint64_t output_offset = 0;
+
+// Output buffer and number of bytes waiting in it
+static uint8_t* output_buffer = NULL;
+static size_t output_buffered = 0;
+
+// Write large headers for all DIR entries (metadata-first images with 4 GiB of metadata)
+static bool large_dir_headers = false;
+
+// Metadata-first layout: all entries first, file contents in a separate data region
+static bool split_layout = false;
+
+// Write wide DATA_REF values (needed for data regions above 4 GiB)
+static bool wide_data_refs = false;
+
+// Set when a file did not fit into a compact DATA_REF
+static bool data_ref_overflow = false;
+
+// Files in the order they are written to the image
+static node_t** file_list = NULL;
+static size_t file_count = 0;
+static size_t file_capacity = 0;
+
+// Read-ahead window of the writer (ring of read_ahead jobs)
+static ingest_job_t jobs[MAX_READ_AHEAD];
+static size_t read_ahead = DEFAULT_READ_AHEAD;
+static size_t next_ingest = 0;
+static size_t next_emit = 0;
+
+// Write a manifest next to the output image
+static bool write_manifest_file = false;
+
+// Previous image and its manifest (incremental mode)
+static void* previous_image = NULL;
+static char* manifest_text = NULL;
+static manifest_entry_t* manifest_buckets[PATH_BUCKETS];
+
+// Inputs reported as changed by the build system (optional)
+static char* changed_text = NULL;
+static path_set_entry_t* changed_buckets[PATH_BUCKETS];
+static bool changed_list_loaded = false;
+
+// Number of files copied from the previous image
+static size_t reused_count = 0;
+
+// Number of deleted paths written as whiteouts (-w)
+static size_t whiteout_count = 0;
+
+// Access trace used for placement (optional)
+static char* trace_text = NULL;
+static trace_entry_t* trace_buckets[PATH_BUCKETS];
+static size_t trace_count = 0;
+
+// Length of the input directory prefix of node paths
+static size_t input_prefix_len = 0;
+
+// Path filter written to the image header (-b, disabled if 0 bits per entry)
+static uint32_t bloom_bits_per_entry = 0;
+static dmffs_bloom_t bloom = {0, 0};
+static uint8_t* bloom_filter = NULL;
+
+// Stable layout: erase sector size (-s, disabled if 0) and growth slack in percent (-g)
+static uint64_t sector_size = 0;
+static uint64_t slack_percent = DEFAULT_SLACK_PERCENT;
+
+// Path index written to the image header (-x)
+static bool lookup_index = false;
+static sort_slot_t* index_slots = NULL;
+static dmffs_index_t index_header = {0, 0};
+static uint64_t index_table_offset = 0;
+
+// Front-coded table of all names written to the image header (-n)
+static bool string_table = false;
+static dmffs_strings_t strings_header = {0, 0};
+static uint8_t* strings_data = NULL;
+
+// Smallest zero run stored as a hole (-z, sparse files disabled if 0)
+static uint64_t min_hole_size = 0;
+
+// Comma separated extensions of the files stored gzip encoded (-e, disabled if NULL)
+static const char* encode_extensions = NULL;
+static size_t encoded_count = 0;
+
+// Deflate match finder (hash chains over the last DEFLATE_WINDOW positions)
+static uint32_t* deflate_head = NULL;
+static uint32_t* deflate_prev = NULL;
+
+// CRC-32 table of the gzip trailer
+static uint32_t crc_table[256];
+static bool crc_table_ready = false;
+
+// Deflate length and distance codes (RFC 1951, 3.2.5)
+static const uint16_t length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t distance_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t distance_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
 /**
  * @brief Build a path by concatenating directory and entry
  * Simple replacement for snprintf in DMOD_MODULE mode
@@ -30,310 +331,3781 @@ static void build_path(char* buffer, size_t buffer_size, const char* dir, const
         return;
     }
     
-    // Copy directory
-    strcpy(buffer, dir);
-    
-    // Add separator if needed
-    if (dir_len > 0 && buffer[dir_len - 1] != '/') {
-        buffer[dir_len] = '/';
-        buffer[dir_len + 1] = '\0';
-    }
+    // Copy directory
+    strcpy(buffer, dir);
+    
+    // Add separator if needed
+    if (dir_len > 0 && buffer[dir_len - 1] != '/') {
+        buffer[dir_len] = '/';
+        buffer[dir_len + 1] = '\0';
+    }
+    
+    // Append entry
+    strcat(buffer, entry);
+}
+
+/**
+ * @brief Duplicate a string using the DMOD allocator
+ * 
+ * @param str String to copy
+ * @return Copy of the string, or NULL on allocation failure
+ */
+static char* duplicate_string(const char* str)
+{
+    size_t length = strlen(str);
+    char* copy = Dmod_Malloc(length + 1);
+    if (copy) {
+        memcpy(copy, str, length + 1);
+    }
+    return copy;
+}
+
+/**
+ * @brief Parse a decimal number
+ * 
+ * @param str String to parse
+ * @param value Pointer to store the value
+ * @return true if the whole string is a valid number, false otherwise
+ */
+static bool parse_number(const char* str, uint64_t* value)
+{
+    uint64_t result = 0;
+    
+    if (!str || *str == '\0') return false;
+    
+    for (; *str; str++) {
+        if (*str < '0' || *str > '9') {
+            return false;
+        }
+        result = result * 10 + (uint64_t)(*str - '0');
+    }
+    
+    *value = result;
+    return true;
+}
+
+/**
+ * @brief Parse a hexadecimal number
+ * 
+ * @param str String to parse
+ * @param value Pointer to store the value
+ * @return true if the whole string is a valid number, false otherwise
+ */
+static bool parse_hex_number(const char* str, uint64_t* value)
+{
+    uint64_t result = 0;
+    
+    if (!str || *str == '\0') return false;
+    
+    for (; *str; str++) {
+        char c = *str;
+        uint64_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = (uint64_t)(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            digit = (uint64_t)(c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            digit = (uint64_t)(c - 'A' + 10);
+        } else {
+            return false;
+        }
+        result = (result << 4) | digit;
+    }
+    
+    *value = result;
+    return true;
+}
+
+/**
+ * @brief Append a decimal number to a string
+ * Simple replacement for snprintf in DMOD_MODULE mode
+ * 
+ * @param buffer Position in the output buffer (at least 21 bytes available)
+ * @param value Value to append
+ * @return Position after the appended number
+ */
+static char* append_decimal(char* buffer, uint64_t value)
+{
+    char digits[20];
+    size_t count = 0;
+    
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    
+    while (count > 0) {
+        *buffer++ = digits[--count];
+    }
+    *buffer = '\0';
+    return buffer;
+}
+
+/**
+ * @brief Append a 64-bit number as 16 hexadecimal digits to a string
+ * 
+ * @param buffer Position in the output buffer (at least 17 bytes available)
+ * @param value Value to append
+ * @return Position after the appended number
+ */
+static char* append_hex64(char* buffer, uint64_t value)
+{
+    static const char hex_digits[] = "0123456789abcdef";
+    
+    for (int shift = 60; shift >= 0; shift -= 4) {
+        *buffer++ = hex_digits[(value >> shift) & 0xF];
+    }
+    *buffer = '\0';
+    return buffer;
+}
+
+/**
+ * @brief Update a FNV-1a 64-bit hash with a block of data
+ * 
+ * @param hash Current hash value (HASH_INIT for a new hash)
+ * @param data Data to hash
+ * @param size Size of the data
+ * @return Updated hash value
+ */
+static uint64_t hash_update(uint64_t hash, const void* data, size_t size)
+{
+    const uint8_t* ptr = data;
+    
+    while (size-- > 0) {
+        hash ^= *ptr++;
+        hash *= HASH_PRIME;
+    }
+    
+    return hash;
+}
+
+/**
+ * @brief Get the bucket index of a path
+ * 
+ * @param path Path to hash
+ * @return Bucket index
+ */
+static size_t path_bucket(const char* path)
+{
+    return (size_t)(hash_update(HASH_INIT, path, strlen(path)) % PATH_BUCKETS);
+}
+
+/**
+ * @brief Read a whole text file into a null-terminated buffer
+ * 
+ * @param path Path of the file
+ * @return Buffer (to be released with Dmod_Free), or NULL on error
+ */
+static char* read_text_file(const char* path)
+{
+    void* file = Dmod_FileOpen(path, "rb");
+    if (!file) {
+        DMOD_LOG_ERROR("Failed to open file: %s\n", path);
+        return NULL;
+    }
+    
+    size_t size = Dmod_FileSize(file);
+    char* text = Dmod_Malloc(size + 1);
+    if (!text) {
+        DMOD_LOG_ERROR("Failed to allocate %u bytes for file: %s\n", (unsigned int)size, path);
+        Dmod_FileClose(file);
+        return NULL;
+    }
+    
+    if (size > 0 && Dmod_FileRead(text, 1, size, file) != size) {
+        DMOD_LOG_ERROR("Failed to read file: %s\n", path);
+        Dmod_Free(text);
+        Dmod_FileClose(file);
+        return NULL;
+    }
+    
+    text[size] = '\0';
+    Dmod_FileClose(file);
+    return text;
+}
+
+/**
+ * @brief Split the next line of a text buffer into space separated fields
+ * 
+ * The last field takes the rest of the line, so it may contain spaces.
+ * The buffer is modified in place.
+ * 
+ * @param cursor Position in the text, updated to the next line
+ * @param fields Array to store the fields
+ * @param max_fields Number of fields to split
+ * @return Number of fields found, or -1 at the end of the text
+ */
+static int split_line(char** cursor, char** fields, int max_fields)
+{
+    char* ptr = *cursor;
+    if (*ptr == '\0') {
+        return -1;
+    }
+    
+    // Terminate the line
+    char* end = ptr;
+    while (*end && *end != '\n') end++;
+    *cursor = (*end == '\n') ? end + 1 : end;
+    *end = '\0';
+    if (end > ptr && end[-1] == '\r') {
+        end[-1] = '\0';
+    }
+    
+    int count = 0;
+    while (*ptr && count < max_fields) {
+        fields[count++] = ptr;
+        if (count == max_fields) {
+            break;
+        }
+        while (*ptr && *ptr != ' ') ptr++;
+        if (*ptr) {
+            *ptr++ = '\0';
+        }
+    }
+    
+    return count;
+}
+
+/**
+ * @brief Get the size of the TLV header needed for a value of the given length
+ * 
+ * @param length TLV length
+ * @return Header size in bytes
+ */
+static uint64_t tlv_header_size(uint64_t length)
+{
+    return (length >= DMFFS_TLV_LENGTH_LARGE) ? DMFFS_TLV_LARGE_HEADER_SIZE : DMFFS_TLV_HEADER_SIZE;
+}
+
+/**
+ * @brief Encode a TLV header
+ * 
+ * The compact header is used whenever the length fits into 32 bits,
+ * unless the large one is explicitly requested.
+ * 
+ * @param buffer Buffer for the encoded header (DMFFS_TLV_LARGE_HEADER_SIZE bytes)
+ * @param type TLV type
+ * @param length TLV length
+ * @param large Force the large header
+ * @return Size of the encoded header
+ */
+static size_t encode_tlv_header(uint8_t* buffer, uint32_t type, uint64_t length, bool large)
+{
+    uint32_t compact_length = (large || length >= DMFFS_TLV_LENGTH_LARGE) ? DMFFS_TLV_LENGTH_LARGE : (uint32_t)length;
+    
+    memcpy(buffer, &type, sizeof(uint32_t));
+    memcpy(buffer + sizeof(uint32_t), &compact_length, sizeof(uint32_t));
+    if (compact_length != DMFFS_TLV_LENGTH_LARGE) {
+        return DMFFS_TLV_HEADER_SIZE;
+    }
+    
+    memcpy(buffer + DMFFS_TLV_HEADER_SIZE, &length, sizeof(uint64_t));
+    return DMFFS_TLV_LARGE_HEADER_SIZE;
+}
+
+/**
+ * @brief Read the monotonic clock
+ * 
+ * DMOD has no clock API, so the phases are only timed by host builds
+ * (MAKE_DMFFS_HOST_CLOCK, see host/CMakeLists.txt).
+ * 
+ * @return Time in microseconds (0 without a clock)
+ */
+static uint64_t clock_us(void)
+{
+#ifdef MAKE_DMFFS_HOST_CLOCK
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000u + (uint64_t)now.tv_nsec / 1000u;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief Start timing a build phase
+ * 
+ * @return Start time to pass to phase_end()
+ */
+static uint64_t phase_start(void)
+{
+    return phase_timing ? clock_us() : 0;
+}
+
+/**
+ * @brief Add the time since phase_start() to a build phase
+ * 
+ * @param phase Build phase
+ * @param start Value returned by phase_start()
+ */
+static void phase_end(phase_t phase, uint64_t start)
+{
+    if (phase_timing) {
+        phase_time[phase] += clock_us() - start;
+    }
+}
+
+/**
+ * @brief Seek to an absolute offset of a file
+ * 
+ * The DMOD file API takes the offset as long, so offsets beyond its range
+ * (2 GiB where long has 32 bits) are rejected instead of wrapping around.
+ * 
+ * @param file File to seek in
+ * @param offset Offset from the start of the file
+ * @return true on success, false on error
+ */
+static bool seek_file(void* file, uint64_t offset)
+{
+    if (offset > (uint64_t)(~0UL >> 1)) {
+        DMOD_LOG_ERROR("Cannot seek to offset %lu MiB, it does not fit into long\n", (unsigned long)(offset >> 20));
+        return false;
+    }
+    
+    return Dmod_FileSeek(file, (long)offset, SEEK_SET) == 0;
+}
+
+/**
+ * @brief Write the buffered output to the output file
+ * 
+ * @return true on success, false on error
+ */
+static bool flush_output(void)
+{
+    uint64_t start = phase_start();
+    bool written = output_buffered == 0 || Dmod_FileWrite(output_buffer, 1, output_buffered, output_file) == output_buffered;
+    phase_end(PHASE_WRITE, start);
+    
+    if (!written) {
+        DMOD_LOG_ERROR("Failed to write %u bytes to the output file\n", (unsigned int)output_buffered);
+        return false;
+    }
+    
+    output_buffered = 0;
+    return true;
+}
+
+/**
+ * @brief Write data to the output file through the output buffer
+ * 
+ * @param data Data to write
+ * @param size Number of bytes to write
+ * @return true on success, false on error
+ */
+static bool write_output(const void* data, size_t size)
+{
+    if (!output_file) return false;
+    
+    const uint8_t* ptr = data;
+    while (size > 0) {
+        // Large blocks bypass the buffer when it is empty
+        if (output_buffered == 0 && size >= OUTPUT_BUFFER_SIZE) {
+            uint64_t start = phase_start();
+            bool written = Dmod_FileWrite(ptr, 1, size, output_file) == size;
+            phase_end(PHASE_WRITE, start);
+            if (!written) {
+                DMOD_LOG_ERROR("Failed to write %u bytes to the output file\n", (unsigned int)size);
+                return false;
+            }
+            output_offset += size;
+            return true;
+        }
+        
+        size_t chunk = OUTPUT_BUFFER_SIZE - output_buffered;
+        if (chunk > size) {
+            chunk = size;
+        }
+        
+        memcpy(output_buffer + output_buffered, ptr, chunk);
+        output_buffered += chunk;
+        output_offset += chunk;
+        ptr += chunk;
+        size -= chunk;
+        
+        if (output_buffered == OUTPUT_BUFFER_SIZE && !flush_output()) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Write a block of zeros to the output
+ * 
+ * @param size Number of bytes to write
+ * @return true on success, false on error
+ */
+static bool write_zeros(uint64_t size)
+{
+    while (size > 0) {
+        if (output_buffered == OUTPUT_BUFFER_SIZE && !flush_output()) {
+            return false;
+        }
+        
+        size_t chunk = OUTPUT_BUFFER_SIZE - output_buffered;
+        if (chunk > size) {
+            chunk = (size_t)size;
+        }
+        
+        memset(output_buffer + output_buffered, 0, chunk);
+        output_buffered += chunk;
+        output_offset += chunk;
+        size -= chunk;
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Write a TLV header to the output file
+ * 
+ * @param type TLV type
+ * @param length TLV length
+ * @param large Force the large header
+ * @return true on success, false on error
+ */
+static bool write_tlv_header(uint32_t type, uint64_t length, bool large)
+{
+    uint8_t header[DMFFS_TLV_LARGE_HEADER_SIZE];
+    size_t header_size = encode_tlv_header(header, type, length, large);
+    
+    if (!write_output(header, header_size)) {
+        DMOD_LOG_ERROR("Failed to write TLV header\n");
+        return false;
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Overwrite a previously written TLV header
+ * 
+ * Headers that are still in the output buffer are patched in memory,
+ * the others directly in the output file.
+ * 
+ * @param header_offset Offset of the header in the output file
+ * @param type TLV type
+ * @param length TLV length
+ * @param large true if the header was written in the large form
+ * @return true on success, false on error
+ */
+static bool patch_tlv_header(uint64_t header_offset, uint32_t type, uint64_t length, bool large)
+{
+    uint8_t header[DMFFS_TLV_LARGE_HEADER_SIZE];
+    size_t header_size = encode_tlv_header(header, type, length, large);
+    uint64_t buffer_offset = output_offset - output_buffered;
+    
+    if (header_offset >= buffer_offset) {
+        memcpy(output_buffer + (header_offset - buffer_offset), header, header_size);
+        return true;
+    }
+    
+    if (!flush_output() ||
+        !seek_file(output_file, header_offset) ||
+        Dmod_FileWrite(header, 1, header_size, output_file) != header_size ||
+        !seek_file(output_file, output_offset)) {
+        DMOD_LOG_ERROR("Failed to patch TLV header at offset %lu\n", (unsigned long)header_offset);
+        return false;
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Make room for bytes at an offset of the output
+ * 
+ * Everything from the offset to the end of the output is moved back by the
+ * size of the gap, so a length that turns out not to fit into its compact
+ * form can be widened without building the image again. The gap keeps
+ * stale bytes until the caller overwrites it.
+ * 
+ * @param offset Offset of the gap in the output file
+ * @param size Size of the gap
+ * @return true on success, false on error
+ */
+static bool insert_output_gap(uint64_t offset, uint64_t size)
+{
+    if (!flush_output()) {
+        return false;
+    }
+    
+    // The output buffer is empty after the flush, move the bytes through it from the end
+    uint64_t end = output_offset;
+    while (end > offset) {
+        size_t chunk = (end - offset < OUTPUT_BUFFER_SIZE) ? (size_t)(end - offset) : OUTPUT_BUFFER_SIZE;
+        end -= chunk;
+        if (!seek_file(output_file, end) ||
+            Dmod_FileRead(output_buffer, 1, chunk, output_file) != chunk ||
+            !seek_file(output_file, end + size) ||
+            Dmod_FileWrite(output_buffer, 1, chunk, output_file) != chunk) {
+            DMOD_LOG_ERROR("Failed to move the output at offset %lu\n", (unsigned long)end);
+            return false;
+        }
+    }
+    
+    output_offset += size;
+    return seek_file(output_file, output_offset);
+}
+
+/**
+ * @brief Write a TLV entry with data to the output file
+ * 
+ * @param type TLV type
+ * @param data Data to write
+ * @param length Length of data
+ * @return true on success, false on error
+ */
+static bool write_tlv(uint32_t type, const void* data, uint32_t length)
+{
+    if (!write_tlv_header(type, length, false)) {
+        return false;
+    }
+    
+    if (length > 0 && data) {
+        if (!write_output(data, length)) {
+            DMOD_LOG_ERROR("Failed to write TLV data (%u bytes)\n", length);
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Release a tree node and all its children
+ * 
+ * @param node Node to release
+ */
+static void free_tree(node_t* node)
+{
+    while (node) {
+        node_t* next = node->next;
+        free_tree(node->children);
+        Dmod_Free(node->content);
+        Dmod_Free(node->name);
+        Dmod_Free(node->path);
+        Dmod_Free(node);
+        node = next;
+    }
+}
+
+/**
+ * @brief Append a file to the list of files in image order
+ * 
+ * @param node File node
+ * @return true on success, false on allocation failure
+ */
+static bool add_to_file_list(node_t* node)
+{
+    if (file_count == file_capacity) {
+        size_t new_capacity = file_capacity ? file_capacity * 2 : 64;
+        node_t** new_list = Dmod_Malloc(new_capacity * sizeof(node_t*));
+        if (!new_list) {
+            DMOD_LOG_ERROR("Failed to allocate the file list\n");
+            return false;
+        }
+        if (file_list) {
+            memcpy(new_list, file_list, file_count * sizeof(node_t*));
+            Dmod_Free(file_list);
+        }
+        file_list = new_list;
+        file_capacity = new_capacity;
+    }
+    
+    file_list[file_count++] = node;
+    return true;
+}
+
+/**
+ * @brief Scan a directory recursively into the in-memory tree
+ * 
+ * Only directories are opened here; files are opened once, when they are ingested.
+ * 
+ * @param dir Directory handle opened by the caller
+ * @param parent Directory node to fill
+ * @return true on success, false on error
+ */
+static bool scan_directory(void* dir, node_t* parent)
+{
+    char path_buffer[MAX_PATH_LEN];
+    node_t** tail = &parent->children;
+    
+    const char* entry = NULL;
+    while ((entry = Dmod_ReadDir(dir)) != NULL) {
+        // Skip . and ..
+        if (strcmp(entry, ".") == 0 || strcmp(entry, "..") == 0) {
+            continue;
+        }
+        
+        // Build full path
+        build_path(path_buffer, sizeof(path_buffer), parent->path, entry);
+        if (path_buffer[0] == '\0') {
+            continue; // Skip if path is too long
+        }
+        
+        node_t* node = Dmod_Malloc(sizeof(node_t));
+        if (!node) {
+            DMOD_LOG_ERROR("Failed to allocate tree node for: %s\n", path_buffer);
+            return false;
+        }
+        memset(node, 0, sizeof(node_t));
+        *tail = node;
+        tail = &node->next;
+        
+        node->name = duplicate_string(entry);
+        node->path = duplicate_string(path_buffer);
+        if (!node->name || !node->path) {
+            DMOD_LOG_ERROR("Failed to allocate tree node for: %s\n", path_buffer);
+            return false;
+        }
+        node->rel_path = node->path + input_prefix_len;
+        
+        // Check if it's a directory
+        void* subdir = Dmod_OpenDir(path_buffer);
+        if (subdir) {
+            node->is_dir = true;
+            bool success = scan_directory(subdir, node);
+            Dmod_CloseDir(subdir);
+            if (!success) {
+                return false;
+            }
+        } else if (!add_to_file_list(node)) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Add an entry to a directory node of the tree
+ * 
+ * @param parent Directory node
+ * @param name Name of the entry
+ * @return New node, NULL on error
+ */
+static node_t* add_child(node_t* parent, const char* name)
+{
+    char path_buffer[MAX_PATH_LEN];
+    
+    build_path(path_buffer, sizeof(path_buffer), parent->path, name);
+    if (path_buffer[0] == '\0') {
+        DMOD_LOG_ERROR("Path too long: %s/%s\n", parent->path, name);
+        return NULL;
+    }
+    
+    node_t* node = Dmod_Malloc(sizeof(node_t));
+    if (!node) {
+        DMOD_LOG_ERROR("Failed to allocate tree node for: %s\n", path_buffer);
+        return NULL;
+    }
+    memset(node, 0, sizeof(node_t));
+    
+    node_t** tail = &parent->children;
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = node;
+    
+    node->name = duplicate_string(name);
+    node->path = duplicate_string(path_buffer);
+    if (!node->name || !node->path) {
+        DMOD_LOG_ERROR("Failed to allocate tree node for: %s\n", path_buffer);
+        return NULL;
+    }
+    node->rel_path = node->path + input_prefix_len;
+    
+    return node;
+}
+
+/**
+ * @brief Find an entry of a directory node by name
+ * 
+ * @param parent Directory node
+ * @param name Name of the entry
+ * @return Node of the entry, NULL if not found
+ */
+static node_t* find_child(node_t* parent, const char* name)
+{
+    node_t* node = parent->children;
+    while (node && strcmp(node->name, name) != 0) {
+        node = node->next;
+    }
+    return node;
+}
+
+/**
+ * @brief Add a deleted path to the tree as a whiteout
+ * 
+ * Missing parent directories are added as empty directories, which merge
+ * with the directories of the lower images.
+ * 
+ * @param root Root directory node
+ * @param path Deleted path relative to the input directory (modified)
+ * @return true on success, false on error
+ */
+static bool add_whiteout(node_t* root, char* path)
+{
+    node_t* parent = root;
+    
+    while (*path == '/') path++;
+    while (*path) {
+        char* end = path;
+        while (*end && *end != '/') end++;
+        char* next = end;
+        while (*next == '/') next++;
+        bool last = (*next == '\0');
+        *end = '\0';
+        
+        node_t* node = find_child(parent, path);
+        
+        if (last) {
+            if (node) {
+                DMOD_LOG_ERROR("Deleted path is part of the input: %s\n", node->rel_path);
+                return false;
+            }
+            node = add_child(parent, path);
+            if (node) {
+                node->is_whiteout = true;
+            }
+            return node != NULL;
+        }
+        
+        if (!node) {
+            node = add_child(parent, path);
+            if (!node) {
+                return false;
+            }
+            node->is_dir = true;
+        } else if (!node->is_dir) {
+            DMOD_LOG_ERROR("Deleted path below a file: %s\n", node->rel_path);
+            return false;
+        }
+        
+        parent = node;
+        path = next;
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Load the list of deleted paths of an overlay image
+ * 
+ * The list contains one path per line, relative to the input directory.
+ * 
+ * @param root Root directory node
+ * @param path Path of the list
+ * @return true on success, false on error
+ */
+static bool load_whiteouts(node_t* root, const char* path)
+{
+    char* text = read_text_file(path);
+    if (!text) {
+        return false;
+    }
+    
+    char* cursor = text;
+    char* fields[1];
+    int count;
+    bool success = true;
+    while (success && (count = split_line(&cursor, fields, 1)) >= 0) {
+        if (count > 0) {
+            success = add_whiteout(root, fields[0]);
+            whiteout_count += success ? 1 : 0;
+        }
+    }
+    
+    Dmod_Free(text);
+    return success;
+}
+
+/**
+ * @brief Read a number of bytes from the input archive
+ * 
+ * @param archive Archive handle
+ * @param buffer Buffer to fill
+ * @param size Number of bytes to read
+ * @return true on success, false at the end of the archive or on error
+ */
+static bool read_archive(void* archive, void* buffer, size_t size)
+{
+    size_t total_read = 0;
+    
+    while (total_read < size) {
+        size_t read = Dmod_FileRead((uint8_t*)buffer + total_read, 1, size - total_read, archive);
+        if (read == 0) {
+            return false;
+        }
+        total_read += read;
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Skip bytes of the input archive
+ * 
+ * The archive is read instead of seeked, since it may be a pipe.
+ * 
+ * @param archive Archive handle
+ * @param size Number of bytes to skip
+ * @return true on success, false on error
+ */
+static bool skip_archive(void* archive, uint64_t size)
+{
+    uint8_t buffer[TAR_BLOCK_SIZE];
+    
+    while (size > 0) {
+        size_t chunk = size < sizeof(buffer) ? (size_t)size : sizeof(buffer);
+        if (!read_archive(archive, buffer, chunk)) {
+            return false;
+        }
+        size -= chunk;
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Parse a fixed-width number field of an archive header
+ * 
+ * Leading spaces are skipped, a space or NUL ends the number. Tar fields
+ * that do not fit into octal digits are stored in base-256.
+ * 
+ * @param field Field data
+ * @param width Width of the field
+ * @param base 8 (tar, cpio odc) or 16 (cpio newc)
+ * @param value Pointer to store the value
+ * @return true if the field holds a valid number, false otherwise
+ */
+static bool parse_archive_field(const uint8_t* field, size_t width, uint32_t base, uint64_t* value)
+{
+    uint64_t result = 0;
+    size_t i = 0;
+    
+    if (base == 8 && (field[0] & 0x80)) {
+        for (i = 1; i < width; i++) {
+            result = (result << 8) | field[i];
+        }
+        *value = result;
+        return true;
+    }
+    
+    while (i < width && field[i] == ' ') i++;
+    
+    size_t digits = 0;
+    for (; i < width && field[i] != '\0' && field[i] != ' '; i++, digits++) {
+        uint8_t c = field[i];
+        uint32_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = (uint32_t)(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            digit = (uint32_t)(c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            digit = (uint32_t)(c - 'A' + 10);
+        } else {
+            return false;
+        }
+        if (digit >= base) {
+            return false;
+        }
+        result = result * base + digit;
+    }
+    
+    *value = result;
+    return digits > 0;
+}
+
+/**
+ * @brief Find or add the node of an archive path
+ * 
+ * Empty and "." components are ignored; missing parent directories are
+ * added (their time is unknown until the archive lists them).
+ * 
+ * @param root Root directory node
+ * @param path Path of the entry (modified)
+ * @param created Pointer to store whether the node was added
+ * @return Node of the path (a directory if it was added), NULL on error
+ */
+static node_t* add_archive_path(node_t* root, char* path, bool* created)
+{
+    node_t* node = root;
+    
+    *created = false;
+    while (*path) {
+        char* end = path;
+        while (*end && *end != '/') end++;
+        char* next = (*end == '/') ? end + 1 : end;
+        *end = '\0';
+        
+        if (path[0] == '\0' || strcmp(path, ".") == 0) {
+            path = next;
+            continue;
+        }
+        
+        if (strcmp(path, "..") == 0) {
+            DMOD_LOG_ERROR("Archive path leaves the archive: %s\n", node->rel_path ? node->rel_path : "");
+            return NULL;
+        }
+        
+        if (!node->is_dir) {
+            DMOD_LOG_ERROR("Archive entry below a file: %s\n", node->rel_path);
+            return NULL;
+        }
+        
+        node_t* parent = node;
+        node = find_child(parent, path);
+        *created = (node == NULL);
+        if (!node) {
+            node = add_child(parent, path);
+            if (!node) {
+                return NULL;
+            }
+            node->is_dir = true;
+        }
+        
+        path = next;
+    }
+    
+    return node;
+}
+
+/**
+ * @brief Add an entry of an input archive to the tree
+ * 
+ * A later entry of the same path replaces the earlier one, as on extraction.
+ * 
+ * @param root Root directory node
+ * @param entry Archive entry
+ * @param content Content of a file (taken over, may be NULL for empty files)
+ * @return true on success, false on error
+ */
+static bool add_archive_entry(node_t* root, archive_entry_t* entry, uint8_t* content)
+{
+    bool created = false;
+    node_t* node = add_archive_path(root, entry->path, &created);
+    
+    if (node && entry->is_dir) {
+        if (!node->is_dir) {
+            DMOD_LOG_ERROR("Archive directory replaces a file: %s\n", node->rel_path);
+            return false;
+        }
+        node->mtime = entry->mtime;
+        return true;
+    }
+    
+    if (node && node->is_dir && !created) {
+        DMOD_LOG_ERROR("Archive file replaces a directory: %s\n", node == root ? "/" : node->rel_path);
+        node = NULL;
+    } else if (node && created) {
+        node->is_dir = false;
+    }
+    
+    if (!node) {
+        Dmod_Free(content);
+        return false;
+    }
+    
+    Dmod_Free(node->content);
+    node->in_archive = true;
+    node->content = content;
+    node->size = entry->size;
+    node->mtime = entry->mtime;
+    return true;
+}
+
+/**
+ * @brief Read the content of an archive entry and add the entry to the tree
+ * 
+ * Entries other than files and directories (links, devices) are skipped.
+ * 
+ * @param archive Archive handle
+ * @param root Root directory node
+ * @param entry Archive entry
+ * @param padding Number of bytes behind the content
+ * @return true on success, false on error
+ */
+static bool read_archive_entry(void* archive, node_t* root, archive_entry_t* entry, uint64_t padding)
+{
+    if (!entry->is_file && !entry->is_dir) {
+        DMOD_LOG_WARN("Skipping archive entry that is no file or directory: %s\n", entry->path);
+        return skip_archive(archive, entry->size + padding);
+    }
+    
+    uint8_t* content = NULL;
+    if (entry->is_file && entry->size > 0) {
+        content = Dmod_Malloc((size_t)entry->size);
+        if (!content) {
+            DMOD_LOG_ERROR("Failed to allocate %u bytes for archive entry: %s\n", (unsigned int)entry->size, entry->path);
+            return false;
+        }
+        if (!read_archive(archive, content, (size_t)entry->size)) {
+            DMOD_LOG_ERROR("Archive ends inside of: %s\n", entry->path);
+            Dmod_Free(content);
+            return false;
+        }
+    } else if (!skip_archive(archive, entry->size)) {
+        DMOD_LOG_ERROR("Archive ends inside of: %s\n", entry->path);
+        return false;
+    }
+    
+    DMOD_LOG_INFO("Archive entry: %s (%lu bytes)\n", entry->path, (unsigned long)entry->size);
+    return add_archive_entry(root, entry, content) && skip_archive(archive, padding);
+}
+
+/**
+ * @brief Check the header checksum of a tar block
+ * 
+ * @param block Header block
+ * @return true if the checksum matches, false otherwise
+ */
+static bool check_tar_checksum(const uint8_t* block)
+{
+    uint64_t expected = 0;
+    uint64_t sum = 0;
+    
+    if (!parse_archive_field(block + 148, 8, 8, &expected)) {
+        return false;
+    }
+    
+    // The checksum field itself counts as spaces
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; i++) {
+        sum += (i >= 148 && i < 156) ? ' ' : block[i];
+    }
+    
+    return sum == expected;
+}
+
+/**
+ * @brief Apply the records of a pax extended header to the next entry
+ * 
+ * Records have the form "<length> <key>=<value>\n"; only the path and the
+ * modification time are used.
+ * 
+ * @param data Header data (modified)
+ * @param size Size of the header data
+ * @param entry Next archive entry
+ * @param has_path Pointer to store whether the path was set
+ * @param has_mtime Pointer to store whether the time was set
+ */
+static void apply_pax_header(char* data, size_t size, archive_entry_t* entry, bool* has_path, bool* has_mtime)
+{
+    size_t offset = 0;
+    
+    while (offset < size) {
+        size_t length = 0;
+        size_t i = offset;
+        while (i < size && data[i] >= '0' && data[i] <= '9') {
+            length = length * 10 + (size_t)(data[i++] - '0');
+        }
+        if (i >= size || data[i] != ' ' || length <= i - offset + 1 || length > size - offset) {
+            return;
+        }
+        
+        char* key = data + i + 1;
+        data[offset + length - 1] = '\0';
+        char* value = strchr(key, '=');
+        if (value) {
+            *value++ = '\0';
+            if (strcmp(key, "path") == 0 && strlen(value) < MAX_PATH_LEN) {
+                strcpy(entry->path, value);
+                *has_path = true;
+            } else if (strcmp(key, "mtime") == 0) {
+                // Fractions of a second are dropped
+                uint64_t mtime = 0;
+                for (; *value >= '0' && *value <= '9'; value++) {
+                    mtime = mtime * 10 + (uint64_t)(*value - '0');
+                }
+                entry->mtime = (uint32_t)mtime;
+                *has_mtime = true;
+            }
+        }
+        
+        offset += length;
+    }
+}
+
+/**
+ * @brief Read the entries of a tar archive (ustar, GNU and pax)
+ * 
+ * @param archive Archive handle
+ * @param root Root directory node
+ * @param entry Entry buffer
+ * @param block First header block (already read), reused for the following ones
+ * @return true on success, false on error
+ */
+static bool load_tar(void* archive, node_t* root, archive_entry_t* entry, uint8_t* block)
+{
+    bool has_path = false;
+    bool has_mtime = false;
+    
+    for (;;) {
+        // The archive ends with zero blocks
+        bool is_zero = true;
+        for (size_t i = 0; i < TAR_BLOCK_SIZE && is_zero; i++) {
+            is_zero = (block[i] == 0);
+        }
+        if (is_zero) {
+            return true;
+        }
+        
+        uint64_t size = 0;
+        uint64_t mtime = 0;
+        if (!check_tar_checksum(block) || !parse_archive_field(block + 124, 12, 8, &size)) {
+            DMOD_LOG_ERROR("Invalid tar header in the input archive\n");
+            return false;
+        }
+        parse_archive_field(block + 136, 12, 8, &mtime);
+        
+        char type = (char)block[156];
+        uint64_t padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+        
+        if (type == 'L' || type == 'x') {
+            // GNU long name or pax extended header of the next entry
+            if (size >= (type == 'L' ? MAX_PATH_LEN : MAX_PAX_HEADER_SIZE)) {
+                DMOD_LOG_ERROR("Extended tar header too long\n");
+                return false;
+            }
+            char* data = Dmod_Malloc((size_t)size + 1);
+            if (!data || !read_archive(archive, data, (size_t)size) || !skip_archive(archive, padding)) {
+                DMOD_LOG_ERROR("Failed to read an extended tar header\n");
+                Dmod_Free(data);
+                return false;
+            }
+            data[size] = '\0';
+            if (type == 'L') {
+                strcpy(entry->path, data);
+                has_path = true;
+            } else {
+                apply_pax_header(data, (size_t)size, entry, &has_path, &has_mtime);
+            }
+            Dmod_Free(data);
+        } else if (type == 'g') {
+            // Global pax header
+            if (!skip_archive(archive, size + padding)) {
+                return false;
+            }
+        } else {
+            if (!has_path) {
+                // ustar splits long paths into a prefix and a name
+                size_t length = 0;
+                if (memcmp(block + 257, "ustar", 5) == 0 && block[345] != '\0') {
+                    while (length < 155 && block[345 + length] != '\0') {
+                        entry->path[length] = (char)block[345 + length];
+                        length++;
+                    }
+                    entry->path[length++] = '/';
+                }
+                for (size_t i = 0; i < 100 && block[i] != '\0'; i++) {
+                    entry->path[length++] = (char)block[i];
+                }
+                entry->path[length] = '\0';
+            }
+            if (!has_mtime) {
+                entry->mtime = (uint32_t)mtime;
+            }
+            entry->size = size;
+            entry->is_file = (type == '0' || type == '\0' || type == '7');
+            entry->is_dir = (type == '5');
+            if (entry->is_dir) {
+                // The size of a directory entry holds no content
+                padding += size;
+                entry->size = 0;
+            }
+            if (!read_archive_entry(archive, root, entry, padding)) {
+                return false;
+            }
+            has_path = false;
+            has_mtime = false;
+        }
+        
+        if (!read_archive(archive, block, TAR_BLOCK_SIZE)) {
+            // Archives written without the end blocks
+            return true;
+        }
+    }
+}
+
+/**
+ * @brief Read the entries of a cpio archive (newc or odc)
+ * 
+ * @param archive Archive handle
+ * @param root Root directory node
+ * @param entry Entry buffer
+ * @param block Header buffer, holding the magic of the first entry
+ * @param newc true for the newc format (hexadecimal), false for odc (octal)
+ * @return true on success, false on error
+ */
+static bool load_cpio(void* archive, node_t* root, archive_entry_t* entry, uint8_t* block, bool newc)
+{
+    const size_t header_size = newc ? CPIO_NEWC_HEADER_SIZE : CPIO_ODC_HEADER_SIZE;
+    const uint32_t base = newc ? 16 : 8;
+    const uint8_t magic[6] = { block[0], block[1], block[2], block[3], block[4], block[5] };
+    
+    for (;;) {
+        uint64_t mode = 0;
+        uint64_t nlink = 0;
+        uint64_t mtime = 0;
+        uint64_t name_size = 0;
+        uint64_t size = 0;
+        
+        // newc: ino, mode, uid, gid, nlink, mtime, filesize, ..., namesize
+        // odc: dev, ino, mode, uid, gid, nlink, rdev, mtime, namesize, filesize
+        bool valid = read_archive(archive, block + sizeof(magic), header_size - sizeof(magic));
+        if (valid && newc) {
+            valid = parse_archive_field(block + 14, 8, base, &mode) && parse_archive_field(block + 38, 8, base, &nlink)
+                 && parse_archive_field(block + 46, 8, base, &mtime) && parse_archive_field(block + 54, 8, base, &size)
+                 && parse_archive_field(block + 94, 8, base, &name_size);
+        } else if (valid) {
+            valid = parse_archive_field(block + 18, 6, base, &mode) && parse_archive_field(block + 36, 6, base, &nlink)
+                 && parse_archive_field(block + 48, 11, base, &mtime) && parse_archive_field(block + 59, 6, base, &name_size)
+                 && parse_archive_field(block + 65, 11, base, &size);
+        }
+        if (!valid || name_size == 0 || name_size > MAX_PATH_LEN || !read_archive(archive, entry->path, (size_t)name_size)) {
+            DMOD_LOG_ERROR("Invalid cpio header in the input archive\n");
+            return false;
+        }
+        entry->path[name_size - 1] = '\0';
+        
+        // newc pads the header with the name and the content to 4 bytes
+        if (newc && !skip_archive(archive, (4 - (header_size + name_size) % 4) % 4)) {
+            return false;
+        }
+        
+        if (strcmp(entry->path, "TRAILER!!!") == 0) {
+            return true;
+        }
+        
+        entry->size = size;
+        entry->mtime = (uint32_t)mtime;
+        entry->is_file = ((mode & 0170000) == 0100000);
+        entry->is_dir = ((mode & 0170000) == 0040000);
+        if (newc && entry->is_file && nlink > 1 && size == 0) {
+            // newc stores the content of hard links with the last link only
+            entry->is_file = false;
+        }
+        
+        if (!read_archive_entry(archive, root, entry, newc ? (4 - size % 4) % 4 : 0)) {
+            return false;
+        }
+        
+        if (!read_archive(archive, block, sizeof(magic)) || memcmp(block, magic, sizeof(magic)) != 0) {
+            DMOD_LOG_ERROR("Invalid cpio header in the input archive\n");
+            return false;
+        }
+    }
+}
+
+/**
+ * @brief Read the input tree from a tar or cpio archive
+ * 
+ * The archive is read in a single forward pass, so it can be a pipe. File
+ * contents are kept in memory until they are written to the image.
+ * 
+ * @param root Root directory node
+ * @param path Path of the archive, "-" for the standard input
+ * @return true on success, false on error
+ */
+static bool load_archive(node_t* root, const char* path)
+{
+    bool from_stdin = (strcmp(path, ARCHIVE_STDIN) == 0);
+    void* archive = Dmod_FileOpen(from_stdin ? ARCHIVE_STDIN_PATH : path, "rb");
+    if (!archive) {
+        DMOD_LOG_ERROR("Input is neither a directory nor a readable archive: %s\n", path);
+        return false;
+    }
+    
+    archive_entry_t* entry = Dmod_Malloc(sizeof(archive_entry_t));
+    uint8_t* block = Dmod_Malloc(TAR_BLOCK_SIZE);
+    bool success = entry && block;
+    if (!success) {
+        DMOD_LOG_ERROR("Failed to allocate the archive reader\n");
+    } else if (!read_archive(archive, block, 6)) {
+        DMOD_LOG_ERROR("Input archive is empty: %s\n", path);
+        success = false;
+    } else if (memcmp(block, "070701", 6) == 0 || memcmp(block, "070702", 6) == 0) {
+        success = load_cpio(archive, root, entry, block, true);
+    } else if (memcmp(block, "070707", 6) == 0) {
+        success = load_cpio(archive, root, entry, block, false);
+    } else if (block[0] == 0x1F && block[1] == 0x8B) {
+        DMOD_LOG_ERROR("Compressed archives are not supported, decompress into a pipe (e.g. gzip -dc <archive> | make_dmffs - <output>)\n");
+        success = false;
+    } else {
+        success = read_archive(archive, block + 6, TAR_BLOCK_SIZE - 6) && load_tar(archive, root, entry, block);
+        if (!success) {
+            DMOD_LOG_ERROR("Failed to read the input archive: %s\n", path);
+        }
+    }
+    
+    Dmod_Free(entry);
+    Dmod_Free(block);
+    Dmod_FileClose(archive);
+    return success;
+}
+
+/**
+ * @brief Load the list of inputs reported as changed by the build system
+ * 
+ * The list contains one path per line, either as passed to make_dmffs
+ * (e.g. "flashfs/config/app.cfg") or relative to the input directory.
+ * 
+ * @param path Path of the list
+ * @return true on success, false on error
+ */
+static bool load_changed_list(const char* path)
+{
+    changed_text = read_text_file(path);
+    if (!changed_text) {
+        return false;
+    }
+    
+    char* cursor = changed_text;
+    char* fields[1];
+    int count;
+    while ((count = split_line(&cursor, fields, 1)) >= 0) {
+        if (count == 0) {
+            continue;
+        }
+        
+        path_set_entry_t* entry = Dmod_Malloc(sizeof(path_set_entry_t));
+        if (!entry) {
+            DMOD_LOG_ERROR("Failed to allocate the list of changed inputs\n");
+            return false;
+        }
+        
+        size_t bucket = path_bucket(fields[0]);
+        entry->path = fields[0];
+        entry->next = changed_buckets[bucket];
+        changed_buckets[bucket] = entry;
+    }
+    
+    changed_list_loaded = true;
+    return true;
+}
+
+/**
+ * @brief Check if an input file is in the list of changed inputs
+ * 
+ * @param node File node
+ * @return true if the file is listed, false otherwise
+ */
+static bool is_changed(const node_t* node)
+{
+    const char* paths[2] = { node->path, node->rel_path };
+    
+    for (int i = 0; i < 2; i++) {
+        for (path_set_entry_t* entry = changed_buckets[path_bucket(paths[i])]; entry; entry = entry->next) {
+            if (strcmp(entry->path, paths[i]) == 0) {
+                return true;
+            }
+        }
+    }
+    
+    return false;
+}
+
+/**
+ * @brief Build the path of the manifest of an image
+ * 
+ * @param buffer Output buffer
+ * @param buffer_size Size of output buffer
+ * @param image_path Path of the image
+ * @return true on success, false if the path is too long
+ */
+static bool build_manifest_path(char* buffer, size_t buffer_size, const char* image_path)
+{
+    static const char suffix[] = ".manifest";
+    size_t image_len = strlen(image_path);
+    
+    if (image_len + sizeof(suffix) > buffer_size) {
+        DMOD_LOG_ERROR("Path too long: %s%s\n", image_path, suffix);
+        return false;
+    }
+    
+    memcpy(buffer, image_path, image_len);
+    memcpy(buffer + image_len, suffix, sizeof(suffix));
+    return true;
+}
+
+/**
+ * @brief Get the manifest option flags of the image being built
+ * 
+ * @return MANIFEST_OPTION_* flags
+ */
+static uint64_t manifest_options(void)
+{
+    uint64_t options = split_layout ? MANIFEST_OPTION_SPLIT : 0;
+    
+    // Inline FILE entries hold references into the string table
+    if (string_table && !split_layout) {
+        options |= MANIFEST_OPTION_STRINGS;
+    }
+    
+    // The encoded extensions and the hole size change the FILE entries as well
+    if (encode_extensions) {
+        options |= MANIFEST_OPTION_ENCODE | ((hash_update(HASH_INIT, encode_extensions, strlen(encode_extensions)) & 0xFFFFFF) << 40);
+    }
+    
+    return options | (min_hole_size << 8);
+}
+
+/**
+ * @brief Load the manifest of the previous image
+ * 
+ * The manifest starts with a header line:
+ *   dmffs-manifest <version> <options> <image_size>
+ * followed by one line per file:
+ *   <hash> <size> <mtime> <entry_offset> <entry_size> <path>
+ * 
+ * @param image_path Path of the previous image
+ * @return true on success, false on error
+ */
+static bool load_manifest(const char* image_path)
+{
+    char manifest_path[MAX_PATH_LEN];
+    if (!build_manifest_path(manifest_path, sizeof(manifest_path), image_path)) {
+        return false;
+    }
+    
+    manifest_text = read_text_file(manifest_path);
+    if (!manifest_text) {
+        return false;
+    }
+    
+    previous_image = Dmod_FileOpen(image_path, "rb");
+    if (!previous_image) {
+        DMOD_LOG_ERROR("Failed to open previous image: %s\n", image_path);
+        return false;
+    }
+    
+    // Validate the header
+    char* cursor = manifest_text;
+    char* fields[6];
+    uint64_t version = 0;
+    uint64_t options = 0;
+    uint64_t image_size = 0;
+    if (split_line(&cursor, fields, 4) != 4
+     || strcmp(fields[0], "dmffs-manifest") != 0
+     || !parse_number(fields[1], &version)
+     || !parse_number(fields[2], &options)
+     || !parse_number(fields[3], &image_size)) {
+        DMOD_LOG_ERROR("Invalid manifest: %s\n", manifest_path);
+        return false;
+    }
+    
+    if (version != MANIFEST_VERSION || options != manifest_options() || image_size != Dmod_FileSize(previous_image)) {
+        DMOD_LOG_WARN("Manifest %s does not match the previous image - rebuilding all files\n", manifest_path);
+        return true;
+    }
+    
+    // Load the file entries
+    int count;
+    size_t line = 1;
+    while ((count = split_line(&cursor, fields, 6)) >= 0) {
+        line++;
+        if (count == 0) {
+            continue;
+        }
+        
+        manifest_entry_t entry = {0};
+        uint64_t mtime = 0;
+        if (count != 6
+         || !parse_hex_number(fields[0], &entry.hash)
+         || !parse_number(fields[1], &entry.size)
+         || !parse_number(fields[2], &mtime)
+         || !parse_number(fields[3], &entry.entry_offset)
+         || !parse_number(fields[4], &entry.entry_size)
+         || entry.entry_offset > image_size
+         || entry.entry_size > image_size - entry.entry_offset) {
+            DMOD_LOG_ERROR("Invalid manifest entry at line %u: %s\n", (unsigned int)line, manifest_path);
+            return false;
+        }
+        entry.mtime = (uint32_t)mtime;
+        entry.path = fields[5];
+        
+        manifest_entry_t* new_entry = Dmod_Malloc(sizeof(manifest_entry_t));
+        if (!new_entry) {
+            DMOD_LOG_ERROR("Failed to allocate the manifest\n");
+            return false;
+        }
+        
+        size_t bucket = path_bucket(entry.path);
+        *new_entry = entry;
+        new_entry->next = manifest_buckets[bucket];
+        manifest_buckets[bucket] = new_entry;
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Find the manifest entry of an input file
+ * 
+ * @param node File node
+ * @return Manifest entry, or NULL if the file is not in the manifest
+ */
+static const manifest_entry_t* find_manifest_entry(const node_t* node)
+{
+    for (manifest_entry_t* entry = manifest_buckets[path_bucket(node->rel_path)]; entry; entry = entry->next) {
+        if (strcmp(entry->path, node->rel_path) == 0) {
+            return entry;
+        }
+    }
+    
+    return NULL;
+}
+
+/**
+ * @brief Check that a manifest entry points to a file of the previous image
+ * 
+ * For the split layout the entry is the file content, otherwise it is
+ * the whole FILE TLV.
+ * 
+ * @param entry Manifest entry
+ * @return true if the entry can be copied, false otherwise
+ */
+static bool check_previous_entry(const manifest_entry_t* entry)
+{
+    uint8_t header[DMFFS_TLV_LARGE_HEADER_SIZE];
+    
+    if (split_layout) {
+        return entry->entry_size == entry->size;
+    }
+    
+    // Name references point into the string table of the previous image
+    if (string_table) {
+        return false;
+    }
+    
+    if (entry->entry_size < DMFFS_TLV_HEADER_SIZE
+     || !seek_file(previous_image, entry->entry_offset)
+     || Dmod_FileRead(header, 1, DMFFS_TLV_HEADER_SIZE, previous_image) != DMFFS_TLV_HEADER_SIZE) {
+        return false;
+    }
+    
+    uint32_t type;
+    uint32_t length;
+    memcpy(&type, header, sizeof(uint32_t));
+    memcpy(&length, header + sizeof(uint32_t), sizeof(uint32_t));
+    
+    return type == DMFFS_TLV_TYPE_FILE
+        && length != DMFFS_TLV_LENGTH_LARGE
+        && (uint64_t)DMFFS_TLV_HEADER_SIZE + length == entry->entry_size;
+}
+
+/**
+ * @brief Release the manifest of the previous image and the list of changed inputs
+ */
+static void free_manifest(void)
+{
+    for (size_t i = 0; i < PATH_BUCKETS; i++) {
+        while (manifest_buckets[i]) {
+            manifest_entry_t* next = manifest_buckets[i]->next;
+            Dmod_Free(manifest_buckets[i]);
+            manifest_buckets[i] = next;
+        }
+        while (changed_buckets[i]) {
+            path_set_entry_t* next = changed_buckets[i]->next;
+            Dmod_Free(changed_buckets[i]);
+            changed_buckets[i] = next;
+        }
+    }
+    
+    if (previous_image) {
+        Dmod_FileClose(previous_image);
+        previous_image = NULL;
+    }
+    Dmod_Free(manifest_text);
+    Dmod_Free(changed_text);
+    manifest_text = NULL;
+    changed_text = NULL;
+}
+
+/**
+ * @brief Write the manifest of the generated image
+ * 
+ * @param image_path Path of the generated image
+ * @param image_size Size of the generated image
+ * @return true on success, false on error
+ */
+static bool write_manifest(const char* image_path, uint64_t image_size)
+{
+    char manifest_path[MAX_PATH_LEN];
+    if (!build_manifest_path(manifest_path, sizeof(manifest_path), image_path)) {
+        return false;
+    }
+    
+    void* file = Dmod_FileOpen(manifest_path, "wb");
+    if (!file) {
+        DMOD_LOG_ERROR("Failed to open manifest file: %s\n", manifest_path);
+        return false;
+    }
+    
+    // hash + 4 numbers with separators + path + newline
+    char line[16 + 1 + 4 * 21 + MAX_PATH_LEN + 2];
+    char* ptr = line;
+    
+    strcpy(ptr, "dmffs-manifest ");
+    ptr = append_decimal(ptr + strlen(ptr), MANIFEST_VERSION);
+    *ptr++ = ' ';
+    ptr = append_decimal(ptr, manifest_options());
+    *ptr++ = ' ';
+    ptr = append_decimal(ptr, image_size);
+    *ptr++ = '\n';
+    bool success = Dmod_FileWrite(line, 1, (size_t)(ptr - line), file) == (size_t)(ptr - line);
+    
+    for (size_t i = 0; success && i < file_count; i++) {
+        const node_t* node = file_list[i];
+        
+        ptr = append_hex64(line, node->hash);
+        *ptr++ = ' ';
+        ptr = append_decimal(ptr, node->size);
+        *ptr++ = ' ';
+        ptr = append_decimal(ptr, node->mtime);
+        *ptr++ = ' ';
+        ptr = append_decimal(ptr, node->entry_offset);
+        *ptr++ = ' ';
+        ptr = append_decimal(ptr, node->entry_size);
+        *ptr++ = ' ';
+        strcpy(ptr, node->rel_path);
+        ptr += strlen(ptr);
+        *ptr++ = '\n';
+        
+        success = Dmod_FileWrite(line, 1, (size_t)(ptr - line), file) == (size_t)(ptr - line);
+    }
+    
+    Dmod_FileClose(file);
+    
+    if (!success) {
+        DMOD_LOG_ERROR("Failed to write manifest file: %s\n", manifest_path);
+    }
+    
+    return success;
+}
+
+/**
+ * @brief Load an access trace recorded by the dmffs runtime
+ * 
+ * The trace contains one event per line, "open <path>" or "read <path>",
+ * in the order of the accesses. Files are ranked by their first event.
+ * 
+ * @param path Path of the trace
+ * @return true on success, false on error
+ */
+static bool load_trace(const char* path)
+{
+    trace_text = read_text_file(path);
+    if (!trace_text) {
+        return false;
+    }
+    
+    char* cursor = trace_text;
+    char* fields[2];
+    int count;
+    while ((count = split_line(&cursor, fields, 2)) >= 0) {
+        if (count != 2 || (strcmp(fields[0], "open") != 0 && strcmp(fields[0], "read") != 0)) {
+            continue;
+        }
+        
+        // Trace paths are absolute within the image
+        const char* entry_path = fields[1];
+        while (*entry_path == '/') entry_path++;
+        
+        size_t bucket = path_bucket(entry_path);
+        bool known = false;
+        for (trace_entry_t* entry = trace_buckets[bucket]; entry && !known; entry = entry->next) {
+            known = strcmp(entry->path, entry_path) == 0;
+        }
+        if (known) {
+            continue;
+        }
+        
+        trace_entry_t* entry = Dmod_Malloc(sizeof(trace_entry_t));
+        if (!entry) {
+            DMOD_LOG_ERROR("Failed to allocate the access trace\n");
+            return false;
+        }
+        entry->path = entry_path;
+        entry->rank = trace_count++;
+        entry->next = trace_buckets[bucket];
+        trace_buckets[bucket] = entry;
+    }
+    
+    DMOD_LOG_INFO("Loaded access trace with %u files\n", (unsigned int)trace_count);
+    return true;
+}
+
+/**
+ * @brief Release the access trace
+ */
+static void free_trace(void)
+{
+    for (size_t i = 0; i < PATH_BUCKETS; i++) {
+        while (trace_buckets[i]) {
+            trace_entry_t* next = trace_buckets[i]->next;
+            Dmod_Free(trace_buckets[i]);
+            trace_buckets[i] = next;
+        }
+    }
+    
+    Dmod_Free(trace_text);
+    trace_text = NULL;
+    trace_count = 0;
+}
+
+/**
+ * @brief Assign trace ranks to a subtree and move traced entries to the front
+ * 
+ * Traced children are placed first, in order of their first access, the
+ * others keep their scan order. A directory is ranked by its earliest
+ * accessed descendant, so the entries accessed first end up next to each
+ * other in the metadata.
+ * 
+ * @param node Directory node
+ * @return true on success, false on allocation failure
+ */
+static bool rank_directory(node_t* node)
+{
+    size_t traced = 0;
+    node->rank = SIZE_MAX;
+    
+    for (node_t* child = node->children; child; child = child->next) {
+        child->rank = SIZE_MAX;
+        if (child->is_dir) {
+            if (!rank_directory(child)) {
+                return false;
+            }
+        } else {
+            for (trace_entry_t* entry = trace_buckets[path_bucket(child->rel_path)]; entry; entry = entry->next) {
+                if (strcmp(entry->path, child->rel_path) == 0) {
+                    child->rank = entry->rank;
+                    break;
+                }
+            }
+        }
+        
+        if (child->rank != SIZE_MAX) {
+            traced++;
+        }
+        if (child->rank < node->rank) {
+            node->rank = child->rank;
+        }
+    }
+    
+    if (traced == 0) {
+        return true;
+    }
+    
+    node_t** ranked = Dmod_Malloc(traced * sizeof(node_t*));
+    if (!ranked) {
+        DMOD_LOG_ERROR("Failed to allocate placement list for: %s\n", node->path);
+        return false;
+    }
+    
+    // Detach the traced children and sort them by rank
+    size_t count = 0;
+    node_t** link = &node->children;
+    while (*link) {
+        node_t* child = *link;
+        if (child->rank == SIZE_MAX) {
+            link = &child->next;
+            continue;
+        }
+        *link = child->next;
+        
+        size_t i = count++;
+        while (i > 0 && ranked[i - 1]->rank > child->rank) {
+            ranked[i] = ranked[i - 1];
+            i--;
+        }
+        ranked[i] = child;
+    }
+    
+    // Relink: traced children first, then the rest in scan order
+    node_t* head = node->children;
+    for (size_t i = count; i > 0; i--) {
+        ranked[i - 1]->next = head;
+        head = ranked[i - 1];
+    }
+    node->children = head;
+    
+    Dmod_Free(ranked);
+    return true;
+}
+
+/**
+ * @brief Collect the files of a subtree in tree order
+ * 
+ * @param node Directory node
+ * @return true on success, false on allocation failure
+ */
+static bool collect_files(node_t* node)
+{
+    for (node_t* child = node->children; child; child = child->next) {
+        bool success = child->is_whiteout || (child->is_dir ? collect_files(child) : add_to_file_list(child));
+        if (!success) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Apply the access trace to the placement of the entries
+ * 
+ * Reorders the tree (see rank_directory) and the file list. For the split
+ * layout, the contents of the traced files are placed at the start of the
+ * data region, exactly in access order.
+ * 
+ * @param root Root directory node
+ * @return true on success, false on allocation failure
+ */
+static bool apply_trace(node_t* root)
+{
+    if (!rank_directory(root)) {
+        return false;
+    }
+    
+    file_count = 0;
+    if (!collect_files(root)) {
+        return false;
+    }
+    
+    if (!split_layout) {
+        return true;
+    }
+    
+    // Stable partition of the file list: traced files in rank order first
+    node_t** ordered = Dmod_Malloc((file_count + trace_count) * sizeof(node_t*));
+    if (!ordered) {
+        DMOD_LOG_ERROR("Failed to allocate the file list\n");
+        return false;
+    }
+    memset(ordered, 0, trace_count * sizeof(node_t*));
+    
+    size_t rest = trace_count;
+    for (size_t i = 0; i < file_count; i++) {
+        node_t* node = file_list[i];
+        if (node->rank < trace_count) {
+            ordered[node->rank] = node;
+        } else {
+            ordered[rest++] = node;
+        }
+    }
+    
+    size_t count = 0;
+    for (size_t i = 0; i < rest; i++) {
+        if (ordered[i]) {
+            file_list[count++] = ordered[i];
+        }
+    }
+    
+    Dmod_Free(ordered);
+    return true;
+}
+
+/**
+ * @brief Count the entries of a directory recursively
+ * 
+ * @param node Directory node
+ * @return Number of files and directories below the node
+ */
+static size_t count_entries(const node_t* node)
+{
+    size_t count = 0;
+    
+    for (const node_t* child = node->children; child; child = child->next) {
+        count += 1 + (child->is_dir ? count_entries(child) : 0);
+    }
+    
+    return count;
+}
+
+/**
+ * @brief Add the paths of a directory's entries to the path filter
+ * 
+ * Paths are hashed incrementally as "<parent>/<name>" (see dmffs_bloom_t).
+ * 
+ * @param node Directory node
+ * @param parent_hash Hash of the directory path
+ * @param is_root true for the root directory (its path is empty)
+ */
+static void add_bloom_paths(const node_t* node, uint64_t parent_hash, bool is_root)
+{
+    for (const node_t* child = node->children; child; child = child->next) {
+        uint64_t hash = is_root ? parent_hash : hash_update(parent_hash, "/", 1);
+        hash = hash_update(hash, child->name, strlen(child->name));
+        
+        uint32_t h1 = (uint32_t)hash;
+        uint32_t h2 = (uint32_t)(hash >> 32);
+        for (uint32_t i = 0; i < bloom.hash_count; i++) {
+            uint32_t bit = (uint32_t)(((uint64_t)h1 + (uint64_t)i * h2) % bloom.bit_count);
+            bloom_filter[bit / 8] |= (uint8_t)(1u << (bit % 8));
+        }
+        
+        if (child->is_dir) {
+            add_bloom_paths(child, hash, false);
+        }
+    }
+}
+
+/**
+ * @brief Build the path filter of the input tree
+ * 
+ * The number of hashes is chosen optimal for the bits per entry (bits * ln 2).
+ * 
+ * @param root Root directory node
+ * @return true on success, false on error
+ */
+static bool build_bloom_filter(node_t* root)
+{
+    uint64_t bit_count = (uint64_t)count_entries(root) * bloom_bits_per_entry;
+    
+    // Round up to whole bytes, with a minimum of 64 bits
+    bit_count = (bit_count < 64) ? 64 : (bit_count + 7) / 8 * 8;
+    if (bit_count > 0xFFFFFFF8u) {
+        DMOD_LOG_ERROR("Too many entries for the path filter\n");
+        return false;
+    }
+    
+    bloom.bit_count = (uint32_t)bit_count;
+    bloom.hash_count = (bloom_bits_per_entry * 693u + 500u) / 1000u;
+    if (bloom.hash_count < 1) {
+        bloom.hash_count = 1;
+    } else if (bloom.hash_count > DMFFS_BLOOM_MAX_HASHES) {
+        bloom.hash_count = DMFFS_BLOOM_MAX_HASHES;
+    }
+    
+    bloom_filter = Dmod_Malloc(bloom.bit_count / 8);
+    if (!bloom_filter) {
+        DMOD_LOG_ERROR("Failed to allocate the path filter\n");
+        return false;
+    }
+    memset(bloom_filter, 0, bloom.bit_count / 8);
+    
+    add_bloom_paths(root, HASH_INIT, true);
+    DMOD_LOG_INFO("Path filter: %u bits, %u hashes\n", (unsigned int)bloom.bit_count, (unsigned int)bloom.hash_count);
+    return true;
+}
+
+/**
+ * @brief Get the size of the BLOOM TLV including its header
+ * 
+ * @return Size in bytes (0 if the image has no path filter)
+ */
+static uint64_t bloom_tlv_size(void)
+{
+    return bloom_filter ? DMFFS_TLV_HEADER_SIZE + sizeof(bloom) + bloom.bit_count / 8 : 0;
+}
+
+/**
+ * @brief Write the BLOOM TLV (if the path filter is enabled)
+ * 
+ * @return true on success, false on error
+ */
+static bool write_bloom_tlv(void)
+{
+    if (!bloom_filter) {
+        return true;
+    }
+    
+    if (!write_tlv_header(DMFFS_TLV_TYPE_BLOOM, sizeof(bloom) + bloom.bit_count / 8, false) ||
+        !write_output(&bloom, sizeof(bloom)) ||
+        !write_output(bloom_filter, bloom.bit_count / 8)) {
+        DMOD_LOG_ERROR("Failed to write BLOOM TLV\n");
+        return false;
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Restore the heap order below a slot
+ * 
+ * @param slots Heap of slots
+ * @param root Slot to sift down
+ * @param count Number of slots in the heap
+ */
+static void sift_slot(sort_slot_t* slots, size_t root, size_t count)
+{
+    while (2 * root + 1 < count) {
+        size_t child = 2 * root + 1;
+        if (child + 1 < count && slots[child + 1].key > slots[child].key) {
+            child++;
+        }
+        if (slots[root].key >= slots[child].key) {
+            return;
+        }
+        
+        sort_slot_t slot = slots[root];
+        slots[root] = slots[child];
+        slots[child] = slot;
+        root = child;
+    }
+}
+
+/**
+ * @brief Sort slots by key (heap sort, no extra memory)
+ * 
+ * @param slots Slots to sort
+ * @param count Number of slots
+ */
+static void sort_slots(sort_slot_t* slots, size_t count)
+{
+    for (size_t i = count / 2; i > 0; i--) {
+        sift_slot(slots, i - 1, count);
+    }
+    for (size_t end = count; end > 1; end--) {
+        sort_slot_t slot = slots[0];
+        slots[0] = slots[end - 1];
+        slots[end - 1] = slot;
+        sift_slot(slots, 0, end - 1);
+    }
+}
+
+/**
+ * @brief Add the paths of a directory's entries to the path index
+ * 
+ * Paths are hashed like the path filter keys (see add_bloom_paths()).
+ * 
+ * @param node Directory node
+ * @param parent_hash Hash of the directory path
+ * @param is_root true for the root directory (its path is empty)
+ */
+static void add_index_paths(const node_t* node, uint64_t parent_hash, bool is_root)
+{
+    for (const node_t* child = node->children; child; child = child->next) {
+        uint64_t hash = is_root ? parent_hash : hash_update(parent_hash, "/", 1);
+        hash = hash_update(hash, child->name, strlen(child->name));
+        
+        index_slots[index_header.entry_count].key = hash;
+        index_slots[index_header.entry_count].item = child;
+        index_header.entry_count++;
+        
+        if (child->is_dir) {
+            add_index_paths(child, hash, false);
+        }
+    }
+}
+
+/**
+ * @brief Build the path index of the input tree
+ * 
+ * The paths are sorted by hash and checked for
+ * collisions, so every lookup of an existing path ends at its own entry.
+ * 
+ * @param root Root directory node
+ * @return true on success, false on error
+ */
+static bool build_lookup_index(node_t* root)
+{
+    size_t count = count_entries(root);
+    if (count == 0 || count > UINT32_MAX / sizeof(dmffs_index_entry_t)) {
+        DMOD_LOG_ERROR("Unsupported number of entries for the path index: %lu\n", (unsigned long)count);
+        return false;
+    }
+    
+    index_slots = Dmod_Malloc(count * sizeof(sort_slot_t));
+    if (!index_slots) {
+        DMOD_LOG_ERROR("Failed to allocate the path index\n");
+        return false;
+    }
+    
+    index_header.entry_count = 0;
+    add_index_paths(root, HASH_INIT, true);
+    sort_slots(index_slots, count);
+    
+    for (size_t i = 1; i < count; i++) {
+        if (index_slots[i].key == index_slots[i - 1].key) {
+            DMOD_LOG_ERROR("Path hash collision between %s and %s - rename one of them\n",
+                           ((const node_t*)index_slots[i - 1].item)->rel_path, ((const node_t*)index_slots[i].item)->rel_path);
+            return false;
+        }
+    }
+    
+    // A binary search over n entries reads at most floor(log2(n)) + 1 of them
+    index_header.max_probes = 0;
+    for (size_t remaining = count; remaining > 0; remaining /= 2) {
+        index_header.max_probes++;
+    }
+    
+    DMOD_LOG_INFO("Path index: %u entries, at most %u probes (%u bytes) per lookup\n",
+                  (unsigned int)index_header.entry_count, (unsigned int)index_header.max_probes,
+                  (unsigned int)(index_header.max_probes * sizeof(dmffs_index_entry_t)));
+    return true;
+}
+
+/**
+ * @brief Get the size of the INDEX TLV including its header
+ * 
+ * @return Size in bytes (0 if the image has no path index)
+ */
+static uint64_t index_tlv_size(void)
+{
+    return index_slots ? DMFFS_TLV_HEADER_SIZE + sizeof(index_header) + (uint64_t)index_header.entry_count * sizeof(dmffs_index_entry_t) : 0;
+}
+
+/**
+ * @brief Write the INDEX TLV with a placeholder table (if the path index is enabled)
+ * 
+ * The table is filled by patch_index_tlv() once all entries are written.
+ * 
+ * @return true on success, false on error
+ */
+static bool write_index_tlv(void)
+{
+    if (!index_slots) {
+        return true;
+    }
+    
+    uint64_t table_size = (uint64_t)index_header.entry_count * sizeof(dmffs_index_entry_t);
+    if (!write_tlv_header(DMFFS_TLV_TYPE_INDEX, sizeof(index_header) + table_size, false) ||
+        !write_output(&index_header, sizeof(index_header))) {
+        DMOD_LOG_ERROR("Failed to write INDEX TLV\n");
+        return false;
+    }
+    
+    index_table_offset = output_offset;
+    return write_zeros(table_size);
+}
+
+/**
+ * @brief Fill the table of the INDEX TLV with the offsets of the written entries
+ * 
+ * @return true on success, false on error
+ */
+static bool patch_index_tlv(void)
+{
+    if (!index_slots) {
+        return true;
+    }
+    
+    size_t table_size = index_header.entry_count * sizeof(dmffs_index_entry_t);
+    dmffs_index_entry_t* table = Dmod_Malloc(table_size);
+    if (!table) {
+        DMOD_LOG_ERROR("Failed to allocate the path index table\n");
+        return false;
+    }
+    
+    for (uint32_t i = 0; i < index_header.entry_count; i++) {
+        table[i].hash = index_slots[i].key;
+        table[i].offset = ((const node_t*)index_slots[i].item)->tlv_offset;
+    }
+    
+    bool success = flush_output() &&
+                   seek_file(output_file, index_table_offset) &&
+                   Dmod_FileWrite(table, 1, table_size, output_file) == table_size &&
+                   seek_file(output_file, output_offset);
+    if (!success) {
+        DMOD_LOG_ERROR("Failed to write the path index table\n");
+    }
+    
+    Dmod_Free(table);
+    return success;
+}
+
+/**
+ * @brief Collect the nodes of all entries below a directory
+ * 
+ * @param node Directory node
+ * @param nodes Array to store the nodes
+ * @param count Number of stored nodes (updated)
+ */
+static void add_name_nodes(node_t* node, node_t** nodes, size_t* count)
+{
+    for (node_t* child = node->children; child; child = child->next) {
+        nodes[(*count)++] = child;
+        if (child->is_dir) {
+            add_name_nodes(child, nodes, count);
+        }
+    }
+}
+
+/**
+ * @brief Restore the heap order of nodes sorted by name below a node
+ * 
+ * @param nodes Heap of nodes
+ * @param root Node to sift down
+ * @param count Number of nodes in the heap
+ */
+static void sift_name(node_t** nodes, size_t root, size_t count)
+{
+    while (2 * root + 1 < count) {
+        size_t child = 2 * root + 1;
+        if (child + 1 < count && strcmp(nodes[child + 1]->name, nodes[child]->name) > 0) {
+            child++;
+        }
+        if (strcmp(nodes[root]->name, nodes[child]->name) >= 0) {
+            return;
+        }
+        
+        node_t* node = nodes[root];
+        nodes[root] = nodes[child];
+        nodes[child] = node;
+        root = child;
+    }
+}
+
+/**
+ * @brief Sort nodes by name (heap sort, no extra memory)
+ * 
+ * @param nodes Nodes to sort
+ * @param count Number of nodes
+ */
+static void sort_names(node_t** nodes, size_t count)
+{
+    for (size_t i = count / 2; i > 0; i--) {
+        sift_name(nodes, i - 1, count);
+    }
+    for (size_t end = count; end > 1; end--) {
+        node_t* node = nodes[0];
+        nodes[0] = nodes[end - 1];
+        nodes[end - 1] = node;
+        sift_name(nodes, 0, end - 1);
+    }
+}
+
+/**
+ * @brief Build the string table of the input tree
+ * 
+ * The names are sorted, so equal names share one table entry and
+ * neighbouring names share their prefixes. A block is closed after
+ * DMFFS_STRINGS_BLOCK_NAMES names or once it reaches
+ * DMFFS_STRINGS_BLOCK_SIZE bytes, which bounds the reads of a lookup.
+ * 
+ * @param root Root directory node
+ * @return true on success, false on error
+ */
+static bool build_string_table(node_t* root)
+{
+    node_t** nodes = Dmod_Malloc((count_entries(root) + 1) * sizeof(node_t*));
+    if (!nodes) {
+        DMOD_LOG_ERROR("Failed to allocate the string table\n");
+        return false;
+    }
+    
+    size_t count = 0;
+    add_name_nodes(root, nodes, &count);
+    sort_names(nodes, count);
+    
+    // Worst case without shared prefixes
+    uint64_t capacity = 1;
+    uint64_t plain_size = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t name_len = strlen(nodes[i]->name);
+        if (name_len > MAX_TABLE_NAME_LEN) {
+            DMOD_LOG_ERROR("Name too long for the string table: %s\n", nodes[i]->path);
+            Dmod_Free(nodes);
+            return false;
+        }
+        capacity += 2 + name_len;
+        plain_size += DMFFS_TLV_HEADER_SIZE + name_len;
+    }
+    
+    strings_data = Dmod_Malloc((size_t)capacity);
+    if (!strings_data) {
+        DMOD_LOG_ERROR("Failed to allocate the string table\n");
+        Dmod_Free(nodes);
+        return false;
+    }
+    
+    uint32_t size = 0;
+    uint32_t block_offset = 0;
+    uint32_t block_names = DMFFS_STRINGS_BLOCK_NAMES;
+    const char* previous = NULL;
+    strings_header.name_count = 0;
+    
+    for (size_t i = 0; i < count; i++) {
+        const char* name = nodes[i]->name;
+        if (previous && strcmp(name, previous) == 0) {
+            nodes[i]->name_ref = nodes[i - 1]->name_ref;
+            continue;
+        }
+        
+        size_t name_len = strlen(name);
+        size_t shared = 0;
+        if (block_names == DMFFS_STRINGS_BLOCK_NAMES || size - block_offset >= DMFFS_STRINGS_BLOCK_SIZE) {
+            block_offset = size;
+            block_names = 0;
+        } else {
+            while (shared < name_len && name[shared] == previous[shared]) {
+                shared++;
+            }
+        }
+        
+        if (block_offset > DMFFS_NAME_REF_MAX_BLOCK) {
+            DMOD_LOG_ERROR("Too many names for the string table\n");
+            Dmod_Free(nodes);
+            return false;
+        }
+        
+        strings_data[size++] = (uint8_t)shared;
+        strings_data[size++] = (uint8_t)(name_len - shared);
+        memcpy(strings_data + size, name + shared, name_len - shared);
+        size += (uint32_t)(name_len - shared);
+        
+        nodes[i]->name_ref = DMFFS_NAME_REF(block_offset, block_names, name_len);
+        block_names++;
+        strings_header.name_count++;
+        previous = name;
+    }
+    
+    strings_header.data_size = size;
+    Dmod_Free(nodes);
+    
+    DMOD_LOG_INFO("String table: %u names, %u bytes (%lu bytes of NAME TLVs)\n",
+                  (unsigned int)strings_header.name_count, (unsigned int)size, (unsigned long)plain_size);
+    return true;
+}
+
+/**
+ * @brief Get the size of the STRINGS TLV including its header
+ * 
+ * @return Size in bytes (0 if the image has no string table)
+ */
+static uint64_t strings_tlv_size(void)
+{
+    return strings_data ? DMFFS_TLV_HEADER_SIZE + sizeof(strings_header) + strings_header.data_size : 0;
+}
+
+/**
+ * @brief Write the STRINGS TLV (if the string table is enabled)
+ * 
+ * @return true on success, false on error
+ */
+static bool write_strings_tlv(void)
+{
+    if (!strings_data) {
+        return true;
+    }
+    
+    if (!write_tlv_header(DMFFS_TLV_TYPE_STRINGS, sizeof(strings_header) + strings_header.data_size, false) ||
+        !write_output(&strings_header, sizeof(strings_header)) ||
+        !write_output(strings_data, strings_header.data_size)) {
+        DMOD_LOG_ERROR("Failed to write STRINGS TLV\n");
+        return false;
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Get the size of the NAME (or NAME_REF) TLV of an entry including its header
+ * 
+ * @param node Entry node
+ * @return Size in bytes
+ */
+static uint64_t name_tlv_size(const node_t* node)
+{
+    return DMFFS_TLV_HEADER_SIZE + (strings_data ? sizeof(node->name_ref) : strlen(node->name));
+}
+
+/**
+ * @brief Write the NAME TLV of an entry, or its NAME_REF with a string table
+ * 
+ * @param node Entry node
+ * @return true on success, false on error
+ */
+static bool write_name_tlv(const node_t* node)
+{
+    if (strings_data) {
+        return write_tlv(DMFFS_TLV_TYPE_NAME_REF, &node->name_ref, sizeof(node->name_ref));
+    }
+    
+    return write_tlv(DMFFS_TLV_TYPE_NAME, node->name, (uint32_t)strlen(node->name));
+}
+
+/**
+ * @brief Release the content of an ingested file
+ * 
+ * @param job Ingested file
+ */
+static void free_job_data(ingest_job_t* job)
+{
+    // The content of an archive entry belongs to the tree
+    if (job->data && !job->node->in_archive) {
+        Dmod_Free(job->data);
+    }
+    job->data = NULL;
+}
+
+/**
+ * @brief Release the resources of an ingest job
+ * 
+ * @param job Job to release
+ */
+static void release_job(ingest_job_t* job)
+{
+    if (job->file) {
+        Dmod_FileClose(job->file);
+    }
+    free_job_data(job);
+    memset(job, 0, sizeof(ingest_job_t));
+}
+
+/**
+ * @brief Hash a streamed input file and rewind it for the writer
+ * 
+ * @param job Job of a streamed file
+ * @return true on success, false on error
+ */
+static bool hash_input_file(ingest_job_t* job)
+{
+    uint8_t buffer[4096];
+    uint64_t hash = HASH_INIT;
+    uint64_t total_read = 0;
+    
+    while (total_read < job->size) {
+        size_t to_read = sizeof(buffer);
+        if (to_read > job->size - total_read) {
+            to_read = (size_t)(job->size - total_read);
+        }
+        
+        size_t read = Dmod_FileRead(buffer, 1, to_read, job->file);
+        if (read == 0) {
+            DMOD_LOG_ERROR("Failed to read from file: %s\n", job->node->path);
+            return false;
+        }
+        
+        hash = hash_update(hash, buffer, read);
+        total_read += read;
+    }
+    
+    if (Dmod_FileSeek(job->file, 0, SEEK_SET) != 0) {
+        DMOD_LOG_ERROR("Failed to rewind file: %s\n", job->node->path);
+        return false;
+    }
+    
+    job->node->hash = hash;
+    return true;
+}
+
+/**
+ * @brief Switch an ingested file to its entry of the previous image if the content is unchanged
+ * 
+ * @param job Ingested file
+ * @param entry Manifest entry of the file (may be NULL)
+ * @return true (a file that cannot be reused is simply written again)
+ */
+static bool reuse_unchanged(ingest_job_t* job, const manifest_entry_t* entry)
+{
+    if (!entry || entry->size != job->size || entry->hash != job->node->hash || entry->mtime != job->node->mtime
+     || !check_previous_entry(entry)) {
+        return true;
+    }
+    
+    if (job->file) {
+        Dmod_FileClose(job->file);
+        job->file = NULL;
+    }
+    free_job_data(job);
+    job->reuse = entry;
+    return true;
+}
+
+/**
+ * @brief Ingest an input file
+ * 
+ * Small files are read into memory in one go, larger ones are kept open
+ * and streamed by the writer. This is also the place for per-file
+ * transformations that do not depend on the image layout.
+ * 
+ * In incremental mode, files whose content matches the manifest of the
+ * previous image are marked for reuse of their old FILE TLV.
+ * 
+ * @param job Job to fill
+ * @param node File node
+ * @return true on success, false on error
+ */
+static bool ingest_file(ingest_job_t* job, node_t* node)
+{
+    memset(job, 0, sizeof(ingest_job_t));
+    job->node = node;
+    
+    // The content of an archive entry is already in memory
+    if (node->in_archive) {
+        job->size = node->size;
+        job->data = node->content;
+        node->hash = hash_update(HASH_INIT, job->data, (size_t)job->size);
+        return reuse_unchanged(job, previous_image ? find_manifest_entry(node) : NULL);
+    }
+    
+    void* input_file = Dmod_FileOpen(node->path, "rb");
+    if (!input_file) {
+        DMOD_LOG_ERROR("Failed to open file: %s\n", node->path);
+        return false;
+    }
+    
+    job->size = Dmod_FileSize(input_file);
+    node->size = job->size;
+    
+    // Files not reported as changed are reused without reading them
+    const manifest_entry_t* entry = previous_image ? find_manifest_entry(node) : NULL;
+    if (entry && entry->size == job->size && entry->mtime == node->mtime && changed_list_loaded && !is_changed(node)) {
+        if (check_previous_entry(entry)) {
+            Dmod_FileClose(input_file);
+            node->hash = entry->hash;
+            job->reuse = entry;
+            return true;
+        }
+    }
+    
+    if (job->size > INGEST_MAX_FILE_SIZE) {
+        job->file = input_file;
+        return hash_input_file(job) && reuse_unchanged(job, entry);
+    }
+    
+    if (job->size > 0) {
+        job->data = Dmod_Malloc((size_t)job->size);
+        if (!job->data) {
+            DMOD_LOG_ERROR("Failed to allocate %u bytes for file: %s\n", (unsigned int)job->size, node->path);
+            Dmod_FileClose(input_file);
+            return false;
+        }
+        
+        size_t total_read = 0;
+        while (total_read < job->size) {
+            size_t read = Dmod_FileRead(job->data + total_read, 1, (size_t)job->size - total_read, input_file);
+            if (read == 0) {
+                DMOD_LOG_ERROR("Failed to read from file: %s\n", node->path);
+                Dmod_FileClose(input_file);
+                return false;
+            }
+            total_read += read;
+        }
+    }
+    
+    Dmod_FileClose(input_file);
+    node->hash = hash_update(HASH_INIT, job->data, (size_t)job->size);
+    return reuse_unchanged(job, entry);
+}
+
+/**
+ * @brief Get the ingested job of the next file to write
+ * 
+ * Fills the read-ahead window up to read_ahead files ahead of the writer.
+ * The files are read by the writer itself, one after the other.
+ * 
+ * @param node File node the writer is about to emit
+ * @return Job of the file, or NULL on error
+ */
+static ingest_job_t* take_job(node_t* node)
+{
+    while (next_ingest < file_count && next_ingest < next_emit + read_ahead) {
+        if (!ingest_file(&jobs[next_ingest % read_ahead], file_list[next_ingest])) {
+            return NULL;
+        }
+        next_ingest++;
+    }
+    
+    ingest_job_t* job = &jobs[next_emit % read_ahead];
+    if (next_emit >= next_ingest || job->node != node) {
+        DMOD_LOG_ERROR("Ingest order mismatch for file: %s\n", node->path);
+        return NULL;
+    }
+    
+    next_emit++;
+    return job;
+}
+
+/**
+ * @brief Write the content of an ingested file
+ * 
+ * @param job Ingested file
+ * @return true on success, false on error
+ */
+static bool write_job_data(ingest_job_t* job)
+{
+    if (!job->file) {
+        return write_output(job->data, (size_t)job->size);
+    }
+    
+    // Stream large files straight into the output buffer
+    uint64_t total_read = 0;
+    while (total_read < job->size) {
+        if (output_buffered == OUTPUT_BUFFER_SIZE && !flush_output()) {
+            return false;
+        }
+        
+        size_t to_read = OUTPUT_BUFFER_SIZE - output_buffered;
+        if (to_read > job->size - total_read) {
+            to_read = (size_t)(job->size - total_read);
+        }
+        
+        size_t read = Dmod_FileRead(output_buffer + output_buffered, 1, to_read, job->file);
+        if (read == 0) {
+            DMOD_LOG_ERROR("Failed to read from file: %s\n", job->node->path);
+            return false;
+        }
+        
+        output_buffered += read;
+        output_offset += read;
+        total_read += read;
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Copy a file entry of the previous image to the output
+ * 
+ * @param entry Manifest entry of the file
+ * @return true on success, false on error
+ */
+static bool copy_previous_entry(const manifest_entry_t* entry)
+{
+    if (!seek_file(previous_image, entry->entry_offset)) {
+        DMOD_LOG_ERROR("Failed to seek in the previous image\n");
+        return false;
+    }
+    
+    uint64_t total_read = 0;
+    while (total_read < entry->entry_size) {
+        if (output_buffered == OUTPUT_BUFFER_SIZE && !flush_output()) {
+            return false;
+        }
+        
+        size_t to_read = OUTPUT_BUFFER_SIZE - output_buffered;
+        if (to_read > entry->entry_size - total_read) {
+            to_read = (size_t)(entry->entry_size - total_read);
+        }
+        
+        size_t read = Dmod_FileRead(output_buffer + output_buffered, 1, to_read, previous_image);
+        if (read == 0) {
+            DMOD_LOG_ERROR("Failed to read from the previous image\n");
+            return false;
+        }
+        
+        output_buffered += read;
+        output_offset += read;
+        total_read += read;
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Get the size of a DATA_REF TLV including its header
+ * 
+ * @return Size in bytes
+ */
+static uint64_t data_ref_tlv_size(void)
+{
+    return DMFFS_TLV_HEADER_SIZE + (wide_data_refs ? sizeof(dmffs_data_ref64_t) : sizeof(dmffs_data_ref_t));
+}
+
+/**
+ * @brief Get the size of the DATE TLV of an entry including its header
+ * 
+ * @param node File or directory node
+ * @return Size in bytes (0 if the time is unknown)
+ */
+static uint64_t date_tlv_size(const node_t* node)
+{
+    return node->mtime ? DMFFS_TLV_HEADER_SIZE + sizeof(uint32_t) : 0;
+}
+
+/**
+ * @brief Write the DATE TLV of an entry if its time is known
+ * 
+ * @param node File or directory node
+ * @return true on success, false on error
+ */
+static bool write_date_tlv(const node_t* node)
+{
+    return !node->mtime || write_tlv(DMFFS_TLV_TYPE_DATE, &node->mtime, sizeof(uint32_t));
+}
+
+/**
+ * @brief Calculate the size of the metadata of a directory's contents (split layout)
+ * 
+ * Mirrors process_directory() and write_file_ref(), which makes it possible
+ * to reserve the metadata block before the data region is written.
+ * 
+ * @param node Directory node
+ * @return Size in bytes
+ */
+static uint64_t directory_metadata_size(const node_t* node)
+{
+    uint64_t size = 0;
+    
+    for (const node_t* child = node->children; child; child = child->next) {
+        if (child->is_whiteout) {
+            size += DMFFS_TLV_HEADER_SIZE + name_tlv_size(child);
+        } else if (child->is_dir) {
+            uint64_t header_size = large_dir_headers ? DMFFS_TLV_LARGE_HEADER_SIZE : DMFFS_TLV_HEADER_SIZE;
+            size += header_size + name_tlv_size(child) + date_tlv_size(child) + directory_metadata_size(child);
+        } else {
+            size += DMFFS_TLV_HEADER_SIZE + name_tlv_size(child) + date_tlv_size(child) + data_ref_tlv_size();
+        }
+    }
+    
+    return size;
+}
+
+/**
+ * @brief Write the content of a file to the data region (split layout)
+ * 
+ * @param node File node
+ * @param data_region_offset Offset of the data region in the image
+ * @return true on success, false on error
+ */
+static bool process_file_data(node_t* node, uint64_t data_region_offset)
+{
+    DMOD_LOG_INFO("Processing file data: %s\n", node->path);
+    
+    ingest_job_t* job = take_job(node);
+    if (!job) {
+        return false;
+    }
+    
+    node->entry_offset = output_offset;
+    node->data_offset = output_offset - data_region_offset;
+    
+    bool success;
+    if (job->reuse) {
+        DMOD_LOG_INFO("File unchanged, reusing previous entry: %s\n", node->path);
+        success = copy_previous_entry(job->reuse);
+        reused_count++;
+    } else {
+        success = write_job_data(job);
+    }
+    
+    node->entry_size = output_offset - node->entry_offset;
+    release_job(job);
+    
+    if (!success) {
+        DMOD_LOG_ERROR("Failed to write file: %s\n", node->path);
+        return false;
+    }
+    
+    if (!wide_data_refs && (node->data_offset > UINT32_MAX || node->size > UINT32_MAX)) {
+        DMOD_LOG_WARN("File %s does not fit into a compact DATA_REF\n", node->path);
+        data_ref_overflow = true;
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Write the FILE entry of a file whose content is in the data region (split layout)
+ * 
+ * @param node File node
+ * @return true on success, false on error
+ */
+static bool write_file_ref(const node_t* node)
+{
+    uint8_t ref[sizeof(dmffs_data_ref64_t)];
+    uint32_t ref_size;
+    
+    if (wide_data_refs) {
+        dmffs_data_ref64_t wide_ref = { node->data_offset, node->size };
+        memcpy(ref, &wide_ref, sizeof(wide_ref));
+        ref_size = sizeof(wide_ref);
+    } else {
+        dmffs_data_ref_t compact_ref = { (uint32_t)node->data_offset, (uint32_t)node->size };
+        memcpy(ref, &compact_ref, sizeof(compact_ref));
+        ref_size = sizeof(compact_ref);
+    }
+    
+    // NAME TLV + DATE TLV + DATA_REF TLV (header + ref_size)
+    uint64_t file_tlv_size = name_tlv_size(node) + date_tlv_size(node) + (DMFFS_TLV_HEADER_SIZE + ref_size);
+    
+    return write_tlv_header(DMFFS_TLV_TYPE_FILE, file_tlv_size, false)
+        && write_name_tlv(node)
+        && write_date_tlv(node)
+        && write_tlv(DMFFS_TLV_TYPE_DATA_REF, ref, ref_size);
+}
+
+/**
+ * @brief Check whether a file is stored gzip encoded
+ * 
+ * @param name File name
+ * @return true if the extension of the file is in the -e list
+ */
+static bool should_encode(const char* name)
+{
+    const char* extension = strrchr(name, '.');
+    if (!encode_extensions || !extension) {
+        return false;
+    }
+    
+    extension++;
+    size_t extension_len = strlen(extension);
+    for (const char* item = encode_extensions; *item; ) {
+        const char* item_end = strchr(item, ',');
+        size_t item_len = item_end ? (size_t)(item_end - item) : strlen(item);
+        if (item_len == extension_len && strncmp(item, extension, item_len) == 0) {
+            return true;
+        }
+        item += item_end ? item_len + 1 : item_len;
+    }
+    
+    return false;
+}
+
+/**
+ * @brief Update a CRC-32 (gzip trailer)
+ * 
+ * @param crc Current CRC (0 for the first block)
+ * @param data Data
+ * @param size Data size
+ * @return Updated CRC
+ */
+static uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t size)
+{
+    if (!crc_table_ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; bit++) {
+                value = (value & 1) ? (value >> 1) ^ 0xEDB88320u : value >> 1;
+            }
+            crc_table[i] = value;
+        }
+        crc_table_ready = true;
+    }
+    
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+/**
+ * @brief Append bits to the deflate stream (LSB first)
+ * 
+ * @param writer Bit writer
+ * @param value Bits to append
+ * @param count Number of bits (up to 24)
+ */
+static void put_bits(bit_writer_t* writer, uint32_t value, uint32_t count)
+{
+    writer->bits |= value << writer->bit_count;
+    writer->bit_count += count;
+    
+    while (writer->bit_count >= 8) {
+        if (writer->length < writer->capacity) {
+            writer->data[writer->length++] = (uint8_t)writer->bits;
+        } else {
+            writer->overflow = true;
+        }
+        writer->bits >>= 8;
+        writer->bit_count -= 8;
+    }
+}
+
+/**
+ * @brief Append a Huffman code to the deflate stream (codes are stored MSB first)
+ * 
+ * @param writer Bit writer
+ * @param code Huffman code
+ * @param length Code length in bits
+ */
+static void put_code(bit_writer_t* writer, uint32_t code, uint32_t length)
+{
+    uint32_t reversed = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        reversed = (reversed << 1) | ((code >> i) & 1);
+    }
+    put_bits(writer, reversed, length);
+}
+
+/**
+ * @brief Append a literal/length symbol with the fixed Huffman code
+ * 
+ * @param writer Bit writer
+ * @param symbol Symbol (0-287)
+ */
+static void put_symbol(bit_writer_t* writer, uint32_t symbol)
+{
+    if (symbol < 144) {
+        put_code(writer, 0x30 + symbol, 8);
+    } else if (symbol < 256) {
+        put_code(writer, 0x190 + symbol - 144, 9);
+    } else if (symbol < 280) {
+        put_code(writer, symbol - 256, 7);
+    } else {
+        put_code(writer, 0xC0 + symbol - 280, 8);
+    }
+}
+
+/**
+ * @brief Append a match to the deflate stream
+ * 
+ * @param writer Bit writer
+ * @param length Match length (3-258)
+ * @param distance Match distance (1-32768)
+ */
+static void put_match(bit_writer_t* writer, uint32_t length, uint32_t distance)
+{
+    uint32_t code = 28;
+    while (length_base[code] > length) {
+        code--;
+    }
+    put_symbol(writer, 257 + code);
+    put_bits(writer, length - length_base[code], length_extra[code]);
+    
+    code = 29;
+    while (distance_base[code] > distance) {
+        code--;
+    }
+    put_code(writer, code, 5);
+    put_bits(writer, distance - distance_base[code], distance_extra[code]);
+}
+
+/**
+ * @brief Get the hash chain index of the 3 bytes at a position
+ * 
+ * @param data Position in the input
+ * @return Index into deflate_head
+ */
+static uint32_t deflate_hash(const uint8_t* data)
+{
+    uint32_t value = (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16);
+    return (value * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+/**
+ * @brief Add a position to the hash chains
+ * 
+ * @param data Input data
+ * @param position Position of the next 3 bytes
+ */
+static void deflate_insert(const uint8_t* data, uint32_t position)
+{
+    uint32_t hash = deflate_hash(data + position);
+    deflate_prev[position % DEFLATE_WINDOW] = deflate_head[hash];
+    deflate_head[hash] = position;
+}
+
+/**
+ * @brief Encode a file as a gzip stream
+ * 
+ * Uses a single deflate block with the fixed Huffman codes and a hash chain
+ * match finder, which is small and still saves most of the size of text
+ * assets (HTML, CSS, JavaScript, JSON, SVG).
+ * 
+ * @param data File content
+ * @param size File size (up to INGEST_MAX_FILE_SIZE)
+ * @param encoded_size Pointer to store the size of the gzip stream
+ * @return Gzip stream (to be freed with Dmod_Free), or NULL if it is not smaller than the file
+ */
+static uint8_t* gzip_encode(const uint8_t* data, size_t size, size_t* encoded_size)
+{
+    if (size <= GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE) {
+        return NULL;
+    }
+    
+    if (!deflate_head) {
+        deflate_head = Dmod_Malloc(sizeof(uint32_t) << DEFLATE_HASH_BITS);
+        deflate_prev = Dmod_Malloc(sizeof(uint32_t) * DEFLATE_WINDOW);
+        if (!deflate_head || !deflate_prev) {
+            DMOD_LOG_ERROR("Failed to allocate the deflate match finder\n");
+            return NULL;
+        }
+    }
+    
+    bit_writer_t writer = { Dmod_Malloc(size), size - GZIP_TRAILER_SIZE, 0, 0, 0, false };
+    if (!writer.data) {
+        DMOD_LOG_ERROR("Failed to allocate %u bytes for the encoded file\n", (unsigned int)size);
+        return NULL;
+    }
+    
+    // Header: magic, deflate, no flags, no mtime, no extra flags, unknown OS
+    static const uint8_t gzip_header[GZIP_HEADER_SIZE] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 255 };
+    memcpy(writer.data, gzip_header, GZIP_HEADER_SIZE);
+    writer.length = GZIP_HEADER_SIZE;
+    
+    // Single final block with fixed Huffman codes
+    memset(deflate_head, 0xFF, sizeof(uint32_t) << DEFLATE_HASH_BITS);
+    put_bits(&writer, 1, 1);
+    put_bits(&writer, 1, 2);
+    
+    size_t position = 0;
+    while (position < size && !writer.overflow) {
+        uint32_t best_length = 0;
+        uint32_t best_distance = 0;
+        
+        if (position + DEFLATE_MIN_MATCH <= size) {
+            uint32_t max_length = (size - position < DEFLATE_MAX_MATCH) ? (uint32_t)(size - position) : DEFLATE_MAX_MATCH;
+            uint32_t candidate = deflate_head[deflate_hash(data + position)];
+            
+            for (int chain = 0; candidate != DEFLATE_NO_POSITION && chain < DEFLATE_MAX_CHAIN; chain++) {
+                if (position - candidate > DEFLATE_WINDOW) {
+                    break;
+                }
+                
+                uint32_t length = 0;
+                while (length < max_length && data[candidate + length] == data[position + length]) {
+                    length++;
+                }
+                if (length > best_length) {
+                    best_length = length;
+                    best_distance = (uint32_t)(position - candidate);
+                    if (length == max_length) {
+                        break;
+                    }
+                }
+                
+                // Stop at positions that were overwritten by newer ones
+                uint32_t next = deflate_prev[candidate % DEFLATE_WINDOW];
+                if (next != DEFLATE_NO_POSITION && next >= candidate) {
+                    break;
+                }
+                candidate = next;
+            }
+            
+            deflate_insert(data, (uint32_t)position);
+        }
+        
+        if (best_length < DEFLATE_MIN_MATCH) {
+            put_symbol(&writer, data[position]);
+            position++;
+            continue;
+        }
+        
+        put_match(&writer, best_length, best_distance);
+        for (uint32_t i = 1; i < best_length; i++) {
+            if (position + i + DEFLATE_MIN_MATCH <= size) {
+                deflate_insert(data, (uint32_t)(position + i));
+            }
+        }
+        position += best_length;
+    }
+    
+    // End of block, then flush the last byte
+    put_symbol(&writer, 256);
+    put_bits(&writer, 0, 7);
+    
+    if (writer.overflow) {
+        Dmod_Free(writer.data);
+        return NULL;
+    }
+    
+    // Trailer: CRC-32 and size of the input modulo 2^32, little endian (RFC 1952)
+    uint32_t trailer[2] = { crc32_update(0, data, size), (uint32_t)size };
+    uint8_t* out = writer.data + writer.length;
+    for (size_t i = 0; i < GZIP_TRAILER_SIZE; i++) {
+        out[i] = (uint8_t)(trailer[i / 4] >> (8 * (i % 4)));
+    }
+    *encoded_size = writer.length + GZIP_TRAILER_SIZE;
+    return writer.data;
+}
+
+/**
+ * @brief Write a file as a gzip encoded FILE entry
+ * 
+ * @param node File node
+ * @param job Ingested file (content in memory)
+ * @param encoded Gzip stream of the content
+ * @param encoded_size Size of the gzip stream
+ * @return true on success, false on error
+ */
+static bool write_encoded_file(const node_t* node, const ingest_job_t* job, const uint8_t* encoded, size_t encoded_size)
+{
+    dmffs_encoding_t encoding = { DMFFS_ENCODING_GZIP, 0, job->size };
+    
+    // NAME TLV + DATE TLV + ENCODING TLV + DATA TLV (header + encoded content)
+    uint64_t file_tlv_size = name_tlv_size(node) + date_tlv_size(node)
+                           + (DMFFS_TLV_HEADER_SIZE + sizeof(encoding))
+                           + (tlv_header_size(encoded_size) + encoded_size);
+    
+    DMOD_LOG_INFO("Encoded file: %lu -> %lu bytes\n", (unsigned long)job->size, (unsigned long)encoded_size);
+    encoded_count++;
+    
+    return write_tlv_header(DMFFS_TLV_TYPE_FILE, file_tlv_size, false)
+        && write_name_tlv(node)
+        && write_date_tlv(node)
+        && write_tlv(DMFFS_TLV_TYPE_ENCODING, &encoding, sizeof(encoding))
+        && write_tlv_header(DMFFS_TLV_TYPE_DATA, encoded_size, false)
+        && write_output(encoded, encoded_size);
+}
+
+/**
+ * @brief Find the next zero run of a file that is stored as a hole
+ * 
+ * @param data File content
+ * @param size File size
+ * @param from Offset to start searching at
+ * @param hole Pointer to store the hole
+ * @return true if a hole was found, false otherwise
+ */
+static bool find_hole(const uint8_t* data, uint64_t size, uint64_t from, dmffs_hole_t* hole)
+{
+    uint64_t run_start = from;
+    
+    for (uint64_t i = from; i < size; i++) {
+        if (data[i] != 0) {
+            run_start = i + 1;
+        } else if (i + 1 - run_start >= min_hole_size) {
+            uint64_t run_end = i + 1;
+            while (run_end < size && data[run_end] == 0) {
+                run_end++;
+            }
+            hole->offset = run_start;
+            hole->length = run_end - run_start;
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+/**
+ * @brief Write a file with zero runs as a sparse FILE entry
+ * 
+ * The content is written without its holes, which are listed in a HOLES
+ * TLV. Files without holes are written as regular FILE entries.
+ * 
+ * @param node File node
+ * @param job Ingested file (content in memory)
+ * @return true on success, false on error
+ */
+static bool write_sparse_file(const node_t* node, ingest_job_t* job)
+{
+    dmffs_hole_t hole;
+    uint64_t hole_count = 0;
+    uint64_t hole_bytes = 0;
+    
+    for (uint64_t offset = 0; find_hole(job->data, job->size, offset, &hole); offset = hole.offset + hole.length) {
+        hole_count++;
+        hole_bytes += hole.length;
+    }
+    
+    uint64_t stored_size = job->size - hole_bytes;
+    uint64_t holes_size = sizeof(dmffs_holes_t) + hole_count * sizeof(dmffs_hole_t);
+    
+    if (hole_count == 0) {
+        uint64_t file_tlv_size = name_tlv_size(node) + date_tlv_size(node) + (tlv_header_size(job->size) + job->size);
+        
+        return write_tlv_header(DMFFS_TLV_TYPE_FILE, file_tlv_size, false)
+            && write_name_tlv(node)
+            && write_date_tlv(node)
+            && write_tlv_header(DMFFS_TLV_TYPE_DATA, job->size, false)
+            && write_job_data(job);
+    }
+    
+    DMOD_LOG_INFO("Sparse file: %lu holes, %lu KiB of zeros\n", (unsigned long)hole_count, (unsigned long)(hole_bytes / 1024));
+    
+    // NAME TLV + DATE TLV + HOLES TLV (header + table) + DATA TLV (header + stored content)
+    uint64_t file_tlv_size = name_tlv_size(node) + date_tlv_size(node)
+                           + (tlv_header_size(holes_size) + holes_size)
+                           + (tlv_header_size(stored_size) + stored_size);
+    dmffs_holes_t holes = { job->size };
+    
+    if (!write_tlv_header(DMFFS_TLV_TYPE_FILE, file_tlv_size, false)
+        || !write_name_tlv(node)
+        || !write_date_tlv(node)
+        || !write_tlv_header(DMFFS_TLV_TYPE_HOLES, holes_size, false)
+        || !write_output(&holes, sizeof(holes))) {
+        return false;
+    }
+    
+    for (uint64_t offset = 0; find_hole(job->data, job->size, offset, &hole); offset = hole.offset + hole.length) {
+        if (!write_output(&hole, sizeof(hole))) {
+            return false;
+        }
+    }
+    
+    if (!write_tlv_header(DMFFS_TLV_TYPE_DATA, stored_size, false)) {
+        return false;
+    }
+    
+    // Write the content between the holes
+    uint64_t offset = 0;
+    while (offset < job->size) {
+        uint64_t end = job->size;
+        uint64_t next = end;
+        if (find_hole(job->data, job->size, offset, &hole)) {
+            end = hole.offset;
+            next = hole.offset + hole.length;
+        }
+        if (end > offset && !write_output(job->data + offset, (size_t)(end - offset))) {
+            return false;
+        }
+        offset = next;
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Write a single file to the output in TLV format
+ * 
+ * @param node File node
+ * @return true on success, false on error
+ */
+static bool process_file(node_t* node)
+{
+    DMOD_LOG_INFO("Processing file: %s (name: %s)\n", node->path, node->name);
+    
+    node->tlv_offset = output_offset;
+    
+    // The content has already been written to the data region
+    if (split_layout) {
+        return write_file_ref(node);
+    }
+    
+    ingest_job_t* job = take_job(node);
+    if (!job) {
+        return false;
+    }
+    
+    uint64_t file_size = job->size;
+    DMOD_LOG_INFO("File size: %lu KiB\n", (unsigned long)(file_size / 1024));
+    
+    node->entry_offset = output_offset;
+    
+    uint8_t* encoded = NULL;
+    size_t encoded_size = 0;
+    bool success;
+    if (job->reuse) {
+        DMOD_LOG_INFO("File unchanged, reusing previous entry: %s\n", node->path);
+        success = copy_previous_entry(job->reuse);
+        reused_count++;
+    } else if (!job->file && should_encode(node->name) && (encoded = gzip_encode(job->data, (size_t)job->size, &encoded_size))) {
+        success = write_encoded_file(node, job, encoded, encoded_size);
+        Dmod_Free(encoded);
+    } else if (min_hole_size > 0 && !job->file) {
+        success = write_sparse_file(node, job);
+    } else {
+        // Calculate the total size of FILE TLV:
+        // NAME TLV + DATE TLV + DATA TLV (header + file_size)
+        uint64_t file_tlv_size = name_tlv_size(node) + date_tlv_size(node) + (tlv_header_size(file_size) + file_size);
+        
+        success = write_tlv_header(DMFFS_TLV_TYPE_FILE, file_tlv_size, false)
+               && write_name_tlv(node)
+               && write_date_tlv(node)
+               && write_tlv_header(DMFFS_TLV_TYPE_DATA, file_size, false)
+               && write_job_data(job);
+    }
+    
+    node->entry_size = output_offset - node->entry_offset;
+    release_job(job);
+    
+    if (success) {
+        DMOD_LOG_INFO("File processed successfully: %s\n", node->name);
+    } else {
+        DMOD_LOG_ERROR("Failed to write file: %s\n", node->path);
+    }
+    
+    return success;
+}
+
+/**
+ * @brief Write a deleted entry of an overlay image
+ * 
+ * @param node Whiteout node
+ * @return true on success, false on error
+ */
+static bool process_whiteout(node_t* node)
+{
+    node->tlv_offset = output_offset;
+    return write_tlv_header(DMFFS_TLV_TYPE_WHITEOUT, name_tlv_size(node), false)
+        && write_name_tlv(node);
+}
+
+/**
+ * @brief Move the output offsets of the entries below a directory
+ * 
+ * @param node Directory node
+ * @param size Distance the entries were moved by
+ */
+static void shift_entry_offsets(node_t* node, uint64_t size)
+{
+    for (node_t* child = node->children; child; child = child->next) {
+        child->tlv_offset += size;
+        if (child->is_dir) {
+            shift_entry_offsets(child, size);
+        } else if (!child->is_whiteout) {
+            child->entry_offset += size;
+        }
+    }
+}
+
+/**
+ * @brief Write a directory recursively to the output in TLV format
+ * 
+ * The DIR header is written with a placeholder length and patched once the
+ * whole subtree has been written. A subtree of 4 GiB or more does not fit
+ * into the compact header, so it is moved back by 8 bytes to make room for
+ * the large one (inline layout; metadata-first images size their headers
+ * up front).
+ * 
+ * @param node Directory node
+ * @param write_header Whether to write DIR TLV header (false for root)
+ * @return true on success, false on error
+ */
+static bool process_directory(node_t* node, bool write_header)
+{
+    DMOD_LOG_INFO("Processing directory: %s (write_header: %d)\n", node->path, write_header);
+    
+    uint64_t header_offset = output_offset;
+    uint64_t content_offset = 0;
+    node->tlv_offset = header_offset;
+    
+    // For subdirectories, write the header with a placeholder length
+    if (write_header) {
+        if (!write_tlv_header(DMFFS_TLV_TYPE_DIR, 0, large_dir_headers)) {
+            return false;
+        }
+        content_offset = output_offset;
+        
+        // Write NAME and DATE TLVs
+        if (!write_name_tlv(node) || !write_date_tlv(node)) {
+            return false;
+        }
+    }
+    
+    // Process directory contents
+    for (node_t* child = node->children; child; child = child->next) {
+        bool success = child->is_whiteout ? process_whiteout(child)
+                     : child->is_dir ? process_directory(child, true) : process_file(child);
+        if (!success) {
+            return false;
+        }
+    }
+    
+    // Patch the DIR header with the real content size
+    if (write_header) {
+        uint64_t dir_content_size = output_offset - content_offset;
+        bool large = large_dir_headers;
+        
+        if (!large && dir_content_size >= DMFFS_TLV_LENGTH_LARGE) {
+            uint64_t gap = DMFFS_TLV_LARGE_HEADER_SIZE - DMFFS_TLV_HEADER_SIZE;
+            DMOD_LOG_WARN("Directory %s does not fit into a compact DIR header - moving its entries\n", node->path);
+            if (split_layout || !insert_output_gap(content_offset, gap)) {
+                DMOD_LOG_ERROR("Failed to widen the DIR header of %s\n", node->path);
+                return false;
+            }
+            shift_entry_offsets(node, gap);
+            large = true;
+        }
+        
+        if (!patch_tlv_header(header_offset, DMFFS_TLV_TYPE_DIR, dir_content_size, large)) {
+            return false;
+        }
+    }
+    
+    DMOD_LOG_INFO("Directory processed successfully: %s\n", node->path);
     
-    // Append entry
-    strcat(buffer, entry);
+    return true;
 }
 
 /**
- * @brief Write a TLV header to the output file
+ * @brief Write an image with file contents stored inline in the FILE entries
  * 
- * @param type TLV type
- * @param length TLV length
+ * @param root Root directory node
  * @return true on success, false on error
  */
-static bool write_tlv_header(uint32_t type, uint32_t length)
+static bool write_inline_image(node_t* root)
 {
-    if (!output_file) return false;
+    // Write VERSION TLV (optional)
+    const char* version = "1.0";
+    if (!write_tlv(DMFFS_TLV_TYPE_VERSION, version, strlen(version))) {
+        DMOD_LOG_ERROR("Failed to write VERSION TLV\n");
+        return false;
+    }
     
-    size_t written = Dmod_FileWrite(&type, sizeof(uint32_t), 1, output_file);
-    if (written != 1) {
-        DMOD_LOG_ERROR("Failed to write TLV type\n");
+    if (!write_bloom_tlv() || !write_index_tlv() || !write_strings_tlv()) {
         return false;
     }
     
-    written = Dmod_FileWrite(&length, sizeof(uint32_t), 1, output_file);
-    if (written != 1) {
-        DMOD_LOG_ERROR("Failed to write TLV length\n");
+    // Process the directory (root level - don't write DIR header)
+    if (!process_directory(root, false)) {
         return false;
     }
     
-    return true;
+    // Write END TLV
+    if (!write_tlv_header(DMFFS_TLV_TYPE_END, 0, false)) {
+        DMOD_LOG_ERROR("Failed to write END TLV\n");
+        return false;
+    }
+    
+    return patch_index_tlv();
 }
 
 /**
- * @brief Write a TLV entry with data to the output file
+ * @brief Round a size up to whole erase sectors, with growth slack
  * 
- * @param type TLV type
- * @param data Data to write
- * @param length Length of data
- * @return true on success, false on error
+ * @param size Size in bytes
+ * @return Reserved size in bytes (0 for empty files)
  */
-static bool write_tlv(uint32_t type, const void* data, uint32_t length)
+static uint64_t stable_slot_size(uint64_t size)
 {
-    if (!write_tlv_header(type, length)) {
-        return false;
+    uint64_t reserved = size + size * slack_percent / 100;
+    return (reserved + sector_size - 1) / sector_size * sector_size;
+}
+
+/**
+ * @brief Read the LAYOUT TLV of the previous image
+ * 
+ * @param layout Pointer to store the layout
+ * @return true if the previous image is a metadata-first image, false otherwise
+ */
+static bool read_previous_layout(dmffs_layout_t* layout)
+{
+    uint64_t offset = 0;
+    
+    for (int i = 0; i < 2; i++) {
+        uint32_t header[2];
+        if (!seek_file(previous_image, offset) ||
+            Dmod_FileRead(header, 1, sizeof(header), previous_image) != sizeof(header) ||
+            header[1] == DMFFS_TLV_LENGTH_LARGE) {
+            return false;
+        }
+        
+        if (header[0] == DMFFS_TLV_TYPE_LAYOUT) {
+            return header[1] >= sizeof(*layout) &&
+                   Dmod_FileRead(layout, 1, sizeof(*layout), previous_image) == sizeof(*layout);
+        }
+        offset += DMFFS_TLV_HEADER_SIZE + header[1];
     }
     
-    if (length > 0 && data) {
-        size_t written = Dmod_FileWrite(data, 1, length, output_file);
-        if (written != length) {
-            DMOD_LOG_ERROR("Failed to write TLV data (%u bytes)\n", length);
+    return false;
+}
+
+/**
+ * @brief Get the sizes of all input files (stable layout)
+ * 
+ * The placement has to be known before the first file is written, so the
+ * input files are opened once more to query their sizes.
+ * 
+ * @return true on success, false on error
+ */
+static bool read_input_sizes(void)
+{
+    for (size_t i = 0; i < file_count; i++) {
+        if (file_list[i]->in_archive) {
+            continue;
+        }
+        
+        void* file = Dmod_FileOpen(file_list[i]->path, "rb");
+        if (!file) {
+            DMOD_LOG_ERROR("Failed to open input file: %s\n", file_list[i]->path);
             return false;
         }
+        file_list[i]->size = Dmod_FileSize(file);
+        Dmod_FileClose(file);
     }
     
     return true;
 }
 
 /**
- * @brief Process a single file and write it to the output in TLV format
+ * @brief Place the file contents of a stable layout image
  * 
- * @param filepath Full path to the file
- * @param filename Just the filename (without directory path)
+ * Every content starts at an erase sector boundary and reserves slack to
+ * grow. A file that was in the previous image keeps its offset in the data
+ * region as long as it fits into its previous slot (up to the next content);
+ * other files are appended behind all previous slots. The file list is then
+ * sorted by data offset, which is the order the data region is written in.
+ * 
+ * @param metadata_size Size of the metadata block
+ * @param data_start Pointer to store the offset of the data region
+ * @param data_size Pointer to store the size of the data region
  * @return true on success, false on error
  */
-static bool process_file(const char* filepath, const char* filename)
+static bool plan_stable_layout(uint64_t metadata_size, uint64_t* data_start, uint64_t* data_size)
 {
-    DMOD_LOG_INFO("Processing file: %s (name: %s)\n", filepath, filename);
+    dmffs_layout_t previous = {0, 0};
+    bool has_previous = previous_image && read_previous_layout(&previous);
     
-    // Open the input file
-    void* input_file = Dmod_FileOpen(filepath, "rb");
-    if (!input_file) {
-        DMOD_LOG_ERROR("Failed to open file: %s\n", filepath);
-        return false;
+    // Keep the data region in place if the metadata still fits in front of it
+    *data_start = stable_slot_size(metadata_size);
+    if (has_previous && previous.data_offset >= metadata_size) {
+        *data_start = previous.data_offset;
+    } else if (has_previous) {
+        DMOD_LOG_WARN("Metadata outgrew its reserved block - the data region moves\n");
     }
     
-    // Get file size
-    size_t file_size = Dmod_FileSize(input_file);
-    DMOD_LOG_INFO("File size: %u bytes\n", (unsigned int)file_size);
-    
-    // Calculate the total size of FILE TLV:
-    // NAME TLV (8 + name_len) + DATA TLV (8 + file_size)
-    size_t name_len = strlen(filename);
-    uint32_t file_tlv_size = (8 + name_len) + (8 + file_size);
-    
-    // Write FILE TLV header
-    if (!write_tlv_header(DMFFS_TLV_TYPE_FILE, file_tlv_size)) {
-        Dmod_FileClose(input_file);
+    if (!read_input_sizes()) {
         return false;
     }
     
-    // Write NAME TLV
-    if (!write_tlv(DMFFS_TLV_TYPE_NAME, filename, name_len)) {
-        Dmod_FileClose(input_file);
+    sort_slot_t* slots = Dmod_Malloc((file_count + 1) * sizeof(sort_slot_t));
+    if (!slots) {
+        DMOD_LOG_ERROR("Failed to allocate the stable layout\n");
         return false;
     }
     
-    // Write DATA TLV header
-    if (!write_tlv_header(DMFFS_TLV_TYPE_DATA, file_size)) {
-        Dmod_FileClose(input_file);
-        return false;
+    // Slots of the previous image: from each content to the next one (empty files have none)
+    size_t slot_count = 0;
+    for (size_t i = 0; has_previous && i < file_count; i++) {
+        manifest_entry_t* entry = (manifest_entry_t*)find_manifest_entry(file_list[i]);
+        if (entry && entry->size > 0 && entry->entry_offset >= previous.data_offset &&
+            entry->entry_offset - previous.data_offset <= previous.data_size) {
+            slots[slot_count].key = entry->entry_offset - previous.data_offset;
+            slots[slot_count].item = entry;
+            slot_count++;
+        }
+    }
+    sort_slots(slots, slot_count);
+    for (size_t i = 0; i < slot_count; i++) {
+        uint64_t slot_end = (i + 1 < slot_count) ? slots[i + 1].key : previous.data_size;
+        ((manifest_entry_t*)slots[i].item)->slot_size = slot_end - slots[i].key;
     }
     
-    // Copy file data in chunks
-    uint8_t buffer[1024];
-    size_t total_read = 0;
-    while (total_read < file_size) {
-        size_t to_read = (file_size - total_read) > sizeof(buffer) ? sizeof(buffer) : (file_size - total_read);
-        size_t read = Dmod_FileRead(buffer, 1, to_read, input_file);
-        
-        if (read == 0) {
-            DMOD_LOG_ERROR("Failed to read from file: %s\n", filepath);
-            Dmod_FileClose(input_file);
-            return false;
-        }
+    // Keep the files that still fit, append the others
+    uint64_t next_free = has_previous ? (previous.data_size + sector_size - 1) / sector_size * sector_size : 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < file_count; i++) {
+        node_t* node = file_list[i];
+        const manifest_entry_t* entry = has_previous ? find_manifest_entry(node) : NULL;
         
-        size_t written = Dmod_FileWrite(buffer, 1, read, output_file);
-        if (written != read) {
-            DMOD_LOG_ERROR("Failed to write file data\n");
-            Dmod_FileClose(input_file);
-            return false;
+        if (node->size == 0) {
+            node->data_offset = 0;
+        } else if (entry && entry->slot_size > 0 && node->size <= entry->slot_size) {
+            node->data_offset = entry->entry_offset - previous.data_offset;
+            kept++;
+        } else {
+            node->data_offset = next_free;
+            next_free += stable_slot_size(node->size);
         }
-        
-        total_read += read;
     }
     
-    Dmod_FileClose(input_file);
-    DMOD_LOG_INFO("File processed successfully: %s\n", filename);
+    // Write the data region in offset order, empty files before the file at the same offset
+    for (size_t i = 0; i < file_count; i++) {
+        slots[i].key = (file_list[i]->data_offset << 1) | (file_list[i]->size > 0 ? 1u : 0u);
+        slots[i].item = file_list[i];
+    }
+    sort_slots(slots, file_count);
+    for (size_t i = 0; i < file_count; i++) {
+        file_list[i] = (node_t*)slots[i].item;
+    }
+    Dmod_Free(slots);
     
+    *data_size = next_free;
+    DMOD_LOG_INFO("Stable layout: %u of %u files kept in place, data region at %lu (%lu bytes)\n",
+                  (unsigned int)kept, (unsigned int)file_count, (unsigned long)*data_start, (unsigned long)*data_size);
     return true;
 }
 
 /**
- * @brief Forward declaration for recursive directory processing
+ * @brief Calculate the size of the metadata block of a metadata-first image
+ * 
+ * @param root Root directory node
+ * @param version Value of the VERSION TLV
+ * @return Size of VERSION, LAYOUT, BLOOM, INDEX, STRINGS, all DIR/FILE entries and END
  */
-static bool process_directory_contents(const char* dir_path, const char* base_path, bool write_header);
+static uint64_t metadata_block_size(const node_t* root, const char* version)
+{
+    return (DMFFS_TLV_HEADER_SIZE + strlen(version))
+         + (DMFFS_TLV_HEADER_SIZE + sizeof(dmffs_layout_t))
+         + bloom_tlv_size()
+         + index_tlv_size()
+         + strings_tlv_size()
+         + directory_metadata_size(root)
+         + DMFFS_TLV_HEADER_SIZE;
+}
 
 /**
- * @brief Calculate the size of a directory's TLV content (recursive)
+ * @brief Write a metadata-first image
+ * 
+ * The metadata block (VERSION, LAYOUT, BLOOM, INDEX, all DIR/FILE entries and END) is
+ * reserved first, then file contents are written to the data region in
+ * ingest order, and finally the metadata is written into the reserved
+ * block, once all content offsets are known. With the stable layout, the
+ * block and every content are aligned to erase sectors, with slack.
  * 
- * @param dir_path Full path to the directory
- * @return Total size in bytes, or 0 on error
+ * The DIR headers only cover metadata, so their form is known up front.
+ * The stable layout knows all content sizes up front as well; otherwise a
+ * data region that needs wide DATA_REFs is moved behind the grown block.
+ * 
+ * @param root Root directory node
+ * @return true on success, false on error
  */
-static uint32_t calculate_directory_size(const char* dir_path)
+static bool write_split_image(node_t* root)
 {
-    uint32_t total_size = 0;
-    char path_buffer[MAX_PATH_LEN];
+    const char* version = "1.0";
+    uint64_t start = phase_start();
+    large_dir_headers = directory_metadata_size(root) >= DMFFS_TLV_LENGTH_LARGE;
+    uint64_t metadata_end = metadata_block_size(root, version);
+    uint64_t data_start = metadata_end;
+    uint64_t data_size = 0;
     
-    void* dir = Dmod_OpenDir(dir_path);
-    if (!dir) {
-        return 0;
+    bool planned = sector_size == 0 || plan_stable_layout(metadata_end, &data_start, &data_size);
+    if (planned && sector_size > 0 && !wide_data_refs && data_size > UINT32_MAX) {
+        wide_data_refs = true;
+        metadata_end = metadata_block_size(root, version);
+        if (metadata_end > data_start) {
+            data_start = stable_slot_size(metadata_end);
+        }
+    }
+    phase_end(PHASE_SIZE, start);
+    if (!planned) {
+        return false;
     }
     
-    // Get directory name
-    const char* dir_name = strrchr(dir_path, '/');
-    if (dir_name) {
-        dir_name++; // Skip the '/'
-    } else {
-        dir_name = dir_path;
+    // Reserve the metadata block
+    if (!write_zeros(data_start)) {
+        return false;
     }
-    size_t name_len = strlen(dir_name);
     
-    // NAME TLV size
-    total_size += 8 + name_len;
+    // Write the data region
+    for (size_t i = 0; i < file_count; i++) {
+        if (sector_size > 0) {
+            uint64_t target = data_start + file_list[i]->data_offset;
+            if (output_offset > target) {
+                DMOD_LOG_ERROR("Input file changed during the build: %s\n", file_list[i]->path);
+                return false;
+            }
+            if (!write_zeros(target - output_offset)) {
+                return false;
+            }
+        }
+        if (!process_file_data(file_list[i], data_start)) {
+            return false;
+        }
+    }
     
-    // Calculate size of all entries
-    const char* entry = NULL;
-    while ((entry = Dmod_ReadDir(dir)) != NULL) {
-        // Skip . and ..
-        if (strcmp(entry, ".") == 0 || strcmp(entry, "..") == 0) {
-            continue;
+    if (sector_size > 0 && (output_offset > data_start + data_size || !write_zeros(data_start + data_size - output_offset))) {
+        DMOD_LOG_ERROR("Data region overflow\n");
+        return false;
+    }
+    
+    if (!flush_output()) {
+        return false;
+    }
+    
+    // Without the stable layout the content sizes are only known now
+    if (data_ref_overflow) {
+        if (sector_size > 0) {
+            DMOD_LOG_ERROR("Data region overflow\n");
+            return false;
         }
+        wide_data_refs = true;
+        uint64_t gap = metadata_block_size(root, version) - metadata_end;
         
-        // Build full path
-        build_path(path_buffer, sizeof(path_buffer), dir_path, entry);
-        if (path_buffer[0] == '\0') {
-            continue; // Skip if path is too long
+        DMOD_LOG_WARN("Data region needs wide DATA_REFs - moving it behind the grown metadata\n");
+        if (!insert_output_gap(data_start, gap)) {
+            return false;
         }
-        
-        // Check if it's a directory
-        void* test_dir = Dmod_OpenDir(path_buffer);
-        if (test_dir) {
-            Dmod_CloseDir(test_dir);
-            // It's a directory - calculate its size recursively
-            uint32_t subdir_size = calculate_directory_size(path_buffer);
-            if (subdir_size > 0) {
-                total_size += 8 + subdir_size; // DIR TLV header + content
-            }
-        } else {
-            // It's a file - calculate FILE TLV size
-            void* test_file = Dmod_FileOpen(path_buffer, "rb");
-            if (test_file) {
-                size_t file_size = Dmod_FileSize(test_file);
-                size_t entry_name_len = strlen(entry);
-                uint32_t file_tlv_size = (8 + entry_name_len) + (8 + file_size);
-                total_size += 8 + file_tlv_size; // FILE TLV header + content
-                Dmod_FileClose(test_file);
-            }
+        for (size_t i = 0; i < file_count; i++) {
+            file_list[i]->entry_offset += gap;
         }
+        data_start += gap;
+        metadata_end += gap;
+    }
+    uint64_t data_end = output_offset;
+    
+    // Go back and write the metadata
+    if (Dmod_FileSeek(output_file, 0, SEEK_SET) != 0) {
+        DMOD_LOG_ERROR("Failed to seek in output file\n");
+        return false;
     }
+    output_offset = 0;
     
-    Dmod_CloseDir(dir);
-    return total_size;
+    dmffs_layout_t layout = { data_start, data_end - data_start };
+    bool success = write_tlv(DMFFS_TLV_TYPE_VERSION, version, strlen(version))
+                && write_tlv(DMFFS_TLV_TYPE_LAYOUT, &layout, sizeof(layout))
+                && write_bloom_tlv()
+                && write_index_tlv()
+                && write_strings_tlv()
+                && process_directory(root, false)
+                && write_tlv_header(DMFFS_TLV_TYPE_END, 0, false)
+                && patch_index_tlv();
+    
+    if (success && output_offset != metadata_end) {
+        DMOD_LOG_ERROR("Metadata size mismatch (%lu != %lu)\n", (unsigned long)output_offset, (unsigned long)metadata_end);
+        success = false;
+    }
+    
+    success = success && flush_output();
+    output_offset = data_end;
+    return success;
 }
 
 /**
- * @brief Process a directory recursively and write it to the output in TLV format
+ * @brief Write the DMFFS image for a scanned input tree
  * 
- * @param dir_path Full path to the directory
- * @param base_path Base path to remove from full paths
- * @param write_header Whether to write DIR TLV header (false for root)
+ * @param root Root directory node
+ * @param output_path Output file path
  * @return true on success, false on error
  */
-static bool process_directory_contents(const char* dir_path, const char* base_path, bool write_header)
+static bool build_image(node_t* root, const char* output_path)
 {
-    DMOD_LOG_INFO("Processing directory: %s (write_header: %d)\n", dir_path, write_header);
-    
-    char path_buffer[MAX_PATH_LEN];
-    
-    void* dir = Dmod_OpenDir(dir_path);
-    if (!dir) {
-        DMOD_LOG_ERROR("Failed to open directory: %s\n", dir_path);
+    // Open output file
+    // Read access lets a too small header be widened in place (insert_output_gap())
+    output_file = Dmod_FileOpen(output_path, "w+b");
+    if (!output_file) {
+        DMOD_LOG_ERROR("Failed to open output file: %s\n", output_path);
         return false;
     }
+    output_offset = 0;
+    output_buffered = 0;
+    next_ingest = 0;
+    next_emit = 0;
+    reused_count = 0;
+    encoded_count = 0;
     
-    // For subdirectories, calculate size and write header
-    if (write_header) {
-        const char* dir_name = strrchr(dir_path, '/');
-        if (dir_name) {
-            dir_name++; // Skip the '/'
-        } else {
-            dir_name = dir_path;
-        }
-        size_t name_len = strlen(dir_name);
-        
-        // Calculate total directory content size
-        Dmod_CloseDir(dir);
-        uint32_t dir_content_size = calculate_directory_size(dir_path);
-        
-        if (dir_content_size == 0) {
-            DMOD_LOG_ERROR("Failed to calculate directory size: %s\n", dir_path);
-            return false;
-        }
-        
-        // Write DIR TLV header
-        if (!write_tlv_header(DMFFS_TLV_TYPE_DIR, dir_content_size)) {
-            return false;
-        }
-        
-        // Write NAME TLV
-        if (!write_tlv(DMFFS_TLV_TYPE_NAME, dir_name, name_len)) {
-            return false;
-        }
-        
-        // Reopen directory for processing
-        dir = Dmod_OpenDir(dir_path);
-        if (!dir) {
-            DMOD_LOG_ERROR("Failed to reopen directory: %s\n", dir_path);
-            return false;
-        }
+    bool success = split_layout ? write_split_image(root) : write_inline_image(root);
+    
+    if (success) {
+        success = flush_output();
     }
     
-    // Process directory contents
-    const char* entry = NULL;
-    while ((entry = Dmod_ReadDir(dir)) != NULL) {
-        // Skip . and ..
-        if (strcmp(entry, ".") == 0 || strcmp(entry, "..") == 0) {
-            continue;
-        }
-        
-        // Build full path
-        build_path(path_buffer, sizeof(path_buffer), dir_path, entry);
-        if (path_buffer[0] == '\0') {
-            continue; // Skip if path is too long
-        }
-        
-        // Check if it's a directory
-        void* test_dir = Dmod_OpenDir(path_buffer);
-        if (test_dir) {
-            Dmod_CloseDir(test_dir);
-            // It's a subdirectory - process recursively with header
-            if (!process_directory_contents(path_buffer, base_path, true)) {
-                Dmod_CloseDir(dir);
-                return false;
-            }
-        } else {
-            // It's a file
-            if (!process_file(path_buffer, entry)) {
-                Dmod_CloseDir(dir);
-                return false;
-            }
-        }
+    // Drop files that were ingested but not written (only on errors)
+    for (size_t i = 0; i < read_ahead; i++) {
+        release_job(&jobs[i]);
     }
     
-    Dmod_CloseDir(dir);
-    DMOD_LOG_INFO("Directory processed successfully: %s\n", dir_path);
+    // Close output file
+    Dmod_FileClose(output_file);
+    output_file = NULL;
     
-    return true;
+    return success;
+}
+
+/**
+ * @brief Print the times of the build phases (-T)
+ * 
+ * One line of key=value pairs on the standard output, so benchmarks can
+ * parse it (see host/tools/dmffs_build_bench.c). Times are in microseconds.
+ * 
+ * @param total Time of the whole build
+ */
+static void print_phase_times(uint64_t total)
+{
+    uint64_t input_bytes = 0;
+    for (size_t i = 0; i < file_count; i++) {
+        input_bytes += file_list[i]->size;
+    }
+    
+    Dmod_Printf("phases files=%lu input_bytes=%lu image_bytes=%lu walk_us=%lu size_us=%lu copy_us=%lu write_us=%lu total_us=%lu\n",
+                (unsigned long)file_count, (unsigned long)input_bytes, (unsigned long)output_offset,
+                (unsigned long)phase_time[PHASE_WALK], (unsigned long)phase_time[PHASE_SIZE],
+                (unsigned long)phase_time[PHASE_COPY], (unsigned long)phase_time[PHASE_WRITE], (unsigned long)total);
+}
+
+/**
+ * @brief Print usage information
+ */
+static void print_usage(void)
+{
+    DMOD_LOG_ERROR("Usage: make_dmffs [options] <input_directory|archive> <output_file>\n");
+    DMOD_LOG_ERROR("  The input may be a tar or cpio archive, \"-\" reads it from the standard input\n");
+    DMOD_LOG_ERROR("Options:\n");
+    DMOD_LOG_ERROR("  -r <files>  Read-ahead depth: number of files buffered ahead of the writer (1-%d, default %d)\n", MAX_READ_AHEAD, DEFAULT_READ_AHEAD);
+    DMOD_LOG_ERROR("  -l <layout> Image layout: inline (default) or split (metadata first, then file contents)\n");
+    DMOD_LOG_ERROR("  -p <trace>  Place the files of a runtime access trace first, in access order\n");
+    DMOD_LOG_ERROR("  -b <bits>   Add a path filter with <bits> per entry (1-%d, e.g. 10) for fast misses\n", MAX_BLOOM_BITS);
+    DMOD_LOG_ERROR("  -s <sector> Stable layout aligned to <sector> byte erase sectors, keeps the offsets of -i <image> (implies -l split -m)\n");
+    DMOD_LOG_ERROR("  -g <pct>    Growth slack of the stable layout in percent (default %d)\n", DEFAULT_SLACK_PERCENT);
+    DMOD_LOG_ERROR("  -x          Add a path index for lookups with a bounded number of reads\n");
+    DMOD_LOG_ERROR("  -n          Store all names in one front-coded string table\n");
+    DMOD_LOG_ERROR("  -e <exts>   Store files with these extensions gzip encoded, e.g. html,css,js (inline layout only)\n");
+    DMOD_LOG_ERROR("  -z <bytes>  Store zero runs of at least <bytes> (min %d) as holes (inline layout only)\n", MIN_HOLE_SIZE);
+    DMOD_LOG_ERROR("  -w <list>   File listing paths deleted by this overlay image, one per line\n");
+    DMOD_LOG_ERROR("  -m          Write a manifest to <output_file>.manifest\n");
+    DMOD_LOG_ERROR("  -i <image>  Incremental build reusing unchanged files of <image> (needs <image>.manifest)\n");
+    DMOD_LOG_ERROR("  -u <list>   File listing the changed inputs, other files are reused without reading them\n");
+    DMOD_LOG_ERROR("  -T          Print the time of each build phase in one machine-readable line (host builds)\n");
+    DMOD_LOG_ERROR("Example: make_dmffs ./flashfs ./out/flash-fs.bin\n");
 }
 
 /**
@@ -348,58 +4120,233 @@ int main(int argc, const char* argv[])
     DMOD_LOG_INFO("make_dmffs - DMFFS Binary Generator\n");
     DMOD_LOG_INFO("Version 0.1\n\n");
     
-    // Check arguments
-    // When run via dmod_loader with --args, argc doesn't include program name
-    // So we expect argc=2 (input_dir, output_file)
-    if (argc != 3) {
-        DMOD_LOG_ERROR("Usage: make_dmffs <input_directory> <output_file>\n");
-        DMOD_LOG_ERROR("Example: make_dmffs ./flashfs ./out/flash-fs.bin\n");
-        return 1;
+    const char* input_dir = NULL;
+    const char* output_path = NULL;
+    const char* previous_path = NULL;
+    const char* changed_path = NULL;
+    const char* trace_path = NULL;
+    const char* whiteout_path = NULL;
+    
+    // Parse arguments (argv[0] is the program name)
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            uint64_t depth_arg = 0;
+            if (!parse_number(argv[++i], &depth_arg) || depth_arg < 1 || depth_arg > MAX_READ_AHEAD) {
+                DMOD_LOG_ERROR("Invalid read-ahead depth: %s\n", argv[i]);
+                return 1;
+            }
+            read_ahead = (size_t)depth_arg;
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "split") == 0) {
+                split_layout = true;
+            } else if (strcmp(argv[i], "inline") == 0) {
+                split_layout = false;
+            } else {
+                DMOD_LOG_ERROR("Unknown layout: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            uint64_t bits_arg = 0;
+            if (!parse_number(argv[++i], &bits_arg) || bits_arg < 1 || bits_arg > MAX_BLOOM_BITS) {
+                DMOD_LOG_ERROR("Invalid number of path filter bits: %s\n", argv[i]);
+                return 1;
+            }
+            bloom_bits_per_entry = (uint32_t)bits_arg;
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            if (!parse_number(argv[++i], &sector_size) || sector_size < 1 || sector_size > MAX_SECTOR_SIZE) {
+                DMOD_LOG_ERROR("Invalid erase sector size: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+            if (!parse_number(argv[++i], &slack_percent) || slack_percent > 1000) {
+                DMOD_LOG_ERROR("Invalid growth slack: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-x") == 0) {
+            lookup_index = true;
+        } else if (strcmp(argv[i], "-n") == 0) {
+            string_table = true;
+        } else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+            encode_extensions = argv[++i];
+        } else if (strcmp(argv[i], "-z") == 0 && i + 1 < argc) {
+            if (!parse_number(argv[++i], &min_hole_size) || min_hole_size < MIN_HOLE_SIZE || min_hole_size > UINT32_MAX) {
+                DMOD_LOG_ERROR("Invalid minimum hole size: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-m") == 0) {
+            write_manifest_file = true;
+        } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            previous_path = argv[++i];
+            write_manifest_file = true;
+        } else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+            changed_path = argv[++i];
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            whiteout_path = argv[++i];
+        } else if (strcmp(argv[i], "-T") == 0) {
+#ifdef MAKE_DMFFS_HOST_CLOCK
+            phase_timing = true;
+#else
+            DMOD_LOG_ERROR("Option -T needs the host build of make_dmffs (see host/CMakeLists.txt)\n");
+            return 1;
+#endif
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            DMOD_LOG_ERROR("Unknown option: %s\n", argv[i]);
+            print_usage();
+            return 1;
+        } else if (!input_dir) {
+            input_dir = argv[i];
+        } else if (!output_path) {
+            output_path = argv[i];
+        } else {
+            print_usage();
+            return 1;
+        }
     }
     
-    const char* input_dir = argv[1];
-    const char* output_path = argv[2];
+    if (!input_dir || !output_path) {
+        print_usage();
+        return 1;
+    }
     
-    DMOD_LOG_INFO("Input directory: %s\n", input_dir);
-    DMOD_LOG_INFO("Output file: %s\n", output_path);
+    // The stable layout places the contents in a separate data region and
+    // needs the manifest as the reference of the next build
+    if (sector_size > 0) {
+        split_layout = true;
+        write_manifest_file = true;
+    }
     
-    // Check if input directory exists
-    void* test_dir = Dmod_OpenDir(input_dir);
-    if (!test_dir) {
-        DMOD_LOG_ERROR("Input directory does not exist or cannot be opened: %s\n", input_dir);
+    // The split layout reserves the metadata before the contents are read
+    if ((min_hole_size > 0 || encode_extensions) && split_layout) {
+        DMOD_LOG_ERROR("Options -e and -z are not supported with the split layout\n");
         return 1;
     }
-    Dmod_CloseDir(test_dir);
     
-    // Open output file
-    output_file = Dmod_FileOpen(output_path, "wb");
-    if (!output_file) {
-        DMOD_LOG_ERROR("Failed to open output file: %s\n", output_path);
+    if (changed_path && !previous_path) {
+        DMOD_LOG_ERROR("Option -u requires -i\n");
         return 1;
     }
     
-    // Write VERSION TLV (optional)
-    const char* version = "1.0";
-    if (!write_tlv(DMFFS_TLV_TYPE_VERSION, version, strlen(version))) {
-        DMOD_LOG_ERROR("Failed to write VERSION TLV\n");
-        Dmod_FileClose(output_file);
+    // The previous image is read while the new one is written
+    if (previous_path && strcmp(previous_path, output_path) == 0) {
+        DMOD_LOG_ERROR("The previous image must not be the output file: %s\n", output_path);
         return 1;
     }
     
-    // Process the directory (root level - don't write DIR header)
-    bool success = process_directory_contents(input_dir, input_dir, false);
+    DMOD_LOG_INFO("Input directory: %s\n", input_dir);
+    DMOD_LOG_INFO("Output file: %s\n", output_path);
     
-    if (success) {
-        // Write END TLV
-        if (!write_tlv_header(DMFFS_TLV_TYPE_END, 0)) {
-            DMOD_LOG_ERROR("Failed to write END TLV\n");
-            success = false;
+    uint64_t build_start = phase_start();
+    
+    // Load the previous image for incremental builds
+    if (previous_path) {
+        DMOD_LOG_INFO("Previous image: %s\n", previous_path);
+        if (!load_manifest(previous_path) || (changed_path && !load_changed_list(changed_path))) {
+            free_manifest();
+            return 1;
         }
     }
     
-    // Close output file
-    Dmod_FileClose(output_file);
-    output_file = NULL;
+    // Scan the input tree, inputs other than directories are read as archives
+    void* dir = (strcmp(input_dir, ARCHIVE_STDIN) == 0) ? NULL : Dmod_OpenDir(input_dir);
+    
+    node_t root = {0};
+    root.path = duplicate_string(input_dir);
+    root.is_dir = true;
+    input_prefix_len = strlen(input_dir);
+    if (input_prefix_len > 0 && input_dir[input_prefix_len - 1] != '/') {
+        input_prefix_len++;
+    }
+    // Archive entries come in any order, their file list is built from the tree
+    bool success = root.path && (dir ? scan_directory(dir, &root) : (load_archive(&root, input_dir) && collect_files(&root)));
+    if (dir) {
+        Dmod_CloseDir(dir);
+    }
+    
+    // Add the deleted paths of an overlay image
+    if (success && whiteout_path) {
+        success = load_whiteouts(&root, whiteout_path);
+    }
+    
+    // Place the files of the access trace first
+    if (success && trace_path) {
+        success = load_trace(trace_path) && apply_trace(&root);
+    }
+    phase_end(PHASE_WALK, build_start);
+    
+    uint64_t size_start = phase_start();
+    if (success && bloom_bits_per_entry > 0) {
+        success = build_bloom_filter(&root);
+    }
+    
+    if (success && lookup_index) {
+        success = build_lookup_index(&root);
+    }
+    
+    if (success && string_table) {
+        success = build_string_table(&root);
+    }
+    phase_end(PHASE_SIZE, size_start);
+    
+    output_buffer = Dmod_Malloc(OUTPUT_BUFFER_SIZE);
+    if (!output_buffer) {
+        DMOD_LOG_ERROR("Failed to allocate the output buffer\n");
+        success = false;
+    }
+    
+    if (success) {
+        DMOD_LOG_INFO("Found %u files\n", (unsigned int)file_count);
+        uint64_t copy_start = phase_start();
+        uint64_t timed = phase_time[PHASE_SIZE] + phase_time[PHASE_WRITE];
+        success = build_image(&root, output_path);
+        
+        // Everything the image build did not spend on sizes and writes is copying
+        phase_end(PHASE_COPY, copy_start);
+        phase_time[PHASE_COPY] -= phase_time[PHASE_SIZE] + phase_time[PHASE_WRITE] - timed;
+    }
+    
+    if (success && previous_path) {
+        DMOD_LOG_INFO("Reused %u of %u files from the previous image\n", (unsigned int)reused_count, (unsigned int)file_count);
+    }
+    
+    if (success && encode_extensions) {
+        DMOD_LOG_INFO("Encoded %u of %u files\n", (unsigned int)encoded_count, (unsigned int)file_count);
+    }
+    
+    if (success && whiteout_path) {
+        DMOD_LOG_INFO("Wrote %u deleted paths as whiteouts\n", (unsigned int)whiteout_count);
+    }
+    
+    if (success && write_manifest_file) {
+        uint64_t start = phase_start();
+        success = write_manifest(output_path, output_offset);
+        phase_end(PHASE_WRITE, start);
+    }
+    
+    if (success && phase_timing) {
+        print_phase_times(clock_us() - build_start);
+    }
+    
+    free_manifest();
+    free_trace();
+    free_tree(root.children);
+    Dmod_Free(root.path);
+    Dmod_Free(file_list);
+    Dmod_Free(output_buffer);
+    Dmod_Free(bloom_filter);
+    Dmod_Free(index_slots);
+    Dmod_Free(strings_data);
+    Dmod_Free(deflate_head);
+    Dmod_Free(deflate_prev);
+    file_list = NULL;
+    output_buffer = NULL;
+    bloom_filter = NULL;
+    index_slots = NULL;
+    strings_data = NULL;
+    deflate_head = NULL;
+    deflate_prev = NULL;
     
     if (success) {
         DMOD_LOG_INFO("\nSuccess! Created DMFFS binary: %s\n", output_path);
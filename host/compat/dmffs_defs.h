@@ -0,0 +1,6 @@
+#ifndef DMFFS_HOST_DMFFS_DEFS_H
+#define DMFFS_HOST_DMFFS_DEFS_H
+
+// Module definitions are generated by the DMOD build, none are needed on the host
+
+#endif // DMFFS_HOST_DMFFS_DEFS_H
@@ -0,0 +1,89 @@
+#ifndef DMFFS_HOST_DMFSI_H
+#define DMFFS_HOST_DMFSI_H
+
+/**
+ * @file dmfsi.h
+ * @brief Host implementation of the DMFSI interface definitions
+ *
+ * The DIF declaration macro defines plain functions, so the interface of the
+ * file system is available as dmfsi_dmffs_<name>() without the DMOD registry.
+ */
+
+#include "dmod.h"
+
+typedef struct dmfsi_context* dmfsi_context_t;
+
+#define DMFSI_OK                0
+#define DMFSI_ERR_GENERAL       (-1)
+#define DMFSI_ERR_INVALID       (-2)
+#define DMFSI_ERR_NOT_FOUND     (-3)
+#define DMFSI_ERR_NO_SPACE      (-4)
+
+#define DMFSI_O_RDONLY          0x0000
+#define DMFSI_O_WRONLY          0x0001
+#define DMFSI_O_RDWR            0x0002
+#define DMFSI_O_CREAT           0x0100
+#define DMFSI_O_TRUNC           0x0200
+
+#define DMFSI_ATTR_READONLY     0x01
+#define DMFSI_ATTR_DIRECTORY    0x10
+
+#define DMFSI_SEEK_SET          0
+#define DMFSI_SEEK_CUR          1
+#define DMFSI_SEEK_END          2
+
+/**
+ * @brief Directory entry
+ */
+typedef struct {
+    char name[256];         //!< entry name
+    uint32_t size;          //!< file size (0 for directories)
+    uint32_t attr;          //!< DMFSI_ATTR_* flags
+    uint32_t time;          //!< modification time
+} dmfsi_dir_entry_t;
+
+/**
+ * @brief File information
+ */
+typedef struct {
+    uint32_t size;          //!< file size (0 for directories)
+    uint32_t attr;          //!< DMFSI_ATTR_* flags
+    uint32_t ctime;         //!< creation time
+    uint32_t mtime;         //!< modification time
+    uint32_t atime;         //!< access time
+} dmfsi_stat_t;
+
+#define dmod_dmfsi_dif_api_declaration(version, module, ret, name, args)    ret dmfsi_##module##name args
+
+/**
+ * @brief DMFSI interface of the dmffs module (implemented in src/dmffs.c)
+ */
+dmfsi_context_t dmfsi_dmffs_init(const char* config);
+int dmfsi_dmffs_context_is_valid(dmfsi_context_t ctx);
+int dmfsi_dmffs_deinit(dmfsi_context_t ctx);
+int dmfsi_dmffs_fopen(dmfsi_context_t ctx, void** fp, const char* path, int mode, int attr);
+int dmfsi_dmffs_fclose(dmfsi_context_t ctx, void* fp);
+int dmfsi_dmffs_fread(dmfsi_context_t ctx, void* fp, void* buffer, size_t size, size_t* read);
+int dmfsi_dmffs_fwrite(dmfsi_context_t ctx, void* fp, const void* buffer, size_t size, size_t* written);
+long dmfsi_dmffs_lseek(dmfsi_context_t ctx, void* fp, long offset, int whence);
+int dmfsi_dmffs_ioctl(dmfsi_context_t ctx, void* fp, int request, void* arg);
+int dmfsi_dmffs_sync(dmfsi_context_t ctx, void* fp);
+int dmfsi_dmffs_getc(dmfsi_context_t ctx, void* fp);
+int dmfsi_dmffs_putc(dmfsi_context_t ctx, void* fp, int c);
+long dmfsi_dmffs_tell(dmfsi_context_t ctx, void* fp);
+int dmfsi_dmffs_eof(dmfsi_context_t ctx, void* fp);
+long dmfsi_dmffs_size(dmfsi_context_t ctx, void* fp);
+int dmfsi_dmffs_fflush(dmfsi_context_t ctx, void* fp);
+int dmfsi_dmffs_error(dmfsi_context_t ctx, void* fp);
+int dmfsi_dmffs_opendir(dmfsi_context_t ctx, void** dp, const char* path);
+int dmfsi_dmffs_readdir(dmfsi_context_t ctx, void* dp, dmfsi_dir_entry_t* entry);
+int dmfsi_dmffs_closedir(dmfsi_context_t ctx, void* dp);
+int dmfsi_dmffs_mkdir(dmfsi_context_t ctx, const char* path, int mode);
+int dmfsi_dmffs_direxists(dmfsi_context_t ctx, const char* path);
+int dmfsi_dmffs_stat(dmfsi_context_t ctx, const char* path, dmfsi_stat_t* stat);
+int dmfsi_dmffs_unlink(dmfsi_context_t ctx, const char* path);
+int dmfsi_dmffs_rename(dmfsi_context_t ctx, const char* oldpath, const char* newpath);
+int dmfsi_dmffs_chmod(dmfsi_context_t ctx, const char* path, int mode);
+int dmfsi_dmffs_utime(dmfsi_context_t ctx, const char* path, uint32_t atime, uint32_t mtime);
+
+#endif // DMFFS_HOST_DMFSI_H
@@ -0,0 +1,111 @@
+#ifndef DMFFS_HOST_DMOD_H
+#define DMFFS_HOST_DMOD_H
+
+/**
+ * @file dmod.h
+ * @brief Host implementation of the DMOD API subset used by the dmffs sources
+ *
+ * This header replaces the DMOD SDK when src/dmffs.c is compiled as a plain
+ * host library. Memory reads are direct copies from the process address
+ * space, allocations and files go to the C library, directories to the
+ * POSIX dirent API and logs to stderr.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+/**
+ * @brief Module configuration (unused on the host)
+ */
+typedef struct {
+    int reserved;
+} Dmod_Config_t;
+
+#define DMOD_LOG_ERROR(...)     fprintf(stderr, "[ERROR] " __VA_ARGS__)
+#define DMOD_LOG_WARN(...)      fprintf(stderr, "[WARN] " __VA_ARGS__)
+#ifdef DMFFS_HOST_VERBOSE
+#define DMOD_LOG_INFO(...)      fprintf(stderr, "[INFO] " __VA_ARGS__)
+#else
+#define DMOD_LOG_INFO(...)      ((void)0)
+#endif
+
+#define Dmod_Printf             printf
+#define Dmod_IsFunctionConnected(function)  (1)
+
+static inline void* Dmod_Malloc(size_t size)
+{
+    return malloc(size);
+}
+
+static inline void Dmod_Free(void* ptr)
+{
+    free(ptr);
+}
+
+static inline const char* Dmod_GetEnv(const char* name)
+{
+    return getenv(name);
+}
+
+static inline size_t Dmod_ReadMemory(uintptr_t address, void* buffer, size_t size)
+{
+    memcpy(buffer, (const void*)address, size);
+    return size;
+}
+
+static inline void* Dmod_FileOpen(const char* path, const char* mode)
+{
+    return fopen(path, mode);
+}
+
+static inline size_t Dmod_FileRead(void* buffer, size_t size, size_t count, void* file)
+{
+    return fread(buffer, size, count, (FILE*)file);
+}
+
+static inline size_t Dmod_FileWrite(const void* buffer, size_t size, size_t count, void* file)
+{
+    return fwrite(buffer, size, count, (FILE*)file);
+}
+
+static inline int Dmod_FileSeek(void* file, long offset, int origin)
+{
+    return fseek((FILE*)file, offset, origin);
+}
+
+static inline size_t Dmod_FileSize(void* file)
+{
+    long position = ftell((FILE*)file);
+    fseek((FILE*)file, 0, SEEK_END);
+    long size = ftell((FILE*)file);
+    fseek((FILE*)file, position, SEEK_SET);
+    return size < 0 ? 0 : (size_t)size;
+}
+
+static inline void Dmod_FileClose(void* file)
+{
+    fclose((FILE*)file);
+}
+
+static inline void* Dmod_OpenDir(const char* path)
+{
+    return opendir(path);
+}
+
+static inline const char* Dmod_ReadDir(void* dir)
+{
+    struct dirent* entry = readdir((DIR*)dir);
+    return entry ? entry->d_name : NULL;
+}
+
+static inline void Dmod_CloseDir(void* dir)
+{
+    closedir((DIR*)dir);
+}
+
+#endif // DMFFS_HOST_DMOD_H
@@ -0,0 +1,110 @@
+#ifndef DMFFS_HOST_H
+#define DMFFS_HOST_H
+
+/**
+ * @file dmffs_host.h
+ * @brief Host reader library for DMFFS images
+ *
+ * The library maps a DMFFS image file into memory and runs the dmffs file
+ * system on top of it, so host tools, fuzzers and benchmarks can read images
+ * without the DMOD loader. The DMFSI functions of the file system
+ * (dmfsi_dmffs_*) can also be called directly with dmffs_host_context().
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "dmfsi.h"
+#include "dmffs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Mounted host image
+ */
+typedef struct dmffs_host dmffs_host_t;
+
+/**
+ * @brief Map an image file and mount it
+ *
+ * @param image_path Path of the image file
+ * @param config (optional) Additional dmffs configuration, e.g. "trace=256"
+ * @return Mounted image on success, NULL on failure
+ */
+dmffs_host_t* dmffs_host_open(const char* image_path, const char* config);
+
+/**
+ * @brief Mount an image that is already in memory
+ *
+ * The memory must stay valid until dmffs_host_close() is called.
+ *
+ * @param image Image data
+ * @param size Image size in bytes
+ * @param config (optional) Additional dmffs configuration
+ * @return Mounted image on success, NULL on failure
+ */
+dmffs_host_t* dmffs_host_open_memory(const void* image, size_t size, const char* config);
+
+/**
+ * @brief Unmount an image and release its mapping
+ *
+ * @param host Mounted image
+ */
+void dmffs_host_close(dmffs_host_t* host);
+
+/**
+ * @brief Get the file system context of a mounted image
+ *
+ * @param host Mounted image
+ * @return Context for the dmfsi_dmffs_* functions
+ */
+dmfsi_context_t dmffs_host_context(dmffs_host_t* host);
+
+/**
+ * @brief Get the image data
+ *
+ * @param host Mounted image
+ * @param size (optional) Pointer to store the image size
+ * @return Pointer to the first byte of the image
+ */
+const void* dmffs_host_image(dmffs_host_t* host, size_t* size);
+
+/**
+ * @brief File and directory operations
+ *
+ * Read-only wrappers of the corresponding dmfsi_dmffs_* functions.
+ */
+int dmffs_host_fopen(dmffs_host_t* host, void** fp, const char* path);
+int dmffs_host_fread(dmffs_host_t* host, void* fp, void* buffer, size_t size, size_t* read);
+int dmffs_host_fclose(dmffs_host_t* host, void* fp);
+int dmffs_host_opendir(dmffs_host_t* host, void** dp, const char* path);
+int dmffs_host_readdir(dmffs_host_t* host, void* dp, dmfsi_dir_entry_t* entry);
+int dmffs_host_closedir(dmffs_host_t* host, void* dp);
+int dmffs_host_stat(dmffs_host_t* host, const char* path, dmfsi_stat_t* stat);
+
+/**
+ * @brief Visit the next entry of a tree walk (see dmffs_ioctl_walk_t)
+ *
+ * @param host Mounted image
+ * @param walk Walk state, zeroed before the first call
+ * @return DMFSI_OK with the next entry, DMFSI_ERR_NOT_FOUND at the end
+ */
+int dmffs_host_walk(dmffs_host_t* host, dmffs_ioctl_walk_t* walk);
+
+/**
+ * @brief Get the content of an open file without copying it
+ *
+ * @param host Mounted image
+ * @param fp File handle
+ * @param data Pointer to store the address of the content in the image
+ * @param size Pointer to store the size of the content
+ * @return DMFSI_OK on success, error code otherwise
+ */
+int dmffs_host_fmap(dmffs_host_t* host, void* fp, const void** data, uint64_t* size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DMFFS_HOST_H
@@ -0,0 +1,192 @@
+#include "dmffs_host.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Maximum length of the configuration string
+#define MAX_CONFIG_LEN 512
+
+/**
+ * @brief Mounted host image
+ */
+struct dmffs_host
+{
+    const void* image;          //!< image data
+    size_t size;                //!< image size in bytes
+    bool mapped;                //!< true if the image was mapped by dmffs_host_open()
+    dmfsi_context_t ctx;        //!< file system context
+};
+
+/**
+ * @brief Mount an image in memory
+ *
+ * @param image Image data
+ * @param size Image size in bytes
+ * @param config (optional) Additional dmffs configuration
+ * @param mapped true if the image has to be unmapped at close
+ * @return Mounted image on success, NULL on failure
+ */
+static dmffs_host_t* mount_image(const void* image, size_t size, const char* config, bool mapped)
+{
+    char full_config[MAX_CONFIG_LEN];
+    int length = snprintf(full_config, sizeof(full_config), "backend=mmap;flash_addr=0x%llx;flash_size=0x%llx%s%s",
+                          (unsigned long long)(uintptr_t)image, (unsigned long long)size,
+                          (config && *config) ? ";" : "", (config && *config) ? config : "");
+    if (length < 0 || (size_t)length >= sizeof(full_config)) {
+        DMOD_LOG_ERROR("Configuration string too long: '%s'\n", config);
+        return NULL;
+    }
+
+    dmffs_host_t* host = malloc(sizeof(dmffs_host_t));
+    if (!host) {
+        DMOD_LOG_ERROR("Failed to allocate host image\n");
+        return NULL;
+    }
+
+    host->image = image;
+    host->size = size;
+    host->mapped = mapped;
+    host->ctx = dmfsi_dmffs_init(full_config);
+    if (!host->ctx) {
+        free(host);
+        return NULL;
+    }
+
+    return host;
+}
+
+dmffs_host_t* dmffs_host_open(const char* image_path, const char* config)
+{
+    if (!image_path) {
+        return NULL;
+    }
+
+    int fd = open(image_path, O_RDONLY);
+    if (fd < 0) {
+        DMOD_LOG_ERROR("Failed to open image: %s\n", image_path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        DMOD_LOG_ERROR("Failed to get size of image: %s\n", image_path);
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void* image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        DMOD_LOG_ERROR("Failed to map image: %s\n", image_path);
+        return NULL;
+    }
+
+    dmffs_host_t* host = mount_image(image, size, config, true);
+    if (!host) {
+        munmap(image, size);
+    }
+
+    return host;
+}
+
+dmffs_host_t* dmffs_host_open_memory(const void* image, size_t size, const char* config)
+{
+    if (!image || size == 0) {
+        return NULL;
+    }
+
+    return mount_image(image, size, config, false);
+}
+
+void dmffs_host_close(dmffs_host_t* host)
+{
+    if (!host) {
+        return;
+    }
+
+    dmfsi_dmffs_deinit(host->ctx);
+    if (host->mapped) {
+        munmap((void*)host->image, host->size);
+    }
+    free(host);
+}
+
+dmfsi_context_t dmffs_host_context(dmffs_host_t* host)
+{
+    return host ? host->ctx : NULL;
+}
+
+const void* dmffs_host_image(dmffs_host_t* host, size_t* size)
+{
+    if (!host) {
+        return NULL;
+    }
+
+    if (size) {
+        *size = host->size;
+    }
+    return host->image;
+}
+
+int dmffs_host_fopen(dmffs_host_t* host, void** fp, const char* path)
+{
+    return host ? dmfsi_dmffs_fopen(host->ctx, fp, path, DMFSI_O_RDONLY, 0) : DMFSI_ERR_INVALID;
+}
+
+int dmffs_host_fread(dmffs_host_t* host, void* fp, void* buffer, size_t size, size_t* read)
+{
+    return host ? dmfsi_dmffs_fread(host->ctx, fp, buffer, size, read) : DMFSI_ERR_INVALID;
+}
+
+int dmffs_host_fclose(dmffs_host_t* host, void* fp)
+{
+    return host ? dmfsi_dmffs_fclose(host->ctx, fp) : DMFSI_ERR_INVALID;
+}
+
+int dmffs_host_opendir(dmffs_host_t* host, void** dp, const char* path)
+{
+    return host ? dmfsi_dmffs_opendir(host->ctx, dp, path) : DMFSI_ERR_INVALID;
+}
+
+int dmffs_host_readdir(dmffs_host_t* host, void* dp, dmfsi_dir_entry_t* entry)
+{
+    return host ? dmfsi_dmffs_readdir(host->ctx, dp, entry) : DMFSI_ERR_INVALID;
+}
+
+int dmffs_host_closedir(dmffs_host_t* host, void* dp)
+{
+    return host ? dmfsi_dmffs_closedir(host->ctx, dp) : DMFSI_ERR_INVALID;
+}
+
+int dmffs_host_stat(dmffs_host_t* host, const char* path, dmfsi_stat_t* stat)
+{
+    return host ? dmfsi_dmffs_stat(host->ctx, path, stat) : DMFSI_ERR_INVALID;
+}
+
+int dmffs_host_walk(dmffs_host_t* host, dmffs_ioctl_walk_t* walk)
+{
+    return host ? dmfsi_dmffs_ioctl(host->ctx, NULL, DMFFS_IOCTL_WALK, walk) : DMFSI_ERR_INVALID;
+}
+
+int dmffs_host_fmap(dmffs_host_t* host, void* fp, const void** data, uint64_t* size)
+{
+    dmffs_ioctl_map_t map;
+
+    if (!host || !fp || !data || !size) {
+        return DMFSI_ERR_INVALID;
+    }
+
+    int result = dmfsi_dmffs_ioctl(host->ctx, fp, DMFFS_IOCTL_MAP, &map);
+    if (result != DMFSI_OK) {
+        return result;
+    }
+
+    *data = map.data;
+    *size = map.size;
+    return DMFSI_OK;
+}
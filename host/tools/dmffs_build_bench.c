@@ -0,0 +1,554 @@
+/**
+ * @file dmffs_build_bench.c
+ * @brief Build throughput benchmark of make_dmffs
+ *
+ * Generates an input tree with a configurable number of files, directory
+ * depth, fanout and file size distribution, builds it with the host build
+ * of make_dmffs and reports the throughput as one JSON object per line:
+ * one line per run and a final summary line with the fastest run. The run
+ * lines include the phase times make_dmffs prints with -T. Every image is
+ * mounted afterwards to check that it holds all generated files.
+ *
+ * Usage: dmffs_build_bench [options]
+ */
+#include "dmffs_host.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Default benchmark parameters
+#define DEFAULT_FILES           1000
+#define DEFAULT_DEPTH           3
+#define DEFAULT_FANOUT          4
+#define DEFAULT_MIN_SIZE        1024
+#define DEFAULT_MAX_SIZE        65536
+#define DEFAULT_RUNS            3
+#define DEFAULT_SEED            1
+
+// Maximum length of a generated path or of the make_dmffs command line
+#define MAX_PATH_LEN            512
+#define MAX_COMMAND_LEN         2048
+
+// Bytes per MB of the reported throughput
+#define BYTES_PER_MB            1000000.0
+
+#ifndef MAKE_DMFFS_PATH
+#define MAKE_DMFFS_PATH         "make_dmffs"
+#endif
+
+/**
+ * @brief Distribution of the generated file sizes
+ */
+typedef enum {
+    SIZES_FIXED,                //!< every file has the minimum size
+    SIZES_UNIFORM,              //!< uniform between the minimum and the maximum
+    SIZES_LOG,                  //!< log-uniform: many small files, few large ones
+} size_distribution_t;
+
+/**
+ * @brief Benchmark parameters
+ */
+typedef struct {
+    uint32_t files;                     //!< number of generated files
+    uint32_t depth;                     //!< deepest directory level
+    uint32_t fanout;                    //!< subdirectories per directory
+    uint64_t min_size;                  //!< smallest file size
+    uint64_t max_size;                  //!< largest file size
+    size_distribution_t distribution;   //!< file size distribution
+    uint32_t runs;                      //!< number of timed builds
+    uint64_t seed;                      //!< seed of the generated contents
+    const char* make_dmffs;             //!< path of the host make_dmffs
+    const char* options;                //!< additional make_dmffs options
+    const char* work_dir;               //!< directory of the tree and the image
+    bool keep;                          //!< keep the tree and the image
+} bench_config_t;
+
+/**
+ * @brief Phase times printed by make_dmffs -T (microseconds)
+ */
+typedef struct {
+    unsigned long files;        //!< number of files in the image
+    unsigned long input_bytes;  //!< bytes of all input files
+    unsigned long image_bytes;  //!< size of the image
+    unsigned long walk;         //!< input walk
+    unsigned long size;         //!< size calculation
+    unsigned long copy;         //!< data copy
+    unsigned long write;        //!< output writes
+    unsigned long total;        //!< whole build
+} phase_times_t;
+
+/**
+ * @brief Next value of a xorshift64 generator
+ *
+ * @param state Generator state (not 0)
+ * @return Pseudo random value
+ */
+static uint64_t next_random(uint64_t* state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+/**
+ * @brief Read the monotonic clock
+ *
+ * @return Time in seconds
+ */
+static double now_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Number of directories of the generated tree
+ *
+ * The directories form a complete tree with the configured fanout and
+ * depth, numbered in breadth-first order (0 is the root). There are never
+ * more directories than files.
+ *
+ * @param config Benchmark parameters
+ * @return Number of directories including the root
+ */
+static uint32_t directory_count(const bench_config_t* config)
+{
+    uint64_t count = 1;
+    uint64_t level = 1;
+
+    for (uint32_t i = 0; i < config->depth && count < config->files; i++) {
+        level *= config->fanout;
+        count += level;
+    }
+
+    return (uint32_t)(count < config->files ? count : config->files);
+}
+
+/**
+ * @brief Build the path of a generated directory
+ *
+ * @param config Benchmark parameters
+ * @param dir Directory number (breadth-first)
+ * @param buffer Output buffer
+ * @param size Size of the output buffer
+ * @return true on success, false if the path is too long
+ */
+static bool directory_path(const bench_config_t* config, uint32_t dir, char* buffer, size_t size)
+{
+    char components[MAX_PATH_LEN];
+
+    // Prepend the components from the leaf up
+    components[0] = '\0';
+    while (dir > 0) {
+        char component[MAX_PATH_LEN];
+        int written = snprintf(component, sizeof(component), "/d%u%s", (unsigned int)((dir - 1) % config->fanout), components);
+        if (written < 0 || (size_t)written >= sizeof(components)) {
+            return false;
+        }
+        memcpy(components, component, (size_t)written + 1);
+        dir = (dir - 1) / config->fanout;
+    }
+
+    int written = snprintf(buffer, size, "%s/tree%s", config->work_dir, components);
+    return written >= 0 && (size_t)written < size;
+}
+
+/**
+ * @brief Build the path of a generated file
+ *
+ * Files are spread over all directories in turn.
+ *
+ * @param config Benchmark parameters
+ * @param file File number
+ * @param buffer Output buffer
+ * @param size Size of the output buffer
+ * @return true on success, false if the path is too long
+ */
+static bool file_path(const bench_config_t* config, uint32_t file, char* buffer, size_t size)
+{
+    char dir[MAX_PATH_LEN];
+    if (!directory_path(config, file % directory_count(config), dir, sizeof(dir))) {
+        return false;
+    }
+
+    int written = snprintf(buffer, size, "%s/f%u.bin", dir, (unsigned int)file);
+    return written >= 0 && (size_t)written < size;
+}
+
+/**
+ * @brief Pick the size of a generated file
+ *
+ * @param config Benchmark parameters
+ * @param state Generator state
+ * @return File size in bytes
+ */
+static uint64_t pick_size(const bench_config_t* config, uint64_t* state)
+{
+    uint64_t range = config->max_size - config->min_size;
+
+    if (config->distribution == SIZES_FIXED || range == 0) {
+        return config->min_size;
+    }
+    if (config->distribution == SIZES_UNIFORM) {
+        return config->min_size + next_random(state) % (range + 1);
+    }
+
+    // Log-uniform: pick a power of two between the limits, then a size within it
+    uint32_t low = 0;
+    uint32_t high = 0;
+    while (low < 63 && (2ull << low) <= config->min_size) {
+        low++;
+    }
+    while (high < 63 && (2ull << high) <= config->max_size) {
+        high++;
+    }
+    uint32_t bits = low + (uint32_t)(next_random(state) % (high - low + 1));
+    uint64_t size = (1ull << bits) + next_random(state) % (1ull << bits);
+    if (size < config->min_size) {
+        size = config->min_size;
+    }
+    return size > config->max_size ? config->max_size : size;
+}
+
+/**
+ * @brief Generate the input tree
+ *
+ * @param config Benchmark parameters
+ * @param total_bytes Pointer to store the bytes of all files
+ * @return true on success, false on error
+ */
+static bool generate_tree(const bench_config_t* config, uint64_t* total_bytes)
+{
+    uint32_t dirs = directory_count(config);
+    char path[MAX_PATH_LEN];
+    uint64_t state = config->seed ? config->seed : DEFAULT_SEED;
+
+    for (uint32_t i = 0; i < dirs; i++) {
+        if (!directory_path(config, i, path, sizeof(path)) || (mkdir(path, 0755) != 0 && errno != EEXIST)) {
+            fprintf(stderr, "Failed to create directory: %s\n", path);
+            return false;
+        }
+    }
+
+    uint8_t* buffer = malloc(config->max_size > 0 ? (size_t)config->max_size : 1);
+    if (!buffer) {
+        fprintf(stderr, "Failed to allocate %llu bytes\n", (unsigned long long)config->max_size);
+        return false;
+    }
+
+    *total_bytes = 0;
+    for (uint32_t i = 0; i < config->files; i++) {
+        if (!file_path(config, i, path, sizeof(path))) {
+            fprintf(stderr, "Path too long for file %u\n", (unsigned int)i);
+            free(buffer);
+            return false;
+        }
+
+        // Random contents, so nothing can be shared or compressed
+        uint64_t size = pick_size(config, &state);
+        for (uint64_t j = 0; j < size; j += sizeof(uint64_t)) {
+            uint64_t value = next_random(&state);
+            memcpy(buffer + j, &value, size - j < sizeof(value) ? (size_t)(size - j) : sizeof(value));
+        }
+
+        FILE* file = fopen(path, "wb");
+        bool success = file && fwrite(buffer, 1, (size_t)size, file) == size;
+        if (file && fclose(file) != 0) {
+            success = false;
+        }
+        if (!success) {
+            fprintf(stderr, "Failed to write file: %s\n", path);
+            free(buffer);
+            return false;
+        }
+        *total_bytes += size;
+    }
+
+    free(buffer);
+    return true;
+}
+
+/**
+ * @brief Remove the generated tree and the image
+ *
+ * @param config Benchmark parameters
+ */
+static void remove_tree(const bench_config_t* config)
+{
+    uint32_t dirs = directory_count(config);
+    char path[MAX_PATH_LEN];
+
+    for (uint32_t i = 0; i < config->files; i++) {
+        if (file_path(config, i, path, sizeof(path))) {
+            remove(path);
+        }
+    }
+
+    // Children are numbered after their parents
+    for (uint32_t i = dirs; i > 0; i--) {
+        if (directory_path(config, i - 1, path, sizeof(path))) {
+            rmdir(path);
+        }
+    }
+
+    snprintf(path, sizeof(path), "%s/image.ffs", config->work_dir);
+    remove(path);
+    snprintf(path, sizeof(path), "%s/image.ffs.manifest", config->work_dir);
+    remove(path);
+}
+
+/**
+ * @brief Run make_dmffs once and read its phase times
+ *
+ * @param config Benchmark parameters
+ * @param times Pointer to store the phase times
+ * @param elapsed Pointer to store the end-to-end time in seconds
+ * @return true on success, false on error
+ */
+static bool run_build(const bench_config_t* config, phase_times_t* times, double* elapsed)
+{
+    char command[MAX_COMMAND_LEN];
+    int length = snprintf(command, sizeof(command), "\"%s\" -T %s \"%s/tree\" \"%s/image.ffs\"",
+                          config->make_dmffs, config->options, config->work_dir, config->work_dir);
+    if (length < 0 || (size_t)length >= sizeof(command)) {
+        fprintf(stderr, "Command line too long\n");
+        return false;
+    }
+
+    double start = now_seconds();
+    FILE* output = popen(command, "r");
+    if (!output) {
+        fprintf(stderr, "Failed to run: %s\n", command);
+        return false;
+    }
+
+    char line[512];
+    bool found = false;
+    while (fgets(line, sizeof(line), output)) {
+        found = found || sscanf(line, "phases files=%lu input_bytes=%lu image_bytes=%lu walk_us=%lu size_us=%lu copy_us=%lu write_us=%lu total_us=%lu",
+                                &times->files, &times->input_bytes, &times->image_bytes, &times->walk,
+                                &times->size, &times->copy, &times->write, &times->total) == 8;
+    }
+    int status = pclose(output);
+    *elapsed = now_seconds() - start;
+
+    if (status != 0 || !found) {
+        fprintf(stderr, "make_dmffs failed (status %d): %s\n", status, command);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Check that the image holds all generated files
+ *
+ * @param config Benchmark parameters
+ * @return true if the image mounts and holds every file, false otherwise
+ */
+static bool check_image(const bench_config_t* config)
+{
+    char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/image.ffs", config->work_dir);
+
+    dmffs_host_t* host = dmffs_host_open(path, NULL);
+    if (!host) {
+        fprintf(stderr, "Failed to mount image: %s\n", path);
+        return false;
+    }
+
+    dmffs_ioctl_walk_t walk;
+    memset(&walk, 0, sizeof(walk));
+    uint32_t files = 0;
+    int result;
+    while ((result = dmffs_host_walk(host, &walk)) == DMFSI_OK) {
+        files += walk.type == DMFFS_TLV_TYPE_FILE ? 1 : 0;
+    }
+    dmffs_host_close(host);
+
+    if (result != DMFSI_ERR_NOT_FOUND || files != config->files) {
+        fprintf(stderr, "Image holds %u of %u files: %s\n", (unsigned int)files, (unsigned int)config->files, path);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Print the result of a run as one JSON object
+ *
+ * @param config Benchmark parameters
+ * @param result "run" for a single run, "best" for the summary of the fastest run
+ * @param run Run number
+ * @param bytes Bytes of all input files
+ * @param times Phase times of the run
+ * @param elapsed End-to-end time in seconds
+ */
+static void print_result(const bench_config_t* config, const char* result, uint32_t run, uint64_t bytes, const phase_times_t* times, double elapsed)
+{
+    static const char* distributions[] = { "fixed", "uniform", "log" };
+
+    printf("{\"result\": \"%s\", \"run\": %u, \"files\": %u, \"depth\": %u, \"fanout\": %u, \"sizes\": \"%s\", \"min_size\": %llu, \"max_size\": %llu, "
+           "\"options\": \"%s\", \"input_bytes\": %llu, \"image_bytes\": %lu, \"seconds\": %.6f, \"files_per_s\": %.1f, \"mb_per_s\": %.2f, "
+           "\"walk_s\": %.6f, \"size_s\": %.6f, \"copy_s\": %.6f, \"write_s\": %.6f}\n",
+           result, (unsigned int)run,
+           (unsigned int)config->files, (unsigned int)config->depth, (unsigned int)config->fanout,
+           distributions[config->distribution], (unsigned long long)config->min_size, (unsigned long long)config->max_size,
+           config->options, (unsigned long long)bytes, times->image_bytes, elapsed,
+           elapsed > 0 ? config->files / elapsed : 0.0, elapsed > 0 ? bytes / BYTES_PER_MB / elapsed : 0.0,
+           times->walk / 1e6, times->size / 1e6, times->copy / 1e6, times->write / 1e6);
+}
+
+/**
+ * @brief Print usage information
+ *
+ * @param program Program name
+ */
+static void print_usage(const char* program)
+{
+    fprintf(stderr, "Usage: %s [options]\n", program);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -f <files>    Number of generated files (default %d)\n", DEFAULT_FILES);
+    fprintf(stderr, "  -d <depth>    Deepest directory level (default %d)\n", DEFAULT_DEPTH);
+    fprintf(stderr, "  -o <fanout>   Subdirectories per directory (default %d)\n", DEFAULT_FANOUT);
+    fprintf(stderr, "  -s <min:max>  File sizes in bytes (default %d:%d)\n", DEFAULT_MIN_SIZE, DEFAULT_MAX_SIZE);
+    fprintf(stderr, "  -D <dist>     Size distribution: fixed, uniform or log (default log)\n");
+    fprintf(stderr, "  -r <runs>     Number of timed builds (default %d)\n", DEFAULT_RUNS);
+    fprintf(stderr, "  -S <seed>     Seed of the generated contents (default %d)\n", DEFAULT_SEED);
+    fprintf(stderr, "  -a <options>  Additional make_dmffs options, e.g. \"-l split -x\"\n");
+    fprintf(stderr, "  -m <path>     make_dmffs executable (default %s)\n", MAKE_DMFFS_PATH);
+    fprintf(stderr, "  -w <dir>      Existing directory for the tree and the image (default: new directory in /tmp)\n");
+    fprintf(stderr, "  -k            Keep the tree and the image\n");
+}
+
+/**
+ * @brief Parse a number option
+ *
+ * @param str Option value
+ * @param value Pointer to store the value
+ * @return true on success, false if the value is not a number
+ */
+static bool parse_number(const char* str, uint64_t* value)
+{
+    char* end = NULL;
+    errno = 0;
+    *value = strtoull(str, &end, 0);
+    return errno == 0 && end != str && *end == '\0';
+}
+
+int main(int argc, char* argv[])
+{
+    bench_config_t config = {
+        DEFAULT_FILES, DEFAULT_DEPTH, DEFAULT_FANOUT, DEFAULT_MIN_SIZE, DEFAULT_MAX_SIZE,
+        SIZES_LOG, DEFAULT_RUNS, DEFAULT_SEED, MAKE_DMFFS_PATH, "", NULL, false
+    };
+    char temp_dir[] = "/tmp/dmffs_bench.XXXXXX";
+
+    for (int i = 1; i < argc; i++) {
+        uint64_t value = 0;
+        bool has_value = i + 1 < argc;
+        bool valid = true;
+
+        if (strcmp(argv[i], "-f") == 0 && has_value) {
+            valid = parse_number(argv[++i], &value) && value >= 1 && value <= UINT32_MAX;
+            config.files = (uint32_t)value;
+        } else if (strcmp(argv[i], "-d") == 0 && has_value) {
+            valid = parse_number(argv[++i], &value) && value <= 32;
+            config.depth = (uint32_t)value;
+        } else if (strcmp(argv[i], "-o") == 0 && has_value) {
+            valid = parse_number(argv[++i], &value) && value >= 1 && value <= 1024;
+            config.fanout = (uint32_t)value;
+        } else if (strcmp(argv[i], "-s") == 0 && has_value) {
+            char* separator = strchr(argv[++i], ':');
+            if (separator) {
+                *separator = '\0';
+                valid = parse_number(separator + 1, &config.max_size);
+            }
+            valid = valid && parse_number(argv[i], &config.min_size);
+            if (!separator) {
+                config.max_size = config.min_size;
+            }
+            valid = valid && config.min_size <= config.max_size && config.max_size <= (1ull << 32);
+        } else if (strcmp(argv[i], "-D") == 0 && has_value) {
+            i++;
+            if (strcmp(argv[i], "fixed") == 0) {
+                config.distribution = SIZES_FIXED;
+            } else if (strcmp(argv[i], "uniform") == 0) {
+                config.distribution = SIZES_UNIFORM;
+            } else {
+                valid = strcmp(argv[i], "log") == 0;
+                config.distribution = SIZES_LOG;
+            }
+        } else if (strcmp(argv[i], "-r") == 0 && has_value) {
+            valid = parse_number(argv[++i], &value) && value >= 1 && value <= 1000;
+            config.runs = (uint32_t)value;
+        } else if (strcmp(argv[i], "-S") == 0 && has_value) {
+            valid = parse_number(argv[++i], &config.seed);
+        } else if (strcmp(argv[i], "-a") == 0 && has_value) {
+            config.options = argv[++i];
+        } else if (strcmp(argv[i], "-m") == 0 && has_value) {
+            config.make_dmffs = argv[++i];
+        } else if (strcmp(argv[i], "-w") == 0 && has_value) {
+            config.work_dir = argv[++i];
+        } else if (strcmp(argv[i], "-k") == 0) {
+            config.keep = true;
+        } else {
+            print_usage(argv[0]);
+            return 2;
+        }
+
+        if (!valid) {
+            fprintf(stderr, "Invalid value of %s: %s\n", argv[i - 1], argv[i]);
+            return 2;
+        }
+    }
+
+    if (!config.work_dir) {
+        config.work_dir = mkdtemp(temp_dir);
+        if (!config.work_dir) {
+            fprintf(stderr, "Failed to create a temporary directory\n");
+            return 2;
+        }
+    }
+
+    uint64_t total_bytes = 0;
+    bool success = generate_tree(&config, &total_bytes);
+
+    phase_times_t best_times;
+    double best = 0.0;
+    uint32_t best_run = 0;
+    for (uint32_t run = 1; success && run <= config.runs; run++) {
+        phase_times_t times;
+        double elapsed = 0.0;
+        success = run_build(&config, &times, &elapsed) && check_image(&config);
+        if (success) {
+            print_result(&config, "run", run, total_bytes, &times, elapsed);
+            if (run == 1 || elapsed < best) {
+                best = elapsed;
+                best_run = run;
+                best_times = times;
+            }
+        }
+    }
+
+    if (success) {
+        print_result(&config, "best", best_run, total_bytes, &best_times, best);
+    }
+
+    if (!config.keep) {
+        remove_tree(&config);
+        if (config.work_dir == temp_dir) {
+            rmdir(temp_dir);
+        }
+    } else {
+        fprintf(stderr, "Kept the tree and the image in: %s\n", config.work_dir);
+    }
+
+    return success ? 0 : 1;
+}
@@ -0,0 +1,363 @@
+/**
+ * @file dmffs_lookup_check.c
+ * @brief Lookup latency harness for DMFFS images
+ *
+ * Opens and stats every path of an image, plus a missing sibling of every
+ * path, and measures the flash reads of each lookup with DMFFS_IOCTL_STATS.
+ * For images with a path index (make_dmffs -x) the maximum is checked
+ * against the bound documented with dmffs_index_t; a custom limit can be
+ * given for other images. Finally all paths are resolved together with
+ * DMFFS_IOCTL_BATCH, which has to find every one of them.
+ *
+ * With -c the image is compared with a reference image of the same tree
+ * (e.g. built without -n or -b): the batch may not read more often or more
+ * bytes than in the reference, and neither may the worst lookups when both
+ * images have the same path filter (its probes cost reads by design). An
+ * image with a string table is held to the bytes of the found paths only:
+ * the NAME_REF of every sibling is read to learn its length, which costs a
+ * read and 4 bytes more than a NAME header when the lengths differ.
+ *
+ * Usage: dmffs_lookup_check [-c <reference>] <image> [max_reads]
+ */
+#include "dmffs_host.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Suffix of the missing path probed next to every entry
+#define MISS_SUFFIX ".missing"
+
+/**
+ * @brief Worst case of one kind of lookup
+ */
+typedef struct {
+    const char* name;                       //!< kind of lookup
+    uint64_t count;                         //!< number of measured lookups
+    uint64_t max_reads;                     //!< most flash reads of a lookup
+    uint64_t max_bytes;                     //!< most bytes read by a lookup
+    char path[DMFFS_WALK_MAX_PATH + 16];    //!< path of the lookup with the most reads
+} lookup_stats_t;
+
+/**
+ * @brief Measured costs of an image
+ */
+typedef struct {
+    lookup_stats_t lookups[3];  //!< worst fopen, stat and miss lookups
+    uint64_t batch_reads;       //!< flash reads of the batch lookup
+    uint64_t batch_bytes;       //!< bytes read by the batch lookup
+    uint32_t bloom_hashes;      //!< filter bytes read by a lookup (0 without BLOOM TLV)
+    bool has_strings;           //!< true if the image has a STRINGS TLV
+} image_costs_t;
+
+/**
+ * @brief Lookup parameters of the image header
+ */
+typedef struct {
+    bool has_index;             //!< true if the image has an INDEX TLV
+    uint32_t max_probes;        //!< most index entries read by a lookup
+    uint32_t bloom_hashes;      //!< filter bytes read by a lookup (0 without BLOOM TLV)
+    bool has_strings;           //!< true if the image has a STRINGS TLV
+} image_header_t;
+
+/**
+ * @brief Read the lookup parameters from the image header
+ *
+ * @param image Image data
+ * @param size Image size
+ * @param header Pointer to store the parameters
+ */
+static void read_image_header(const uint8_t* image, size_t size, image_header_t* header)
+{
+    size_t offset = 0;
+
+    memset(header, 0, sizeof(*header));
+    while (offset + DMFFS_TLV_HEADER_SIZE <= size) {
+        uint32_t type;
+        uint32_t length;
+        memcpy(&type, image + offset, sizeof(type));
+        memcpy(&length, image + offset + sizeof(type), sizeof(length));
+
+        // Header TLVs are never large
+        size_t value = offset + DMFFS_TLV_HEADER_SIZE;
+        if (length == DMFFS_TLV_LENGTH_LARGE || length > size - value) {
+            return;
+        }
+
+        if (type == DMFFS_TLV_TYPE_INDEX && length >= sizeof(dmffs_index_t)) {
+            dmffs_index_t index;
+            memcpy(&index, image + value, sizeof(index));
+            header->has_index = true;
+            header->max_probes = index.max_probes;
+        } else if (type == DMFFS_TLV_TYPE_BLOOM && length >= sizeof(dmffs_bloom_t)) {
+            dmffs_bloom_t bloom;
+            memcpy(&bloom, image + value, sizeof(bloom));
+            header->bloom_hashes = bloom.hash_count;
+        } else if (type == DMFFS_TLV_TYPE_STRINGS) {
+            header->has_strings = true;
+        } else if (type != DMFFS_TLV_TYPE_VERSION && type != DMFFS_TLV_TYPE_LAYOUT) {
+            return;
+        }
+
+        offset = value + length;
+    }
+}
+
+/**
+ * @brief Get the flash read counters
+ *
+ * @param host Mounted image
+ * @return Current counters
+ */
+static dmffs_ioctl_stats_t read_stats(dmffs_host_t* host)
+{
+    dmffs_ioctl_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    dmfsi_dmffs_ioctl(dmffs_host_context(host), NULL, DMFFS_IOCTL_STATS, &stats);
+    return stats;
+}
+
+/**
+ * @brief Resolve all paths of the image with one DMFFS_IOCTL_BATCH request
+ * 
+ * @param host Mounted image
+ * @param paths Paths of all entries
+ * @param count Number of paths
+ * @param costs Costs to store the reads of the batch in
+ * @return true if every path was found, false otherwise
+ */
+static bool check_batch(dmffs_host_t* host, char** paths, size_t count, image_costs_t* costs)
+{
+    dmffs_ioctl_batch_entry_t* entries = calloc(count > 0 ? count : 1, sizeof(dmffs_ioctl_batch_entry_t));
+    if (!entries) {
+        fprintf(stderr, "Failed to allocate %zu batch entries\n", count);
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        entries[i].path = paths[i];
+    }
+
+    dmffs_ioctl_batch_t batch = { entries, (uint32_t)count, 0, 0 };
+    dmffs_ioctl_stats_t before = read_stats(host);
+    int result = dmfsi_dmffs_ioctl(dmffs_host_context(host), NULL, DMFFS_IOCTL_BATCH, &batch);
+    dmffs_ioctl_stats_t after = read_stats(host);
+
+    const char* missing = "-";
+    for (size_t i = 0; i < count && result == DMFSI_OK; i++) {
+        if (entries[i].result != DMFSI_OK) {
+            missing = entries[i].path;
+            break;
+        }
+    }
+
+    costs->batch_reads = after.reads - before.reads;
+    costs->batch_bytes = after.bytes - before.bytes;
+    printf("%-6s %6llu lookups, %llu reads, %llu bytes in one request (missing: %s)\n", "batch",
+           (unsigned long long)count, (unsigned long long)(after.reads - before.reads),
+           (unsigned long long)(after.bytes - before.bytes), missing);
+
+    free(entries);
+    return result == DMFSI_OK && batch.found == count;
+}
+
+/**
+ * @brief Record the cost of a lookup
+ *
+ * @param stats Worst case of the lookup kind
+ * @param before Counters before the lookup
+ * @param after Counters after the lookup
+ * @param path Looked up path
+ */
+static void record_lookup(lookup_stats_t* stats, dmffs_ioctl_stats_t before, dmffs_ioctl_stats_t after, const char* path)
+{
+    uint64_t reads = after.reads - before.reads;
+    uint64_t bytes = after.bytes - before.bytes;
+
+    stats->count++;
+    if (reads > stats->max_reads) {
+        stats->max_reads = reads;
+        snprintf(stats->path, sizeof(stats->path), "%s", path);
+    }
+    if (bytes > stats->max_bytes) {
+        stats->max_bytes = bytes;
+    }
+}
+
+/**
+ * @brief Measure the lookups of an image and check them against the bound
+ *
+ * @param image_path Image file
+ * @param max_reads Bound of the reads of a lookup (0 for the bound of the path index)
+ * @param costs Costs to store the measured values in
+ * @return 0 if the lookups are within the bound, 1 if not, 2 if the image cannot be read
+ */
+static int check_image(const char* image_path, uint64_t max_reads, image_costs_t* costs)
+{
+    dmffs_host_t* host = dmffs_host_open(image_path, NULL);
+    if (!host) {
+        fprintf(stderr, "Failed to mount image: %s\n", image_path);
+        return 2;
+    }
+
+    size_t image_size = 0;
+    const uint8_t* image = dmffs_host_image(host, &image_size);
+    image_header_t header;
+    read_image_header(image, image_size, &header);
+
+    uint64_t limit = max_reads;
+    if (limit == 0 && header.has_index) {
+        limit = (uint64_t)header.bloom_hashes + header.max_probes + DMFFS_INDEX_ENTRY_READS;
+    }
+
+    memset(costs, 0, sizeof(*costs));
+    costs->bloom_hashes = header.bloom_hashes;
+    costs->has_strings = header.has_strings;
+    lookup_stats_t* lookups = costs->lookups;
+    lookups[0].name = "fopen";
+    lookups[1].name = "stat";
+    lookups[2].name = "miss";
+    char miss_path[DMFFS_WALK_MAX_PATH + 16];
+    char** paths = NULL;
+    size_t path_count = 0;
+    size_t path_capacity = 0;
+    dmffs_ioctl_walk_t walk;
+    memset(&walk, 0, sizeof(walk));
+
+    int result;
+    while ((result = dmffs_host_walk(host, &walk)) == DMFSI_OK) {
+        dmffs_ioctl_stats_t before = read_stats(host);
+        dmfsi_stat_t stat;
+        if (dmffs_host_stat(host, walk.path, &stat) != DMFSI_OK) {
+            fprintf(stderr, "Failed to stat: %s\n", walk.path);
+            dmffs_host_close(host);
+            return 2;
+        }
+        record_lookup(&lookups[1], before, read_stats(host), walk.path);
+
+        // Keep the path for the batch lookup
+        if (path_count == path_capacity) {
+            size_t capacity = path_capacity ? path_capacity * 2 : 64;
+            char** grown = realloc(paths, capacity * sizeof(char*));
+            if (grown) {
+                paths = grown;
+                path_capacity = capacity;
+            }
+        }
+        if (path_count < path_capacity && (paths[path_count] = malloc(strlen(walk.path) + 1)) != NULL) {
+            strcpy(paths[path_count++], walk.path);
+        }
+
+        if (walk.type == DMFFS_TLV_TYPE_FILE) {
+            void* fp = NULL;
+            before = read_stats(host);
+            if (dmffs_host_fopen(host, &fp, walk.path) != DMFSI_OK) {
+                fprintf(stderr, "Failed to open: %s\n", walk.path);
+                dmffs_host_close(host);
+                return 2;
+            }
+            record_lookup(&lookups[0], before, read_stats(host), walk.path);
+            dmffs_host_fclose(host, fp);
+        }
+
+        snprintf(miss_path, sizeof(miss_path), "%s%s", walk.path, MISS_SUFFIX);
+        before = read_stats(host);
+        if (dmffs_host_stat(host, miss_path, &stat) == DMFSI_OK) {
+            continue;
+        }
+        record_lookup(&lookups[2], before, read_stats(host), miss_path);
+    }
+
+    if (result != DMFSI_ERR_NOT_FOUND) {
+        fprintf(stderr, "Tree walk failed (%d) after: %s\n", result, walk.path);
+        dmffs_host_close(host);
+        return 2;
+    }
+
+    printf("Image:      %s\n", image_path);
+    if (header.has_index) {
+        printf("Path index: at most %u probes, %u filter reads\n", (unsigned int)header.max_probes, (unsigned int)header.bloom_hashes);
+    } else {
+        printf("Path index: - (directories are scanned)\n");
+    }
+
+    bool exceeded = false;
+    for (size_t i = 0; i < sizeof(costs->lookups) / sizeof(costs->lookups[0]); i++) {
+        printf("%-6s %6llu lookups, max %llu reads, max %llu bytes (%s)\n", lookups[i].name,
+               (unsigned long long)lookups[i].count, (unsigned long long)lookups[i].max_reads,
+               (unsigned long long)lookups[i].max_bytes, lookups[i].count ? lookups[i].path : "-");
+        exceeded = exceeded || (limit > 0 && lookups[i].max_reads > limit);
+    }
+
+    bool batch_found = check_batch(host, paths, path_count, costs);
+    for (size_t i = 0; i < path_count; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+
+    if (limit > 0) {
+        printf("Bound:      %llu reads per lookup - %s\n", (unsigned long long)limit, exceeded ? "EXCEEDED" : "ok");
+    }
+
+    dmffs_host_close(host);
+    return (exceeded || !batch_found) ? 1 : 0;
+}
+
+/**
+ * @brief Check that an image costs no more reads than a reference image
+ *
+ * @param costs Costs of the image
+ * @param reference Costs of the reference image
+ * @return true if the image is not more expensive, false otherwise
+ */
+static bool compare_costs(const image_costs_t* costs, const image_costs_t* reference)
+{
+    bool ok = costs->batch_reads <= reference->batch_reads && costs->batch_bytes <= reference->batch_bytes;
+    printf("Compared:   batch %llu/%llu reads, %llu/%llu bytes", (unsigned long long)costs->batch_reads,
+           (unsigned long long)reference->batch_reads, (unsigned long long)costs->batch_bytes,
+           (unsigned long long)reference->batch_bytes);
+
+    // Filter probes add reads to every lookup, misses become cheaper instead
+    if (costs->bloom_hashes == reference->bloom_hashes) {
+        // A NAME_REF is read apart from its header to learn the length of a sibling, so
+        // with different name layouts only the bytes of the found paths (fopen, stat) compare
+        bool same_names = costs->has_strings == reference->has_strings;
+        size_t kinds = same_names ? sizeof(costs->lookups) / sizeof(costs->lookups[0]) : 2;
+        for (size_t i = 0; i < kinds; i++) {
+            printf(", %s %llu/%llu bytes", costs->lookups[i].name, (unsigned long long)costs->lookups[i].max_bytes,
+                   (unsigned long long)reference->lookups[i].max_bytes);
+            ok = ok && costs->lookups[i].max_bytes <= reference->lookups[i].max_bytes &&
+                 (!same_names || costs->lookups[i].max_reads <= reference->lookups[i].max_reads);
+        }
+    }
+
+    printf(" - %s\n", ok ? "ok" : "MORE THAN THE REFERENCE");
+    return ok;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* reference_path = NULL;
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "-c") == 0) {
+        reference_path = argv[2];
+        first = 3;
+    }
+
+    if (argc - first < 1 || argc - first > 2) {
+        fprintf(stderr, "Usage: %s [-c <reference>] <image> [max_reads]\n", argv[0]);
+        return 2;
+    }
+
+    uint64_t max_reads = (argc - first == 2) ? strtoull(argv[first + 1], NULL, 0) : 0;
+    image_costs_t costs;
+    int result = check_image(argv[first], max_reads, &costs);
+    if (result == 2 || !reference_path) {
+        return result;
+    }
+
+    image_costs_t reference;
+    if (check_image(reference_path, max_reads, &reference) == 2) {
+        return 2;
+    }
+
+    return (compare_costs(&costs, &reference) && result == 0) ? 0 : 1;
+}
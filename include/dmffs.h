@@ -2,6 +2,7 @@
 #define DMFFS_H
 
 #include "dmod.h"
+#include "dmffs_config.h"
 
 #ifndef DMFFS_ENV_FLASH_ADDR
 #define DMFFS_ENV_FLASH_ADDR "FLASH_FS_ADDR"
@@ -11,6 +12,10 @@
 #define DMFFS_ENV_FLASH_SIZE "FLASH_FS_SIZE"
 #endif
 
+#ifndef DMFFS_DEFAULT_BLOCK_SIZE
+#define DMFFS_DEFAULT_BLOCK_SIZE 512    //!< Block size of the "block" backend if not configured
+#endif
+
 /**
  * @brief TLV structure for flash file system metadata
  * 
@@ -22,21 +27,475 @@ typedef struct {
     uint8_t  value[];       //!< Value field (flexible array member)
 } tlv_t;
 
+/**
+ * @brief Value of tlv_t.length marking a large TLV
+ * 
+ * @note Values that do not fit into 32 bits are stored with a large header:
+ *       the 32-bit length holds this marker and is followed by the real
+ *       64-bit length (see tlv_large_t). Readers accept both encodings for
+ *       any length, writers use the large one only when it is needed, so
+ *       small images keep the compact 8-byte headers.
+ */
+#define DMFFS_TLV_LENGTH_LARGE      0xFFFFFFFFu
+
+#define DMFFS_TLV_HEADER_SIZE       8       //!< Size of the compact TLV header
+#define DMFFS_TLV_LARGE_HEADER_SIZE 16      //!< Size of the large TLV header
+
+/**
+ * @brief TLV structure with a 64-bit length
+ */
+typedef struct {
+    uint32_t type;          //!< Type of the TLV entry
+    uint32_t length;        //!< Always DMFFS_TLV_LENGTH_LARGE
+    uint64_t large_length;  //!< Length of the value field
+    uint8_t  value[];       //!< Value field (flexible array member)
+} tlv_large_t;
+
 /**
  * @brief TLV types for flash file system
  */
 typedef enum {
-    DMFFS_TLV_TYPE_INVALID = 0,             //!< Invalid TLV type
-    DMFFS_TLV_TYPE_FILE    = 1,             //!< File entry
-    DMFFS_TLV_TYPE_DIR     = 2,             //!< Directory entry
-    DMFFS_TLV_TYPE_VERSION = 3,             //!< Version information
-    DMFFS_TLV_TYPE_NAME    = 4,             //!< Name entry
-    DMFFS_TLV_TYPE_DATA    = 5,             //!< Data entry
-    DMFFS_TLV_TYPE_DATE    = 6,             //!< Date/time entry (timestamp)
-    DMFFS_TLV_TYPE_ATTR    = 7,             //!< Attributes entry
-    DMFFS_TLV_TYPE_OWNER   = 8,             //!< Owner entry
-    DMFFS_TLV_TYPE_GROUP   = 9,             //!< Group entry
-    DMFFS_TLV_TYPE_END     = 0xFFFFFFFF     //!< End of TLV entries
+    DMFFS_TLV_TYPE_INVALID  = 0,            //!< Invalid TLV type
+    DMFFS_TLV_TYPE_FILE     = 1,            //!< File entry
+    DMFFS_TLV_TYPE_DIR      = 2,            //!< Directory entry
+    DMFFS_TLV_TYPE_VERSION  = 3,            //!< Version information
+    DMFFS_TLV_TYPE_NAME     = 4,            //!< Name entry
+    DMFFS_TLV_TYPE_DATA     = 5,            //!< Data entry
+    DMFFS_TLV_TYPE_DATE     = 6,            //!< Date/time entry (timestamp)
+    DMFFS_TLV_TYPE_ATTR     = 7,            //!< Attributes entry
+    DMFFS_TLV_TYPE_OWNER    = 8,            //!< Owner entry
+    DMFFS_TLV_TYPE_GROUP    = 9,            //!< Group entry
+    DMFFS_TLV_TYPE_LAYOUT   = 10,           //!< Image layout (metadata-first images only)
+    DMFFS_TLV_TYPE_DATA_REF = 11,           //!< Reference to file content in the data region
+    DMFFS_TLV_TYPE_BLOOM    = 12,           //!< Bloom filter of all paths (optional image header)
+    DMFFS_TLV_TYPE_HOLES    = 13,           //!< Zero-filled ranges of a sparse file
+    DMFFS_TLV_TYPE_ENCODING = 14,           //!< Content encoding of a pre-compressed file
+    DMFFS_TLV_TYPE_INDEX    = 15,           //!< Sorted path hash index (optional image header)
+    DMFFS_TLV_TYPE_WHITEOUT = 16,           //!< Deleted entry of an overlay image (holds a NAME TLV)
+    DMFFS_TLV_TYPE_STRINGS  = 17,           //!< Front-coded table of all names (optional image header)
+    DMFFS_TLV_TYPE_NAME_REF = 18,           //!< Reference to a name in the STRINGS TLV (replaces NAME)
+    DMFFS_TLV_TYPE_END      = 0xFFFFFFFF    //!< End of TLV entries
 } dmffs_tlv_type_t;
 
+/**
+ * @brief Value of the LAYOUT TLV
+ * 
+ * @note Metadata-first images start with VERSION and LAYOUT TLVs, followed by
+ *       the complete DIR/FILE tree terminated by END. FILE entries carry a
+ *       DATA_REF instead of DATA, and all file contents are stored in the data
+ *       region that follows the metadata. A walk over the tree therefore only
+ *       reads the compact metadata block at the front of the image.
+ */
+typedef struct {
+    uint64_t data_offset;   //!< Offset of the data region from the image start
+    uint64_t data_size;     //!< Size of the data region
+} dmffs_layout_t;
+
+/**
+ * @brief Value of the DATA_REF TLV (compact form, 8 bytes)
+ * 
+ * @note The offset is relative to the start of the data region. When the
+ *       offset or the size does not fit into 32 bits, the wide form
+ *       (dmffs_data_ref64_t) is used. Readers tell them apart by the length.
+ */
+typedef struct {
+    uint32_t offset;        //!< Offset of the content in the data region
+    uint32_t size;          //!< Size of the content
+} dmffs_data_ref_t;
+
+/**
+ * @brief Value of the DATA_REF TLV (wide form, 16 bytes)
+ */
+typedef struct {
+    uint64_t offset;        //!< Offset of the content in the data region
+    uint64_t size;          //!< Size of the content
+} dmffs_data_ref64_t;
+
+/**
+ * @brief Header of the HOLES TLV value (followed by dmffs_hole_t entries)
+ * 
+ * @note A sparse FILE carries a HOLES TLV next to its DATA (or DATA_REF).
+ *       The stored content is the file without its holes; the holes are
+ *       sorted by offset, do not overlap and read as zeros. Sizes and seek
+ *       positions always refer to the logical file.
+ */
+typedef struct {
+    uint64_t size;          //!< Logical file size including the holes
+} dmffs_holes_t;
+
+/**
+ * @brief Zero-filled range of a sparse file
+ */
+typedef struct {
+    uint64_t offset;        //!< Logical offset of the hole
+    uint64_t length;        //!< Length of the hole
+} dmffs_hole_t;
+
+/**
+ * @brief Content encodings of pre-compressed files
+ */
+typedef enum {
+    DMFFS_ENCODING_IDENTITY = 0,            //!< Content is stored as-is
+    DMFFS_ENCODING_GZIP     = 1,            //!< Content is a gzip stream (RFC 1952)
+    DMFFS_ENCODING_DEFLATE  = 2,            //!< Content is a zlib stream (RFC 1950, HTTP "deflate")
+} dmffs_encoding_type_t;
+
+/**
+ * @brief Value of the ENCODING TLV
+ * 
+ * @note The DATA (or DATA_REF) of an encoded FILE holds the encoded bytes.
+ *       The runtime never decodes them: reads, sizes and DMFFS_IOCTL_MAP
+ *       return the encoded content, so it can be sent as-is with a matching
+ *       HTTP Content-Encoding.
+ */
+typedef struct {
+    uint32_t type;          //!< Encoding (dmffs_encoding_type_t)
+    uint32_t reserved;      //!< Reserved, 0
+    uint64_t size;          //!< Size of the decoded content
+} dmffs_encoding_t;
+
+/**
+ * @brief Header of the BLOOM TLV value (followed by bit_count / 8 bytes of filter bits)
+ * 
+ * @note The filter holds the path of every FILE and DIR entry, relative to
+ *       the root and with single '/' separators (e.g. "config/app.cfg"). The
+ *       key of a path is its FNV-1a 64-bit hash h; the probed bits are
+ *       (h1 + i * h2) % bit_count for i < hash_count, where h1 and h2 are the
+ *       low and high 32 bits of h. Bit n is bit (n % 8) of byte n / 8.
+ *       A path with any probed bit clear is not in the image.
+ */
+typedef struct {
+    uint32_t bit_count;     //!< Number of filter bits (multiple of 8)
+    uint32_t hash_count;    //!< Number of probed bits per path
+} dmffs_bloom_t;
+
+#define DMFFS_BLOOM_HASH_INIT   0xCBF29CE484222325ull   //!< FNV-1a 64-bit offset basis
+#define DMFFS_BLOOM_HASH_PRIME  0x00000100000001B3ull   //!< FNV-1a 64-bit prime
+#define DMFFS_BLOOM_MAX_HASHES  16                      //!< Largest supported hash_count
+
+/**
+ * @brief Header of the INDEX TLV value (followed by dmffs_index_entry_t entries)
+ * 
+ * @note The index holds one entry per FILE and DIR, sorted by the hash of
+ *       the path (hashed like the BLOOM keys, see dmffs_bloom_t); make_dmffs
+ *       rejects images with colliding hashes. Lookups in an indexed image
+ *       binary search the index instead of scanning directories, so a lookup
+ *       reads at most hash_count filter bytes, max_probes index entries and
+ *       DMFFS_INDEX_ENTRY_READS more times to verify and parse the entry.
+ */
+typedef struct {
+    uint32_t entry_count;   //!< Number of index entries
+    uint32_t max_probes;    //!< Most index entries read by a lookup (floor(log2(entry_count)) + 1)
+} dmffs_index_t;
+
+/**
+ * @brief Entry of the INDEX TLV
+ */
+typedef struct {
+    uint64_t hash;          //!< FNV-1a 64-bit hash of the path
+    uint64_t offset;        //!< Offset of the FILE or DIR TLV in the image
+} dmffs_index_entry_t;
+
+/**
+ * @brief Header of the STRINGS TLV value (followed by data_size bytes of names)
+ * 
+ * @note The table holds the names of all entries, sorted and without
+ *       duplicates, front-coded in blocks of at most DMFFS_STRINGS_BLOCK_NAMES
+ *       names: every name is stored as a byte with the length of the prefix
+ *       it shares with the previous name of the block, a byte with the length
+ *       of the rest, and the rest. The first name of a block shares nothing,
+ *       so a name is decoded from the start of its block. Entries of an image
+ *       with a table carry a NAME_REF instead of a NAME TLV.
+ */
+typedef struct {
+    uint32_t name_count;    //!< Number of names in the table
+    uint32_t data_size;     //!< Size of the name data following the header
+} dmffs_strings_t;
+
+#define DMFFS_STRINGS_BLOCK_NAMES   16  //!< Most names of a front-coded block
+#define DMFFS_STRINGS_BLOCK_SIZE    128 //!< Size after which make_dmffs starts a new block (and the runtime read chunk)
+
+/**
+ * @brief Value of the NAME_REF TLV (32 bits)
+ * 
+ * @note Bits 0-7 hold the length of the name, bits 8-11 its position in
+ *       the block and bits 12-31 the offset of the block in the name data of
+ *       the STRINGS TLV, so the table holds up to 1 MiB of names. The length
+ *       lets lookups skip names of a different length without reading the
+ *       table.
+ */
+#define DMFFS_NAME_REF_LENGTH(ref)  ((ref) & 0xFFu)             //!< Length of the referenced name
+#define DMFFS_NAME_REF_INDEX(ref)   (((ref) >> 8) & 0xFu)       //!< Position of the name in its block
+#define DMFFS_NAME_REF_BLOCK(ref)   ((ref) >> 12)               //!< Offset of the block in the name data
+#define DMFFS_NAME_REF(block, index, length)    (((uint32_t)(block) << 12) | ((uint32_t)(index) << 8) | (uint32_t)(length))
+#define DMFFS_NAME_REF_MAX_BLOCK    0xFFFFFu                    //!< Largest block offset of a NAME_REF
+
+#ifndef DMFFS_INDEX_ENTRY_READS
+#define DMFFS_INDEX_ENTRY_READS 16      //!< Most flash reads to verify and parse an indexed entry written by make_dmffs
+#endif
+
+#ifndef DMFFS_MAX_OVERLAYS
+#define DMFFS_MAX_OVERLAYS      4       //!< Most overlay images mounted on top of the base image
+#endif
+
+#ifndef DMFFS_MAX_PINS
+#define DMFFS_MAX_PINS          8       //!< Most "pin=<path>" configuration keys
+#endif
+
+/**
+ * @brief Overlay images
+ * 
+ * @note Patch images are mounted on top of the base image with one
+ *       "overlay=<flash_addr>:<flash_size>" configuration key per image
+ *       ("overlay=<device>" for the block backend); a later overlay takes
+ *       precedence over the earlier ones and over the base. A path resolves
+ *       to the entry of the highest image that has it, unless that image or
+ *       one above it holds a WHITEOUT or a FILE in place of the path or of
+ *       one of its directories. Directories of the same path are merged.
+ *       Every image is searched with its own path filter and index, so patch
+ *       images should be built with make_dmffs -b or -x. Regions without a
+ *       valid image (e.g. erased flash) are skipped.
+ */
+
+#define DMFFS_DELTA_MAGIC       0x544C4446u     //!< "FDLT", first bytes of a sector delta
+#define DMFFS_DELTA_VERSION     1               //!< Version of the sector delta format
+
+/**
+ * @brief Header of a sector delta between two images
+ * 
+ * @note A delta, as written by dmffs_delta, holds the erase sectors of the
+ *       new image that differ from the old one: the header is followed by
+ *       sector_count records in ascending sector order, each a 32-bit sector
+ *       number and sector_size bytes of new content (the last sector of the
+ *       image is padded with zeros). Sectors without a record are unchanged,
+ *       bytes past the end of the old image count as zeros. The hashes are
+ *       FNV-1a 64-bit hashes of the whole images, so an updater can check
+ *       that the delta fits the installed image and verify the result.
+ */
+typedef struct {
+    uint32_t magic;         //!< DMFFS_DELTA_MAGIC
+    uint32_t version;       //!< DMFFS_DELTA_VERSION
+    uint32_t sector_size;   //!< Erase sector size in bytes
+    uint32_t sector_count;  //!< Number of sector records
+    uint64_t old_size;      //!< Size of the old image
+    uint64_t new_size;      //!< Size of the new image
+    uint64_t old_hash;      //!< Hash of the old image
+    uint64_t new_hash;      //!< Hash of the new image
+} dmffs_delta_header_t;
+
+/**
+ * @brief DMFFS specific requests for dmfsi_dmffs_ioctl
+ */
+typedef enum {
+    DMFFS_IOCTL_LSEEK64    = 0x46460001,    //!< 64-bit seek (arg: dmffs_ioctl_lseek64_t*)
+    DMFFS_IOCTL_TELL64     = 0x46460002,    //!< 64-bit position (arg: uint64_t*)
+    DMFFS_IOCTL_SIZE64     = 0x46460003,    //!< 64-bit file size (arg: uint64_t*)
+    DMFFS_IOCTL_TRACE_EXPORT = 0x46460004,  //!< Export the access trace (arg: dmffs_ioctl_trace_t*, fp may be NULL)
+    DMFFS_IOCTL_DATA_OFFSET = 0x46460005,   //!< Offset of the stored file content in the image (arg: uint64_t*)
+    DMFFS_IOCTL_MAP        = 0x46460006,    //!< Direct pointer to the file content (arg: dmffs_ioctl_map_t*)
+    DMFFS_IOCTL_WALK       = 0x46460007,    //!< Next entry of a tree walk (arg: dmffs_ioctl_walk_t*, fp may be NULL)
+    DMFFS_IOCTL_ENCODING   = 0x46460008,    //!< Content encoding of the file (arg: dmffs_ioctl_encoding_t*)
+    DMFFS_IOCTL_STATS      = 0x46460009,    //!< Flash read counters (arg: dmffs_ioctl_stats_t*, fp may be NULL)
+    DMFFS_IOCTL_INDEX_STEP = 0x4646000A,    //!< Extend the RAM path index (arg: dmffs_ioctl_index_t*, fp may be NULL)
+    DMFFS_IOCTL_LOOKUP     = 0x4646000B,    //!< Inode of a path, relative to a directory handle (arg: dmffs_ioctl_inode_t*, fp may be NULL)
+    DMFFS_IOCTL_DIR_INODE  = 0x4646000C,    //!< Inode of the entry last returned by _readdir (arg: dmffs_ioctl_inode_t*, fp may be NULL)
+    DMFFS_IOCTL_OPEN_INODE = 0x4646000D,    //!< Open a file by inode (arg: dmffs_ioctl_inode_t*, fp may be NULL)
+    DMFFS_IOCTL_OPENAT     = 0x4646000E,    //!< Open a file relative to a directory handle (arg: dmffs_ioctl_inode_t*, fp may be NULL)
+    DMFFS_IOCTL_BATCH      = 0x4646000F,    //!< Resolve a list of paths in one pass (arg: dmffs_ioctl_batch_t*, fp may be NULL)
+} dmffs_ioctl_request_t;
+
+/**
+ * @brief Argument of DMFFS_IOCTL_LSEEK64
+ */
+typedef struct {
+    int64_t  offset;        //!< Offset relative to whence
+    int      whence;        //!< DMFSI_SEEK_SET, DMFSI_SEEK_CUR or DMFSI_SEEK_END
+    uint64_t position;      //!< Resulting position (output)
+} dmffs_ioctl_lseek64_t;
+
+/**
+ * @brief Argument of DMFFS_IOCTL_TRACE_EXPORT
+ * 
+ * @note The access trace is recorded when the file system is initialized with
+ *       "trace=<events>" in the configuration string. It is exported as text,
+ *       one line per event in the order they happened: "open <path>" for the
+ *       first open and "read <path>" for the first read of a file. The trace
+ *       can be passed to make_dmffs (-p) to place those files in access order.
+ */
+typedef struct {
+    char*    buffer;        //!< Output buffer (null-terminated, may be NULL to query the length)
+    size_t   size;          //!< Size of the output buffer
+    size_t   length;        //!< Length of the complete trace without the terminator (output)
+} dmffs_ioctl_trace_t;
+
+/**
+ * @brief Argument of DMFFS_IOCTL_MAP
+ * 
+ * @note Only backends with directly addressable flash ("backend=mmap")
+ *       and files pinned in RAM ("pin=<path>") support this request, others
+ *       return DMFSI_ERR_GENERAL. Sparse files (see dmffs_holes_t) cannot be
+ *       mapped either.
+ */
+typedef struct {
+    const void* data;       //!< Address of the file content (output)
+    uint64_t size;          //!< Size of the file content (output)
+} dmffs_ioctl_map_t;
+
+/**
+ * @brief Argument of DMFFS_IOCTL_ENCODING
+ * 
+ * @note Files without an ENCODING TLV report DMFFS_ENCODING_IDENTITY with
+ *       both sizes equal to the file size.
+ */
+typedef struct {
+    uint32_t encoding;      //!< Encoding of the content (dmffs_encoding_type_t, output)
+    uint64_t size;          //!< Size of the encoded content, as read with fread (output)
+    uint64_t decoded_size;  //!< Size of the content after decoding (output)
+} dmffs_ioctl_encoding_t;
+
+/**
+ * @brief Argument of DMFFS_IOCTL_STATS
+ * 
+ * @note The counters include every backend read since the file system was
+ *       initialized; the cost of an operation is the difference of the
+ *       counters before and after it. Reads of the parts of the images
+ *       pinned in RAM ("pin=<path>") are not flash reads, they are counted
+ *       in pinned_reads.
+ */
+typedef struct {
+    uint64_t reads;         //!< Number of flash reads (output)
+    uint64_t bytes;         //!< Number of bytes read from flash (output)
+    uint64_t pinned;        //!< Bytes of the images held in RAM (output)
+    uint64_t pinned_reads;  //!< Number of reads served from RAM (output)
+} dmffs_ioctl_stats_t;
+
+#ifndef DMFFS_WALK_MAX_DEPTH
+#define DMFFS_WALK_MAX_DEPTH    16      //!< Deepest directory level a tree walk descends into
+#endif
+
+#ifndef DMFFS_WALK_MAX_PATH
+#define DMFFS_WALK_MAX_PATH     (DMFFS_MAX_PATH_LEN + 1)    //!< Size of the path buffer of a tree walk
+#endif
+
+/**
+ * @brief Argument of DMFFS_IOCTL_WALK
+ * 
+ * @note Visits every FILE and DIR entry in one forward pass over the image,
+ *       directories before their contents. Zero the structure and call the
+ *       request repeatedly: each call returns DMFSI_OK with the next entry,
+ *       and DMFSI_ERR_NOT_FOUND once the walk is complete. An entry whose
+ *       path does not fit or that is nested deeper than DMFFS_WALK_MAX_DEPTH
+ *       returns DMFSI_ERR_NO_SPACE and is skipped (with its contents); the
+ *       walk can be continued. Directory attributes and dates are reported
+ *       when they precede the directory's entries, as written by make_dmffs.
+ */
+typedef struct {
+    char     path[DMFFS_WALK_MAX_PATH];     //!< Path of the entry without leading slash (output)
+    uint32_t type;                          //!< DMFFS_TLV_TYPE_FILE or DMFFS_TLV_TYPE_DIR (output)
+    uint32_t depth;                         //!< Nesting level, 0 for root entries (output)
+    uint64_t size;                          //!< File size, 0 for directories (output)
+    uint64_t data_offset;                   //!< Offset of the file content in the image (output)
+    uint32_t attr;                          //!< DMFSI_ATTR_* flags (output)
+    uint32_t mtime;                         //!< Modification time (output)
+    uint64_t inode;                         //!< Inode number of the entry (output, see dmffs_ioctl_inode_t)
+    
+    // Walk state (zero before the first call)
+    uint64_t next_offset;                   //!< Offset of the next TLV
+    uint32_t level;                         //!< Number of open directories
+    uint32_t started;                       //!< Non-zero once the walk has started
+    uint64_t dir_end[DMFFS_WALK_MAX_DEPTH]; //!< End offsets of the open directories
+    uint16_t path_length[DMFFS_WALK_MAX_DEPTH]; //!< Path lengths of the open directories
+} dmffs_ioctl_walk_t;
+
+/**
+ * @brief Argument of DMFFS_IOCTL_INDEX_STEP
+ * 
+ * @note Images without an INDEX TLV get a path index in RAM when the file
+ *       system is initialized with "ram_index=<entries>" (16 bytes per slot,
+ *       4 slots per 3 entries rounded up to a power of two). The index is
+ *       not built at init: each request reads at most budget more TLVs of a
+ *       depth-first pass over the images, so the work can be spread over
+ *       idle time. Lookups probe the index first and scan only the entries
+ *       the pass has not reached yet; once the index is complete, a lookup
+ *       is a single probe. The request returns DMFSI_ERR_GENERAL if the
+ *       mount has no RAM index and DMFSI_ERR_NO_SPACE once the index has
+ *       stopped growing (entry limit, DMFFS_WALK_MAX_DEPTH or a path hash
+ *       collision); lookups keep using the part that was built.
+ */
+typedef struct {
+    uint32_t budget;        //!< Most TLVs to read in this step (input, 0 only reports the state)
+    uint32_t entries;       //!< Number of indexed entries (output)
+    uint64_t covered;       //!< Bytes of the images covered by the index (output)
+    uint64_t total;         //!< Bytes of the images to cover (output)
+    uint32_t complete;      //!< Non-zero once the index covers all images (output)
+} dmffs_ioctl_index_t;
+
+#define DMFFS_INODE_LEVEL_SHIFT 56      //!< Position of the image number in an inode number
+
+#define DMFFS_INODE(level, offset)  (((uint64_t)(level) << DMFFS_INODE_LEVEL_SHIFT) | (uint64_t)(offset))  //!< Inode number of an entry
+#define DMFFS_INODE_LEVEL(inode)    ((uint32_t)((inode) >> DMFFS_INODE_LEVEL_SHIFT))                       //!< Image of an inode (0 for the base image, n for the n-th overlay)
+#define DMFFS_INODE_OFFSET(inode)   ((inode) & ((1ULL << DMFFS_INODE_LEVEL_SHIFT) - 1))                   //!< Offset of the FILE or DIR TLV of an inode
+
+/**
+ * @brief Argument of DMFFS_IOCTL_LOOKUP, DMFFS_IOCTL_DIR_INODE, DMFFS_IOCTL_OPEN_INODE and DMFFS_IOCTL_OPENAT
+ * 
+ * @note The inode number of an entry is the offset of its FILE or DIR TLV,
+ *       with the number of the overlay holding it in the top bits
+ *       (DMFFS_INODE). It stays the same while the image is mounted, so an
+ *       entry found by _readdir (DMFFS_IOCTL_DIR_INODE) or a lookup can be
+ *       opened again by DMFFS_IOCTL_OPEN_INODE without resolving its path.
+ *       An inode is checked to point to a complete FILE entry of the
+ *       directory tree of its image whose path no overlay shadows or
+ *       whiteouts, but numbers that were not obtained from the same mount
+ *       are not detected otherwise. DMFFS_IOCTL_LOOKUP and DMFFS_IOCTL_OPENAT resolve
+ *       path relative to the directory handle dir of _opendir (NULL or an
+ *       absolute path for the root directory), so only the entries of that
+ *       directory and below are searched.
+ */
+typedef struct {
+    void*       dir;        //!< Directory handle of _opendir (input, NULL for the root directory, required by DMFFS_IOCTL_DIR_INODE)
+    const char* path;       //!< Path relative to dir (input of DMFFS_IOCTL_LOOKUP and DMFFS_IOCTL_OPENAT)
+    uint64_t    inode;      //!< Inode number (output, input of DMFFS_IOCTL_OPEN_INODE)
+    uint32_t    type;       //!< DMFFS_TLV_TYPE_FILE or DMFFS_TLV_TYPE_DIR (output)
+    void*       fp;         //!< Opened file handle, to be closed with _fclose (output of the open requests)
+} dmffs_ioctl_inode_t;
+
+#define DMFFS_BATCH_OPEN        0x1     //!< Open the found files (flag of dmffs_ioctl_batch_t)
+
+/**
+ * @brief Path of a DMFFS_IOCTL_BATCH request and its result
+ */
+typedef struct {
+    const char* path;       //!< Path from the root directory, with or without leading slash (input)
+    int32_t     result;     //!< DMFSI_OK if found (and opened), DMFSI_ERR_NOT_FOUND or the error of the open (output)
+    uint32_t    type;       //!< DMFFS_TLV_TYPE_FILE or DMFFS_TLV_TYPE_DIR (output)
+    uint64_t    inode;      //!< Inode number (output, see dmffs_ioctl_inode_t)
+    uint64_t    size;       //!< File size, 0 for directories (output)
+    uint32_t    attr;       //!< DMFSI_ATTR_* flags (output)
+    uint32_t    mtime;      //!< Modification time (output)
+    void*       fp;         //!< File handle to be closed with _fclose (output with DMFFS_BATCH_OPEN, NULL otherwise)
+} dmffs_ioctl_batch_entry_t;
+
+/**
+ * @brief Argument of DMFFS_IOCTL_BATCH
+ * 
+ * @note Resolves all paths together, with one forward pass over the entries
+ *       of each image instead of one scan per path: the pass only descends
+ *       into the directories on the way to a pending path and stops once
+ *       every path is resolved. Images with a path index (INDEX TLV or a
+ *       complete RAM index) look up every path with the index instead. The
+ *       results are the same as of _stat and _fopen for each path, overlays
+ *       and whiteouts included. A path nested deeper than
+ *       DMFFS_WALK_MAX_DEPTH is looked up on its own. The request returns
+ *       DMFSI_OK once all paths have their result and DMFSI_ERR_GENERAL if
+ *       the lookup state (at most 16 bytes per path) cannot be
+ *       allocated.
+ */
+typedef struct {
+    dmffs_ioctl_batch_entry_t* entries; //!< Paths and their results (input and output)
+    uint32_t count;                     //!< Number of entries (input)
+    uint32_t flags;                     //!< DMFFS_BATCH_* flags (input)
+    uint32_t found;                     //!< Number of found paths (output)
+} dmffs_ioctl_batch_t;
+
 #endif // DMFFS_H
\ No newline at end of file
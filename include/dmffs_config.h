@@ -0,0 +1,94 @@
+#ifndef DMFFS_CONFIG_H
+#define DMFFS_CONFIG_H
+
+/**
+ * @brief Compile-time configuration of the dmffs module
+ *
+ * Every option can be overridden with a definition of the compiler
+ * (e.g. -DDMFFS_MAX_NAME_LEN=31). Defining DMFFS_PROFILE_MINIMAL switches
+ * the defaults of all options that are not set explicitly to the values for
+ * small targets. The options change the layout of the ioctl structures of
+ * dmffs.h, so applications must be built with the same configuration as the
+ * module.
+ *
+ * The CMake build selects the profile with -DDMFFS_PROFILE=full|minimal.
+ */
+
+#define DMFFS_LOG_LEVEL_NONE    0       //!< No log messages
+#define DMFFS_LOG_LEVEL_ERROR   1       //!< Errors only
+#define DMFFS_LOG_LEVEL_WARN    2       //!< Errors and warnings
+#define DMFFS_LOG_LEVEL_INFO    3       //!< All log messages
+
+#ifdef DMFFS_PROFILE_MINIMAL
+
+#ifndef DMFFS_MAX_NAME_LEN
+#define DMFFS_MAX_NAME_LEN      31
+#endif
+
+#ifndef DMFFS_MAX_PATH_LEN
+#define DMFFS_MAX_PATH_LEN      63
+#endif
+
+#ifndef DMFFS_ENABLE_DATA_FALLBACK
+#define DMFFS_ENABLE_DATA_FALLBACK  0
+#endif
+
+#ifndef DMFFS_ENABLE_GETC
+#define DMFFS_ENABLE_GETC       0
+#endif
+
+#ifndef DMFFS_ENABLE_TRACE
+#define DMFFS_ENABLE_TRACE      0
+#endif
+
+#ifndef DMFFS_ENABLE_BLOCK_BACKEND
+#define DMFFS_ENABLE_BLOCK_BACKEND  0
+#endif
+
+#ifndef DMFFS_LOG_LEVEL
+#define DMFFS_LOG_LEVEL         DMFFS_LOG_LEVEL_ERROR
+#endif
+
+#ifndef DMFFS_MAX_OVERLAYS
+#define DMFFS_MAX_OVERLAYS      1
+#endif
+
+#ifndef DMFFS_MAX_PINS
+#define DMFFS_MAX_PINS          1
+#endif
+
+#ifndef DMFFS_WALK_MAX_DEPTH
+#define DMFFS_WALK_MAX_DEPTH    8
+#endif
+
+#endif // DMFFS_PROFILE_MINIMAL
+
+#ifndef DMFFS_MAX_NAME_LEN
+#define DMFFS_MAX_NAME_LEN      255     //!< Longest name of an entry that can be looked up and listed in full
+#endif
+
+#ifndef DMFFS_MAX_PATH_LEN
+#define DMFFS_MAX_PATH_LEN      255     //!< Longest path of directory handles, pins, traces and tree walks
+#endif
+
+#ifndef DMFFS_ENABLE_DATA_FALLBACK
+#define DMFFS_ENABLE_DATA_FALLBACK  1   //!< Expose a flash without TLV structure as the single file "data.bin"
+#endif
+
+#ifndef DMFFS_ENABLE_GETC
+#define DMFFS_ENABLE_GETC       1       //!< Implement _getc (otherwise it always reports the end of file)
+#endif
+
+#ifndef DMFFS_ENABLE_TRACE
+#define DMFFS_ENABLE_TRACE      1       //!< Access trace ("trace=", "trace_file=", DMFFS_IOCTL_TRACE_EXPORT)
+#endif
+
+#ifndef DMFFS_ENABLE_BLOCK_BACKEND
+#define DMFFS_ENABLE_BLOCK_BACKEND  1   //!< "block" backend reading the image from a device file
+#endif
+
+#ifndef DMFFS_LOG_LEVEL
+#define DMFFS_LOG_LEVEL         DMFFS_LOG_LEVEL_INFO    //!< Most verbose log messages compiled in
+#endif
+
+#endif // DMFFS_CONFIG_H
@@ -6,11 +6,117 @@
 #include "dmfsi.h"
 #include "string.h"
 
+/**
+ * @brief Offset and size type used for addressing the flash image
+ */
+typedef uint64_t dmffs_off_t;
+
 static const void* g_flash_addr = NULL;     //!< default flash address
-static size_t g_flash_size = 0;             //!< default flash size
+static dmffs_off_t g_flash_size = 0;        //!< default flash size
 
 #define MAGIC_DMFSS_CTX 0x444D4653  // 'DMFS'
 
+#define DMFFS_LONG_MAX  ((dmffs_off_t)(~0UL >> 1))  //!< largest position representable as long
+
+// Size for the 32-bit size fields of DMFSI: like _size, a size that does not
+// fit is never truncated, it is reported as UINT32_MAX (see DMFFS_IOCTL_SIZE64)
+#define DMFFS_SIZE32(size)  ((size) > UINT32_MAX ? UINT32_MAX : (uint32_t)(size))
+
+#ifndef SEEK_SET
+#define SEEK_SET 0
+#endif
+
+// Log messages above DMFFS_LOG_LEVEL are compiled out
+#if DMFFS_LOG_LEVEL < DMFFS_LOG_LEVEL_INFO
+#undef DMOD_LOG_INFO
+#define DMOD_LOG_INFO(...)  ((void)0)
+#endif
+#if DMFFS_LOG_LEVEL < DMFFS_LOG_LEVEL_WARN
+#undef DMOD_LOG_WARN
+#define DMOD_LOG_WARN(...)  ((void)0)
+#endif
+#if DMFFS_LOG_LEVEL < DMFFS_LOG_LEVEL_ERROR
+#undef DMOD_LOG_ERROR
+#define DMOD_LOG_ERROR(...) ((void)0)
+#endif
+
+#define DMFFS_TRACE_OPEN    1   //!< trace event: first open of a file
+#define DMFFS_TRACE_READ    2   //!< trace event: first read of a file
+
+#define DMFFS_FIELD_NAME    0x1 //!< file entry field: name (NAME TLV)
+#define DMFFS_FIELD_DATA    0x2 //!< file entry field: content location, size, holes and encoding
+#define DMFFS_FIELD_TIME    0x4 //!< file entry field: modification time (DATE TLV)
+#define DMFFS_FIELD_ATTR    0x8 //!< file entry field: attributes (ATTR TLV)
+
+#define DMFFS_RAM_INDEX_EMPTY   UINT64_MAX  //!< offset of an unused RAM index slot
+
+/**
+ * @brief Access trace event
+ */
+typedef struct {
+    dmffs_off_t entry_offset;   //!< offset of the FILE TLV
+    uint32_t event;             //!< DMFFS_TRACE_OPEN or DMFFS_TRACE_READ
+} dmffs_trace_event_t;
+
+/**
+ * @brief Flash access backend
+ * 
+ * Selected with the "backend=<name>" configuration key.
+ */
+typedef struct {
+    const char* name;                                   //!< name of the backend in the configuration string
+    bool (*open)(dmfsi_context_t ctx);                  //!< prepare the access, false if the flash is not available
+    void (*close)(dmfsi_context_t ctx);                 //!< release the backend resources (optional)
+    size_t (*read)(dmfsi_context_t ctx, dmffs_off_t offset, void* buffer, size_t size);    //!< read raw bytes
+    const void* (*map)(dmfsi_context_t ctx, dmffs_off_t offset);                        //!< address of a flash byte (optional)
+} dmffs_backend_t;
+
+/**
+ * @brief Part of an image copied to RAM ("pin=<path>")
+ */
+typedef struct {
+    dmffs_off_t offset;         //!< offset of the range in flash
+    dmffs_off_t size;           //!< size of the range
+    uint8_t* data;              //!< copy of the range
+} dmffs_pin_t;
+
+/**
+ * @brief Path index built in RAM for images without an INDEX TLV
+ * 
+ * The index is filled by a depth-first pass over the image in bounded
+ * steps (DMFFS_IOCTL_INDEX_STEP). Every entry before the position of the
+ * pass is in the index, the open directories of the pass tell lookups
+ * where the uncovered part of a directory starts.
+ */
+typedef struct {
+    dmffs_index_entry_t* slots; //!< open addressing table of path hashes (offset DMFFS_RAM_INDEX_EMPTY if unused)
+    uint32_t slot_mask;         //!< number of slots - 1 (power of two)
+    uint32_t capacity;          //!< most indexed entries
+    uint32_t count;             //!< number of indexed entries
+    dmffs_off_t offset;         //!< next TLV of the pass, all entries before it are indexed
+    uint32_t depth;             //!< number of open directories
+    bool complete;              //!< true once the pass has covered the whole image
+    bool halted;                //!< true if the index cannot grow any more
+    dmffs_off_t dir_offset[DMFFS_WALK_MAX_DEPTH];   //!< offsets of the open directories, outermost first
+    dmffs_off_t dir_end[DMFFS_WALK_MAX_DEPTH];      //!< end offsets of the open directories
+    uint64_t dir_hash[DMFFS_WALK_MAX_DEPTH];        //!< path hashes of the open directories
+} dmffs_ram_index_t;
+
+/**
+ * @brief Sequential reader of the name data of the string table
+ * 
+ * Chunks are appended to the buffer while it has room, so it holds a whole
+ * block of names that the runtime can match and a walk can return to the
+ * start of the block without reading it again.
+ */
+typedef struct {
+    dmffs_off_t offset;         //!< offset of the first buffered byte in flash
+    dmffs_off_t end;            //!< end of the name data
+    size_t length;              //!< number of buffered bytes
+    size_t position;            //!< position of the next byte in the buffer
+    uint8_t chunk[DMFFS_STRINGS_BLOCK_SIZE + 2 + DMFFS_MAX_NAME_LEN];    //!< buffered bytes
+} dmffs_string_reader_t;
+
 /**
  * @brief DMFSI context structure
  */
@@ -18,16 +124,77 @@ struct dmfsi_context
 {
     uint32_t magic;             //!< magic number for validation
     const void* flash_addr;     //!< flash base address
-    size_t flash_size;          //!< flash size in bytes
+    dmffs_off_t flash_size;     //!< flash size in bytes
+    dmffs_off_t root_offset;    //!< offset of the first entry of the root directory
+    dmffs_off_t metadata_end;   //!< end of the metadata (flash size for inline images)
+    dmffs_off_t data_offset;    //!< offset of the data region (metadata-first images)
+    dmffs_off_t data_size;      //!< size of the data region (0 for inline images)
+    dmffs_off_t bloom_offset;   //!< offset of the path filter bits (BLOOM TLV)
+    uint32_t bloom_bits;        //!< number of path filter bits (0 if the image has no filter)
+    uint32_t bloom_hashes;      //!< number of probed bits per path
+    dmffs_off_t index_offset;   //!< offset of the first path index entry (INDEX TLV)
+    uint32_t index_count;       //!< number of path index entries (0 if the image has no index)
+    dmffs_off_t strings_offset; //!< offset of the name data of the string table (STRINGS TLV)
+    uint32_t strings_size;      //!< size of the name data (0 if the image has no string table)
+    dmffs_string_reader_t strings_reader;   //!< reader of the string table, positioned behind the cached name
+    dmffs_off_t strings_block;  //!< offset of the block of the cached name in flash, relative to the name data
+    uint32_t strings_count;     //!< number of names of the block decoded so far (0 if no name is cached)
+    size_t strings_length;      //!< length of the cached name
+    char strings_name[DMFFS_MAX_NAME_LEN];  //!< cached name (truncated to fit, not null-terminated)
+    dmffs_ram_index_t* ram_index;   //!< path index in RAM (NULL if disabled or the image has an INDEX TLV)
+    uint32_t ram_index_entries; //!< most entries of the RAM index ("ram_index=<entries>", 0 if disabled)
+    uint64_t read_count;        //!< number of flash reads
+    uint64_t read_bytes;        //!< number of bytes read from flash
+    dmffs_pin_t* pins;          //!< ranges pinned in RAM, sorted by offset
+    uint32_t pin_count;         //!< number of pinned ranges
+    uint32_t pin_capacity;      //!< size of the pins array
+    uint64_t pinned_bytes;      //!< total size of the pinned ranges
+    uint64_t pinned_reads;      //!< number of reads served from the pinned ranges
+    const char* pin_paths[DMFFS_MAX_PINS];  //!< paths of the "pin=" keys (point into the configuration, valid during init only)
+    size_t pin_lengths[DMFFS_MAX_PINS];     //!< lengths of the pinned paths
+    uint32_t pin_path_count;    //!< number of "pin=" keys
+    dmffs_trace_event_t* trace; //!< access trace (NULL if tracing is disabled)
+    size_t trace_capacity;      //!< maximum number of trace events
+    size_t trace_count;         //!< number of recorded trace events
+    char* trace_file;           //!< file the trace is written to at deinit (optional)
+    const dmffs_backend_t* backend; //!< flash access backend
+    bool flash_ready;           //!< true if the backend has access to the flash
+    const uint8_t* direct;      //!< flash address for direct loads (memory-mapped flash only)
+    char* device;               //!< device path (block backend)
+    void* device_file;          //!< opened device (block backend)
+    uint8_t* block;             //!< cached block (block backend)
+    size_t block_size;          //!< block size (block backend)
+    dmffs_off_t block_offset;   //!< offset of the cached block
+    size_t block_length;        //!< number of valid bytes in the cached block (0 if empty)
+    dmfsi_context_t overlays[DMFFS_MAX_OVERLAYS];   //!< overlay images, lowest precedence first
+    uint32_t overlay_count;     //!< number of overlay images
+    uint32_t level;             //!< precedence of the image in the mount (0 for the base image, n for the n-th overlay)
 };
 
+/**
+ * @brief Decoded TLV header
+ */
+typedef struct {
+    dmffs_off_t offset;         //!< offset of the TLV in flash
+    uint32_t type;              //!< TLV type
+    dmffs_off_t length;         //!< length of the value
+    dmffs_off_t value_offset;   //!< offset of the value in flash
+    dmffs_off_t next_offset;    //!< offset of the TLV following this one
+} dmffs_tlv_header_t;
+
 /**
  * @brief File entry metadata parsed from TLV
  */
 typedef struct {
-    char name[256];             //!< file name
-    uint32_t data_offset;       //!< offset to file data in flash
-    uint32_t data_size;         //!< size of file data
+    dmffs_off_t offset;         //!< offset of the FILE TLV in flash
+    dmffs_off_t name_length;    //!< length of the name (DMFFS_FIELD_NAME)
+    dmffs_off_t data_offset;    //!< offset to file data in flash
+    dmffs_off_t data_size;      //!< size of file data (logical size for sparse files)
+    dmffs_off_t stored_size;    //!< size of the stored content (without holes)
+    dmffs_off_t holes_offset;   //!< offset of the first dmffs_hole_t (sparse files)
+    dmffs_off_t hole_count;     //!< number of holes (0 for regular files)
+    uint32_t encoding;          //!< content encoding (dmffs_encoding_type_t)
+    dmffs_off_t decoded_size;   //!< size of the decoded content (encoded files)
     uint32_t attr;              //!< file attributes
     uint32_t mtime;             //!< modification time
     uint32_t ctime;             //!< creation time
@@ -38,8 +205,9 @@ typedef struct {
  */
 typedef struct {
     dmffs_file_entry_t entry;   //!< file entry metadata
-    long position;              //!< current read position
+    dmffs_off_t position;       //!< current read position
     dmfsi_context_t ctx;        //!< file system context
+    bool read_traced;           //!< true once the first read has been traced
 } dmffs_file_handle_t;
 
 /**
@@ -47,24 +215,52 @@ typedef struct {
  */
 typedef struct {
     dmfsi_context_t ctx;        //!< file system context
-    uint32_t current_offset;    //!< current offset in flash for scanning
+    dmffs_off_t current_offset; //!< current offset in flash for scanning
     int entry_index;            //!< current entry index
-    char path[256];             //!< current directory path
+    char path[DMFFS_MAX_PATH_LEN + 1];  //!< current directory path
     bool in_dir;                //!< true if currently inside a DIR entry
-    uint32_t dir_end_offset;    //!< end offset of current DIR
+    dmffs_off_t dir_end_offset; //!< end offset of current DIR
+    dmffs_off_t dir_offset;     //!< offset of the DIR TLV (if in_dir, single image mounts)
+    uint64_t path_hash;         //!< hash of the directory path
+    uint64_t entry_inode;       //!< inode number of the entry last returned
+    uint32_t entry_type;        //!< TLV type of the entry last returned (0 if none)
+    uint32_t layer;             //!< image currently listed (overlay mounts)
+    uint32_t layer_count;       //!< number of images with the directory (0 without overlays)
+    dmfsi_context_t layers[DMFFS_MAX_OVERLAYS + 1];         //!< images with the directory, highest precedence first
+    dmffs_off_t layer_offset[DMFFS_MAX_OVERLAYS + 1];       //!< offset of the first entry in each image
+    dmffs_off_t layer_end[DMFFS_MAX_OVERLAYS + 1];          //!< end of the directory in each image
 } dmffs_dir_handle_t;
 
+/**
+ * @brief Result of a path lookup in one image of an overlay mount
+ */
+typedef enum {
+    DMFFS_LOOKUP_MISSING = 0,   //!< no entry, the lower images are searched
+    DMFFS_LOOKUP_FOUND,         //!< FILE or DIR entry of the path
+    DMFFS_LOOKUP_HIDDEN,        //!< the path is deleted (WHITEOUT) or a parent is replaced by a file
+} dmffs_lookup_t;
+
+/**
+ * @brief Lookup state of a path of DMFFS_IOCTL_BATCH
+ */
+typedef struct {
+    const char* rest;           //!< remaining path, from the next component to match
+    uint32_t level;             //!< number of directories matched in the current pass
+    uint8_t result;             //!< dmffs_lookup_t result in the images searched so far
+    bool pending;               //!< true while the current pass may still find the path
+} dmffs_batch_state_t;
+
 /**
  * @brief Simple hex string parser for embedded systems
  * 
  * @param hex_str String in format "0x1234ABCD" or "1234ABCD"
  * @return Parsed value or 0 if parsing failed
  */
-static size_t parse_hex_string(const char* hex_str)
+static uint64_t parse_hex_string(const char* hex_str)
 {
     if (!hex_str) return 0;
     
-    size_t result = 0;
+    uint64_t result = 0;
     const char* ptr = hex_str;
     
     // Skip "0x" prefix if present
@@ -96,6 +292,315 @@ static size_t parse_hex_string(const char* hex_str)
     return result;
 }
 
+/**
+ * @brief Simple decimal string parser for embedded systems
+ * 
+ * @param str String with a decimal number
+ * @param length Length of the string
+ * @return Parsed value or 0 if parsing failed
+ */
+static uint64_t parse_decimal_string(const char* str, size_t length)
+{
+    uint64_t result = 0;
+    
+    for (size_t i = 0; i < length; i++) {
+        if (str[i] < '0' || str[i] > '9') {
+            DMOD_LOG_ERROR("Invalid character in decimal (%.*s) string: '%c'\n", (int)length, str, str[i]);
+            return 0;
+        }
+        result = result * 10 + (uint64_t)(str[i] - '0');
+    }
+    
+    return result;
+}
+
+/**
+ * @brief Read raw bytes through Dmod_ReadMemory (dmod backend)
+ * 
+ * @param ctx File system context
+ * @param offset Offset in flash to read from
+ * @param buffer Buffer to store the data
+ * @param size Number of bytes to read
+ * @return Number of bytes read
+ */
+static size_t dmod_backend_read(dmfsi_context_t ctx, dmffs_off_t offset, void* buffer, size_t size)
+{
+    uintptr_t base = (uintptr_t)ctx->flash_addr;
+    
+    // The offset must be addressable on this platform
+    if (offset > (dmffs_off_t)(UINTPTR_MAX - base)) {
+        return 0;
+    }
+    
+    return Dmod_ReadMemory(base + (uintptr_t)offset, buffer, size);
+}
+
+/**
+ * @brief Check that the flash address is configured (dmod backend)
+ * 
+ * @param ctx File system context
+ * @return true if the flash is available, false otherwise
+ */
+static bool dmod_backend_open(dmfsi_context_t ctx)
+{
+    return ctx->flash_addr != NULL;
+}
+
+/**
+ * @brief Enable direct loads from memory-mapped flash (mmap backend)
+ * 
+ * @param ctx File system context
+ * @return true if the flash is available, false otherwise
+ */
+static bool mmap_backend_open(dmfsi_context_t ctx)
+{
+    if (!ctx->flash_addr) {
+        return false;
+    }
+    
+    ctx->direct = (const uint8_t*)ctx->flash_addr;
+    return true;
+}
+
+/**
+ * @brief Read raw bytes with a plain memory copy (mmap backend)
+ * 
+ * @param ctx File system context
+ * @param offset Offset in flash to read from
+ * @param buffer Buffer to store the data
+ * @param size Number of bytes to read
+ * @return Number of bytes read (0 if the range is outside the flash)
+ */
+static inline size_t mmap_backend_read(dmfsi_context_t ctx, dmffs_off_t offset, void* buffer, size_t size)
+{
+    if (offset > ctx->flash_size || size > ctx->flash_size - offset) {
+        return 0;
+    }
+    
+    memcpy(buffer, ctx->direct + offset, size);
+    return size;
+}
+
+/**
+ * @brief Get the address of a flash byte (mmap backend)
+ * 
+ * @param ctx File system context
+ * @param offset Offset in flash
+ * @return Address of the byte
+ */
+static const void* mmap_backend_map(dmfsi_context_t ctx, dmffs_off_t offset)
+{
+    return ctx->direct + offset;
+}
+
+#if DMFFS_ENABLE_BLOCK_BACKEND
+/**
+ * @brief Open the device and allocate the block cache (block backend)
+ * 
+ * The flash size is limited to the size of the device.
+ * 
+ * @param ctx File system context
+ * @return true if the device is available, false otherwise
+ */
+static bool block_backend_open(dmfsi_context_t ctx)
+{
+    if (!ctx->device) {
+        DMOD_LOG_ERROR("Block backend requires the 'device=<path>' config key\n");
+        return false;
+    }
+    
+    ctx->device_file = Dmod_FileOpen(ctx->device, "rb");
+    if (!ctx->device_file) {
+        DMOD_LOG_ERROR("Failed to open block device: %s\n", ctx->device);
+        return false;
+    }
+    
+    if (ctx->block_size == 0) {
+        ctx->block_size = DMFFS_DEFAULT_BLOCK_SIZE;
+    }
+    ctx->block = Dmod_Malloc(ctx->block_size);
+    if (!ctx->block) {
+        DMOD_LOG_ERROR("Failed to allocate block cache of %u bytes\n", (unsigned int)ctx->block_size);
+        Dmod_FileClose(ctx->device_file);
+        ctx->device_file = NULL;
+        return false;
+    }
+    ctx->block_length = 0;
+    
+    dmffs_off_t device_size = Dmod_FileSize(ctx->device_file);
+    if (ctx->flash_size == 0 || ctx->flash_size > device_size) {
+        ctx->flash_size = device_size;
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Close the device and release the block cache (block backend)
+ * 
+ * @param ctx File system context
+ */
+static void block_backend_close(dmfsi_context_t ctx)
+{
+    Dmod_FileClose(ctx->device_file);
+    Dmod_Free(ctx->block);
+    ctx->device_file = NULL;
+    ctx->block = NULL;
+}
+
+/**
+ * @brief Read raw bytes from the device
+ * 
+ * @param ctx File system context
+ * @param offset Offset on the device
+ * @param buffer Buffer to store the data
+ * @param size Number of bytes to read
+ * @return Number of bytes read
+ */
+static size_t read_device(dmfsi_context_t ctx, dmffs_off_t offset, void* buffer, size_t size)
+{
+    if (offset > DMFFS_LONG_MAX || Dmod_FileSeek(ctx->device_file, (long)offset, SEEK_SET) != 0) {
+        return 0;
+    }
+    
+    return Dmod_FileRead(buffer, 1, size, ctx->device_file);
+}
+
+/**
+ * @brief Read raw bytes through the block cache (block backend)
+ * 
+ * Whole aligned blocks are read directly into the buffer, partial blocks
+ * (TLV headers, names) are served from a single cached block.
+ * 
+ * @param ctx File system context
+ * @param offset Offset in flash to read from
+ * @param buffer Buffer to store the data
+ * @param size Number of bytes to read
+ * @return Number of bytes read
+ */
+static size_t block_backend_read(dmfsi_context_t ctx, dmffs_off_t offset, void* buffer, size_t size)
+{
+    uint8_t* output = buffer;
+    size_t done = 0;
+    
+    while (done < size) {
+        dmffs_off_t position = offset + done;
+        dmffs_off_t block_offset = position - position % ctx->block_size;
+        size_t remaining = size - done;
+        
+        if (position == block_offset && remaining >= ctx->block_size) {
+            size_t length = remaining - remaining % ctx->block_size;
+            size_t read = read_device(ctx, position, output + done, length);
+            done += read;
+            if (read != length) {
+                break;
+            }
+            continue;
+        }
+        
+        if (ctx->block_length == 0 || ctx->block_offset != block_offset) {
+            ctx->block_offset = block_offset;
+            ctx->block_length = read_device(ctx, block_offset, ctx->block, ctx->block_size);
+        }
+        
+        size_t start = (size_t)(position - block_offset);
+        if (start >= ctx->block_length) {
+            break;
+        }
+        
+        size_t length = ctx->block_length - start;
+        if (length > remaining) {
+            length = remaining;
+        }
+        memcpy(output + done, ctx->block + start, length);
+        done += length;
+    }
+    
+    return done;
+}
+#endif // DMFFS_ENABLE_BLOCK_BACKEND
+
+/**
+ * @brief Available flash access backends (the first one is the default)
+ */
+static const dmffs_backend_t g_backends[] = {
+    { "dmod",   dmod_backend_open,  NULL,                   dmod_backend_read,  NULL },
+    { "mmap",   mmap_backend_open,  NULL,                   mmap_backend_read,  mmap_backend_map },
+#if DMFFS_ENABLE_BLOCK_BACKEND
+    { "block",  block_backend_open, block_backend_close,    block_backend_read, NULL },
+#endif
+};
+
+/**
+ * @brief Find a backend by name
+ * 
+ * @param name Name of the backend
+ * @param length Length of the name
+ * @return Backend or NULL if there is no backend with this name
+ */
+static const dmffs_backend_t* find_backend(const char* name, size_t length)
+{
+    for (size_t i = 0; i < sizeof(g_backends) / sizeof(g_backends[0]); i++) {
+        if (strlen(g_backends[i].name) == length && strncmp(g_backends[i].name, name, length) == 0) {
+            return &g_backends[i];
+        }
+    }
+    
+    return NULL;
+}
+
+/**
+ * @brief Add an overlay image from an "overlay=" configuration value
+ * 
+ * The value is "<flash_addr>:<flash_size>" (hex) or a device path for the
+ * block backend. The image is opened by open_overlays() once the whole
+ * configuration is known.
+ * 
+ * @param ctx DMFSI context of the base image
+ * @param value Value of the key
+ * @param length Length of the value
+ * @return true on success, false on error
+ */
+static bool add_overlay(dmfsi_context_t ctx, const char* value, size_t length)
+{
+    if (ctx->overlay_count >= DMFFS_MAX_OVERLAYS) {
+        DMOD_LOG_ERROR("Too many overlay images (at most %u)\n", (unsigned int)DMFFS_MAX_OVERLAYS);
+        return false;
+    }
+    
+    dmfsi_context_t overlay = Dmod_Malloc(sizeof(struct dmfsi_context));
+    if (!overlay) {
+        DMOD_LOG_ERROR("Failed to allocate overlay context\n");
+        return false;
+    }
+    memset(overlay, 0, sizeof(struct dmfsi_context));
+    overlay->magic = MAGIC_DMFSS_CTX;
+    ctx->overlays[ctx->overlay_count++] = overlay;
+    
+    const char* separator = memchr(value, ':', length);
+    if (separator) {
+        char value_str[20] = {0};
+        size_t addr_len = (size_t)(separator - value);
+        strncpy(value_str, value, addr_len < 19 ? addr_len : 19);
+        overlay->flash_addr = (const void*)(uintptr_t)parse_hex_string(value_str);
+        
+        size_t size_len = length - addr_len - 1;
+        memset(value_str, 0, sizeof(value_str));
+        strncpy(value_str, separator + 1, size_len < 19 ? size_len : 19);
+        overlay->flash_size = parse_hex_string(value_str);
+        return true;
+    }
+    
+    overlay->device = Dmod_Malloc(length + 1);
+    if (!overlay->device) {
+        DMOD_LOG_ERROR("Failed to allocate overlay device path\n");
+        return false;
+    }
+    memcpy(overlay->device, value, length);
+    overlay->device[length] = '\0';
+    return true;
+}
+
 /**
  * @brief Parse configuration string for DMFFS
  * 
@@ -106,6 +611,10 @@ static size_t parse_hex_string(const char* hex_str)
 static bool parse_config_string( dmfsi_context_t ctx, const char* config )
 {
     // Example config string: "flash_addr=0x08000000;flash_size=0x100000"
+    // Optional keys: "trace=<events>", "trace_file=<path>",
+    // "backend=dmod|mmap|block", "device=<path>", "block_size=<bytes>" and
+    // "overlay=<flash_addr>:<flash_size>" or "overlay=<device>" (repeatable),
+    // "ram_index=<entries>", "pin=<path>" (repeatable)
     const char* ptr = config;
     while (*ptr) {
         // Parse key
@@ -129,11 +638,55 @@ static bool parse_config_string( dmfsi_context_t ctx, const char* config )
         if (key_len == 10 && strncmp(key_start, "flash_addr", 10) == 0) {
             char value_str[20] = {0};
             strncpy(value_str, value_start, value_len < 19 ? value_len : 19);
-            ctx->flash_addr = (const void*)parse_hex_string(value_str);
+            ctx->flash_addr = (const void*)(uintptr_t)parse_hex_string(value_str);
         } else if (key_len == 10 && strncmp(key_start, "flash_size", 10) == 0) {
             char value_str[20] = {0};
             strncpy(value_str, value_start, value_len < 19 ? value_len : 19);
             ctx->flash_size = parse_hex_string(value_str);
+#if DMFFS_ENABLE_TRACE
+        } else if (key_len == 5 && strncmp(key_start, "trace", 5) == 0) {
+            ctx->trace_capacity = (size_t)parse_decimal_string(value_start, value_len);
+        } else if (key_len == 10 && strncmp(key_start, "trace_file", 10) == 0) {
+            Dmod_Free(ctx->trace_file);
+            ctx->trace_file = Dmod_Malloc(value_len + 1);
+            if (!ctx->trace_file) {
+                DMOD_LOG_ERROR("Failed to allocate trace file path\n");
+                return false;
+            }
+            memcpy(ctx->trace_file, value_start, value_len);
+            ctx->trace_file[value_len] = '\0';
+#endif
+        } else if (key_len == 7 && strncmp(key_start, "backend", 7) == 0) {
+            ctx->backend = find_backend(value_start, value_len);
+            if (!ctx->backend) {
+                DMOD_LOG_ERROR("Unknown backend: '%.*s'\n", (int)value_len, value_start);
+                return false;
+            }
+        } else if (key_len == 6 && strncmp(key_start, "device", 6) == 0) {
+            Dmod_Free(ctx->device);
+            ctx->device = Dmod_Malloc(value_len + 1);
+            if (!ctx->device) {
+                DMOD_LOG_ERROR("Failed to allocate device path\n");
+                return false;
+            }
+            memcpy(ctx->device, value_start, value_len);
+            ctx->device[value_len] = '\0';
+        } else if (key_len == 10 && strncmp(key_start, "block_size", 10) == 0) {
+            ctx->block_size = (size_t)parse_decimal_string(value_start, value_len);
+        } else if (key_len == 9 && strncmp(key_start, "ram_index", 9) == 0) {
+            ctx->ram_index_entries = (uint32_t)parse_decimal_string(value_start, value_len);
+        } else if (key_len == 3 && strncmp(key_start, "pin", 3) == 0) {
+            if (ctx->pin_path_count >= DMFFS_MAX_PINS) {
+                DMOD_LOG_ERROR("Too many pinned paths (at most %u)\n", (unsigned int)DMFFS_MAX_PINS);
+                return false;
+            }
+            ctx->pin_paths[ctx->pin_path_count] = value_start;
+            ctx->pin_lengths[ctx->pin_path_count] = value_len;
+            ctx->pin_path_count++;
+        } else if (key_len == 7 && strncmp(key_start, "overlay", 7) == 0) {
+            if (!add_overlay(ctx, value_start, value_len)) {
+                return false;
+            }
         } else {
             DMOD_LOG_WARN("Unknown config key: '%.*s'\n", (int)key_len, key_start);
         }
@@ -144,31 +697,114 @@ static bool parse_config_string( dmfsi_context_t ctx, const char* config )
     return true;
 }
 
+/**
+ * @brief Find the RAM copy of a range of the image
+ * 
+ * @param ctx File system context
+ * @param offset Offset of the range in flash
+ * @param size Size of the range
+ * @return Copy of the range, NULL if the range is not pinned completely
+ */
+static const uint8_t* find_pinned(dmfsi_context_t ctx, dmffs_off_t offset, dmffs_off_t size)
+{
+    // Last range starting at or before the offset
+    uint32_t low = 0;
+    uint32_t high = ctx->pin_count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (ctx->pins[middle].offset <= offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low == 0) {
+        return NULL;
+    }
+    
+    const dmffs_pin_t* pin = &ctx->pins[low - 1];
+    if (offset - pin->offset > pin->size || size > pin->size - (offset - pin->offset)) {
+        return NULL;
+    }
+    
+    return pin->data + (offset - pin->offset);
+}
+
+/**
+ * @brief Read raw bytes from flash
+ * 
+ * Memory-mapped flash is loaded in place, so the header and value readers
+ * do not go through the backend call. Pinned ranges are copied from RAM.
+ * 
+ * @param ctx File system context
+ * @param offset Offset in flash to read from
+ * @param buffer Buffer to store the data
+ * @param size Number of bytes to read
+ * @return Number of bytes read
+ */
+static inline size_t read_flash(dmfsi_context_t ctx, dmffs_off_t offset, void* buffer, size_t size)
+{
+    if (ctx->pin_count > 0) {
+        const uint8_t* pinned = find_pinned(ctx, offset, size);
+        if (pinned) {
+            ctx->pinned_reads++;
+            memcpy(buffer, pinned, size);
+            return size;
+        }
+    }
+    
+    ctx->read_count++;
+    ctx->read_bytes += size;
+    
+    if (ctx->direct) {
+        return mmap_backend_read(ctx, offset, buffer, size);
+    }
+    
+    return ctx->backend->read(ctx, offset, buffer, size);
+}
+
 /**
  * @brief Read a TLV header from flash
  * 
+ * Both the compact and the large header encodings are accepted. Headers
+ * whose value does not fit into the flash are rejected.
+ * 
  * @param ctx File system context
  * @param offset Offset in flash to read from
- * @param type Pointer to store TLV type
- * @param length Pointer to store TLV length
+ * @param header Pointer to store the decoded header
  * @return true if successful, false otherwise
  */
-static bool read_tlv_header(dmfsi_context_t ctx, uint32_t offset, uint32_t* type, uint32_t* length)
+static bool read_tlv_header(dmfsi_context_t ctx, dmffs_off_t offset, dmffs_tlv_header_t* header)
 {
-    if (!ctx || !type || !length) return false;
-    
-    uintptr_t flash_addr = (uintptr_t)ctx->flash_addr + offset;
+    if (!ctx || !header) return false;
     
-    // Read type (4 bytes)
-    if (Dmod_ReadMemory(flash_addr, type, sizeof(uint32_t)) != sizeof(uint32_t)) {
+    // Read type and length (8 bytes)
+    uint32_t raw[2];
+    if (read_flash(ctx, offset, raw, sizeof(raw)) != sizeof(raw)) {
         return false;
     }
     
-    // Read length (4 bytes)
-    if (Dmod_ReadMemory(flash_addr + sizeof(uint32_t), length, sizeof(uint32_t)) != sizeof(uint32_t)) {
+    header->offset = offset;
+    header->type = raw[0];
+    header->length = raw[1];
+    header->value_offset = offset + DMFFS_TLV_HEADER_SIZE;
+    
+    // Large TLV - the real length follows the compact header
+    if (raw[1] == DMFFS_TLV_LENGTH_LARGE) {
+        uint64_t large_length;
+        if (read_flash(ctx, header->value_offset, &large_length, sizeof(large_length)) != sizeof(large_length)) {
+            return false;
+        }
+        header->length = large_length;
+        header->value_offset += sizeof(uint64_t);
+    }
+    
+    // Validate the value range (this also protects against overflows)
+    if (header->value_offset > ctx->flash_size || header->length > ctx->flash_size - header->value_offset) {
         return false;
     }
     
+    header->next_offset = header->value_offset + header->length;
     return true;
 }
 
@@ -181,231 +817,2116 @@ static bool read_tlv_header(dmfsi_context_t ctx, uint32_t offset, uint32_t* type
  * @param length Number of bytes to read
  * @return Number of bytes read
  */
-static size_t read_tlv_value(dmfsi_context_t ctx, uint32_t offset, void* buffer, uint32_t length)
+static size_t read_tlv_value(dmfsi_context_t ctx, dmffs_off_t offset, void* buffer, size_t length)
 {
     if (!ctx || !buffer || length == 0) return 0;
     
-    uintptr_t flash_addr = (uintptr_t)ctx->flash_addr + offset;
-    return Dmod_ReadMemory(flash_addr, buffer, length);
+    return read_flash(ctx, offset, buffer, length);
+}
+
+/**
+ * @brief Check if a TLV holds the name of an entry
+ * 
+ * @param header TLV header
+ * @return true for NAME and NAME_REF TLVs
+ */
+static inline bool is_name_tlv(const dmffs_tlv_header_t* header)
+{
+    return header->type == DMFFS_TLV_TYPE_NAME || header->type == DMFFS_TLV_TYPE_NAME_REF;
 }
 
 /**
- * @brief Parse a file entry from TLV structure
+ * @brief Read the next byte of the string table
  * 
  * @param ctx File system context
- * @param offset Offset to FILE TLV entry in flash
- * @param entry Pointer to store parsed file entry
- * @return Offset to next TLV entry, or 0 on error
+ * @param reader String table reader
+ * @param byte Pointer to store the byte
+ * @return true if successful, false at the end of the name data
  */
-static uint32_t parse_file_entry(dmfsi_context_t ctx, uint32_t offset, dmffs_file_entry_t* entry)
+static bool read_string_byte(dmfsi_context_t ctx, dmffs_string_reader_t* reader, uint8_t* byte)
 {
-    if (!ctx || !entry) return 0;
-    
-    uint32_t type, length;
-    if (!read_tlv_header(ctx, offset, &type, &length)) {
-        return 0;
+    if (reader->position == reader->length) {
+        if (reader->length + DMFFS_STRINGS_BLOCK_SIZE > sizeof(reader->chunk)) {
+            reader->offset += reader->length;
+            reader->position = 0;
+            reader->length = 0;
+        }
+        
+        dmffs_off_t offset = reader->offset + reader->length;
+        if (offset >= reader->end) {
+            return false;
+        }
+        
+        size_t length = (reader->end - offset < DMFFS_STRINGS_BLOCK_SIZE) ? (size_t)(reader->end - offset) : DMFFS_STRINGS_BLOCK_SIZE;
+        if (read_flash(ctx, offset, reader->chunk + reader->length, length) != length) {
+            return false;
+        }
+        reader->length += length;
+    }
+    
+    *byte = reader->chunk[reader->position++];
+    return true;
+}
+
+/**
+ * @brief Move a string table reader to an offset of the name data
+ * 
+ * The buffered bytes are kept if they hold the offset.
+ * 
+ * @param ctx File system context
+ * @param reader String table reader
+ * @param offset Offset in flash
+ */
+static void seek_string_reader(dmfsi_context_t ctx, dmffs_string_reader_t* reader, dmffs_off_t offset)
+{
+    reader->end = ctx->strings_offset + ctx->strings_size;
+    if (offset >= reader->offset && offset - reader->offset < reader->length) {
+        reader->position = (size_t)(offset - reader->offset);
+        return;
+    }
+    
+    reader->offset = offset;
+    reader->length = 0;
+    reader->position = 0;
+}
+
+/**
+ * @brief Decode the next name of the cached block of the string table
+ * 
+ * @param ctx File system context
+ * @return true if successful, false if the name data is damaged (the cache is dropped)
+ */
+static bool decode_cached_name(dmfsi_context_t ctx)
+{
+    dmffs_string_reader_t* reader = &ctx->strings_reader;
+    uint8_t prefix;
+    uint8_t suffix;
+    
+    if (!read_string_byte(ctx, reader, &prefix) || !read_string_byte(ctx, reader, &suffix) || prefix > ctx->strings_length) {
+        ctx->strings_count = 0;
+        return false;
+    }
+    
+    for (size_t i = prefix; i < (size_t)prefix + suffix; i++) {
+        uint8_t byte;
+        if (!read_string_byte(ctx, reader, &byte)) {
+            ctx->strings_count = 0;
+            return false;
+        }
+        if (i < sizeof(ctx->strings_name)) {
+            ctx->strings_name[i] = (char)byte;
+        }
+    }
+    
+    ctx->strings_length = (size_t)prefix + suffix;
+    ctx->strings_count++;
+    return true;
+}
+
+/**
+ * @brief Compare a name with the cached name of the string table
+ * 
+ * @param ctx File system context
+ * @param name Name to compare (not null-terminated, at most DMFFS_MAX_NAME_LEN bytes)
+ * @param length Length of the name
+ * @return Negative if the name sorts before the cached one, 0 if they are equal, positive otherwise
+ */
+static int compare_cached_name(dmfsi_context_t ctx, const char* name, size_t length)
+{
+    size_t common = (length < ctx->strings_length) ? length : ctx->strings_length;
+    int order = memcmp(name, ctx->strings_name, common);
+    
+    if (order != 0 || length == ctx->strings_length) {
+        return order;
+    }
+    return (length < ctx->strings_length) ? -1 : 1;
+}
+
+/**
+ * @brief Decode or compare a name of the string table
+ * 
+ * The context keeps the last decoded name with the reader behind it, so
+ * the names of a block are decoded once while the siblings of a directory
+ * are compared, and a later name of the same block continues the walk
+ * instead of starting over. The table is sorted, so a comparison first
+ * places the wanted name before or after the cached one and rejects a
+ * reference on the other side without reading.
+ * 
+ * @param ctx File system context
+ * @param ref NAME_REF value
+ * @param match Name to compare with (not null-terminated, as long as the reference says, NULL to decode the name)
+ * @param name Buffer to store the decoded name (truncated to fit)
+ * @param name_size Size of the buffer
+ * @return true if the name was decoded or matches, false otherwise
+ */
+static bool read_table_name(dmfsi_context_t ctx, uint32_t ref, const char* match, char* name, size_t name_size)
+{
+    size_t length = DMFFS_NAME_REF_LENGTH(ref);
+    uint32_t index = DMFFS_NAME_REF_INDEX(ref);
+    dmffs_off_t block = DMFFS_NAME_REF_BLOCK(ref);
+    
+    if (block >= ctx->strings_size) {
+        return false;
+    }
+    
+    bool cached = ctx->strings_count > 0 && ctx->strings_block == block;
+    if (match && ctx->strings_count > 0) {
+        uint32_t current = ctx->strings_count - 1;
+        int order = compare_cached_name(ctx, match, length);
+        int position = (block != ctx->strings_block) ? ((block < ctx->strings_block) ? -1 : 1) :
+                       (index != current) ? ((index < current) ? -1 : 1) : 0;
+        if ((order > 0) - (order < 0) != position) {
+            return false;
+        }
+    }
+    
+    if (!cached || index + 1 < ctx->strings_count) {
+        seek_string_reader(ctx, &ctx->strings_reader, ctx->strings_offset + block);
+        ctx->strings_block = block;
+        ctx->strings_count = 0;
+        ctx->strings_length = 0;
+    }
+    
+    while (ctx->strings_count <= index) {
+        if (!decode_cached_name(ctx)) {
+            return false;
+        }
+        // A name sorting after the wanted one ends the walk
+        if (match && ctx->strings_count <= index && compare_cached_name(ctx, match, length) < 0) {
+            return false;
+        }
+    }
+    
+    if (match) {
+        return ctx->strings_length == length && compare_cached_name(ctx, match, length) == 0;
+    }
+    
+    size_t copied = (ctx->strings_length < name_size - 1) ? ctx->strings_length : name_size - 1;
+    if (copied > sizeof(ctx->strings_name)) {
+        copied = sizeof(ctx->strings_name);
+    }
+    memcpy(name, ctx->strings_name, copied);
+    name[copied] = '\0';
+    return ctx->strings_length == length;
+}
+
+/**
+ * @brief Read the value of a NAME_REF TLV
+ * 
+ * @param ctx File system context
+ * @param header NAME_REF TLV header
+ * @param ref Pointer to store the reference
+ * @return true if successful, false otherwise
+ */
+static bool read_name_ref(dmfsi_context_t ctx, const dmffs_tlv_header_t* header, uint32_t* ref)
+{
+    return header->length == sizeof(*ref) && read_tlv_value(ctx, header->value_offset, ref, sizeof(*ref)) == sizeof(*ref);
+}
+
+/**
+ * @brief Read a NAME or NAME_REF TLV value into a string buffer
+ * 
+ * @param ctx File system context
+ * @param header NAME or NAME_REF TLV header
+ * @param name Buffer to store the name
+ * @param name_size Size of the buffer (the name is truncated to fit)
+ * @return Length of the whole name (0 if it could not be read)
+ */
+static size_t read_tlv_name(dmfsi_context_t ctx, const dmffs_tlv_header_t* header, char* name, size_t name_size)
+{
+    name[0] = '\0';
+    
+    if (header->type == DMFFS_TLV_TYPE_NAME_REF) {
+        uint32_t ref;
+        if (!read_name_ref(ctx, header, &ref) || !read_table_name(ctx, ref, NULL, name, name_size)) {
+            name[0] = '\0';
+            return 0;
+        }
+        return DMFFS_NAME_REF_LENGTH(ref);
+    }
+    
+    size_t length = (header->length < name_size - 1) ? (size_t)header->length : name_size - 1;
+    if (length > 0) {
+        read_tlv_value(ctx, header->value_offset, name, length);
+        name[length] = '\0';
+    }
+    
+    return (size_t)header->length;
+}
+
+/**
+ * @brief Resolve a DATA_REF TLV to the location of the file content
+ * 
+ * @param ctx File system context
+ * @param header DATA_REF TLV header
+ * @param entry File entry to update
+ * @return true if the reference points into the data region, false otherwise
+ */
+static bool read_data_ref(dmfsi_context_t ctx, const dmffs_tlv_header_t* header, dmffs_file_entry_t* entry)
+{
+    dmffs_data_ref64_t ref;
+    
+    if (header->length == sizeof(dmffs_data_ref_t)) {
+        dmffs_data_ref_t compact;
+        if (read_tlv_value(ctx, header->value_offset, &compact, sizeof(compact)) != sizeof(compact)) {
+            return false;
+        }
+        ref.offset = compact.offset;
+        ref.size = compact.size;
+    } else if (header->length == sizeof(dmffs_data_ref64_t)) {
+        if (read_tlv_value(ctx, header->value_offset, &ref, sizeof(ref)) != sizeof(ref)) {
+            return false;
+        }
+    } else {
+        return false;
+    }
+    
+    // The content must lie within the data region
+    if (ref.offset > ctx->data_size || ref.size > ctx->data_size - ref.offset) {
+        return false;
+    }
+    
+    entry->data_offset = ctx->data_offset + ref.offset;
+    entry->data_size = ref.size;
+    return true;
+}
+
+/**
+ * @brief Parse the requested fields of a file entry from TLV structure
+ * 
+ * Only the values of the requested fields are read, and the nested TLVs
+ * are decoded only until all of them are found. The DATA or DATA_REF TLV
+ * completes DMFFS_FIELD_DATA, since make_dmffs writes HOLES and ENCODING
+ * in front of it. Fields that are not requested keep their defaults.
+ * 
+ * @param ctx File system context
+ * @param offset Offset to FILE TLV entry in flash
+ * @param entry Pointer to store parsed file entry
+ * @param fields Fields to decode (DMFFS_FIELD_* flags)
+ * @param name Buffer to store the name (DMFFS_FIELD_NAME, truncated to fit)
+ * @param name_size Size of the name buffer
+ * @return Offset to next TLV entry, or 0 on error
+ */
+static dmffs_off_t parse_file_entry(dmfsi_context_t ctx, dmffs_off_t offset, dmffs_file_entry_t* entry,
+                                    uint32_t fields, char* name, size_t name_size)
+{
+    if (!ctx || !entry || ((fields & DMFFS_FIELD_NAME) && (!name || name_size == 0))) return 0;
+    
+    dmffs_tlv_header_t header;
+    if (!read_tlv_header(ctx, offset, &header)) {
+        return 0;
     }
     
-    if (type != DMFFS_TLV_TYPE_FILE) {
+    if (header.type != DMFFS_TLV_TYPE_FILE) {
         return 0;
     }
     
     // Initialize entry
     memset(entry, 0, sizeof(dmffs_file_entry_t));
+    entry->offset = offset;
     entry->attr = DMFSI_ATTR_READONLY;
+    dmffs_holes_t holes = {0};
+    uint32_t found = 0;
+    if (fields & DMFFS_FIELD_NAME) {
+        name[0] = '\0';
+    }
     
     // Parse nested TLVs within FILE entry
-    uint32_t nested_offset = offset + 8; // Skip FILE TLV header
-    uint32_t end_offset = offset + 8 + length;
+    dmffs_off_t nested_offset = header.value_offset;
+    dmffs_off_t end_offset = header.next_offset;
     
-    while (nested_offset < end_offset) {
-        uint32_t nested_type, nested_length;
-        if (!read_tlv_header(ctx, nested_offset, &nested_type, &nested_length)) {
+    while (nested_offset < end_offset && (found & fields) != fields) {
+        dmffs_tlv_header_t nested;
+        if (!read_tlv_header(ctx, nested_offset, &nested)) {
             break;
         }
         
-        uint32_t value_offset = nested_offset + 8;
-        
-        switch (nested_type) {
+        switch (nested.type) {
             case DMFFS_TLV_TYPE_NAME:
-                if (nested_length > 0 && nested_length <= sizeof(entry->name) - 1) {
-                    read_tlv_value(ctx, value_offset, entry->name, nested_length);
-                    entry->name[nested_length] = '\0';
-                } else if (nested_length > sizeof(entry->name) - 1) {
-                    // Truncate to fit
-                    read_tlv_value(ctx, value_offset, entry->name, sizeof(entry->name) - 1);
-                    entry->name[sizeof(entry->name) - 1] = '\0';
-                } else {
-                    // Zero-length name
-                    entry->name[0] = '\0';
+            case DMFFS_TLV_TYPE_NAME_REF:
+                if (fields & DMFFS_FIELD_NAME) {
+                    entry->name_length = read_tlv_name(ctx, &nested, name, name_size);
                 }
+                found |= DMFFS_FIELD_NAME;
                 break;
                 
             case DMFFS_TLV_TYPE_DATA:
-                entry->data_offset = value_offset;
-                entry->data_size = nested_length;
+                entry->data_offset = nested.value_offset;
+                entry->data_size = nested.length;
+                found |= DMFFS_FIELD_DATA;
+                break;
+            
+            case DMFFS_TLV_TYPE_DATA_REF:
+                if (fields & DMFFS_FIELD_DATA) {
+                    read_data_ref(ctx, &nested, entry);
+                }
+                found |= DMFFS_FIELD_DATA;
+                break;
+            
+            case DMFFS_TLV_TYPE_ENCODING:
+            {
+                dmffs_encoding_t encoding;
+                if ((fields & DMFFS_FIELD_DATA) && nested.length >= sizeof(encoding) &&
+                    read_tlv_value(ctx, nested.value_offset, &encoding, sizeof(encoding)) == sizeof(encoding)) {
+                    entry->encoding = encoding.type;
+                    entry->decoded_size = encoding.size;
+                }
+                break;
+            }
+            
+            case DMFFS_TLV_TYPE_HOLES:
+                if ((fields & DMFFS_FIELD_DATA) && nested.length >= sizeof(holes) &&
+                    read_tlv_value(ctx, nested.value_offset, &holes, sizeof(holes)) == sizeof(holes)) {
+                    entry->holes_offset = nested.value_offset + sizeof(holes);
+                    entry->hole_count = (nested.length - sizeof(holes)) / sizeof(dmffs_hole_t);
+                }
                 break;
                 
             case DMFFS_TLV_TYPE_DATE:
-                if (nested_length >= sizeof(uint32_t)) {
-                    read_tlv_value(ctx, value_offset, &entry->mtime, sizeof(uint32_t));
+                if ((fields & DMFFS_FIELD_TIME) && nested.length >= sizeof(uint32_t)) {
+                    read_tlv_value(ctx, nested.value_offset, &entry->mtime, sizeof(uint32_t));
                     entry->ctime = entry->mtime;
                 }
+                found |= DMFFS_FIELD_TIME;
                 break;
                 
             case DMFFS_TLV_TYPE_ATTR:
-                if (nested_length >= sizeof(uint32_t)) {
-                    read_tlv_value(ctx, value_offset, &entry->attr, sizeof(uint32_t));
+                if ((fields & DMFFS_FIELD_ATTR) && nested.length >= sizeof(uint32_t)) {
+                    read_tlv_value(ctx, nested.value_offset, &entry->attr, sizeof(uint32_t));
                 }
+                found |= DMFFS_FIELD_ATTR;
                 break;
                 
             // Skip OWNER, GROUP and unknown tags
             default:
                 break;
         }
-        
-        nested_offset += 8 + nested_length;
+        
+        nested_offset = nested.next_offset;
+    }
+    
+    // Sparse files report their logical size
+    entry->stored_size = entry->data_size;
+    if (entry->hole_count > 0) {
+        entry->data_size = holes.size;
+    }
+    if (entry->encoding == DMFFS_ENCODING_IDENTITY) {
+        entry->decoded_size = entry->data_size;
+    }
+    
+    return end_offset;
+}
+
+/**
+ * @brief Read the name of a FILE or DIR entry
+ * 
+ * @param ctx File system context
+ * @param entry FILE or DIR TLV header
+ * @param name Buffer to store the name
+ * @param name_size Size of the buffer
+ * @return true if the NAME TLV was found, false otherwise
+ */
+static bool read_entry_name(dmfsi_context_t ctx, const dmffs_tlv_header_t* entry, char* name, size_t name_size)
+{
+    dmffs_off_t nested_offset = entry->value_offset;
+    
+    name[0] = '\0';
+    while (nested_offset < entry->next_offset) {
+        dmffs_tlv_header_t nested;
+        if (!read_tlv_header(ctx, nested_offset, &nested)) {
+            break;
+        }
+        
+        if (is_name_tlv(&nested) && nested.length > 0) {
+            read_tlv_name(ctx, &nested, name, name_size);
+            return true;
+        }
+        
+        nested_offset = nested.next_offset;
+    }
+    
+    return false;
+}
+
+/**
+ * @brief Compare the name of a FILE, DIR or WHITEOUT entry
+ * 
+ * The length of the NAME TLV (or the length held by the NAME_REF) is
+ * compared first, so the name is only read from flash for entries with a
+ * name of the same length.
+ * 
+ * @param ctx File system context
+ * @param entry Entry TLV header
+ * @param name Name to compare with (not null-terminated)
+ * @param name_length Length of the name
+ * @return true if the entry has this name, false otherwise
+ */
+static bool match_entry_name(dmfsi_context_t ctx, const dmffs_tlv_header_t* entry, const char* name, size_t name_length)
+{
+    char entry_name[DMFFS_MAX_NAME_LEN + 1];
+    dmffs_off_t nested_offset = entry->value_offset;
+    
+    if (name_length == 0 || name_length >= sizeof(entry_name)) {
+        return false;
+    }
+    
+    while (nested_offset < entry->next_offset) {
+        dmffs_tlv_header_t nested;
+        if (!read_tlv_header(ctx, nested_offset, &nested)) {
+            break;
+        }
+        
+        if (nested.type == DMFFS_TLV_TYPE_NAME) {
+            return nested.length == name_length &&
+                   read_tlv_value(ctx, nested.value_offset, entry_name, name_length) == name_length &&
+                   memcmp(entry_name, name, name_length) == 0;
+        }
+        
+        if (nested.type == DMFFS_TLV_TYPE_NAME_REF) {
+            uint32_t ref;
+            return read_name_ref(ctx, &nested, &ref) && DMFFS_NAME_REF_LENGTH(ref) == name_length &&
+                   read_table_name(ctx, ref, name, NULL, 0);
+        }
+        
+        nested_offset = nested.next_offset;
+    }
+    
+    return false;
+}
+
+/**
+ * @brief Parse the metadata of a DIR entry
+ * 
+ * @param ctx File system context
+ * @param dir DIR TLV header
+ * @param name Buffer to store the name (NULL if the name is not needed)
+ * @param name_size Size of the buffer
+ * @param attr Pointer to store the attributes
+ * @param time Pointer to store the modification time
+ */
+static void parse_dir_entry(dmfsi_context_t ctx, const dmffs_tlv_header_t* dir, char* name, size_t name_size, uint32_t* attr, uint32_t* time)
+{
+    dmffs_off_t nested_offset = dir->value_offset;
+    
+    if (name) {
+        name[0] = '\0';
+    }
+    *attr = DMFSI_ATTR_DIRECTORY | DMFSI_ATTR_READONLY;
+    *time = 0;
+    
+    while (nested_offset < dir->next_offset) {
+        dmffs_tlv_header_t nested;
+        if (!read_tlv_header(ctx, nested_offset, &nested)) {
+            break;
+        }
+        
+        // The metadata of a directory precedes its entries
+        if (nested.type == DMFFS_TLV_TYPE_FILE || nested.type == DMFFS_TLV_TYPE_DIR) {
+            break;
+        }
+        
+        if (is_name_tlv(&nested) && nested.length > 0) {
+            if (name) {
+                read_tlv_name(ctx, &nested, name, name_size);
+            }
+        } else if (nested.type == DMFFS_TLV_TYPE_ATTR && nested.length >= sizeof(uint32_t)) {
+            read_tlv_value(ctx, nested.value_offset, attr, sizeof(uint32_t));
+            *attr |= DMFSI_ATTR_DIRECTORY; // Ensure directory flag
+        } else if (nested.type == DMFFS_TLV_TYPE_DATE && nested.length >= sizeof(uint32_t)) {
+            read_tlv_value(ctx, nested.value_offset, time, sizeof(uint32_t));
+        }
+        
+        nested_offset = nested.next_offset;
+    }
+}
+
+/**
+ * @brief Search for a FILE, DIR or WHITEOUT entry by name within a range of entries
+ * 
+ * @param ctx File system context
+ * @param offset Offset of the first entry
+ * @param end_offset End of the range (end of the parent DIR or of the metadata)
+ * @param name Name to search for
+ * @param header Pointer to store the header of the found entry
+ * @return true if entry found, false otherwise
+ */
+static bool find_entry(dmfsi_context_t ctx, dmffs_off_t offset, dmffs_off_t end_offset, const char* name, dmffs_tlv_header_t* header)
+{
+    size_t name_length = strlen(name);
+    
+    while (offset < end_offset) {
+        if (!read_tlv_header(ctx, offset, header)) {
+            break;
+        }
+        
+        if (header->type == DMFFS_TLV_TYPE_END || header->type == DMFFS_TLV_TYPE_INVALID) {
+            break;
+        }
+        
+        if ((header->type == DMFFS_TLV_TYPE_FILE || header->type == DMFFS_TLV_TYPE_DIR ||
+             header->type == DMFFS_TLV_TYPE_WHITEOUT) &&
+            match_entry_name(ctx, header, name, name_length)) {
+            return true;
+        }
+        
+        offset = header->next_offset;
+    }
+    
+    return false;
+}
+
+/**
+ * @brief Hash a path for the path filter and the path index
+ * 
+ * The path is hashed in the canonical form used by make_dmffs: components
+ * separated by single slashes, without a trailing slash.
+ * 
+ * @param path Path without the leading slash
+ * @return FNV-1a 64-bit hash of the canonical path
+ */
+static uint64_t hash_path(const char* path)
+{
+    uint64_t hash = DMFFS_BLOOM_HASH_INIT;
+    bool first = true;
+    
+    while (*path) {
+        if (*path == '/') {
+            path++;
+            continue;
+        }
+        
+        if (!first) {
+            hash = (hash ^ '/') * DMFFS_BLOOM_HASH_PRIME;
+        }
+        for (; *path && *path != '/'; path++) {
+            hash = (hash ^ (uint8_t)*path) * DMFFS_BLOOM_HASH_PRIME;
+        }
+        first = false;
+    }
+    
+    return hash;
+}
+
+/**
+ * @brief Extend the hash of a path by one component
+ * 
+ * @param hash Hash of the parent path (DMFFS_BLOOM_HASH_INIT for root entries)
+ * @param first true for root entries (no separator is hashed)
+ * @param name Name of the component (not null-terminated)
+ * @param length Length of the name
+ * @return Hash of the path, as computed by hash_path()
+ */
+static uint64_t hash_component(uint64_t hash, bool first, const char* name, size_t length)
+{
+    if (!first) {
+        hash = (hash ^ '/') * DMFFS_BLOOM_HASH_PRIME;
+    }
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * DMFFS_BLOOM_HASH_PRIME;
+    }
+    
+    return hash;
+}
+
+/**
+ * @brief Check the path filter of the image for a path hash
+ * 
+ * @param ctx File system context
+ * @param hash Hash of the path (see hash_path())
+ * @return false if the path is definitely not in the image, true otherwise
+ */
+static bool hash_may_exist(dmfsi_context_t ctx, uint64_t hash)
+{
+    if (ctx->bloom_bits == 0) {
+        return true;
+    }
+    
+    uint32_t h1 = (uint32_t)hash;
+    uint32_t h2 = (uint32_t)(hash >> 32);
+    for (uint32_t i = 0; i < ctx->bloom_hashes; i++) {
+        uint32_t bit = (uint32_t)(((uint64_t)h1 + (uint64_t)i * h2) % ctx->bloom_bits);
+        uint8_t byte;
+        if (read_flash(ctx, ctx->bloom_offset + bit / 8, &byte, 1) != 1) {
+            return true;
+        }
+        if ((byte & (1u << (bit % 8))) == 0) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Check the path filter of the image
+ * 
+ * @param ctx File system context
+ * @param path Path without the leading slash
+ * @return false if the path is definitely not in the image, true otherwise
+ */
+static bool path_may_exist(dmfsi_context_t ctx, const char* path)
+{
+    return ctx->bloom_bits == 0 || hash_may_exist(ctx, hash_path(path));
+}
+
+/**
+ * @brief Verify the entry a path index points to
+ * 
+ * @param ctx File system context
+ * @param offset Offset of the entry
+ * @param last Last component of the path (not null-terminated)
+ * @param last_length Length of the last component
+ * @param dir_only true if the entry has to be a directory
+ * @param header Pointer to store the header of the FILE, DIR or WHITEOUT entry
+ * @return true if the entry has the name of the path, false otherwise
+ */
+static bool verify_indexed_entry(dmfsi_context_t ctx, dmffs_off_t offset, const char* last, size_t last_length, bool dir_only, dmffs_tlv_header_t* header)
+{
+    if (!read_tlv_header(ctx, offset, header) ||
+        (header->type != DMFFS_TLV_TYPE_DIR && dir_only) ||
+        (header->type != DMFFS_TLV_TYPE_DIR && header->type != DMFFS_TLV_TYPE_FILE &&
+         header->type != DMFFS_TLV_TYPE_WHITEOUT)) {
+        return false;
+    }
+    
+    return match_entry_name(ctx, header, last, last_length);
+}
+
+/**
+ * @brief Search for an entry by path hash in the path index
+ * 
+ * Binary searches the sorted index, so at most floor(log2(index_count)) + 1
+ * entries are read, and verifies the name of the found entry.
+ * 
+ * @param ctx File system context
+ * @param hash Hash of the path (see hash_path())
+ * @param last Last component of the path (not null-terminated)
+ * @param last_length Length of the last component
+ * @param dir_only true if the entry has to be a directory
+ * @param header Pointer to store the header of the found FILE, DIR or WHITEOUT entry
+ * @return true if entry found, false otherwise
+ */
+static bool find_indexed_hash(dmfsi_context_t ctx, uint64_t hash, const char* last, size_t last_length, bool dir_only, dmffs_tlv_header_t* header)
+{
+    uint32_t low = 0;
+    uint32_t high = ctx->index_count;
+    
+    
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        dmffs_index_entry_t entry;
+        if (read_tlv_value(ctx, ctx->index_offset + (dmffs_off_t)middle * sizeof(entry), &entry, sizeof(entry)) != sizeof(entry)) {
+            return false;
+        }
+        
+        if (entry.hash < hash) {
+            low = middle + 1;
+        } else if (entry.hash > hash) {
+            high = middle;
+        } else {
+            return verify_indexed_entry(ctx, entry.offset, last, last_length, dir_only, header);
+        }
+    }
+    
+    return false;
+}
+
+/**
+ * @brief Get the first slot probed for a path hash in the RAM index
+ * 
+ * @param index RAM index
+ * @param hash Hash of the path
+ * @return Slot number
+ */
+static inline uint32_t ram_index_slot(const dmffs_ram_index_t* index, uint64_t hash)
+{
+    return (uint32_t)(hash ^ (hash >> 32)) & index->slot_mask;
+}
+
+/**
+ * @brief Add an entry to the RAM index
+ * 
+ * @param index RAM index
+ * @param hash Hash of the path of the entry
+ * @param offset Offset of the FILE, DIR or WHITEOUT TLV
+ * @return true on success, false if the index is full or has the hash already
+ */
+static bool insert_ram_entry(dmffs_ram_index_t* index, uint64_t hash, dmffs_off_t offset)
+{
+    if (index->count >= index->capacity) {
+        return false;
+    }
+    
+    uint32_t slot = ram_index_slot(index, hash);
+    while (index->slots[slot].offset != DMFFS_RAM_INDEX_EMPTY) {
+        if (index->slots[slot].hash == hash) {
+            return false;
+        }
+        slot = (slot + 1) & index->slot_mask;
+    }
+    
+    index->slots[slot].hash = hash;
+    index->slots[slot].offset = offset;
+    index->count++;
+    return true;
+}
+
+/**
+ * @brief Search for an entry by path hash in the RAM index
+ * 
+ * @param ctx File system context
+ * @param hash Hash of the path (see hash_path())
+ * @param last Last component of the path (not null-terminated)
+ * @param last_length Length of the last component
+ * @param dir_only true if the entry has to be a directory
+ * @param header Pointer to store the header of the found FILE, DIR or WHITEOUT entry
+ * @return true if entry found, false otherwise
+ */
+static bool find_ram_hash(dmfsi_context_t ctx, uint64_t hash, const char* last, size_t last_length, bool dir_only, dmffs_tlv_header_t* header)
+{
+    const dmffs_ram_index_t* index = ctx->ram_index;
+    
+    for (uint32_t slot = ram_index_slot(index, hash); index->slots[slot].offset != DMFFS_RAM_INDEX_EMPTY; slot = (slot + 1) & index->slot_mask) {
+        if (index->slots[slot].hash == hash) {
+            return verify_indexed_entry(ctx, index->slots[slot].offset, last, last_length, dir_only, header);
+        }
+    }
+    
+    return false;
+}
+
+/**
+ * @brief Get the first entry of a directory that the RAM index does not cover
+ * 
+ * @param index RAM index
+ * @param parent DIR TLV header (NULL for the root directory)
+ * @param first Offset of the first entry of the directory
+ * @param end End of the directory
+ * @return Offset to continue a scan of the directory at (end if all its entries are indexed)
+ */
+static dmffs_off_t ram_index_resume(const dmffs_ram_index_t* index, const dmffs_tlv_header_t* parent, dmffs_off_t first, dmffs_off_t end)
+{
+    if (index->offset <= first) {
+        return first;
+    }
+    if (index->offset >= end) {
+        return end;
+    }
+    
+    // The pass is inside the directory, which is open at some level
+    uint32_t level = 0;
+    if (parent) {
+        while (level < index->depth && index->dir_offset[level] != parent->offset) level++;
+        if (level == index->depth) {
+            return first;
+        }
+        level++;
+    }
+    
+    // Skip the entry the pass is in, or continue where the pass is
+    return level < index->depth ? index->dir_end[level] : index->offset;
+}
+
+/**
+ * @brief Search for an entry of a directory with the help of the RAM index
+ * 
+ * Entries the index covers are found with a probe, only the part of the
+ * directory the index has not reached yet is scanned.
+ * 
+ * @param ctx File system context
+ * @param parent DIR TLV header (NULL for the root directory)
+ * @param hash Hash of the path of the entry
+ * @param name Name of the entry
+ * @param header Pointer to store the header of the found FILE, DIR or WHITEOUT entry
+ * @return true if entry found, false otherwise
+ */
+static bool find_ram_child(dmfsi_context_t ctx, const dmffs_tlv_header_t* parent, uint64_t hash, const char* name, dmffs_tlv_header_t* header)
+{
+    dmffs_off_t first = parent ? parent->value_offset : ctx->root_offset;
+    dmffs_off_t end = parent ? parent->next_offset : ctx->metadata_end;
+    
+    if (find_ram_hash(ctx, hash, name, strlen(name), false, header)) {
+        return true;
+    }
+    if (ctx->ram_index->complete) {
+        return false;
+    }
+    
+    return find_entry(ctx, ram_index_resume(ctx->ram_index, parent, first, end), end, name, header);
+}
+
+/**
+ * @brief Extend the RAM index by a bounded number of TLVs
+ * 
+ * Continues the depth-first pass over the image where the previous step
+ * stopped. The pass stops growing the index, instead of skipping entries,
+ * when the index is full, a directory is nested too deep or two paths have
+ * the same hash; lookups then keep scanning the rest.
+ * 
+ * @param ctx File system context of the image
+ * @param budget Most TLVs to read
+ * @return Number of TLVs read
+ */
+static uint32_t step_ram_index(dmfsi_context_t ctx, uint32_t budget)
+{
+    dmffs_ram_index_t* index = ctx->ram_index;
+    uint32_t steps = 0;
+    
+    while (steps < budget && !index->complete && !index->halted) {
+        // Leave the directories that are indexed completely
+        while (index->depth > 0 && index->offset >= index->dir_end[index->depth - 1]) {
+            index->depth--;
+        }
+        if (index->depth == 0 && index->offset >= ctx->metadata_end) {
+            index->complete = true;
+            break;
+        }
+        
+        dmffs_tlv_header_t header;
+        if (!read_tlv_header(ctx, index->offset, &header)) {
+            index->halted = true;
+            break;
+        }
+        steps++;
+        
+        // Lookups do not scan past the end of the entries
+        if (header.type == DMFFS_TLV_TYPE_END || header.type == DMFFS_TLV_TYPE_INVALID) {
+            if (index->depth == 0) {
+                index->complete = true;
+                break;
+            }
+            index->offset = index->dir_end[index->depth - 1];
+            continue;
+        }
+        
+        char name[DMFFS_MAX_NAME_LEN + 1];
+        if ((header.type == DMFFS_TLV_TYPE_FILE || header.type == DMFFS_TLV_TYPE_DIR ||
+             header.type == DMFFS_TLV_TYPE_WHITEOUT) && read_entry_name(ctx, &header, name, sizeof(name))) {
+            uint64_t parent_hash = index->depth > 0 ? index->dir_hash[index->depth - 1] : DMFFS_BLOOM_HASH_INIT;
+            uint64_t hash = hash_component(parent_hash, index->depth == 0, name, strlen(name));
+            bool is_dir = (header.type == DMFFS_TLV_TYPE_DIR);
+            
+            if ((is_dir && index->depth == DMFFS_WALK_MAX_DEPTH) || !insert_ram_entry(index, hash, header.offset)) {
+                DMOD_LOG_WARN("RAM index stopped at %u entries - the rest is scanned\n", (unsigned int)index->count);
+                index->halted = true;
+                break;
+            }
+            
+            // Descend into the directory
+            if (is_dir) {
+                index->dir_offset[index->depth] = header.offset;
+                index->dir_end[index->depth] = header.next_offset;
+                index->dir_hash[index->depth] = hash;
+                index->depth++;
+                index->offset = header.value_offset;
+                continue;
+            }
+        }
+        
+        index->offset = header.next_offset;
+    }
+    
+    return steps;
+}
+
+/**
+ * @brief Allocate the RAM index of an image
+ * 
+ * Images with an INDEX TLV do not need one.
+ * 
+ * @param ctx File system context of the image
+ * @param entries Most entries of the index
+ */
+static void init_ram_index(dmfsi_context_t ctx, uint32_t entries)
+{
+    if (entries == 0 || ctx->index_count > 0 || !ctx->flash_ready || entries > (UINT32_MAX / 4) * 3) {
+        return;
+    }
+    
+    // Keep the table at most 3/4 full
+    uint32_t slot_count = 16;
+    while (slot_count < entries + entries / 3 + 1) {
+        slot_count *= 2;
+    }
+    
+    dmffs_ram_index_t* index = Dmod_Malloc(sizeof(dmffs_ram_index_t));
+    dmffs_index_entry_t* slots = index ? Dmod_Malloc(slot_count * sizeof(dmffs_index_entry_t)) : NULL;
+    if (!slots) {
+        DMOD_LOG_ERROR("Failed to allocate RAM index for %u entries\n", (unsigned int)entries);
+        Dmod_Free(index);
+        return;
+    }
+    
+    memset(index, 0, sizeof(dmffs_ram_index_t));
+    memset(slots, 0xFF, slot_count * sizeof(dmffs_index_entry_t));
+    index->slots = slots;
+    index->slot_mask = slot_count - 1;
+    index->capacity = entries;
+    index->offset = ctx->root_offset;
+    ctx->ram_index = index;
+}
+
+/**
+ * @brief Search for an entry by path in the path index
+ * 
+ * Uses the INDEX TLV of the image, or else its RAM index.
+ * 
+ * @param ctx File system context
+ * @param path Path without the leading slash
+ * @param header Pointer to store the header of the found FILE, DIR or WHITEOUT entry
+ * @return true if entry found, false otherwise
+ */
+static bool find_indexed_entry(dmfsi_context_t ctx, const char* path, dmffs_tlv_header_t* header)
+{
+    // Last path component, a trailing slash requires a directory
+    size_t length = strlen(path);
+    bool dir_only = length > 0 && path[length - 1] == '/';
+    while (length > 0 && path[length - 1] == '/') length--;
+    size_t start = length;
+    while (start > 0 && path[start - 1] != '/') start--;
+    
+    if (ctx->index_count == 0) {
+        return find_ram_hash(ctx, hash_path(path), path + start, length - start, dir_only, header);
+    }
+    
+    return find_indexed_hash(ctx, hash_path(path), path + start, length - start, dir_only, header);
+}
+
+/**
+ * @brief Search for an entry below a directory, one path component at a time
+ * 
+ * With a RAM index, every component is probed first and the directories
+ * are only scanned where the index does not cover them yet.
+ * 
+ * @param ctx File system context
+ * @param parent DIR TLV header to start at (NULL for the root directory)
+ * @param hash Hash of the path of the directory (DMFFS_BLOOM_HASH_INIT for the root directory)
+ * @param path Path relative to the directory (e.g., "sub/file.txt" or "file.txt")
+ * @param header Pointer to store the header of the found FILE, DIR or WHITEOUT entry
+ * @return true if entry found, false otherwise
+ */
+static bool find_entry_below(dmfsi_context_t ctx, const dmffs_tlv_header_t* parent, uint64_t hash, const char* path, dmffs_tlv_header_t* header)
+{
+    char name[DMFFS_MAX_NAME_LEN + 1];
+    dmffs_off_t offset = parent ? parent->value_offset : ctx->root_offset;
+    dmffs_off_t end_offset = parent ? parent->next_offset : ctx->metadata_end;
+    dmffs_tlv_header_t dir;
+    
+    while (true) {
+        // Extract the next path component
+        const char* separator = strchr(path, '/');
+        size_t length = separator ? (size_t)(separator - path) : strlen(path);
+        if (length == 0 || length >= sizeof(name)) {
+            return false;
+        }
+        memcpy(name, path, length);
+        name[length] = '\0';
+        
+        bool found;
+        if (ctx->ram_index) {
+            hash = hash_component(hash, parent == NULL, name, length);
+            found = find_ram_child(ctx, parent, hash, name, header);
+        } else {
+            found = find_entry(ctx, offset, end_offset, name, header);
+        }
+        if (!found) {
+            return false;
+        }
+        
+        if (!separator) {
+            return true;
+        }
+        
+        // Skip the separator (a trailing one is only valid for directories)
+        while (*separator == '/') separator++;
+        if (*separator == '\0' || header->type != DMFFS_TLV_TYPE_DIR) {
+            return *separator == '\0' && header->type == DMFFS_TLV_TYPE_DIR;
+        }
+        
+        // Continue in the found directory
+        offset = header->value_offset;
+        end_offset = header->next_offset;
+        dir = *header;
+        parent = &dir;
+        path = separator;
+    }
+}
+
+/**
+ * @brief Search for an entry by path, one path component at a time
+ * 
+ * Images with a path index are searched through the index instead. With
+ * a RAM index, the whole path is probed first.
+ * 
+ * @param ctx File system context
+ * @param path Path without the leading slash (e.g., "dir/sub/file.txt" or "file.txt")
+ * @param header Pointer to store the header of the found FILE, DIR or WHITEOUT entry
+ * @return true if entry found, false otherwise
+ */
+static bool find_entry_by_path(dmfsi_context_t ctx, const char* path, dmffs_tlv_header_t* header)
+{
+    // Definite misses do not touch the entries
+    if (!path_may_exist(ctx, path)) {
+        return false;
+    }
+    
+    if (ctx->index_count > 0) {
+        return find_indexed_entry(ctx, path, header);
+    }
+    
+    if (ctx->ram_index) {
+        if (find_indexed_entry(ctx, path, header)) {
+            return true;
+        }
+        if (ctx->ram_index->complete) {
+            return false;
+        }
+    }
+    
+    return find_entry_below(ctx, NULL, DMFFS_BLOOM_HASH_INIT, path, header);
+}
+
+/**
+ * @brief Look up a path in one image of an overlay mount
+ * 
+ * Besides the entry of the path, the lookup reports whether the image hides
+ * the path from the images below it. Images never hold entries below their
+ * own FILE or WHITEOUT entries, so a hit on the whole path is final; after a
+ * miss, the parent directories are checked from the top, each of them with
+ * the path filter first.
+ * 
+ * @param ctx File system context of the image
+ * @param path Path without the leading slash
+ * @param header Pointer to store the header of the found entry
+ * @return Result of the lookup
+ */
+static dmffs_lookup_t find_overlay_entry(dmfsi_context_t ctx, const char* path, dmffs_tlv_header_t* header)
+{
+    char name[DMFFS_MAX_NAME_LEN + 1];
+    dmffs_off_t offset = ctx->root_offset;
+    dmffs_off_t end_offset = ctx->metadata_end;
+    dmffs_tlv_header_t dir;
+    const dmffs_tlv_header_t* parent = NULL;
+    uint64_t hash = DMFFS_BLOOM_HASH_INIT;
+    
+    if ((ctx->index_count > 0 || ctx->ram_index) && path_may_exist(ctx, path) && find_indexed_entry(ctx, path, header)) {
+        return header->type == DMFFS_TLV_TYPE_WHITEOUT ? DMFFS_LOOKUP_HIDDEN : DMFFS_LOOKUP_FOUND;
+    }
+    
+    for (bool first = true; ; first = false) {
+        // Extract the next path component and extend the hash (see hash_path())
+        const char* end = path;
+        while (*end && *end != '/') end++;
+        size_t length = (size_t)(end - path);
+        if (length == 0 || length >= sizeof(name)) {
+            return DMFFS_LOOKUP_MISSING;
+        }
+        hash = hash_component(hash, first, path, length);
+        
+        const char* rest = end;
+        while (*rest == '/') rest++;
+        bool last = (*rest == '\0');
+        bool dir_only = last && *end == '/';
+        
+        bool found;
+        if (!hash_may_exist(ctx, hash)) {
+            found = false;
+        } else if (ctx->index_count > 0) {
+            found = find_indexed_hash(ctx, hash, path, length, false, header);
+        } else {
+            memcpy(name, path, length);
+            name[length] = '\0';
+            found = ctx->ram_index ? find_ram_child(ctx, parent, hash, name, header)
+                                   : find_entry(ctx, offset, end_offset, name, header);
+        }
+        
+        if (!found) {
+            return DMFFS_LOOKUP_MISSING;
+        }
+        if (header->type == DMFFS_TLV_TYPE_WHITEOUT) {
+            return DMFFS_LOOKUP_HIDDEN;
+        }
+        if (header->type == DMFFS_TLV_TYPE_FILE) {
+            return (last && !dir_only) ? DMFFS_LOOKUP_FOUND : DMFFS_LOOKUP_HIDDEN;
+        }
+        if (last) {
+            return DMFFS_LOOKUP_FOUND;
+        }
+        
+        // Continue in the found directory
+        offset = header->value_offset;
+        end_offset = header->next_offset;
+        dir = *header;
+        parent = &dir;
+        path = rest;
+    }
+}
+
+/**
+ * @brief Get an image of the mount by precedence
+ * 
+ * @param ctx File system context of the base image
+ * @param level 0 for the base image, n for the n-th overlay
+ * @return File system context of the image
+ */
+static inline dmfsi_context_t get_layer(dmfsi_context_t ctx, uint32_t level)
+{
+    return level == 0 ? ctx : ctx->overlays[level - 1];
+}
+
+/**
+ * @brief Search for a FILE or DIR entry by path in all images of the mount
+ * 
+ * Without overlays, this is a plain lookup in the base image.
+ * 
+ * @param ctx File system context of the base image
+ * @param path Path without the leading slash
+ * @param header Pointer to store the header of the found entry
+ * @return File system context of the image holding the entry, NULL if not found
+ */
+static dmfsi_context_t resolve_path(dmfsi_context_t ctx, const char* path, dmffs_tlv_header_t* header)
+{
+    if (ctx->overlay_count == 0) {
+        return (find_entry_by_path(ctx, path, header) && header->type != DMFFS_TLV_TYPE_WHITEOUT) ? ctx : NULL;
+    }
+    
+    for (uint32_t level = ctx->overlay_count + 1; level > 0; level--) {
+        dmfsi_context_t layer = get_layer(ctx, level - 1);
+        dmffs_lookup_t result = find_overlay_entry(layer, path, header);
+        if (result == DMFFS_LOOKUP_FOUND) {
+            return layer;
+        }
+        if (result == DMFFS_LOOKUP_HIDDEN) {
+            return NULL;
+        }
+    }
+    
+    return NULL;
+}
+
+/**
+ * @brief Search for a file by path, supporting directories and overlays
+ * 
+ * @param ctx File system context
+ * @param path Full path to search for (e.g., "dir/file.txt" or "file.txt")
+ * @param entry Pointer to store found file entry
+ * @return File system context of the image holding the file, NULL if not found
+ */
+static dmfsi_context_t find_file_by_path(dmfsi_context_t ctx, const char* path, dmffs_file_entry_t* entry)
+{
+    if (!ctx || !path || !entry) return NULL;
+    
+    dmffs_tlv_header_t header;
+    dmfsi_context_t layer = resolve_path(ctx, path, &header);
+    if (!layer || header.type != DMFFS_TLV_TYPE_FILE) {
+        return NULL;
+    }
+    
+    // The name has been matched already, only the content is needed to read the file
+    return parse_file_entry(layer, header.offset, entry, DMFFS_FIELD_DATA, NULL, 0) != 0 ? layer : NULL;
+}
+
+/**
+ * @brief Read the image header (VERSION, LAYOUT, BLOOM, INDEX and STRINGS TLVs)
+ * 
+ * Finds the first entry of the root directory, the path filter, the path
+ * index, the string table and, for metadata-first images, the location of
+ * the data region.
+ * 
+ * @param ctx File system context
+ */
+static void read_image_layout(dmfsi_context_t ctx)
+{
+    ctx->root_offset = 0;
+    ctx->metadata_end = ctx->flash_size;
+    ctx->data_offset = 0;
+    ctx->data_size = 0;
+    ctx->bloom_bits = 0;
+    ctx->index_count = 0;
+    ctx->strings_size = 0;
+    ctx->strings_count = 0;
+    ctx->strings_reader.length = 0;
+    
+    if (!ctx->flash_ready) {
+        return;
+    }
+    
+    dmffs_tlv_header_t header;
+    while (read_tlv_header(ctx, ctx->root_offset, &header)) {
+        if (header.type == DMFFS_TLV_TYPE_LAYOUT) {
+            dmffs_layout_t layout;
+            if (header.length >= sizeof(layout) &&
+                read_tlv_value(ctx, header.value_offset, &layout, sizeof(layout)) == sizeof(layout) &&
+                layout.data_offset >= header.next_offset &&
+                layout.data_offset <= ctx->flash_size &&
+                layout.data_size <= ctx->flash_size - layout.data_offset) {
+                ctx->metadata_end = layout.data_offset;
+                ctx->data_offset = layout.data_offset;
+                ctx->data_size = layout.data_size;
+            } else {
+                DMOD_LOG_ERROR("Invalid LAYOUT TLV - file contents are not available\n");
+            }
+        } else if (header.type == DMFFS_TLV_TYPE_BLOOM) {
+            dmffs_bloom_t bloom;
+            if (header.length >= sizeof(bloom) &&
+                read_tlv_value(ctx, header.value_offset, &bloom, sizeof(bloom)) == sizeof(bloom) &&
+                bloom.bit_count > 0 && bloom.bit_count % 8 == 0 &&
+                bloom.hash_count > 0 && bloom.hash_count <= DMFFS_BLOOM_MAX_HASHES &&
+                bloom.bit_count / 8 <= header.length - sizeof(bloom)) {
+                ctx->bloom_offset = header.value_offset + sizeof(bloom);
+                ctx->bloom_bits = bloom.bit_count;
+                ctx->bloom_hashes = bloom.hash_count;
+            } else {
+                DMOD_LOG_WARN("Invalid BLOOM TLV - path filter is not used\n");
+            }
+        } else if (header.type == DMFFS_TLV_TYPE_INDEX) {
+            dmffs_index_t index;
+            if (header.length >= sizeof(index) &&
+                read_tlv_value(ctx, header.value_offset, &index, sizeof(index)) == sizeof(index) &&
+                index.entry_count > 0 &&
+                index.entry_count <= (header.length - sizeof(index)) / sizeof(dmffs_index_entry_t)) {
+                ctx->index_offset = header.value_offset + sizeof(index);
+                ctx->index_count = index.entry_count;
+            } else {
+                DMOD_LOG_WARN("Invalid INDEX TLV - directories are scanned\n");
+            }
+        } else if (header.type == DMFFS_TLV_TYPE_STRINGS) {
+            dmffs_strings_t strings;
+            if (header.length >= sizeof(strings) &&
+                read_tlv_value(ctx, header.value_offset, &strings, sizeof(strings)) == sizeof(strings) &&
+                strings.data_size <= header.length - sizeof(strings)) {
+                ctx->strings_offset = header.value_offset + sizeof(strings);
+                ctx->strings_size = strings.data_size;
+            } else {
+                DMOD_LOG_ERROR("Invalid STRINGS TLV - names are not available\n");
+            }
+        } else if (header.type != DMFFS_TLV_TYPE_VERSION) {
+            break;
+        }
+        
+        ctx->root_offset = header.next_offset;
+    }
+}
+
+/**
+ * @brief Check if flash contains valid TLV structure
+ * 
+ * @param ctx File system context
+ * @return true if valid TLV structure found, false otherwise
+ */
+static bool has_valid_tlv_structure(dmfsi_context_t ctx)
+{
+    if (!ctx || !ctx->flash_ready) return false;
+    
+    dmffs_tlv_header_t header;
+    // Try to read first TLV header
+    if (!read_tlv_header(ctx, 0, &header)) {
+        return false;
+    }
+    
+    // Check for an image header tag at start
+    if (header.type == DMFFS_TLV_TYPE_VERSION || header.type == DMFFS_TLV_TYPE_LAYOUT ||
+        header.type == DMFFS_TLV_TYPE_BLOOM || header.type == DMFFS_TLV_TYPE_INDEX ||
+        header.type == DMFFS_TLV_TYPE_STRINGS) {
+        return true;
+    }
+    
+    // Or check for FILE/DIR tag (or WHITEOUT of an overlay image)
+    if (header.type == DMFFS_TLV_TYPE_FILE || header.type == DMFFS_TLV_TYPE_DIR ||
+        header.type == DMFFS_TLV_TYPE_WHITEOUT) {
+        return true;
+    }
+    
+    return false;
+}
+
+/**
+ * @brief Release a context with everything it owns
+ * 
+ * Also used for contexts that were not completely initialized, the fields
+ * that were not set up yet are zero.
+ * 
+ * @param ctx File system context (base image or overlay)
+ */
+static void free_context(dmfsi_context_t ctx)
+{
+    if (ctx->flash_ready && ctx->backend->close) {
+        ctx->backend->close(ctx);
+    }
+    
+    for (uint32_t i = 0; i < ctx->overlay_count; i++) {
+        free_context(ctx->overlays[i]);
+    }
+    
+    if (ctx->ram_index) {
+        Dmod_Free(ctx->ram_index->slots);
+    }
+    Dmod_Free(ctx->ram_index);
+    for (uint32_t i = 0; i < ctx->pin_count; i++) {
+        Dmod_Free(ctx->pins[i].data);
+    }
+    Dmod_Free(ctx->pins);
+    Dmod_Free(ctx->trace);
+    Dmod_Free(ctx->trace_file);
+    Dmod_Free(ctx->device);
+    Dmod_Free(ctx);
+}
+
+/**
+ * @brief Open the overlay images of the mount
+ * 
+ * Overlays use the backend of the base image. Regions without a valid image
+ * are dropped, so an erased patch slot does not hide the base image.
+ * 
+ * @param ctx File system context of the base image
+ */
+static void open_overlays(dmfsi_context_t ctx)
+{
+    uint32_t count = 0;
+    
+    for (uint32_t i = 0; i < ctx->overlay_count; i++) {
+        dmfsi_context_t overlay = ctx->overlays[i];
+        overlay->backend = ctx->backend;
+        overlay->block_size = ctx->block_size;
+        overlay->flash_ready = overlay->backend->open(overlay);
+        read_image_layout(overlay);
+        
+        if (!has_valid_tlv_structure(overlay)) {
+            DMOD_LOG_WARN("Overlay %u has no valid image - skipped\n", (unsigned int)(i + 1));
+            free_context(overlay);
+            continue;
+        }
+        ctx->overlays[count++] = overlay;
+        overlay->level = count;
+    }
+    
+    ctx->overlay_count = count;
+}
+
+/**
+ * @brief Copy a range of an image to RAM
+ * 
+ * Ranges inside a pinned range are not copied again, pinned ranges inside
+ * the new one are released.
+ * 
+ * @param ctx File system context of the image
+ * @param offset Offset of the range
+ * @param size Size of the range
+ * @return true if the range is pinned, false on error
+ */
+static bool pin_range(dmfsi_context_t ctx, dmffs_off_t offset, dmffs_off_t size)
+{
+    if (size == 0 || find_pinned(ctx, offset, size)) {
+        return true;
+    }
+    if (offset > ctx->flash_size || size > ctx->flash_size - offset || size > (dmffs_off_t)SIZE_MAX) {
+        return false;
+    }
+    
+    if (ctx->pin_count == ctx->pin_capacity) {
+        uint32_t capacity = ctx->pin_capacity ? ctx->pin_capacity * 2 : 8;
+        dmffs_pin_t* pins = Dmod_Malloc(capacity * sizeof(dmffs_pin_t));
+        if (!pins) {
+            DMOD_LOG_ERROR("Failed to allocate pinned ranges\n");
+            return false;
+        }
+        if (ctx->pin_count > 0) {
+            memcpy(pins, ctx->pins, ctx->pin_count * sizeof(dmffs_pin_t));
+        }
+        Dmod_Free(ctx->pins);
+        ctx->pins = pins;
+        ctx->pin_capacity = capacity;
+    }
+    
+    uint8_t* data = Dmod_Malloc((size_t)size);
+    if (!data) {
+        DMOD_LOG_ERROR("Failed to allocate %llu bytes to pin\n", (unsigned long long)size);
+        return false;
+    }
+    if (read_flash(ctx, offset, data, (size_t)size) != (size_t)size) {
+        Dmod_Free(data);
+        return false;
+    }
+    
+    // Release the ranges inside the new one and keep the others sorted
+    uint32_t count = 0;
+    uint32_t position = 0;
+    for (uint32_t i = 0; i < ctx->pin_count; i++) {
+        dmffs_pin_t pin = ctx->pins[i];
+        if (pin.offset >= offset && pin.offset - offset + pin.size <= size) {
+            ctx->pinned_bytes -= pin.size;
+            Dmod_Free(pin.data);
+            continue;
+        }
+        if (pin.offset <= offset) {
+            position = count + 1;
+        }
+        ctx->pins[count++] = pin;
+    }
+    memmove(&ctx->pins[position + 1], &ctx->pins[position], (count - position) * sizeof(dmffs_pin_t));
+    ctx->pins[position].offset = offset;
+    ctx->pins[position].size = size;
+    ctx->pins[position].data = data;
+    ctx->pin_count = count + 1;
+    ctx->pinned_bytes += size;
+    return true;
+}
+
+/**
+ * @brief Copy an entry with all its contents to RAM
+ * 
+ * The TLV of the entry holds the metadata of the subtree and, for inline
+ * images, the file contents. The contents of metadata-first images are
+ * pinned separately, adjacent ones as one range.
+ * 
+ * @param ctx File system context of the image
+ * @param header FILE or DIR TLV header
+ * @return true on success, false on error
+ */
+static bool pin_entry(dmfsi_context_t ctx, const dmffs_tlv_header_t* header)
+{
+    if (!pin_range(ctx, header->offset, header->next_offset - header->offset)) {
+        return false;
+    }
+    
+    // Names of the string table are read by every lookup of the entries
+    if (ctx->strings_size > 0 && !pin_range(ctx, ctx->strings_offset, ctx->strings_size)) {
+        return false;
+    }
+    
+    if (ctx->data_size == 0) {
+        return true;
+    }
+    
+    // Directories hold their entries, so a forward scan visits the whole subtree
+    dmffs_off_t start = 0;
+    dmffs_off_t end = 0;
+    dmffs_off_t offset = header->offset;
+    while (offset < header->next_offset) {
+        dmffs_tlv_header_t nested;
+        if (!read_tlv_header(ctx, offset, &nested)) {
+            break;
+        }
+        
+        if (nested.type == DMFFS_TLV_TYPE_DIR) {
+            offset = nested.value_offset;
+            continue;
+        }
+        
+        dmffs_file_entry_t entry;
+        if (nested.type == DMFFS_TLV_TYPE_FILE &&
+            parse_file_entry(ctx, nested.offset, &entry, DMFFS_FIELD_DATA, NULL, 0) != 0 && entry.stored_size > 0) {
+            if (entry.data_offset != end) {
+                if (!pin_range(ctx, start, end - start)) {
+                    return false;
+                }
+                start = entry.data_offset;
+            }
+            end = entry.data_offset + entry.stored_size;
+        }
+        offset = nested.next_offset;
+    }
+    
+    return pin_range(ctx, start, end - start);
+}
+
+/**
+ * @brief Copy the configured paths ("pin=<path>") of all images to RAM
+ * 
+ * A path is pinned in every image of the mount that holds it. An empty
+ * path or "/" pins the whole images, also without a valid TLV structure.
+ * 
+ * @param ctx File system context of the base image
+ */
+static void pin_paths(dmfsi_context_t ctx)
+{
+    for (uint32_t i = 0; i < ctx->pin_path_count; i++) {
+        char path[DMFFS_MAX_PATH_LEN + 1];
+        const char* value = ctx->pin_paths[i];
+        size_t length = ctx->pin_lengths[i];
+        while (length > 0 && *value == '/') {
+            value++;
+            length--;
+        }
+        if (length >= sizeof(path)) {
+            DMOD_LOG_WARN("Pinned path too long - skipped\n");
+            continue;
+        }
+        memcpy(path, value, length);
+        path[length] = '\0';
+        
+        bool found = false;
+        for (uint32_t level = 0; level <= ctx->overlay_count; level++) {
+            dmfsi_context_t layer = get_layer(ctx, level);
+            dmffs_tlv_header_t header;
+            if (!layer->flash_ready) {
+                continue;
+            }
+            
+            if (length == 0) {
+                found = pin_range(layer, 0, layer->flash_size) || found;
+            } else if (has_valid_tlv_structure(layer) && find_entry_by_path(layer, path, &header) &&
+                       header.type != DMFFS_TLV_TYPE_WHITEOUT) {
+                found = pin_entry(layer, &header) || found;
+            }
+        }
+        
+        if (!found) {
+            DMOD_LOG_WARN("Failed to pin '/%s'\n", path);
+        }
+        ctx->pin_paths[i] = NULL;
+    }
+    ctx->pin_path_count = 0;
+    
+    uint64_t pinned = 0;
+    for (uint32_t level = 0; level <= ctx->overlay_count; level++) {
+        pinned += get_layer(ctx, level)->pinned_bytes;
+    }
+    if (pinned > 0) {
+        DMOD_LOG_INFO("Pinned %llu bytes in RAM\n", (unsigned long long)pinned);
+    }
+}
+
+#if DMFFS_ENABLE_TRACE
+/**
+ * @brief Record an access in the trace
+ * 
+ * Only the first event of each kind is recorded for a file.
+ * 
+ * @param ctx File system context
+ * @param entry_offset Offset of the FILE TLV
+ * @param event DMFFS_TRACE_OPEN or DMFFS_TRACE_READ
+ */
+static void trace_access(dmfsi_context_t ctx, dmffs_off_t entry_offset, uint32_t event)
+{
+    if (!ctx->trace || ctx->trace_count >= ctx->trace_capacity) {
+        return;
+    }
+    
+    for (size_t i = 0; i < ctx->trace_count; i++) {
+        if (ctx->trace[i].entry_offset == entry_offset && ctx->trace[i].event == event) {
+            return;
+        }
+    }
+    
+    ctx->trace[ctx->trace_count].entry_offset = entry_offset;
+    ctx->trace[ctx->trace_count].event = event;
+    ctx->trace_count++;
+}
+#else
+#define trace_access(ctx, entry_offset, event)  ((void)0)
+#endif
+
+/**
+ * @brief Create the handle of an open file
+ * 
+ * @param layer File system context of the image holding the file
+ * @param entry File entry with the content fields (DMFFS_FIELD_DATA)
+ * @param fp Pointer to store the file handle
+ * @return DMFSI_OK on success, DMFSI_ERR_GENERAL if out of memory
+ */
+static int open_file_handle(dmfsi_context_t layer, const dmffs_file_entry_t* entry, void** fp)
+{
+    dmffs_file_handle_t* handle = Dmod_Malloc(sizeof(dmffs_file_handle_t));
+    if (!handle) {
+        return DMFSI_ERR_GENERAL;
+    }
+    
+    memcpy(&handle->entry, entry, sizeof(dmffs_file_entry_t));
+    handle->position = 0;
+    handle->ctx = layer;
+    handle->read_traced = false;
+    
+    // Only files of the base image are traced (overlays have no trace)
+    trace_access(layer, entry->offset, DMFFS_TRACE_OPEN);
+    
+    *fp = handle;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Build the full path of an entry from its TLV offset
+ * 
+ * Descends from the root into the DIR entries that contain the offset and
+ * skips all other siblings, so only a TLV on the sibling chain of one of
+ * the directories is accepted.
+ * 
+ * @param ctx File system context
+ * @param entry_offset Offset of the FILE or DIR TLV
+ * @param path Buffer to store the path (e.g., "/dir/file.txt")
+ * @param path_size Size of the buffer
+ * @return true if the entry was found and the path fits, false otherwise
+ */
+static bool build_entry_path(dmfsi_context_t ctx, dmffs_off_t entry_offset, char* path, size_t path_size)
+{
+    dmffs_off_t offset = ctx->root_offset;
+    dmffs_off_t end_offset = ctx->metadata_end;
+    size_t length = 0;
+    
+    while (offset < end_offset) {
+        dmffs_tlv_header_t header;
+        if (!read_tlv_header(ctx, offset, &header)) {
+            break;
+        }
+        
+        if (header.type == DMFFS_TLV_TYPE_END || header.type == DMFFS_TLV_TYPE_INVALID) {
+            break;
+        }
+        
+        if (entry_offset < header.offset || entry_offset >= header.next_offset) {
+            offset = header.next_offset;
+            continue;
+        }
+        
+        // Append the name of the entry that contains the offset
+        char name[DMFFS_MAX_NAME_LEN + 1];
+        read_entry_name(ctx, &header, name, sizeof(name));
+        size_t name_len = strlen(name);
+        if (length + 1 + name_len + 1 > path_size) {
+            return false;
+        }
+        path[length++] = '/';
+        memcpy(path + length, name, name_len + 1);
+        length += name_len;
+        
+        if (header.offset == entry_offset) {
+            return true;
+        }
+        
+        if (header.type != DMFFS_TLV_TYPE_DIR) {
+            break;
+        }
+        
+        offset = header.value_offset;
+        end_offset = header.next_offset;
+    }
+    
+    return false;
+}
+
+#if DMFFS_ENABLE_TRACE
+/**
+ * @brief Format a trace event as a text line
+ * 
+ * @param ctx File system context
+ * @param event Trace event
+ * @param line Buffer to store the line (e.g., "open /dir/file.txt\n")
+ * @param line_size Size of the buffer
+ * @return Length of the line, or 0 if the entry cannot be resolved
+ */
+static size_t format_trace_event(dmfsi_context_t ctx, const dmffs_trace_event_t* event, char* line, size_t line_size)
+{
+    const char* prefix = (event->event == DMFFS_TRACE_OPEN) ? "open " : "read ";
+    size_t prefix_len = strlen(prefix);
+    
+    if (line_size < prefix_len + 2 || !build_entry_path(ctx, event->entry_offset, line + prefix_len, line_size - prefix_len - 1)) {
+        return 0;
+    }
+    
+    memcpy(line, prefix, prefix_len);
+    size_t length = strlen(line);
+    line[length++] = '\n';
+    line[length] = '\0';
+    return length;
+}
+
+/**
+ * @brief Export the access trace as text
+ * 
+ * @param ctx File system context
+ * @param arg Export request
+ * @return DMFSI_OK on success, DMFSI_ERR_NO_SPACE if the buffer is too small
+ */
+static int export_trace(dmfsi_context_t ctx, dmffs_ioctl_trace_t* arg)
+{
+    char line[sizeof("open \n") + DMFFS_MAX_PATH_LEN];
+    size_t written = 0;
+    
+    arg->length = 0;
+    for (size_t i = 0; i < ctx->trace_count; i++) {
+        size_t length = format_trace_event(ctx, &ctx->trace[i], line, sizeof(line));
+        if (arg->buffer && arg->length + length < arg->size) {
+            memcpy(arg->buffer + arg->length, line, length);
+            written = arg->length + length;
+        }
+        arg->length += length;
+    }
+    
+    if (arg->buffer && arg->size > 0) {
+        arg->buffer[written] = '\0';
+    }
+    
+    return (arg->buffer && arg->length >= arg->size) ? DMFSI_ERR_NO_SPACE : DMFSI_OK;
+}
+
+/**
+ * @brief Write the access trace to the configured trace file
+ * 
+ * @param ctx File system context
+ */
+static void write_trace_file(dmfsi_context_t ctx)
+{
+    void* file = Dmod_FileOpen(ctx->trace_file, "w");
+    if (!file) {
+        DMOD_LOG_ERROR("Failed to open trace file: %s\n", ctx->trace_file);
+        return;
+    }
+    
+    char line[sizeof("open \n") + DMFFS_MAX_PATH_LEN];
+    for (size_t i = 0; i < ctx->trace_count; i++) {
+        size_t length = format_trace_event(ctx, &ctx->trace[i], line, sizeof(line));
+        if (length > 0 && Dmod_FileWrite(line, 1, length, file) != length) {
+            DMOD_LOG_ERROR("Failed to write trace file: %s\n", ctx->trace_file);
+            break;
+        }
+    }
+    
+    Dmod_FileClose(file);
+}
+#endif // DMFFS_ENABLE_TRACE
+
+/**
+ * @brief Visit the next entry of a tree walk
+ * 
+ * The walk never goes back: the state holds the offset of the next TLV and
+ * the end offsets of the enclosing directories, so a complete walk reads
+ * every header once.
+ * 
+ * @param ctx File system context
+ * @param walk Walk state and output entry
+ * @return DMFSI_OK with the next entry, DMFSI_ERR_NOT_FOUND at the end,
+ *         DMFSI_ERR_NO_SPACE for an entry that was skipped
+ */
+static int walk_next(dmfsi_context_t ctx, dmffs_ioctl_walk_t* walk)
+{
+    if (!walk->started) {
+        walk->started = 1;
+        walk->level = 0;
+        walk->next_offset = ctx->root_offset;
+    }
+    
+    if (!ctx->flash_ready) {
+        return DMFSI_ERR_NOT_FOUND;
+    }
+    
+    while (true) {
+        // Leave the directories that have been completed
+        while (walk->level > 0 && walk->next_offset >= walk->dir_end[walk->level - 1]) {
+            walk->level--;
+        }
+        
+        dmffs_off_t end_offset = walk->level > 0 ? walk->dir_end[walk->level - 1] : ctx->metadata_end;
+        dmffs_tlv_header_t header;
+        if (walk->next_offset >= end_offset || !read_tlv_header(ctx, walk->next_offset, &header) ||
+            header.type == DMFFS_TLV_TYPE_END || header.type == DMFFS_TLV_TYPE_INVALID) {
+            if (walk->level == 0) {
+                return DMFSI_ERR_NOT_FOUND;
+            }
+            // Damaged directory - continue behind it
+            walk->next_offset = walk->dir_end[--walk->level];
+            continue;
+        }
+        
+        // Skip the metadata TLVs of the enclosing directory
+        if (header.type != DMFFS_TLV_TYPE_FILE && header.type != DMFFS_TLV_TYPE_DIR) {
+            walk->next_offset = header.next_offset;
+            continue;
+        }
+        
+        size_t parent_length = walk->level > 0 ? walk->path_length[walk->level - 1] : 0;
+        char* name = walk->path + parent_length + (parent_length > 0 ? 1 : 0);
+        size_t name_size = sizeof(walk->path) - (size_t)(name - walk->path);
+        walk->next_offset = header.next_offset;
+        walk->depth = walk->level;
+        walk->type = header.type;
+        walk->inode = DMFFS_INODE(0, header.offset);
+        walk->size = 0;
+        walk->data_offset = 0;
+        
+        if (parent_length + 2 >= sizeof(walk->path)) {
+            return DMFSI_ERR_NO_SPACE;
+        }
+        if (parent_length > 0) {
+            walk->path[parent_length] = '/';
+        }
+        
+        if (header.type == DMFFS_TLV_TYPE_FILE) {
+            dmffs_file_entry_t entry;
+            uint32_t fields = DMFFS_FIELD_NAME | DMFFS_FIELD_DATA | DMFFS_FIELD_TIME | DMFFS_FIELD_ATTR;
+            if (parse_file_entry(ctx, header.offset, &entry, fields, name, name_size) == 0 || entry.name_length >= name_size) {
+                walk->path[parent_length] = '\0';
+                return DMFSI_ERR_NO_SPACE;
+            }
+            walk->size = entry.data_size;
+            walk->data_offset = entry.data_offset;
+            walk->attr = entry.attr;
+            walk->mtime = entry.mtime;
+            return DMFSI_OK;
+        }
+        
+        // Read the directory metadata up to its first entry
+        dmffs_off_t nested_offset = header.value_offset;
+        name[0] = '\0';
+        walk->attr = DMFSI_ATTR_DIRECTORY | DMFSI_ATTR_READONLY;
+        walk->mtime = 0;
+        while (nested_offset < header.next_offset) {
+            dmffs_tlv_header_t nested;
+            if (!read_tlv_header(ctx, nested_offset, &nested) ||
+                nested.type == DMFFS_TLV_TYPE_FILE || nested.type == DMFFS_TLV_TYPE_DIR) {
+                break;
+            }
+            
+            if (is_name_tlv(&nested)) {
+                if (read_tlv_name(ctx, &nested, name, name_size) >= name_size) {
+                    walk->path[parent_length] = '\0';
+                    return DMFSI_ERR_NO_SPACE;
+                }
+            } else if (nested.type == DMFFS_TLV_TYPE_ATTR && nested.length >= sizeof(uint32_t)) {
+                read_tlv_value(ctx, nested.value_offset, &walk->attr, sizeof(uint32_t));
+                walk->attr |= DMFSI_ATTR_DIRECTORY;
+            } else if (nested.type == DMFFS_TLV_TYPE_DATE && nested.length >= sizeof(uint32_t)) {
+                read_tlv_value(ctx, nested.value_offset, &walk->mtime, sizeof(uint32_t));
+            }
+            
+            nested_offset = nested.next_offset;
+        }
+        
+        // Descend into the directory
+        if (walk->level >= DMFFS_WALK_MAX_DEPTH) {
+            return DMFSI_ERR_NO_SPACE;
+        }
+        walk->dir_end[walk->level] = header.next_offset;
+        walk->path_length[walk->level] = (uint16_t)strlen(walk->path);
+        walk->level++;
+        walk->next_offset = nested_offset;
+        return DMFSI_OK;
+    }
+}
+
+/**
+ * @brief Read file content at a logical position
+ * 
+ * Holes of sparse files are filled with zeros instead of being read from
+ * flash; the stored content is read around them.
+ * 
+ * @param ctx File system context
+ * @param entry File entry
+ * @param position Logical position in the file
+ * @param buffer Buffer to store the data
+ * @param size Number of bytes to read (within the logical size)
+ * @return Number of bytes read
+ */
+static size_t read_file_data(dmfsi_context_t ctx, const dmffs_file_entry_t* entry, dmffs_off_t position, void* buffer, size_t size)
+{
+    if (entry->hole_count == 0) {
+        return read_flash(ctx, entry->data_offset + position, buffer, size);
+    }
+    
+    uint8_t* output = buffer;
+    size_t done = 0;
+    dmffs_off_t skipped = 0;    // hole bytes in front of the current position
+    dmffs_off_t index = 0;
+    dmffs_hole_t hole = {0, 0};
+    bool have_hole = false;
+    
+    while (done < size) {
+        dmffs_off_t current = position + done;
+        
+        // Find the first hole that ends behind the current position
+        while (!have_hole && index < entry->hole_count) {
+            if (read_tlv_value(ctx, entry->holes_offset + index * sizeof(dmffs_hole_t), &hole, sizeof(hole)) != sizeof(hole) ||
+                hole.length > entry->data_size || hole.offset > entry->data_size - hole.length) {
+                return done;
+            }
+            index++;
+            if (hole.offset + hole.length > current) {
+                have_hole = true;
+            } else {
+                skipped += hole.length;
+            }
+        }
+        
+        size_t chunk = size - done;
+        if (have_hole && hole.offset <= current) {
+            dmffs_off_t left = hole.offset + hole.length - current;
+            if (chunk >= left) {
+                chunk = (size_t)left;
+                skipped += hole.length;
+                have_hole = false;
+            }
+            memset(output + done, 0, chunk);
+            done += chunk;
+            continue;
+        }
+        
+        if (have_hole && hole.offset - current < chunk) {
+            chunk = (size_t)(hole.offset - current);
+        }
+        
+        dmffs_off_t stored = current - skipped;
+        if (stored >= entry->stored_size) {
+            break;
+        }
+        if (chunk > entry->stored_size - stored) {
+            chunk = (size_t)(entry->stored_size - stored);
+        }
+        
+        size_t read = read_flash(ctx, entry->data_offset + stored, output + done, chunk);
+        done += read;
+        if (read != chunk) {
+            break;
+        }
+    }
+    
+    return done;
+}
+
+/**
+ * @brief Move the position of a file handle
+ * 
+ * The new position is clamped to the file boundaries.
+ * 
+ * @param handle File handle
+ * @param offset Offset relative to whence
+ * @param whence DMFSI_SEEK_SET, DMFSI_SEEK_CUR or DMFSI_SEEK_END
+ * @param position Pointer to store the new position
+ * @return true if successful, false if whence is invalid
+ */
+static bool seek_file(dmffs_file_handle_t* handle, int64_t offset, int whence, dmffs_off_t* position)
+{
+    dmffs_off_t base = 0;
+    dmffs_off_t size = handle->entry.data_size;
+    
+    switch (whence) {
+        case DMFSI_SEEK_SET:
+            base = 0;
+            break;
+        
+        case DMFSI_SEEK_CUR:
+            base = handle->position;
+            break;
+        
+        case DMFSI_SEEK_END:
+            base = size;
+            break;
+        
+        default:
+            return false;
+    }
+    
+    // Validate position (computed unsigned to avoid overflows)
+    if (offset < 0) {
+        dmffs_off_t distance = (dmffs_off_t)(-(offset + 1)) + 1;
+        *position = (distance > base) ? 0 : base - distance;
+    } else {
+        dmffs_off_t distance = (dmffs_off_t)offset;
+        *position = (distance > size - base) ? size : base + distance;
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Read the next FILE or DIR entry of the image currently listed
+ * 
+ * @param handle Directory handle
+ * @param entry Pointer to store the entry
+ * @return DMFSI_OK with the next entry, DMFSI_ERR_NOT_FOUND at the end of the directory
+ */
+static int read_dir_entry(dmffs_dir_handle_t* handle, dmfsi_dir_entry_t* entry)
+{
+    dmfsi_context_t ctx = handle->ctx;
+    
+    // If we're inside a directory, only scan within that directory
+    dmffs_off_t end_offset = handle->in_dir ? handle->dir_end_offset : ctx->metadata_end;
+    
+    while (handle->current_offset < end_offset) {
+        dmffs_tlv_header_t header;
+        if (!read_tlv_header(ctx, handle->current_offset, &header)) {
+            break;
+        }
+        
+        if (header.type == DMFFS_TLV_TYPE_END || header.type == DMFFS_TLV_TYPE_INVALID) {
+            break;
+        }
+        
+        if (header.type == DMFFS_TLV_TYPE_FILE) {
+            dmffs_file_entry_t file_entry;
+            uint32_t fields = DMFFS_FIELD_NAME | DMFFS_FIELD_DATA | DMFFS_FIELD_TIME | DMFFS_FIELD_ATTR;
+            dmffs_off_t next_offset = parse_file_entry(ctx, handle->current_offset, &file_entry, fields, entry->name, sizeof(entry->name));
+            
+            // The next entry follows the FILE TLV, also if it could not be parsed
+            handle->current_offset = header.next_offset;
+            if (next_offset != 0) {
+                if (entry->name[0] != '\0') {
+                    // Return this file
+                    entry->size = DMFFS_SIZE32(file_entry.data_size);
+                    entry->attr = file_entry.attr;
+                    entry->time = file_entry.mtime;
+                    handle->entry_index++;
+                    handle->entry_inode = DMFFS_INODE(ctx->level, header.offset);
+                    handle->entry_type = header.type;
+                    return DMFSI_OK;
+                }
+            }
+        } else if (header.type == DMFFS_TLV_TYPE_DIR) {
+            uint32_t dir_attr;
+            uint32_t dir_time;
+            parse_dir_entry(ctx, &header, entry->name, sizeof(entry->name), &dir_attr, &dir_time);
+            
+            handle->current_offset = header.next_offset;
+            
+            if (entry->name[0] != '\0') {
+                // Return this directory
+                entry->size = 0;
+                entry->attr = dir_attr;
+                entry->time = dir_time;
+                handle->entry_index++;
+                handle->entry_inode = DMFFS_INODE(ctx->level, header.offset);
+                handle->entry_type = header.type;
+                return DMFSI_OK;
+            }
+        } else {
+            // Skip this TLV (including WHITEOUT entries)
+            handle->current_offset = header.next_offset;
+        }
     }
     
-    return end_offset;
+    handle->entry_type = 0;
+    return DMFSI_ERR_NOT_FOUND;
 }
 
 /**
- * @brief Search for a file by path, supporting directories
+ * @brief Check if an entry of a merged directory is replaced by a higher image
  * 
- * @param ctx File system context
- * @param path Full path to search for (e.g., "dir/file.txt" or "file.txt")
- * @param entry Pointer to store found file entry
- * @return true if file found, false otherwise
+ * Any entry with the same name in a higher image of the directory, including
+ * a WHITEOUT, hides the entry. Indexed images are searched through the index.
+ * 
+ * @param handle Directory handle (overlay mount)
+ * @param name Name of the entry in the image currently listed
+ * @return true if the entry is hidden, false otherwise
  */
-static bool find_file_by_path(dmfsi_context_t ctx, const char* path, dmffs_file_entry_t* entry)
+static bool is_shadowed(dmffs_dir_handle_t* handle, const char* name)
 {
-    if (!ctx || !path || !entry) return false;
-    
-    // Parse the path to get directory components
-    char path_copy[256];
-    strncpy(path_copy, path, sizeof(path_copy) - 1);
-    path_copy[sizeof(path_copy) - 1] = '\0';
-    
-    // Split path into directory and filename
-    char* last_slash = strrchr(path_copy, '/');
-    const char* filename = last_slash ? last_slash + 1 : path_copy;
-    
-    // Start scanning from beginning
-    uint32_t offset = 0;
-    
-    // Skip VERSION tag if present
-    uint32_t type, length;
-    if (read_tlv_header(ctx, offset, &type, &length) && type == DMFFS_TLV_TYPE_VERSION) {
-        offset += 8 + length;
-    }
-    
-    // If we have a directory path, we need to navigate into directories
-    if (last_slash) {
-        *last_slash = '\0'; // Terminate directory path
-        char* dir_name = path_copy;
-        
-        // Navigate through directory structure
-        while (offset < ctx->flash_size) {
-            if (!read_tlv_header(ctx, offset, &type, &length)) {
-                break;
-            }
-            
-            if (type == DMFFS_TLV_TYPE_END || type == DMFFS_TLV_TYPE_INVALID) {
-                break;
-            }
-            
-            if (type == DMFFS_TLV_TYPE_DIR) {
-                // Parse DIR name
-                uint32_t nested_offset = offset + 8;
-                uint32_t end_offset = offset + 8 + length;
-                char dir_entry_name[256] = {0};
-                bool name_found = false;
-                
-                // First pass: get directory name
-                while (nested_offset < end_offset) {
-                    uint32_t nested_type, nested_length;
-                    if (!read_tlv_header(ctx, nested_offset, &nested_type, &nested_length)) {
-                        break;
-                    }
-                    
-                    if (nested_type == DMFFS_TLV_TYPE_NAME && nested_length > 0) {
-                        uint32_t value_offset = nested_offset + 8;
-                        if (nested_length <= sizeof(dir_entry_name) - 1) {
-                            read_tlv_value(ctx, value_offset, dir_entry_name, nested_length);
-                            dir_entry_name[nested_length] = '\0';
-                        }
-                        name_found = true;
-                        break;
-                    }
-                    
-                    nested_offset += 8 + nested_length;
-                }
-                
-                // Check if this is the directory we're looking for
-                if (name_found && strcmp(dir_entry_name, dir_name) == 0) {
-                    // Found the directory, search for file inside
-                    nested_offset = offset + 8;
-                    
-                    while (nested_offset < end_offset) {
-                        uint32_t nested_type, nested_length;
-                        if (!read_tlv_header(ctx, nested_offset, &nested_type, &nested_length)) {
-                            break;
-                        }
-                        
-                        if (nested_type == DMFFS_TLV_TYPE_FILE) {
-                            dmffs_file_entry_t file_entry;
-                            uint32_t next_offset = parse_file_entry(ctx, nested_offset, &file_entry);
-                            
-                            if (next_offset == 0) {
-                                // Parse error - skip this TLV entry manually
-                                nested_offset += 8 + nested_length;
-                            } else if (strcmp(file_entry.name, filename) == 0) {
-                                memcpy(entry, &file_entry, sizeof(dmffs_file_entry_t));
-                                return true;
-                            } else {
-                                nested_offset = next_offset;
-                            }
-                        } else {
-                            nested_offset += 8 + nested_length;
-                        }
-                    }
-                    
-                    return false; // Directory found but file not in it
-                }
-                
-                offset += 8 + length;
-            } else {
-                offset += 8 + length;
-            }
-        }
-        
-        return false; // Directory not found
+    size_t length = strlen(name);
+    uint64_t hash = (handle->path[0] != '\0') ? (handle->path_hash ^ '/') * DMFFS_BLOOM_HASH_PRIME : DMFFS_BLOOM_HASH_INIT;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * DMFFS_BLOOM_HASH_PRIME;
     }
     
-    // No directory in path, search root level
-    while (offset < ctx->flash_size) {
-        if (!read_tlv_header(ctx, offset, &type, &length)) {
-            break;
-        }
+    for (uint32_t i = 0; i < handle->layer; i++) {
+        dmfsi_context_t layer = handle->layers[i];
+        dmffs_tlv_header_t header;
         
-        if (type == DMFFS_TLV_TYPE_END || type == DMFFS_TLV_TYPE_INVALID) {
-            break;
+        if (!hash_may_exist(layer, hash)) {
+            continue;
         }
         
-        if (type == DMFFS_TLV_TYPE_FILE) {
-            uint32_t next_offset = parse_file_entry(ctx, offset, entry);
-            
-            if (next_offset == 0) {
-                // Parse error - skip this TLV entry manually
-                offset += 8 + length;
-            } else if (strcmp(entry->name, filename) == 0) {
-                return true;
-            } else {
-                offset = next_offset;
-            }
-        } else {
-            offset += 8 + length;
+        bool found = (layer->index_count > 0)
+                   ? find_indexed_hash(layer, hash, name, length, false, &header)
+                   : find_entry(layer, handle->layer_offset[i], handle->layer_end[i], name, &header);
+        if (found) {
+            return true;
         }
     }
     
@@ -413,32 +2934,54 @@ static bool find_file_by_path(dmfsi_context_t ctx, const char* path, dmffs_file_
 }
 
 /**
- * @brief Check if flash contains valid TLV structure
+ * @brief Find the images of a directory of an overlay mount
  * 
- * @param ctx File system context
- * @return true if valid TLV structure found, false otherwise
+ * @param ctx File system context of the base image
+ * @param handle Directory handle with the normalized path
+ * @return true if the path is a directory, false otherwise
  */
-static bool has_valid_tlv_structure(dmfsi_context_t ctx)
+static bool open_overlay_dir(dmfsi_context_t ctx, dmffs_dir_handle_t* handle)
 {
-    if (!ctx || !ctx->flash_addr) return false;
-    
-    uint32_t type, length;
-    // Try to read first TLV header
-    if (!read_tlv_header(ctx, 0, &type, &length)) {
-        return false;
-    }
+    handle->path_hash = hash_path(handle->path);
+    handle->layer_count = 0;
     
-    // Check for VERSION tag at start
-    if (type == DMFFS_TLV_TYPE_VERSION) {
-        return true;
+    for (uint32_t level = ctx->overlay_count + 1; level > 0; level--) {
+        dmfsi_context_t layer = get_layer(ctx, level - 1);
+        uint32_t n = handle->layer_count;
+        
+        if (handle->path[0] == '\0') {
+            handle->layers[n] = layer;
+            handle->layer_offset[n] = layer->root_offset;
+            handle->layer_end[n] = layer->metadata_end;
+            handle->layer_count++;
+            continue;
+        }
+        
+        dmffs_tlv_header_t header;
+        dmffs_lookup_t result = find_overlay_entry(layer, handle->path, &header);
+        if (result == DMFFS_LOOKUP_MISSING) {
+            continue;
+        }
+        if (result == DMFFS_LOOKUP_HIDDEN || header.type != DMFFS_TLV_TYPE_DIR) {
+            break;
+        }
+        
+        handle->layers[n] = layer;
+        handle->layer_offset[n] = header.value_offset;
+        handle->layer_end[n] = header.next_offset;
+        handle->layer_count++;
     }
     
-    // Or check for FILE/DIR tag
-    if (type == DMFFS_TLV_TYPE_FILE || type == DMFFS_TLV_TYPE_DIR) {
-        return true;
+    if (handle->layer_count == 0) {
+        return false;
     }
     
-    return false;
+    handle->layer = 0;
+    handle->ctx = handle->layers[0];
+    handle->current_offset = handle->layer_offset[0];
+    handle->dir_end_offset = handle->layer_end[0];
+    handle->in_dir = true;
+    return true;
 }
 
 /**
@@ -477,7 +3020,7 @@ int dmod_init(const Dmod_Config_t *Config)
     
     // Parse flash address from hex string (e.g., "0x08000000")
     if (flash_addr_str) {
-        size_t addr = parse_hex_string(flash_addr_str);
+        uintptr_t addr = (uintptr_t)parse_hex_string(flash_addr_str);
         g_flash_addr = (const void*)addr;
         
         DMOD_LOG_INFO("Flash address set to: 0x%08X\n", (unsigned int)addr);
@@ -487,10 +3030,10 @@ int dmod_init(const Dmod_Config_t *Config)
     
     // Parse flash size from hex string (e.g., "0x100000" for 1MB)
     if (flash_size_str) {
-        size_t size = parse_hex_string(flash_size_str);
+        dmffs_off_t size = parse_hex_string(flash_size_str);
         g_flash_size = size;
         
-        DMOD_LOG_INFO("Flash size set to: 0x%08X (%u bytes)\n", (unsigned int)size, (unsigned int)size);
+        DMOD_LOG_INFO("Flash size set to: 0x%08llX (%llu bytes)\n", (unsigned long long)size, (unsigned long long)size);
     } else {
         DMOD_LOG_WARN("Flash size not configured. '%s' variable is not set (hex value required)\n", DMFFS_ENV_FLASH_SIZE);
     }
@@ -535,17 +3078,39 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmffs, dmfsi_context_t, _init, (const char*
     }
 
     // Set default flash parameters
+    memset(ctx, 0, sizeof(struct dmfsi_context));
     ctx->magic = MAGIC_DMFSS_CTX;
     ctx->flash_addr = g_flash_addr;
     ctx->flash_size = g_flash_size;
+    ctx->backend = &g_backends[0];
 
     // Parse configuration string
     if (config && !parse_config_string(ctx, config)) {
         DMOD_LOG_ERROR("Failed to parse DMFFS configuration string: '%s'\n", config);
-        Dmod_Free(ctx);
+        free_context(ctx);
         return NULL;
     }
 
+#if DMFFS_ENABLE_TRACE
+    // Allocate the access trace
+    if (ctx->trace_capacity > 0) {
+        ctx->trace = Dmod_Malloc(ctx->trace_capacity * sizeof(dmffs_trace_event_t));
+        if (!ctx->trace) {
+            DMOD_LOG_ERROR("Failed to allocate access trace for %u events\n", (unsigned int)ctx->trace_capacity);
+            free_context(ctx);
+            return NULL;
+        }
+    }
+#endif
+
+    ctx->flash_ready = ctx->backend->open(ctx);
+    read_image_layout(ctx);
+    open_overlays(ctx);
+    for (uint32_t level = 0; level <= ctx->overlay_count; level++) {
+        init_ram_index(get_layer(ctx, level), ctx->ram_index_entries);
+    }
+    pin_paths(ctx);
+
     return ctx;
 }
 
@@ -570,7 +3135,13 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _deinit, (dmfsi_context_t ctx)
         return DMFSI_ERR_INVALID;
     }
 
-    Dmod_Free( ctx );
+#if DMFFS_ENABLE_TRACE
+    if (ctx->trace && ctx->trace_file) {
+        write_trace_file(ctx);
+    }
+#endif
+
+    free_context(ctx);
     return DMFSI_OK;
 }
 
@@ -604,6 +3175,7 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _fopen, (dmfsi_context_t ctx, v
     
     // Try to find file in TLV structure
     if (!has_valid_tlv_structure(ctx)) {
+#if DMFFS_ENABLE_DATA_FALLBACK
         // No valid TLV structure - check if requesting data.bin fallback
         if (strcmp(path, "data.bin") == 0) {
             // Create handle for entire flash content
@@ -613,128 +3185,654 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _fopen, (dmfsi_context_t ctx, v
             }
             
             memset(handle, 0, sizeof(dmffs_file_handle_t));
-            strncpy(handle->entry.name, "data.bin", sizeof(handle->entry.name) - 1);
-            handle->entry.name[sizeof(handle->entry.name) - 1] = '\0';
             handle->entry.data_offset = 0;
             handle->entry.data_size = ctx->flash_size;
+            handle->entry.stored_size = ctx->flash_size;
             handle->entry.attr = DMFSI_ATTR_READONLY;
             handle->position = 0;
             handle->ctx = ctx;
             
-            *fp = handle;
-            return DMFSI_OK;
-        }
-        return DMFSI_ERR_NOT_FOUND;
-    }
-    
-    // Search for file using path (supports directories)
-    dmffs_file_entry_t entry;
-    if (find_file_by_path(ctx, path, &entry)) {
-        // Found the file
-        dmffs_file_handle_t* handle = Dmod_Malloc(sizeof(dmffs_file_handle_t));
-        if (!handle) {
-            return DMFSI_ERR_GENERAL;
+            *fp = handle;
+            return DMFSI_OK;
+        }
+#endif
+        return DMFSI_ERR_NOT_FOUND;
+    }
+    
+    // Search for file using path (supports directories)
+    dmffs_file_entry_t entry;
+    dmfsi_context_t layer = find_file_by_path(ctx, path, &entry);
+    if (layer) {
+        return open_file_handle(layer, &entry, fp);
+    }
+    
+    return DMFSI_ERR_NOT_FOUND;
+}
+
+dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _fclose, (dmfsi_context_t ctx, void* fp) )
+{
+    if (!ctx || !fp) {
+        return DMFSI_ERR_INVALID;
+    }
+    
+    Dmod_Free(fp);
+    return DMFSI_OK;
+}
+
+dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _fread, (dmfsi_context_t ctx, void* fp, void* buffer, size_t size, size_t* read) )
+{
+    if (!ctx || !fp || !buffer || !read) {
+        return DMFSI_ERR_INVALID;
+    }
+    
+    dmffs_file_handle_t* handle = (dmffs_file_handle_t*)fp;
+    *read = 0;
+    
+    // Check if we're at EOF
+    if (handle->position >= handle->entry.data_size) {
+        return DMFSI_OK;
+    }
+    
+    // Calculate how much we can read
+    dmffs_off_t available = handle->entry.data_size - handle->position;
+    size_t to_read = (size < available) ? size : (size_t)available;
+    
+    if (handle->ctx->trace && !handle->read_traced) {
+        trace_access(handle->ctx, handle->entry.offset, DMFFS_TRACE_READ);
+        handle->read_traced = true;
+    }
+    
+    // Read from the image holding the file
+    size_t bytes_read = read_file_data(handle->ctx, &handle->entry, handle->position, buffer, to_read);
+    
+    handle->position += bytes_read;
+    *read = bytes_read;
+    
+    return DMFSI_OK;
+}
+
+dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _fwrite, (dmfsi_context_t ctx, void* fp, const void* buffer, size_t size, size_t* written) )
+{
+    if (written) {
+        *written = 0;
+    }
+    // Read-only file system
+    return DMFSI_ERR_INVALID;
+}
+
+dmod_dmfsi_dif_api_declaration( 1.0, dmffs, long, _lseek, (dmfsi_context_t ctx, void* fp, long offset, int whence) )
+{
+    if (!ctx || !fp) {
+        return -1;
+    }
+    
+    dmffs_file_handle_t* handle = (dmffs_file_handle_t*)fp;
+    dmffs_off_t new_position = 0;
+    
+    if (!seek_file(handle, offset, whence, &new_position)) {
+        return -1;
+    }
+    
+    // Positions beyond the range of long require DMFFS_IOCTL_LSEEK64
+    if (new_position > DMFFS_LONG_MAX) {
+        return -1;
+    }
+    
+    handle->position = new_position;
+    return (long)new_position;
+}
+
+/**
+ * @brief Extend the RAM indexes of all images of the mount (DMFFS_IOCTL_INDEX_STEP)
+ * 
+ * The budget is spent on the images in order, base image first.
+ * 
+ * @param ctx File system context of the base image
+ * @param arg Request argument
+ * @return DMFSI_OK on success, DMFSI_ERR_NO_SPACE if an index stopped growing,
+ *         DMFSI_ERR_GENERAL if the mount has no RAM index
+ */
+static int build_ram_index(dmfsi_context_t ctx, dmffs_ioctl_index_t* arg)
+{
+    uint32_t budget = arg->budget;
+    bool indexed = false;
+    bool halted = false;
+    
+    arg->entries = 0;
+    arg->covered = 0;
+    arg->total = 0;
+    arg->complete = 1;
+    for (uint32_t level = 0; level <= ctx->overlay_count; level++) {
+        dmfsi_context_t layer = get_layer(ctx, level);
+        dmffs_ram_index_t* index = layer->ram_index;
+        if (!index) {
+            continue;
+        }
+        
+        budget -= step_ram_index(layer, budget);
+        indexed = true;
+        halted = halted || index->halted;
+        arg->entries += index->count;
+        arg->covered += (index->complete ? layer->metadata_end : index->offset) - layer->root_offset;
+        arg->total += layer->metadata_end - layer->root_offset;
+        arg->complete = arg->complete && index->complete;
+    }
+    
+    if (!indexed) {
+        return DMFSI_ERR_GENERAL;
+    }
+    
+    return halted ? DMFSI_ERR_NO_SPACE : DMFSI_OK;
+}
+
+/**
+ * @brief Resolve a path relative to an open directory
+ * 
+ * Single images without a path index are searched below the directory
+ * only. Overlay mounts and indexed images look up the joined path, since
+ * the index lookup does not depend on the depth of the entry.
+ * 
+ * @param ctx File system context of the base image
+ * @param dir Directory handle (NULL for the root directory)
+ * @param path Relative path, or absolute path from the root directory
+ * @param header Pointer to store the header of the found entry
+ * @return File system context of the image holding the entry, NULL if not found
+ */
+static dmfsi_context_t resolve_relative_path(dmfsi_context_t ctx, const dmffs_dir_handle_t* dir, const char* path, dmffs_tlv_header_t* header)
+{
+    if (path[0] == '/') {
+        dir = NULL;
+        while (*path == '/') path++;
+    }
+    if (!dir || dir->path[0] == '\0') {
+        return resolve_path(ctx, path, header);
+    }
+    
+    if (ctx->overlay_count > 0 || ctx->index_count > 0) {
+        char joined[2 * sizeof(dir->path)];
+        size_t dir_length = strlen(dir->path);
+        size_t path_length = strlen(path);
+        if (dir_length + 1 + path_length >= sizeof(joined)) {
+            return NULL;
+        }
+        memcpy(joined, dir->path, dir_length);
+        joined[dir_length] = '/';
+        memcpy(joined + dir_length + 1, path, path_length + 1);
+        return resolve_path(ctx, joined, header);
+    }
+    
+    dmffs_tlv_header_t parent;
+    if (!dir->in_dir || !read_tlv_header(ctx, dir->dir_offset, &parent) ||
+        !find_entry_below(ctx, &parent, dir->path_hash, path, header)) {
+        return NULL;
+    }
+    
+    return header->type != DMFFS_TLV_TYPE_WHITEOUT ? ctx : NULL;
+}
+
+/**
+ * @brief Read the file entry of an inode number
+ * 
+ * Checks that the inode points to a complete FILE entry of the directory
+ * tree of one of the images of the mount, and that no image of higher
+ * precedence shadows or whiteouts its path. The path index is keyed by
+ * path hashes, so the path is found by descending from the root, and the
+ * lookup of the path then uses the indexes of the images.
+ * 
+ * @param ctx File system context of the base image
+ * @param inode Inode number (see DMFFS_INODE)
+ * @param entry Pointer to store the file entry with its content fields
+ * @return File system context of the image holding the file, NULL if the inode is not valid
+ */
+static dmfsi_context_t read_inode_entry(dmfsi_context_t ctx, uint64_t inode, dmffs_file_entry_t* entry)
+{
+    uint32_t level = DMFFS_INODE_LEVEL(inode);
+    dmffs_off_t offset = DMFFS_INODE_OFFSET(inode);
+    if (level > ctx->overlay_count) {
+        return NULL;
+    }
+    
+    dmfsi_context_t layer = get_layer(ctx, level);
+    dmffs_tlv_header_t header;
+    char path[DMFFS_MAX_PATH_LEN + 2];
+    if (offset < layer->root_offset || offset >= layer->metadata_end ||
+        !build_entry_path(layer, offset, path, sizeof(path)) ||
+        !read_tlv_header(layer, offset, &header) || header.type != DMFFS_TLV_TYPE_FILE ||
+        header.next_offset > layer->metadata_end ||
+        parse_file_entry(layer, offset, entry, DMFFS_FIELD_DATA, NULL, 0) == 0) {
+        return NULL;
+    }
+    
+    // The content has to be inside the image
+    if (entry->data_offset > layer->flash_size || entry->stored_size > layer->flash_size - entry->data_offset) {
+        return NULL;
+    }
+    
+    // Files of the image with the highest precedence cannot be shadowed
+    dmffs_tlv_header_t visible;
+    if (level < ctx->overlay_count && (resolve_path(ctx, path + 1, &visible) != layer || visible.offset != offset)) {
+        return NULL;
+    }
+    
+    return layer;
+}
+
+/**
+ * @brief Handle the inode requests (DMFFS_IOCTL_LOOKUP, DMFFS_IOCTL_DIR_INODE,
+ *        DMFFS_IOCTL_OPEN_INODE and DMFFS_IOCTL_OPENAT)
+ * 
+ * @param ctx File system context of the base image
+ * @param request Request
+ * @param arg Request argument
+ * @return DMFSI_OK on success, DMFSI_ERR_NOT_FOUND if there is no such entry, error code otherwise
+ */
+static int inode_request(dmfsi_context_t ctx, int request, dmffs_ioctl_inode_t* arg)
+{
+    const dmffs_dir_handle_t* dir = (const dmffs_dir_handle_t*)arg->dir;
+    dmffs_tlv_header_t header;
+    dmffs_file_entry_t entry;
+    dmfsi_context_t layer;
+    
+    if (!has_valid_tlv_structure(ctx)) {
+        return DMFSI_ERR_NOT_FOUND;
+    }
+    
+    switch (request) {
+        case DMFFS_IOCTL_DIR_INODE:
+            if (!dir) {
+                return DMFSI_ERR_INVALID;
+            }
+            if (dir->entry_type == 0) {
+                return DMFSI_ERR_NOT_FOUND;
+            }
+            arg->inode = dir->entry_inode;
+            arg->type = dir->entry_type;
+            return DMFSI_OK;
+        
+        case DMFFS_IOCTL_OPEN_INODE:
+            layer = read_inode_entry(ctx, arg->inode, &entry);
+            if (!layer) {
+                return DMFSI_ERR_NOT_FOUND;
+            }
+            arg->type = DMFFS_TLV_TYPE_FILE;
+            return open_file_handle(layer, &entry, &arg->fp);
+        
+        default:
+            break;
+    }
+    
+    // DMFFS_IOCTL_LOOKUP and DMFFS_IOCTL_OPENAT
+    if (!arg->path) {
+        return DMFSI_ERR_INVALID;
+    }
+    layer = resolve_relative_path(ctx, dir, arg->path, &header);
+    if (!layer) {
+        return DMFSI_ERR_NOT_FOUND;
+    }
+    arg->inode = DMFFS_INODE(layer->level, header.offset);
+    arg->type = header.type;
+    if (request == DMFFS_IOCTL_LOOKUP) {
+        return DMFSI_OK;
+    }
+    
+    if (header.type != DMFFS_TLV_TYPE_FILE ||
+        parse_file_entry(layer, header.offset, &entry, DMFFS_FIELD_DATA, NULL, 0) == 0) {
+        return DMFSI_ERR_NOT_FOUND;
+    }
+    return open_file_handle(layer, &entry, &arg->fp);
+}
+
+/**
+ * @brief Resolve the pending paths of a batch in one forward pass over an image
+ * 
+ * Only the directories on the way to a pending path are entered, the others
+ * are skipped as a whole, and the pass stops once every path is resolved.
+ * The name of an entry is read once and compared with the next component of
+ * all paths waiting at its depth. A path ends in the image the same way as
+ * in find_overlay_entry(). The path filter is only probed when its bits are
+ * pinned: the pass resolves missing paths anyway, so probes read from flash
+ * would cost more than the paths they drop save.
+ * 
+ * @param ctx File system context of the image
+ * @param entries Batch entries (the inode of found paths is set)
+ * @param states Lookup states of the entries
+ * @param count Number of entries
+ */
+static void scan_batch(dmfsi_context_t ctx, dmffs_ioctl_batch_entry_t* entries, dmffs_batch_state_t* states, uint32_t count)
+{
+    dmffs_off_t dir_end[DMFFS_WALK_MAX_DEPTH];
+    dmffs_off_t offset = ctx->root_offset;
+    uint32_t level = 0;
+    uint32_t pending = 0;
+    char name[DMFFS_MAX_NAME_LEN + 1];
+    bool filter = ctx->bloom_bits > 0 && find_pinned(ctx, ctx->bloom_offset, (ctx->bloom_bits + 7) / 8) != NULL;
+    
+    for (uint32_t i = 0; i < count; i++) {
+        dmffs_batch_state_t* state = &states[i];
+        const char* path = entries[i].path;
+        while (path && *path == '/') path++;
+        state->rest = path;
+        state->level = 0;
+        state->pending = state->result == DMFFS_LOOKUP_MISSING && *path != '\0' && (!filter || path_may_exist(ctx, path));
+        pending += state->pending ? 1 : 0;
+    }
+    
+    while (pending > 0) {
+        // Leave the completed directories, the paths still waiting in them are missing
+        while (level > 0 && offset >= dir_end[level - 1]) {
+            for (uint32_t i = 0; i < count; i++) {
+                if (states[i].pending && states[i].level == level) {
+                    states[i].pending = false;
+                    pending--;
+                }
+            }
+            level--;
+        }
+        
+        dmffs_off_t end_offset = level > 0 ? dir_end[level - 1] : ctx->metadata_end;
+        dmffs_tlv_header_t header;
+        if (offset >= end_offset || !read_tlv_header(ctx, offset, &header) ||
+            header.type == DMFFS_TLV_TYPE_END || header.type == DMFFS_TLV_TYPE_INVALID) {
+            if (level == 0) {
+                break;
+            }
+            // Damaged directory - continue behind it
+            offset = dir_end[level - 1];
+            continue;
+        }
+        offset = header.next_offset;
+        
+        if (header.type != DMFFS_TLV_TYPE_FILE && header.type != DMFFS_TLV_TYPE_DIR &&
+            header.type != DMFFS_TLV_TYPE_WHITEOUT) {
+            continue;
+        }
+        
+        bool named = false;
+        bool descend = false;
+        for (uint32_t i = 0; i < count; i++) {
+            dmffs_batch_state_t* state = &states[i];
+            if (!state->pending || state->level != level) {
+                continue;
+            }
+            
+            // The name is read for the first path waiting at this depth
+            if (!named && !read_entry_name(ctx, &header, name, sizeof(name))) {
+                break;
+            }
+            named = true;
+            
+            size_t length = 0;
+            while (state->rest[length] != '\0' && state->rest[length] != '/') length++;
+            if (strncmp(name, state->rest, length) != 0 || name[length] != '\0') {
+                continue;
+            }
+            
+            const char* next = state->rest + length;
+            while (*next == '/') next++;
+            bool last = (*next == '\0');
+            if (header.type == DMFFS_TLV_TYPE_DIR && !last) {
+                state->rest = next;
+                state->level++;
+                descend = true;
+                continue;
+            }
+            
+            // The path ends in this image, a trailing slash requires a directory
+            state->pending = false;
+            pending--;
+            if (header.type == DMFFS_TLV_TYPE_WHITEOUT ||
+                (header.type == DMFFS_TLV_TYPE_FILE && (!last || state->rest[length] == '/'))) {
+                state->result = DMFFS_LOOKUP_HIDDEN;
+            } else {
+                state->result = DMFFS_LOOKUP_FOUND;
+                entries[i].inode = DMFFS_INODE(ctx->level, header.offset);
+            }
         }
         
-        memcpy(&handle->entry, &entry, sizeof(dmffs_file_entry_t));
-        handle->position = 0;
-        handle->ctx = ctx;
+        if (!descend) {
+            continue;
+        }
+        if (level < DMFFS_WALK_MAX_DEPTH) {
+            dir_end[level++] = header.next_offset;
+            offset = header.value_offset;
+            continue;
+        }
         
-        *fp = handle;
-        return DMFSI_OK;
+        // Too deep for the pass, these paths are looked up on their own
+        for (uint32_t i = 0; i < count; i++) {
+            if (states[i].pending && states[i].level > level) {
+                const char* path = entries[i].path;
+                while (*path == '/') path++;
+                dmffs_tlv_header_t found;
+                states[i].result = find_overlay_entry(ctx, path, &found);
+                states[i].pending = false;
+                pending--;
+                if (states[i].result == DMFFS_LOOKUP_FOUND) {
+                    entries[i].inode = DMFFS_INODE(ctx->level, found.offset);
+                }
+            }
+        }
     }
-    
-    return DMFSI_ERR_NOT_FOUND;
 }
 
-dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _fclose, (dmfsi_context_t ctx, void* fp) )
+/**
+ * @brief Fill the result of a found path of a batch
+ * 
+ * @param ctx File system context of the base image
+ * @param entry Batch entry with the inode number of the path
+ * @param open true to open files
+ * @return DMFSI_OK on success, error code otherwise
+ */
+static int read_batch_entry(dmfsi_context_t ctx, dmffs_ioctl_batch_entry_t* entry, bool open)
 {
-    if (!ctx || !fp) {
-        return DMFSI_ERR_INVALID;
+    dmfsi_context_t layer = get_layer(ctx, DMFFS_INODE_LEVEL(entry->inode));
+    dmffs_off_t offset = DMFFS_INODE_OFFSET(entry->inode);
+    dmffs_tlv_header_t header;
+    if (!read_tlv_header(layer, offset, &header)) {
+        return DMFSI_ERR_NOT_FOUND;
     }
+    entry->type = header.type;
     
-    Dmod_Free(fp);
-    return DMFSI_OK;
+    if (header.type == DMFFS_TLV_TYPE_DIR) {
+        parse_dir_entry(layer, &header, NULL, 0, &entry->attr, &entry->mtime);
+        return DMFSI_OK;
+    }
+    
+    dmffs_file_entry_t file;
+    if (parse_file_entry(layer, offset, &file, DMFFS_FIELD_DATA | DMFFS_FIELD_TIME | DMFFS_FIELD_ATTR, NULL, 0) == 0) {
+        return DMFSI_ERR_NOT_FOUND;
+    }
+    entry->size = file.data_size;
+    entry->attr = file.attr;
+    entry->mtime = file.mtime;
+    
+    return open ? open_file_handle(layer, &file, &entry->fp) : DMFSI_OK;
 }
 
-dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _fread, (dmfsi_context_t ctx, void* fp, void* buffer, size_t size, size_t* read) )
+/**
+ * @brief Handle DMFFS_IOCTL_BATCH
+ * 
+ * The images are searched from the top; a path found or hidden in an image
+ * is not searched in the images below it.
+ * 
+ * @param ctx File system context of the base image
+ * @param arg Request argument
+ * @return DMFSI_OK on success, error code otherwise
+ */
+static int batch_request(dmfsi_context_t ctx, dmffs_ioctl_batch_t* arg)
 {
-    if (!ctx || !fp || !buffer || !read) {
+    dmffs_ioctl_batch_entry_t* entries = arg->entries;
+    uint32_t count = arg->count;
+    
+    if (!entries && count > 0) {
         return DMFSI_ERR_INVALID;
     }
     
-    dmffs_file_handle_t* handle = (dmffs_file_handle_t*)fp;
-    *read = 0;
+    arg->found = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        entries[i].result = entries[i].path ? DMFSI_ERR_NOT_FOUND : DMFSI_ERR_INVALID;
+        entries[i].type = 0;
+        entries[i].inode = 0;
+        entries[i].size = 0;
+        entries[i].attr = 0;
+        entries[i].mtime = 0;
+        entries[i].fp = NULL;
+    }
     
-    // Check if we're at EOF
-    if (handle->position >= handle->entry.data_size) {
+    if (count == 0 || !has_valid_tlv_structure(ctx)) {
         return DMFSI_OK;
     }
     
-    // Calculate how much we can read
-    size_t available = handle->entry.data_size - handle->position;
-    size_t to_read = (size < available) ? size : available;
+    dmffs_batch_state_t* states = Dmod_Malloc(count * sizeof(dmffs_batch_state_t));
+    if (!states) {
+        DMOD_LOG_ERROR("Failed to allocate the state of %u lookups\n", (unsigned int)count);
+        return DMFSI_ERR_GENERAL;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        states[i].result = entries[i].path ? DMFFS_LOOKUP_MISSING : DMFFS_LOOKUP_HIDDEN;
+    }
     
-    // Read from flash
-    uintptr_t flash_addr = (uintptr_t)ctx->flash_addr + handle->entry.data_offset + handle->position;
-    size_t bytes_read = Dmod_ReadMemory(flash_addr, buffer, to_read);
+    for (uint32_t level = ctx->overlay_count + 1; level > 0; level--) {
+        dmfsi_context_t layer = get_layer(ctx, level - 1);
+        if (layer->index_count == 0 && !(layer->ram_index && layer->ram_index->complete)) {
+            scan_batch(layer, entries, states, count);
+            continue;
+        }
+        
+        // An index lookup costs a few reads, however deep the path is
+        for (uint32_t i = 0; i < count; i++) {
+            if (states[i].result == DMFFS_LOOKUP_MISSING) {
+                const char* path = entries[i].path;
+                while (*path == '/') path++;
+                dmffs_tlv_header_t header;
+                if (ctx->overlay_count > 0) {
+                    states[i].result = find_overlay_entry(layer, path, &header);
+                } else {
+                    bool found = find_entry_by_path(layer, path, &header) && header.type != DMFFS_TLV_TYPE_WHITEOUT;
+                    states[i].result = found ? DMFFS_LOOKUP_FOUND : DMFFS_LOOKUP_HIDDEN;
+                }
+                if (states[i].result == DMFFS_LOOKUP_FOUND) {
+                    entries[i].inode = DMFFS_INODE(layer->level, header.offset);
+                }
+            }
+        }
+    }
     
-    handle->position += bytes_read;
-    *read = bytes_read;
+    for (uint32_t i = 0; i < count; i++) {
+        if (states[i].result == DMFFS_LOOKUP_FOUND) {
+            entries[i].result = read_batch_entry(ctx, &entries[i], (arg->flags & DMFFS_BATCH_OPEN) != 0);
+            arg->found += entries[i].result == DMFSI_OK ? 1 : 0;
+        }
+    }
     
+    Dmod_Free(states);
     return DMFSI_OK;
 }
 
-dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _fwrite, (dmfsi_context_t ctx, void* fp, const void* buffer, size_t size, size_t* written) )
+/**
+ * @brief DMFFS specific control requests
+ * 
+ * Supported requests are listed in dmffs_ioctl_request_t.
+ * 
+ * @param ctx File system context
+ * @param fp File handle
+ * @param request Request (DMFFS_IOCTL_*)
+ * @param arg Request argument
+ * @return DMFSI_OK on success, error code otherwise
+ */
+dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _ioctl, (dmfsi_context_t ctx, void* fp, int request, void* arg) )
 {
-    if (written) {
-        *written = 0;
+    if (!ctx || !arg) {
+        return DMFSI_ERR_INVALID;
     }
-    // Read-only file system
-    return DMFSI_ERR_INVALID;
-}
-
-dmod_dmfsi_dif_api_declaration( 1.0, dmffs, long, _lseek, (dmfsi_context_t ctx, void* fp, long offset, int whence) )
-{
-    if (!ctx || !fp) {
-        return -1;
+    
+    // Requests that do not need a file handle
+#if DMFFS_ENABLE_TRACE
+    if (request == DMFFS_IOCTL_TRACE_EXPORT) {
+        return export_trace(ctx, (dmffs_ioctl_trace_t*)arg);
+    }
+#endif
+    if (request == DMFFS_IOCTL_WALK) {
+        return walk_next(ctx, (dmffs_ioctl_walk_t*)arg);
+    }
+    if (request == DMFFS_IOCTL_INDEX_STEP) {
+        return build_ram_index(ctx, (dmffs_ioctl_index_t*)arg);
+    }
+    if (request == DMFFS_IOCTL_LOOKUP || request == DMFFS_IOCTL_DIR_INODE ||
+        request == DMFFS_IOCTL_OPEN_INODE || request == DMFFS_IOCTL_OPENAT) {
+        return inode_request(ctx, request, (dmffs_ioctl_inode_t*)arg);
+    }
+    if (request == DMFFS_IOCTL_BATCH) {
+        return batch_request(ctx, (dmffs_ioctl_batch_t*)arg);
+    }
+    if (request == DMFFS_IOCTL_STATS) {
+        dmffs_ioctl_stats_t* stats = (dmffs_ioctl_stats_t*)arg;
+        stats->reads = 0;
+        stats->bytes = 0;
+        stats->pinned = 0;
+        stats->pinned_reads = 0;
+        for (uint32_t level = 0; level <= ctx->overlay_count; level++) {
+            stats->reads += get_layer(ctx, level)->read_count;
+            stats->bytes += get_layer(ctx, level)->read_bytes;
+            stats->pinned += get_layer(ctx, level)->pinned_bytes;
+            stats->pinned_reads += get_layer(ctx, level)->pinned_reads;
+        }
+        return DMFSI_OK;
+    }
+    
+    if (!fp) {
+        return DMFSI_ERR_INVALID;
     }
     
     dmffs_file_handle_t* handle = (dmffs_file_handle_t*)fp;
-    long new_position = 0;
     
-    switch (whence) {
-        case DMFSI_SEEK_SET:
-            new_position = offset;
-            break;
-            
-        case DMFSI_SEEK_CUR:
-            new_position = handle->position + offset;
-            break;
-            
-        case DMFSI_SEEK_END:
-            new_position = handle->entry.data_size + offset;
-            break;
-            
+    switch (request) {
+        case DMFFS_IOCTL_LSEEK64:
+        {
+            dmffs_ioctl_lseek64_t* seek = (dmffs_ioctl_lseek64_t*)arg;
+            if (!seek_file(handle, seek->offset, seek->whence, &handle->position)) {
+                return DMFSI_ERR_INVALID;
+            }
+            seek->position = handle->position;
+            return DMFSI_OK;
+        }
+        
+        case DMFFS_IOCTL_TELL64:
+            *(uint64_t*)arg = handle->position;
+            return DMFSI_OK;
+        
+        case DMFFS_IOCTL_SIZE64:
+            *(uint64_t*)arg = handle->entry.data_size;
+            return DMFSI_OK;
+        
+        case DMFFS_IOCTL_DATA_OFFSET:
+            *(uint64_t*)arg = handle->entry.data_offset;
+            return DMFSI_OK;
+        
+        case DMFFS_IOCTL_MAP:
+        {
+            dmffs_ioctl_map_t* map = (dmffs_ioctl_map_t*)arg;
+            const uint8_t* pinned = find_pinned(handle->ctx, handle->entry.data_offset, handle->entry.stored_size);
+            if (!handle->ctx->flash_ready || (!handle->ctx->backend->map && !pinned) || handle->entry.hole_count > 0) {
+                return DMFSI_ERR_GENERAL;
+            }
+            map->data = pinned ? pinned : handle->ctx->backend->map(handle->ctx, handle->entry.data_offset);
+            map->size = handle->entry.data_size;
+            return DMFSI_OK;
+        }
+        
+        case DMFFS_IOCTL_ENCODING:
+        {
+            dmffs_ioctl_encoding_t* encoding = (dmffs_ioctl_encoding_t*)arg;
+            encoding->encoding = handle->entry.encoding;
+            encoding->size = handle->entry.data_size;
+            encoding->decoded_size = handle->entry.decoded_size;
+            return DMFSI_OK;
+        }
+        
         default:
-            return -1;
-    }
-    
-    // Validate position
-    if (new_position < 0) {
-        new_position = 0;
-    }
-    if (new_position > (long)handle->entry.data_size) {
-        new_position = handle->entry.data_size;
+            return DMFSI_ERR_INVALID;
     }
-    
-    handle->position = new_position;
-    return new_position;
-}
-
-dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _ioctl, (dmfsi_context_t ctx, void* fp, int request, void* arg) )
-{
-    return 0;
 }
 
 dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _sync, (dmfsi_context_t ctx, void* fp) )
@@ -744,6 +3842,7 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _sync, (dmfsi_context_t ctx, vo
 
 dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _getc, (dmfsi_context_t ctx, void* fp) )
 {
+#if DMFFS_ENABLE_GETC
     if (!ctx || !fp) {
         return -1;
     }
@@ -755,14 +3854,22 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _getc, (dmfsi_context_t ctx, vo
         return -1;
     }
     
+    if (handle->ctx->trace && !handle->read_traced) {
+        trace_access(handle->ctx, handle->entry.offset, DMFFS_TRACE_READ);
+        handle->read_traced = true;
+    }
+    
     uint8_t c;
-    uintptr_t flash_addr = (uintptr_t)ctx->flash_addr + handle->entry.data_offset + handle->position;
-    if (Dmod_ReadMemory(flash_addr, &c, 1) != 1) {
+    if (read_file_data(handle->ctx, &handle->entry, handle->position, &c, 1) != 1) {
         return -1;
     }
     
     handle->position++;
     return (int)c;
+#else
+    // Single byte reads are not compiled in (DMFFS_ENABLE_GETC), use _fread
+    return -1;
+#endif
 }
 
 dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _putc, (dmfsi_context_t ctx, void* fp, int c) )
@@ -781,7 +3888,12 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmffs, long, _tell, (dmfsi_context_t ctx, v
     }
     
     dmffs_file_handle_t* handle = (dmffs_file_handle_t*)fp;
-    return handle->position;
+    
+    // Positions beyond the range of long require DMFFS_IOCTL_TELL64
+    if (handle->position > DMFFS_LONG_MAX) {
+        return -1;
+    }
+    return (long)handle->position;
 }
 
 dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _eof, (dmfsi_context_t ctx, void* fp) )
@@ -801,7 +3913,12 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmffs, long, _size, (dmfsi_context_t ctx, v
     }
     
     dmffs_file_handle_t* handle = (dmffs_file_handle_t*)fp;
-    return handle->entry.data_size;
+    
+    // Sizes beyond the range of long require DMFFS_IOCTL_SIZE64
+    if (handle->entry.data_size > DMFFS_LONG_MAX) {
+        return -1;
+    }
+    return (long)handle->entry.data_size;
 }
 
 dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _fflush, (dmfsi_context_t ctx, void* fp) )
@@ -847,77 +3964,45 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _opendir, (dmfsi_context_t ctx,
     
     // Check if we have valid TLV structure
     if (!has_valid_tlv_structure(ctx)) {
+#if DMFFS_ENABLE_DATA_FALLBACK
         // Invalid structure - for root only, we'll return data.bin
         if (handle->path[0] == '\0') {
             handle->entry_index = -1; // Special marker for data.bin
             *dp = handle;
             return DMFSI_OK;
         }
+#endif
         Dmod_Free(handle);
         return DMFSI_ERR_NOT_FOUND;
     }
     
-    // Skip VERSION tag if present
-    uint32_t type, length;
-    handle->current_offset = 0;
-    if (read_tlv_header(ctx, 0, &type, &length) && type == DMFFS_TLV_TYPE_VERSION) {
-        handle->current_offset = 8 + length;
+    // Merge the directory of all images of an overlay mount
+    if (ctx->overlay_count > 0) {
+        if (!open_overlay_dir(ctx, handle)) {
+            Dmod_Free(handle);
+            return DMFSI_ERR_NOT_FOUND;
+        }
+        *dp = handle;
+        return DMFSI_OK;
     }
     
+    handle->current_offset = ctx->root_offset;
+    
     // If opening a subdirectory, find it first
     if (handle->path[0] != '\0') {
-        uint32_t offset = handle->current_offset;
-        
-        while (offset < ctx->flash_size) {
-            if (!read_tlv_header(ctx, offset, &type, &length)) {
-                break;
-            }
-            
-            if (type == DMFFS_TLV_TYPE_END || type == DMFFS_TLV_TYPE_INVALID) {
-                break;
-            }
-            
-            if (type == DMFFS_TLV_TYPE_DIR) {
-                // Check if this is the directory we want
-                uint32_t nested_offset = offset + 8;
-                uint32_t end_offset = offset + 8 + length;
-                char dir_name[256] = {0};
-                
-                while (nested_offset < end_offset) {
-                    uint32_t nested_type, nested_length;
-                    if (!read_tlv_header(ctx, nested_offset, &nested_type, &nested_length)) {
-                        break;
-                    }
-                    
-                    if (nested_type == DMFFS_TLV_TYPE_NAME && nested_length > 0) {
-                        uint32_t value_offset = nested_offset + 8;
-                        if (nested_length <= sizeof(dir_name) - 1) {
-                            read_tlv_value(ctx, value_offset, dir_name, nested_length);
-                            dir_name[nested_length] = '\0';
-                        }
-                        break;
-                    }
-                    
-                    nested_offset += 8 + nested_length;
-                }
-                
-                if (strcmp(dir_name, handle->path) == 0) {
-                    // Found the directory
-                    handle->current_offset = offset + 8; // Start of DIR contents
-                    handle->dir_end_offset = offset + 8 + length;
-                    handle->in_dir = true;
-                    *dp = handle;
-                    return DMFSI_OK;
-                }
-            }
-            
-            offset += 8 + length;
+        dmffs_tlv_header_t header;
+        if (!find_entry_by_path(ctx, handle->path, &header) || header.type != DMFFS_TLV_TYPE_DIR) {
+            // Directory not found
+            Dmod_Free(handle);
+            return DMFSI_ERR_NOT_FOUND;
         }
         
-        // Directory not found
-        Dmod_Free(handle);
-        return DMFSI_ERR_NOT_FOUND;
+        handle->current_offset = header.value_offset; // Start of DIR contents
+        handle->dir_end_offset = header.next_offset;
+        handle->dir_offset = header.offset;
+        handle->in_dir = true;
     }
+    handle->path_hash = hash_path(handle->path);
     
     *dp = handle;
     return DMFSI_OK;
@@ -931,102 +4016,41 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _readdir, (dmfsi_context_t ctx,
     
     dmffs_dir_handle_t* handle = (dmffs_dir_handle_t*)dp;
     
+#if DMFFS_ENABLE_DATA_FALLBACK
     // Special case: no valid TLV structure, return data.bin for root
     if (handle->entry_index < 0) {
         strncpy(entry->name, "data.bin", sizeof(entry->name) - 1);
         entry->name[sizeof(entry->name) - 1] = '\0';
-        entry->size = ctx->flash_size;
+        entry->size = DMFFS_SIZE32(ctx->flash_size);
         entry->attr = DMFSI_ATTR_READONLY;
         entry->time = 0;
         handle->entry_index = 0;
         return DMFSI_OK;
     }
+#endif
     
-    // If we're inside a directory, only scan within that directory
-    uint32_t end_offset = handle->in_dir ? handle->dir_end_offset : ctx->flash_size;
+    // Without overlays, the handle lists a single image
+    if (handle->layer_count == 0) {
+        return read_dir_entry(handle, entry);
+    }
     
-    while (handle->current_offset < end_offset) {
-        uint32_t type, length;
-        if (!read_tlv_header(ctx, handle->current_offset, &type, &length)) {
-            break;
-        }
-        
-        if (type == DMFFS_TLV_TYPE_END || type == DMFFS_TLV_TYPE_INVALID) {
-            break;
-        }
-        
-        if (type == DMFFS_TLV_TYPE_FILE) {
-            dmffs_file_entry_t file_entry;
-            uint32_t next_offset = parse_file_entry(ctx, handle->current_offset, &file_entry);
-            
-            if (next_offset == 0) {
-                // Parse error - skip this TLV entry manually
-                handle->current_offset += 8 + length;
-            } else {
-                handle->current_offset = next_offset;
-                
-                if (file_entry.name[0] != '\0') {
-                    // Return this file
-                    strncpy(entry->name, file_entry.name, sizeof(entry->name) - 1);
-                    entry->name[sizeof(entry->name) - 1] = '\0';
-                    entry->size = file_entry.data_size;
-                    entry->attr = file_entry.attr;
-                    entry->time = file_entry.mtime;
-                    handle->entry_index++;
-                    return DMFSI_OK;
-                }
-            }
-        } else if (type == DMFFS_TLV_TYPE_DIR && !handle->in_dir) {
-            // At root level, list directories
-            uint32_t nested_offset = handle->current_offset + 8;
-            uint32_t dir_end = handle->current_offset + 8 + length;
-            char dir_name[256] = {0};
-            uint32_t dir_attr = DMFSI_ATTR_DIRECTORY | DMFSI_ATTR_READONLY;
-            uint32_t dir_time = 0;
-            
-            // Parse DIR metadata
-            while (nested_offset < dir_end) {
-                uint32_t nested_type, nested_length;
-                if (!read_tlv_header(ctx, nested_offset, &nested_type, &nested_length)) {
-                    break;
-                }
-                
-                uint32_t value_offset = nested_offset + 8;
-                
-                if (nested_type == DMFFS_TLV_TYPE_NAME && nested_length > 0) {
-                    if (nested_length <= sizeof(dir_name) - 1) {
-                        read_tlv_value(ctx, value_offset, dir_name, nested_length);
-                        dir_name[nested_length] = '\0';
-                    }
-                } else if (nested_type == DMFFS_TLV_TYPE_ATTR && nested_length >= sizeof(uint32_t)) {
-                    read_tlv_value(ctx, value_offset, &dir_attr, sizeof(uint32_t));
-                    dir_attr |= DMFSI_ATTR_DIRECTORY; // Ensure directory flag
-                } else if (nested_type == DMFFS_TLV_TYPE_DATE && nested_length >= sizeof(uint32_t)) {
-                    read_tlv_value(ctx, value_offset, &dir_time, sizeof(uint32_t));
-                }
-                
-                nested_offset += 8 + nested_length;
-            }
-            
-            handle->current_offset += 8 + length;
-            
-            if (dir_name[0] != '\0') {
-                // Return this directory
-                strncpy(entry->name, dir_name, sizeof(entry->name) - 1);
-                entry->name[sizeof(entry->name) - 1] = '\0';
-                entry->size = 0;
-                entry->attr = dir_attr;
-                entry->time = dir_time;
-                handle->entry_index++;
+    while (true) {
+        if (read_dir_entry(handle, entry) == DMFSI_OK) {
+            if (!is_shadowed(handle, entry->name)) {
                 return DMFSI_OK;
             }
-        } else {
-            // Skip this TLV
-            handle->current_offset += 8 + length;
+            continue;
         }
+        
+        // Continue with the next image of the directory
+        if (++handle->layer >= handle->layer_count) {
+            handle->layer = handle->layer_count;
+            return DMFSI_ERR_NOT_FOUND;
+        }
+        handle->ctx = handle->layers[handle->layer];
+        handle->current_offset = handle->layer_offset[handle->layer];
+        handle->dir_end_offset = handle->layer_end[handle->layer];
     }
-    
-    return DMFSI_ERR_NOT_FOUND;
 }
 
 // Close directory
@@ -1070,57 +4094,8 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _direxists, (dmfsi_context_t ct
         dir_path++;
     }
     
-    // Search for directory
-    uint32_t offset = 0;
-    uint32_t type, length;
-    
-    // Skip VERSION tag if present
-    if (read_tlv_header(ctx, offset, &type, &length) && type == DMFFS_TLV_TYPE_VERSION) {
-        offset += 8 + length;
-    }
-    
-    while (offset < ctx->flash_size) {
-        if (!read_tlv_header(ctx, offset, &type, &length)) {
-            break;
-        }
-        
-        if (type == DMFFS_TLV_TYPE_END || type == DMFFS_TLV_TYPE_INVALID) {
-            break;
-        }
-        
-        if (type == DMFFS_TLV_TYPE_DIR) {
-            // Check if this is the directory we're looking for
-            uint32_t nested_offset = offset + 8;
-            uint32_t end_offset = offset + 8 + length;
-            char dir_name[256] = {0};
-            
-            while (nested_offset < end_offset) {
-                uint32_t nested_type, nested_length;
-                if (!read_tlv_header(ctx, nested_offset, &nested_type, &nested_length)) {
-                    break;
-                }
-                
-                if (nested_type == DMFFS_TLV_TYPE_NAME && nested_length > 0) {
-                    uint32_t value_offset = nested_offset + 8;
-                    if (nested_length <= sizeof(dir_name) - 1) {
-                        read_tlv_value(ctx, value_offset, dir_name, nested_length);
-                        dir_name[nested_length] = '\0';
-                    }
-                    break;
-                }
-                
-                nested_offset += 8 + nested_length;
-            }
-            
-            if (strcmp(dir_name, dir_path) == 0) {
-                return 1; // Directory found
-            }
-        }
-        
-        offset += 8 + length;
-    }
-    
-    return 0;
+    dmffs_tlv_header_t header;
+    return resolve_path(ctx, dir_path, &header) && header.type == DMFFS_TLV_TYPE_DIR;
 }
 
 dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _stat, (dmfsi_context_t ctx, const char* path, dmfsi_stat_t* stat) )
@@ -1136,22 +4111,34 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _stat, (dmfsi_context_t ctx, co
     
     // Check if we have valid TLV structure
     if (!has_valid_tlv_structure(ctx)) {
+#if DMFFS_ENABLE_DATA_FALLBACK
         // Only data.bin is available
         if (strcmp(path, "data.bin") == 0) {
-            stat->size = ctx->flash_size;
+            stat->size = DMFFS_SIZE32(ctx->flash_size);
             stat->attr = DMFSI_ATTR_READONLY;
             stat->ctime = 0;
             stat->mtime = 0;
             stat->atime = 0;
             return DMFSI_OK;
         }
+#endif
         return DMFSI_ERR_NOT_FOUND;
     }
     
-    // Try to find file using path (supports directories)
-    dmffs_file_entry_t entry;
-    if (find_file_by_path(ctx, path, &entry)) {
-        stat->size = entry.data_size;
+    // Find the entry using path (supports directories and overlays)
+    dmffs_tlv_header_t header;
+    dmfsi_context_t layer = resolve_path(ctx, path, &header);
+    if (!layer) {
+        return DMFSI_ERR_NOT_FOUND;
+    }
+    
+    if (header.type == DMFFS_TLV_TYPE_FILE) {
+        dmffs_file_entry_t entry;
+        if (parse_file_entry(layer, header.offset, &entry, DMFFS_FIELD_DATA | DMFFS_FIELD_TIME | DMFFS_FIELD_ATTR, NULL, 0) == 0) {
+            return DMFSI_ERR_NOT_FOUND;
+        }
+        
+        stat->size = DMFFS_SIZE32(entry.data_size);
         stat->attr = entry.attr;
         stat->ctime = entry.ctime;
         stat->mtime = entry.mtime;
@@ -1159,69 +4146,17 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _stat, (dmfsi_context_t ctx, co
         return DMFSI_OK;
     }
     
-    // Check if it's a directory
-    uint32_t offset = 0;
-    uint32_t type, length;
-    
-    // Skip VERSION tag if present
-    if (read_tlv_header(ctx, offset, &type, &length) && type == DMFFS_TLV_TYPE_VERSION) {
-        offset += 8 + length;
-    }
-    
-    while (offset < ctx->flash_size) {
-        if (!read_tlv_header(ctx, offset, &type, &length)) {
-            break;
-        }
-        
-        if (type == DMFFS_TLV_TYPE_END || type == DMFFS_TLV_TYPE_INVALID) {
-            break;
-        }
-        
-        if (type == DMFFS_TLV_TYPE_DIR) {
-            // Check if this is the directory we're looking for
-            uint32_t nested_offset = offset + 8;
-            uint32_t end_offset = offset + 8 + length;
-            char dir_name[256] = {0};
-            uint32_t dir_attr = DMFSI_ATTR_DIRECTORY | DMFSI_ATTR_READONLY;
-            uint32_t dir_time = 0;
-            
-            while (nested_offset < end_offset) {
-                uint32_t nested_type, nested_length;
-                if (!read_tlv_header(ctx, nested_offset, &nested_type, &nested_length)) {
-                    break;
-                }
-                
-                uint32_t value_offset = nested_offset + 8;
-                
-                if (nested_type == DMFFS_TLV_TYPE_NAME && nested_length > 0) {
-                    if (nested_length <= sizeof(dir_name) - 1) {
-                        read_tlv_value(ctx, value_offset, dir_name, nested_length);
-                        dir_name[nested_length] = '\0';
-                    }
-                } else if (nested_type == DMFFS_TLV_TYPE_ATTR && nested_length >= sizeof(uint32_t)) {
-                    read_tlv_value(ctx, value_offset, &dir_attr, sizeof(uint32_t));
-                    dir_attr |= DMFSI_ATTR_DIRECTORY;
-                } else if (nested_type == DMFFS_TLV_TYPE_DATE && nested_length >= sizeof(uint32_t)) {
-                    read_tlv_value(ctx, value_offset, &dir_time, sizeof(uint32_t));
-                }
-                
-                nested_offset += 8 + nested_length;
-            }
-            
-            if (strcmp(dir_name, path) == 0) {
-                stat->size = 0;
-                stat->attr = dir_attr;
-                stat->ctime = dir_time;
-                stat->mtime = dir_time;
-                stat->atime = dir_time;
-                return DMFSI_OK;
-            }
-        }
-        
-        offset += 8 + length;
-    }
+    // It's a directory, its name is known already
+    uint32_t dir_attr;
+    uint32_t dir_time;
+    parse_dir_entry(layer, &header, NULL, 0, &dir_attr, &dir_time);
     
-    return DMFSI_ERR_NOT_FOUND;
+    stat->size = 0;
+    stat->attr = dir_attr;
+    stat->ctime = dir_time;
+    stat->mtime = dir_time;
+    stat->atime = dir_time;
+    return DMFSI_OK;
 }
 
 dmod_dmfsi_dif_api_declaration( 1.0, dmffs, int, _unlink, (dmfsi_context_t ctx, const char* path) )